@@ -1112,7 +1112,7 @@ vr::EVRInitError CPSMoveControllerLatest::Activate(uint32_t unObjectId)
         ClientPSMoveAPI::register_callback(
             ClientPSMoveAPI::start_controller_data_stream(
                 m_controller_view, 
-                ClientPSMoveAPI::includePositionData | ClientPSMoveAPI::includePhysicsData),
+                ClientPSMoveAPI::includePositionData | ClientPSMoveAPI::includePhysicsData | ClientPSMoveAPI::sharedMemoryDataFrame),
             CPSMoveControllerLatest::start_controller_response_callback,
             this);
     }
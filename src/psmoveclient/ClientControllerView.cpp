@@ -3,6 +3,7 @@
 #include "ClientNetworkManager.h"
 #include "PSMoveProtocolInterface.h"
 #include "PSMoveProtocol.pb.h"
+#include "CompactDataFrame.h"
 #include "MathUtility.h"
 #include <chrono>
 #include <algorithm>
@@ -21,6 +22,8 @@ const PSMoveRawTrackerData k_empty_raw_tracker_data = { 0 };
 
 //-- prototypes ----
 static void update_button_state(PSMoveButtonState &button, unsigned int button_bitmask, unsigned int button_bit);
+static void apply_compact_pose(const CompactControllerDataFrame *data_frame, PSMovePose &out_pose);
+static void apply_compact_physics(const CompactControllerDataFrame *data_frame, PSMovePhysicsData &out_physics);
 
 //-- implementation -----
 
@@ -225,16 +228,7 @@ void ClientPSMoveView::ApplyControllerDataFrame(
             this->PhysicsData.Clear();
         }
 
-        unsigned int button_bitmask= data_frame->button_down_bitmask();
-        update_button_state(TriangleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRIANGLE);
-        update_button_state(CircleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CIRCLE);
-        update_button_state(CrossButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CROSS);
-        update_button_state(SquareButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_SQUARE);
-        update_button_state(SelectButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_SELECT);
-        update_button_state(StartButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_START);
-        update_button_state(PSButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_PS);
-        update_button_state(MoveButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_MOVE);
-        update_button_state(TriggerButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRIGGER);
+        ApplyButtonBitmask(data_frame->button_down_bitmask());
 
         //###bwalker $TODO make sure this is in the range [0, 255]
         this->TriggerValue= static_cast<unsigned char>(psmove_data_frame.trigger_value());
@@ -247,6 +241,49 @@ void ClientPSMoveView::ApplyControllerDataFrame(
     }
 }
 
+void ClientPSMoveView::ApplyCompactControllerDataFrame(const CompactControllerDataFrame *data_frame)
+{
+    if (data_frame->getFlag(CompactControllerDataFrame::IsConnected))
+    {
+        this->bHasValidHardwareCalibration= data_frame->getFlag(CompactControllerDataFrame::ValidHardwareCalibration);
+        this->bIsTrackingEnabled= data_frame->getFlag(CompactControllerDataFrame::IsTrackingEnabled);
+        this->bIsCurrentlyTracking= data_frame->getFlag(CompactControllerDataFrame::IsCurrentlyTracking);
+        this->bIsOrientationValid= data_frame->getFlag(CompactControllerDataFrame::IsOrientationValid);
+        this->bIsPositionValid= data_frame->getFlag(CompactControllerDataFrame::IsPositionValid);
+
+        apply_compact_pose(data_frame, this->Pose);
+        apply_compact_physics(data_frame, this->PhysicsData);
+
+        // Compact data frames never carry the raw sensor or tracker data
+        this->RawSensorData.Clear();
+        this->CalibratedSensorData.Clear();
+        this->RawTrackerData.Clear();
+
+        ApplyButtonBitmask(data_frame->button_down_bitmask);
+
+        this->TriggerValue= static_cast<unsigned char>(data_frame->trigger_value);
+
+        this->bValid= true;
+    }
+    else
+    {
+        Clear();
+    }
+}
+
+void ClientPSMoveView::ApplyButtonBitmask(unsigned int button_bitmask)
+{
+    update_button_state(TriangleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRIANGLE);
+    update_button_state(CircleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CIRCLE);
+    update_button_state(CrossButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CROSS);
+    update_button_state(SquareButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_SQUARE);
+    update_button_state(SelectButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_SELECT);
+    update_button_state(StartButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_START);
+    update_button_state(PSButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_PS);
+    update_button_state(MoveButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_MOVE);
+    update_button_state(TriggerButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRIGGER);
+}
+
 void ClientPSMoveView::Publish(
     PSMoveProtocol::DeviceInputDataFrame_ControllerDataPacket *data_frame)
 {
@@ -312,18 +349,7 @@ void ClientPSNaviView::ApplyControllerDataFrame(const PSMoveProtocol::DeviceOutp
     {
         const PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_PSNaviState &psnavi_data_frame= data_frame->psnavi_state();
 
-        unsigned int button_bitmask= data_frame->button_down_bitmask();
-        update_button_state(L1Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L1);
-        update_button_state(L2Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L2);
-        update_button_state(L3Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L3);
-        update_button_state(CircleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CIRCLE);
-        update_button_state(CrossButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CROSS);
-        update_button_state(PSButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_PS);
-        update_button_state(TriggerButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRIGGER);
-        update_button_state(DPadUpButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_UP);
-        update_button_state(DPadRightButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_RIGHT);
-        update_button_state(DPadDownButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_DOWN);
-        update_button_state(DPadLeftButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_LEFT);
+        ApplyButtonBitmask(data_frame->button_down_bitmask());
 
         //###bwalker $TODO make sure this is in the range [0, 255]
         this->TriggerValue= static_cast<unsigned char>(psnavi_data_frame.trigger_value());
@@ -338,6 +364,39 @@ void ClientPSNaviView::ApplyControllerDataFrame(const PSMoveProtocol::DeviceOutp
     }
 }
 
+void ClientPSNaviView::ApplyCompactControllerDataFrame(const CompactControllerDataFrame *data_frame)
+{
+    if (data_frame->getFlag(CompactControllerDataFrame::IsConnected))
+    {
+        ApplyButtonBitmask(data_frame->button_down_bitmask);
+
+        this->TriggerValue= static_cast<unsigned char>(data_frame->trigger_value);
+        this->Stick_XAxis= static_cast<unsigned char>(data_frame->stick_xaxis);
+        this->Stick_YAxis= static_cast<unsigned char>(data_frame->stick_yaxis);
+
+        this->bValid= true;
+    }
+    else
+    {
+        Clear();
+    }
+}
+
+void ClientPSNaviView::ApplyButtonBitmask(unsigned int button_bitmask)
+{
+    update_button_state(L1Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L1);
+    update_button_state(L2Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L2);
+    update_button_state(L3Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L3);
+    update_button_state(CircleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CIRCLE);
+    update_button_state(CrossButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CROSS);
+    update_button_state(PSButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_PS);
+    update_button_state(TriggerButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRIGGER);
+    update_button_state(DPadUpButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_UP);
+    update_button_state(DPadRightButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_RIGHT);
+    update_button_state(DPadDownButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_DOWN);
+    update_button_state(DPadLeftButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_LEFT);
+}
+
 void ClientPSNaviView::Publish(PSMoveProtocol::DeviceInputDataFrame_ControllerDataPacket *data_frame)
 {
     // Nothing to publish
@@ -527,30 +586,7 @@ void ClientPSDualShock4View::ApplyControllerDataFrame(const PSMoveProtocol::Devi
             this->PhysicsData.Clear();
         }
 
-        unsigned int button_bitmask = data_frame->button_down_bitmask();
-
-        update_button_state(DPadUpButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_UP);
-        update_button_state(DPadDownButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_DOWN);
-        update_button_state(DPadLeftButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_LEFT);
-        update_button_state(DPadRightButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_RIGHT);
-
-        update_button_state(TriangleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRIANGLE);
-        update_button_state(CircleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CIRCLE);
-        update_button_state(CrossButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CROSS);
-        update_button_state(SquareButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_SQUARE);
-
-        update_button_state(L1Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L1);
-        update_button_state(R1Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_R1);
-        update_button_state(L2Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L2);
-        update_button_state(R2Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_R2);
-        update_button_state(L3Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L3);
-        update_button_state(R3Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_R3);
-
-        update_button_state(ShareButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_SHARE);
-        update_button_state(OptionsButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_OPTIONS);
-
-        update_button_state(PSButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_PS);
-        update_button_state(TrackPadButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRACKPAD);
+        ApplyButtonBitmask(data_frame->button_down_bitmask());
 
         this->LeftAnalogX = psds4_data_frame.left_thumbstick_x();
         this->LeftAnalogY = psds4_data_frame.left_thumbstick_y();
@@ -567,6 +603,67 @@ void ClientPSDualShock4View::ApplyControllerDataFrame(const PSMoveProtocol::Devi
     }
 }
 
+void ClientPSDualShock4View::ApplyCompactControllerDataFrame(const CompactControllerDataFrame *data_frame)
+{
+    if (data_frame->getFlag(CompactControllerDataFrame::IsConnected))
+    {
+        this->bHasValidHardwareCalibration = data_frame->getFlag(CompactControllerDataFrame::ValidHardwareCalibration);
+        this->bIsTrackingEnabled = data_frame->getFlag(CompactControllerDataFrame::IsTrackingEnabled);
+        this->bIsCurrentlyTracking = data_frame->getFlag(CompactControllerDataFrame::IsCurrentlyTracking);
+        this->bIsOrientationValid = data_frame->getFlag(CompactControllerDataFrame::IsOrientationValid);
+        this->bIsPositionValid = data_frame->getFlag(CompactControllerDataFrame::IsPositionValid);
+
+        apply_compact_pose(data_frame, this->Pose);
+        apply_compact_physics(data_frame, this->PhysicsData);
+
+        // Compact data frames never carry the raw sensor or tracker data
+        this->RawSensorData.Clear();
+        this->CalibratedSensorData.Clear();
+        this->RawTrackerData.Clear();
+
+        ApplyButtonBitmask(data_frame->button_down_bitmask);
+
+        this->LeftAnalogX = data_frame->left_thumbstick_x;
+        this->LeftAnalogY = data_frame->left_thumbstick_y;
+        this->RightAnalogX = data_frame->right_thumbstick_x;
+        this->RightAnalogY = data_frame->right_thumbstick_y;
+        this->LeftTriggerValue = data_frame->left_trigger_value;
+        this->RightTriggerValue = data_frame->right_trigger_value;
+
+        this->bValid = true;
+    }
+    else
+    {
+        Clear();
+    }
+}
+
+void ClientPSDualShock4View::ApplyButtonBitmask(unsigned int button_bitmask)
+{
+    update_button_state(DPadUpButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_UP);
+    update_button_state(DPadDownButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_DOWN);
+    update_button_state(DPadLeftButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_LEFT);
+    update_button_state(DPadRightButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_RIGHT);
+
+    update_button_state(TriangleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRIANGLE);
+    update_button_state(CircleButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CIRCLE);
+    update_button_state(CrossButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_CROSS);
+    update_button_state(SquareButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_SQUARE);
+
+    update_button_state(L1Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L1);
+    update_button_state(R1Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_R1);
+    update_button_state(L2Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L2);
+    update_button_state(R2Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_R2);
+    update_button_state(L3Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_L3);
+    update_button_state(R3Button, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_R3);
+
+    update_button_state(ShareButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_SHARE);
+    update_button_state(OptionsButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_OPTIONS);
+
+    update_button_state(PSButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_PS);
+    update_button_state(TrackPadButton, button_bitmask, PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket_ButtonType_TRACKPAD);
+}
+
 void ClientPSDualShock4View::Publish(
     PSMoveProtocol::DeviceInputDataFrame_ControllerDataPacket *data_frame)
 {
@@ -676,23 +773,7 @@ void ClientControllerView::ApplyControllerDataFrame(
 {
     assert(data_frame->controller_id() == ControllerID);
 
-    // Compute the data frame receive window statistics if we have received enough samples
-    {
-        long long now = 
-            std::chrono::duration_cast< std::chrono::milliseconds >(
-                std::chrono::system_clock::now().time_since_epoch()).count();
-        long long diff= now - data_frame_last_received_time;
-
-        if (diff > 0)
-        {
-            float seconds= static_cast<float>(diff) / 1000.f;
-            float fps= 1.f / seconds;
-
-            data_frame_average_fps= (0.9f)*data_frame_average_fps + (0.1f)*fps;
-        }
-
-        data_frame_last_received_time= now;
-    }
+    UpdateDataFrameStatistics();
 
     if (data_frame->sequence_num() > this->OutputSequenceNum)
     {
@@ -725,6 +806,62 @@ void ClientControllerView::ApplyControllerDataFrame(
     }
 }
 
+void ClientControllerView::ApplyCompactControllerDataFrame(const CompactControllerDataFrame *data_frame)
+{
+    assert(data_frame->controller_id == ControllerID);
+
+    UpdateDataFrameStatistics();
+
+    if (data_frame->sequence_num > this->OutputSequenceNum)
+    {
+        this->OutputSequenceNum= data_frame->sequence_num;
+        this->IsConnected= data_frame->getFlag(CompactControllerDataFrame::IsConnected);
+
+        switch(data_frame->controller_type)
+        {
+        case PSMoveProtocol::PSMOVE:
+            {
+                this->ControllerViewType= PSMove;
+                this->ViewState.PSMoveView.ApplyCompactControllerDataFrame(data_frame);
+            } break;
+
+        case PSMoveProtocol::PSNAVI:
+            {
+                this->ControllerViewType= PSNavi;
+                this->ViewState.PSNaviView.ApplyCompactControllerDataFrame(data_frame);
+            } break;
+
+        case PSMoveProtocol::PSDUALSHOCK4:
+            {
+                this->ControllerViewType = PSDualShock4;
+                this->ViewState.PSDualShock4View.ApplyCompactControllerDataFrame(data_frame);
+            } break;
+
+        default:
+            assert(0 && "Unhandled controller type");
+        }
+    }
+}
+
+void ClientControllerView::UpdateDataFrameStatistics()
+{
+    // Compute the data frame receive window statistics if we have received enough samples
+    long long now = 
+        std::chrono::duration_cast< std::chrono::milliseconds >(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    long long diff= now - data_frame_last_received_time;
+
+    if (diff > 0)
+    {
+        float seconds= static_cast<float>(diff) / 1000.f;
+        float fps= 1.f / seconds;
+
+        data_frame_average_fps= (0.9f)*data_frame_average_fps + (0.1f)*fps;
+    }
+
+    data_frame_last_received_time= now;
+}
+
 bool ClientControllerView::GetHasUnpublishedState() const
 {
     bool bHasUnpublishedState = false;
@@ -953,4 +1090,42 @@ static void update_button_state(
         button= is_down ? PSMoveButton_PRESSED : PSMoveButton_UP;
         break;
     };
-}
\ No newline at end of file
+}
+
+static void apply_compact_pose(const CompactControllerDataFrame *data_frame, PSMovePose &out_pose)
+{
+    out_pose.Orientation.w= data_frame->orientation[0];
+    out_pose.Orientation.x= data_frame->orientation[1];
+    out_pose.Orientation.y= data_frame->orientation[2];
+    out_pose.Orientation.z= data_frame->orientation[3];
+
+    out_pose.Position.x= data_frame->position[0];
+    out_pose.Position.y= data_frame->position[1];
+    out_pose.Position.z= data_frame->position[2];
+}
+
+static void apply_compact_physics(const CompactControllerDataFrame *data_frame, PSMovePhysicsData &out_physics)
+{
+    if (data_frame->getFlag(CompactControllerDataFrame::HasPhysicsData))
+    {
+        out_physics.Velocity.i= data_frame->velocity[0];
+        out_physics.Velocity.j= data_frame->velocity[1];
+        out_physics.Velocity.k= data_frame->velocity[2];
+
+        out_physics.Acceleration.i= data_frame->acceleration[0];
+        out_physics.Acceleration.j= data_frame->acceleration[1];
+        out_physics.Acceleration.k= data_frame->acceleration[2];
+
+        out_physics.AngularVelocity.i= data_frame->angular_velocity[0];
+        out_physics.AngularVelocity.j= data_frame->angular_velocity[1];
+        out_physics.AngularVelocity.k= data_frame->angular_velocity[2];
+
+        out_physics.AngularAcceleration.i= data_frame->angular_acceleration[0];
+        out_physics.AngularAcceleration.j= data_frame->angular_acceleration[1];
+        out_physics.AngularAcceleration.k= data_frame->angular_acceleration[2];
+    }
+    else
+    {
+        out_physics.Clear();
+    }
+}
@@ -15,6 +15,7 @@ namespace PSMoveProtocol
     class DeviceInputDataFrame;
     class DeviceInputDataFrame_ControllerDataPacket;
 };
+struct CompactControllerDataFrame;
 
 //-- constants -----
 enum PSMoveButtonState {
@@ -203,9 +204,12 @@ private:
     unsigned char Rumble;
     unsigned char LED_r, LED_g, LED_b;
 
+    void ApplyButtonBitmask(unsigned int button_bitmask);
+
 public:
     void Clear();
     void ApplyControllerDataFrame(const PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket *data_frame);
+    void ApplyCompactControllerDataFrame(const CompactControllerDataFrame *data_frame);
     void Publish(PSMoveProtocol::DeviceInputDataFrame_ControllerDataPacket *data_frame);
 
     void SetRumble(float rumbleFraction);
@@ -352,9 +356,12 @@ private:
     unsigned char Stick_XAxis;
     unsigned char Stick_YAxis;
 
+    void ApplyButtonBitmask(unsigned int button_bitmask);
+
 public:
     void Clear();
     void ApplyControllerDataFrame(const PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket *data_frame);
+    void ApplyCompactControllerDataFrame(const CompactControllerDataFrame *data_frame);
     void Publish(PSMoveProtocol::DeviceInputDataFrame_ControllerDataPacket *data_frame);
 
     inline bool IsValid() const
@@ -530,9 +537,12 @@ private:
     unsigned char BigRumble, SmallRumble;
     unsigned char LED_r, LED_g, LED_b;
 
+    void ApplyButtonBitmask(unsigned int button_bitmask);
+
 public:
     void Clear();
     void ApplyControllerDataFrame(const PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket *data_frame);
+    void ApplyCompactControllerDataFrame(const CompactControllerDataFrame *data_frame);
     void Publish(PSMoveProtocol::DeviceInputDataFrame_ControllerDataPacket *data_frame);
 
     void SetBigRumble(float rumbleFraction);
@@ -761,11 +771,14 @@ private:
     long long data_frame_last_received_time;
     float data_frame_average_fps;
 
+    void UpdateDataFrameStatistics();
+
 public:
     ClientControllerView(int ControllerID);
 
     void Clear();
     void ApplyControllerDataFrame(const PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket *data_frame);
+    void ApplyCompactControllerDataFrame(const CompactControllerDataFrame *data_frame);
     void Publish();
 
     // Listener State
@@ -2,6 +2,7 @@
 #include "ClientNetworkManager.h"
 #include "ClientLog.h"
 #include "packedmessage.h"
+#include "CompactDataFrame.h"
 #include "PSMoveProtocol.pb.h"
 #include <cassert>
 #include <iostream>
@@ -293,7 +294,7 @@ private:
             // Start an asynchronous operation to send the data frame
             // NOTE: Even if the write completes immediate, the callback will only be called from io_service::poll()
             m_udp_socket.async_send_to(
-                boost::asio::buffer(m_input_data_frame_buffer, sizeof(m_input_data_frame_buffer)),
+                boost::asio::buffer(m_input_data_frame_buffer, HEADER_SIZE + msg_size),
                 m_udp_server_endpoint,
                 boost::bind(&ClientNetworkManagerImpl::handle_udp_write_connection_id, this, _1));
         }
@@ -600,7 +601,7 @@ private:
                         // Start an asynchronous operation to send the data frame
                         // NOTE: Even if the write completes immediate, the callback will only be called from io_service::poll()
                         m_udp_socket.async_send_to(
-                            boost::asio::buffer(m_input_data_frame_buffer, sizeof(m_input_data_frame_buffer)),
+                            boost::asio::buffer(m_input_data_frame_buffer, HEADER_SIZE + msg_size),
                             m_udp_server_endpoint,
                             boost::bind(&ClientNetworkManagerImpl::handle_udp_write_device_data_frame_complete, this, _1));
                     }
@@ -648,11 +649,12 @@ private:
                 boost::bind(
                     &ClientNetworkManagerImpl::handle_udp_read_data_frame, 
                     this,
-                    asio::placeholders::error));
+                    asio::placeholders::error,
+                    asio::placeholders::bytes_transferred));
         }
     }
 
-    void handle_udp_read_data_frame(const boost::system::error_code& error)
+    void handle_udp_read_data_frame(const boost::system::error_code& error, std::size_t bytes_transferred)
     {
         if (m_connection_stopped)
             return;
@@ -662,7 +664,14 @@ private:
             CLIENT_LOG_DEBUG("ClientNetworkManager::handle_udp_read_data_frame") << "Received DataFrame" << std::endl;
 
             // Process the data frame now that we have received all of it
-            handle_udp_data_frame_received();
+            if (CompactControllerDataFrame::isCompactDataFrame(m_output_data_frame_buffer, bytes_transferred))
+            {
+                handle_udp_compact_data_frame_received(bytes_transferred);
+            }
+            else
+            {
+                handle_udp_data_frame_received();
+            }
 
             // Start reading the next incoming data frame
             start_udp_read_data_frame();
@@ -705,13 +714,38 @@ private:
         else
         {
             CLIENT_LOG_ERROR("ClientNetworkManager::handle_udp_data_frame_received") << "Error malformed response" << std::endl;
-            stop();
+            handle_udp_malformed_data_frame();
+        }
+    }
 
-            if (m_netEventListener)
-            {
-                //###HipsterSloth $TODO pick a better error code that means "malformed data"
-                m_netEventListener->handle_server_connection_socket_error(boost::asio::error::message_size);
-            }
+    // Compact data frames have a fixed layout, so they get copied out of the datagram as is
+    void handle_udp_compact_data_frame_received(std::size_t bytes_received)
+    {
+        // No longer is there a pending read
+        m_has_pending_udp_read= false;
+
+        CompactControllerDataFrame compact_data_frame;
+
+        if (compact_data_frame.unpack(m_output_data_frame_buffer, bytes_received))
+        {
+            m_data_frame_listener->handle_compact_controller_data_frame(compact_data_frame);
+        }
+        else
+        {
+            CLIENT_LOG_ERROR("ClientNetworkManager::handle_udp_compact_data_frame_received") 
+                << "Error malformed compact data frame (" << bytes_received << " bytes)" << std::endl;
+            handle_udp_malformed_data_frame();
+        }
+    }
+
+    void handle_udp_malformed_data_frame()
+    {
+        stop();
+
+        if (m_netEventListener)
+        {
+            //###HipsterSloth $TODO pick a better error code that means "malformed data"
+            m_netEventListener->handle_server_connection_socket_error(boost::asio::error::message_size);
         }
     }
 
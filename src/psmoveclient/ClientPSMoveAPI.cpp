@@ -3,10 +3,15 @@
 #include "ClientRequestManager.h"
 #include "ClientNetworkManager.h"
 #include "ClientControllerView.h"
+#include "CompactDataFrame.h"
 #include "PSMoveProtocol.pb.h"
+#include "SharedControllerState.h"
+#include <bitset>
 #include <iostream>
 #include <map>
 #include <deque>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 //-- typedefs -----
 typedef std::map<int, ClientControllerView *> t_controller_view_map;
@@ -21,6 +26,103 @@ typedef std::deque<ClientPSMoveAPI::Message> t_message_queue;
 typedef std::vector<ResponsePtr> t_event_reference_cache;
 
 //-- internal implementation -----
+/// Reads controller state out of the shared memory the service writes it into for same-host clients
+class SharedControllerStateReadOnlyAccessor
+{
+public:
+    SharedControllerStateReadOnlyAccessor()
+        : m_shared_memory_object(nullptr)
+        , m_region(nullptr)
+    {
+        memset(m_last_sequence, 0, sizeof(m_last_sequence));
+    }
+
+    ~SharedControllerStateReadOnlyAccessor()
+    {
+        dispose();
+    }
+
+    bool initialize()
+    {
+        bool bSuccess = false;
+
+        try
+        {
+            CLIENT_LOG_INFO("SharedControllerState::initialize()") << "Opening shared memory: " << SHARED_CONTROLLER_STATE_NAME;
+
+            m_shared_memory_object =
+                new boost::interprocess::shared_memory_object(
+                    boost::interprocess::open_only,
+                    SHARED_CONTROLLER_STATE_NAME,
+                    boost::interprocess::read_only);
+
+            // Readers never write to the shared memory, not even to the sequence numbers
+            m_region = new boost::interprocess::mapped_region(*m_shared_memory_object, boost::interprocess::read_only);
+
+            if (getHeader()->isCompatible(m_region->get_size()))
+            {
+                bSuccess = true;
+            }
+            else
+            {
+                dispose();
+                CLIENT_LOG_ERROR("SharedControllerState::initialize()") << "Shared memory " << SHARED_CONTROLLER_STATE_NAME
+                    << " was made by an incompatible version of the service";
+            }
+        }
+        catch (boost::interprocess::interprocess_exception &ex)
+        {
+            dispose();
+            CLIENT_LOG_INFO("SharedControllerState::initialize()") << "Failed to open shared memory: " << SHARED_CONTROLLER_STATE_NAME
+                << ", reason: " << ex.what();
+        }
+
+        return bSuccess;
+    }
+
+    void dispose()
+    {
+        if (m_region != nullptr)
+        {
+            delete m_region;
+            m_region = nullptr;
+        }
+
+        if (m_shared_memory_object != nullptr)
+        {
+            delete m_shared_memory_object;
+            m_shared_memory_object = nullptr;
+        }
+    }
+
+    /// Copies out the controller's state if the service wrote a new one since the last call.
+    /// Never waits on the service: if it's mid-write, the new state gets picked up next time.
+    bool readControllerState(int controller_id, CompactControllerDataFrame &out_data_frame)
+    {
+        bool bNewState = false;
+
+        if (controller_id >= 0 && controller_id < SHARED_CONTROLLER_STATE_SLOT_COUNT)
+        {
+            bNewState =
+                getHeader()->getSlot(controller_id)->read(
+                    m_last_sequence[controller_id], out_data_frame, m_last_sequence[controller_id]);
+        }
+
+        return bNewState;
+    }
+
+protected:
+    const SharedControllerStateHeader *getHeader() const
+    {
+        return reinterpret_cast<const SharedControllerStateHeader *>(m_region->get_address());
+    }
+
+private:
+    boost::interprocess::shared_memory_object *m_shared_memory_object;
+    boost::interprocess::mapped_region *m_region;
+    boost::uint32_t m_last_sequence[SHARED_CONTROLLER_STATE_SLOT_COUNT];
+};
+
 class ClientPSMoveAPIImpl : 
     public IDataFrameListener,
     public INotificationListener,
@@ -38,6 +140,9 @@ public:
             &m_request_manager, // IResponseListener
             this) // IClientNetworkEventListener
         , m_controller_view_map()
+        , m_is_local_host(host == "localhost" || host == "127.0.0.1" || host == "::1")
+        , m_shared_controller_state_accessor(nullptr)
+        , m_shared_memory_controller_streams()
     {
     }
 
@@ -45,6 +150,7 @@ public:
     {
         // Without this we get a warning for deletion:
         // "Delete called on 'class ClientPSMoveAPIImpl' that has virtual functions but non-virtual destructor"
+        close_shared_controller_state();
     }
 
     // -- ClientPSMoveAPI System -----
@@ -88,6 +194,9 @@ public:
 
         // Process incoming/outgoing networking requests
         m_network_manager.update();
+
+        // Pick up the latest state of the controllers streamed through shared memory
+        read_shared_controller_state();
     }
 
     void publish()
@@ -133,6 +242,9 @@ public:
         // Close all active network connections
         m_network_manager.shutdown();
 
+        // Unmap the shared controller state
+        close_shared_controller_state();
+
         // Drop an unread messages from the previous call to update
         m_message_queue.clear();
 
@@ -183,6 +295,9 @@ public:
         // If no one is listening to this controller anymore, free it from the map
         if (view->GetListenerCount() <= 0)
         {
+            // Stop reading its shared controller state
+            set_shared_memory_controller_stream(view->GetControllerID(), false);
+
             // Free the controller view allocated in allocate_controller_view
             delete view_entry->second;
             view_entry->second= nullptr;
@@ -242,6 +357,27 @@ public:
             request->mutable_request_start_psmove_data_stream()->set_include_physics_data(true);
         }
 
+        if ((flags & ClientPSMoveAPI::bundleControllerData) > 0)
+        {
+            request->mutable_request_start_psmove_data_stream()->set_bundle_controller_data(true);
+        }
+
+        if ((flags & ClientPSMoveAPI::compactDataFrame) > 0)
+        {
+            request->mutable_request_start_psmove_data_stream()->set_compact_data_frame(true);
+        }
+
+        // Only ask for the shared memory if we could map it, otherwise the data frames keep coming over the network
+        if ((flags & ClientPSMoveAPI::sharedMemoryDataFrame) > 0 && open_shared_controller_state())
+        {
+            request->mutable_request_start_psmove_data_stream()->set_shared_memory_data_frame(true);
+            set_shared_memory_controller_stream(view->GetControllerID(), true);
+        }
+        else
+        {
+            set_shared_memory_controller_stream(view->GetControllerID(), false);
+        }
+
         m_request_manager.send_request(request);
 
         return request->request_id();
@@ -256,6 +392,8 @@ public:
         request->set_type(PSMoveProtocol::Request_RequestType_STOP_CONTROLLER_DATA_STREAM);
         request->mutable_request_stop_psmove_data_stream()->set_controller_id(view->GetControllerID());
 
+        set_shared_memory_controller_stream(view->GetControllerID(), false);
+
         m_request_manager.send_request(request);
 
         return request->request_id();
@@ -412,19 +550,13 @@ public:
         {
         case PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER:
             {
-                const PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket& controller_packet= data_frame->controller_data_packet();
-
-                CLIENT_LOG_TRACE("handle_data_frame") 
-                    << "received data frame for ControllerID: " 
-                    << controller_packet.controller_id() << std::endl;
-
-                t_controller_view_map_iterator view_entry = m_controller_view_map.find(controller_packet.controller_id());
-
-                if (view_entry != m_controller_view_map.end())
+                apply_controller_data_packet(data_frame->controller_data_packet());
+            } break;
+        case PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER_BUNDLE:
+            {
+                for (int packet_index = 0; packet_index < data_frame->controller_data_packet_bundle_size(); ++packet_index)
                 {
-                    ClientControllerView * view = view_entry->second;
-
-                    view->ApplyControllerDataFrame(&controller_packet);
+                    apply_controller_data_packet(data_frame->controller_data_packet_bundle(packet_index));
                 }
             } break;
         case PSMoveProtocol::DeviceOutputDataFrame::TRACKER:
@@ -447,6 +579,96 @@ public:
         }
     }
 
+    void apply_controller_data_packet(const PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket& controller_packet)
+    {
+        CLIENT_LOG_TRACE("handle_data_frame") 
+            << "received data frame for ControllerID: " 
+            << controller_packet.controller_id() << std::endl;
+
+        t_controller_view_map_iterator view_entry = m_controller_view_map.find(controller_packet.controller_id());
+
+        if (view_entry != m_controller_view_map.end())
+        {
+            ClientControllerView * view = view_entry->second;
+
+            view->ApplyControllerDataFrame(&controller_packet);
+        }
+    }
+
+    // -- Shared Controller State -----
+    /// Maps the shared controller state the first time a stream asks for it.
+    /// Only when the service is on this host, so we don't pick up the state of some other local service.
+    bool open_shared_controller_state()
+    {
+        if (m_shared_controller_state_accessor == nullptr && m_is_local_host)
+        {
+            m_shared_controller_state_accessor = new SharedControllerStateReadOnlyAccessor();
+
+            if (!m_shared_controller_state_accessor->initialize())
+            {
+                delete m_shared_controller_state_accessor;
+                m_shared_controller_state_accessor = nullptr;
+
+                // Don't try again
+                m_is_local_host = false;
+            }
+        }
+
+        return m_shared_controller_state_accessor != nullptr;
+    }
+
+    void close_shared_controller_state()
+    {
+        if (m_shared_controller_state_accessor != nullptr)
+        {
+            delete m_shared_controller_state_accessor;
+            m_shared_controller_state_accessor = nullptr;
+        }
+
+        m_shared_memory_controller_streams.reset();
+    }
+
+    void set_shared_memory_controller_stream(int controller_id, bool bIsStreaming)
+    {
+        if (controller_id >= 0 && controller_id < SHARED_CONTROLLER_STATE_SLOT_COUNT)
+        {
+            m_shared_memory_controller_streams.set(controller_id, bIsStreaming);
+        }
+    }
+
+    void read_shared_controller_state()
+    {
+        if (m_shared_controller_state_accessor != nullptr && m_shared_memory_controller_streams.any())
+        {
+            for (int controller_id = 0; controller_id < SHARED_CONTROLLER_STATE_SLOT_COUNT; ++controller_id)
+            {
+                CompactControllerDataFrame data_frame;
+
+                if (m_shared_memory_controller_streams.test(controller_id) &&
+                    m_shared_controller_state_accessor->readControllerState(controller_id, data_frame))
+                {
+                    handle_compact_controller_data_frame(data_frame);
+                }
+            }
+        }
+    }
+
+    virtual void handle_compact_controller_data_frame(const CompactControllerDataFrame &data_frame) override
+    {
+        CLIENT_LOG_TRACE("handle_compact_controller_data_frame") 
+            << "received compact data frame for ControllerID: " 
+            << data_frame.controller_id << std::endl;
+
+        t_controller_view_map_iterator view_entry = m_controller_view_map.find(data_frame.controller_id);
+
+        if (view_entry != m_controller_view_map.end())
+        {
+            ClientControllerView * view = view_entry->second;
+
+            view->ApplyCompactControllerDataFrame(&data_frame);
+        }
+    }
+
     // INotificationListener
     virtual void handle_notification(ResponsePtr notification) override
     {
@@ -654,6 +876,12 @@ private:
     //-- Tracker Views -----
     t_tracker_view_map m_tracker_view_map;
 
+    //-- Shared Controller State -----
+    // Whether the service is on this host and it's worth trying to map its shared controller state
+    bool m_is_local_host;
+    SharedControllerStateReadOnlyAccessor *m_shared_controller_state_accessor;
+    std::bitset<SHARED_CONTROLLER_STATE_SLOT_COUNT> m_shared_memory_controller_streams;
+
     struct PendingRequest
     {
         ClientPSMoveAPI::t_request_id request_id;
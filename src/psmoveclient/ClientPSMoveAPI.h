@@ -43,7 +43,10 @@ public:
         includePhysicsData = 0x02,
         includeRawSensorData = 0x04,
         includeCalibratedSensorData = 0x08,
-        includeRawTrackerData = 0x10
+        includeRawTrackerData = 0x10,
+        bundleControllerData = 0x20, // share datagrams with the other bundled controllers
+        compactDataFrame = 0x40, // fixed layout data frames, without the raw sensor or tracker data
+        sharedMemoryDataFrame = 0x80 // read straight out of the service's shared memory when on the same host (same limits as compactDataFrame)
     };
 
     enum eControllerRumbleChannel
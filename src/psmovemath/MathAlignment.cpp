@@ -666,6 +666,101 @@ eigen_alignment_fit_focal_cone_to_sphere(
     }
 }
 
+bool
+eigen_alignment_triangulate_point(
+    const Eigen::Matrix<float, 3, 4> *pinhole_matrices,
+    const Eigen::Vector2f *pixel_points,
+    const float *weights,
+    const int camera_count,
+    Eigen::Vector3f *out_point,
+    float *out_reprojection_error)
+{
+    // The first pass minimizes the algebraic DLT error.
+    // Dividing each camera's rows by its depth to the first solution makes the
+    // second pass minimize (approximately) the pixel error instead.
+    static const int k_pass_count = 2;
+    static const double k_min_homogeneous_w = 1e-9;
+
+    if (camera_count < 2)
+    {
+        return false;
+    }
+
+    double total_weight = 0.0;
+    for (int camera_index = 0; camera_index < camera_count; ++camera_index)
+    {
+        total_weight += fmax(weights[camera_index], 0.f);
+    }
+
+    if (total_weight <= 0.0)
+    {
+        return false;
+    }
+
+    Eigen::Vector4d point = Eigen::Vector4d::Zero();
+
+    for (int pass = 0; pass < k_pass_count; ++pass)
+    {
+        Eigen::Matrix4d normal_matrix = Eigen::Matrix4d::Zero();
+
+        for (int camera_index = 0; camera_index < camera_count; ++camera_index)
+        {
+            const Eigen::Matrix<double, 3, 4> P = pinhole_matrices[camera_index].cast<double>();
+            const double u = pixel_points[camera_index].x();
+            const double v = pixel_points[camera_index].y();
+            const Eigen::Matrix<double, 1, 4> row_u = u*P.row(2) - P.row(0);
+            const Eigen::Matrix<double, 1, 4> row_v = v*P.row(2) - P.row(1);
+
+            double weight = fmax(weights[camera_index], 0.f);
+            if (pass > 0)
+            {
+                const double depth = P.row(2).dot(point);
+
+                weight = (fabs(depth) > k_normal_epsilon) ? weight / (depth*depth) : 0.0;
+            }
+
+            normal_matrix += weight*(row_u.transpose()*row_u + row_v.transpose()*row_v);
+        }
+
+        // The solution is the eigenvector with the smallest eigenvalue (they come out in increasing order)
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> solver(normal_matrix);
+        if (solver.info() != Eigen::Success)
+        {
+            return false;
+        }
+
+        point = solver.eigenvectors().col(0);
+
+        // A point at infinity means the rays were parallel
+        if (fabs(point.w()) <= k_min_homogeneous_w)
+        {
+            return false;
+        }
+
+        point /= point.w();
+    }
+
+    *out_point = point.head<3>().cast<float>();
+
+    if (out_reprojection_error != nullptr)
+    {
+        double error_sum = 0.0;
+
+        for (int camera_index = 0; camera_index < camera_count; ++camera_index)
+        {
+            const Eigen::Vector3d projection = pinhole_matrices[camera_index].cast<double>() * point;
+            const Eigen::Vector2d pixel_error =
+                projection.head<2>() / projection.z() - pixel_points[camera_index].cast<double>();
+
+            error_sum += fmax(weights[camera_index], 0.f) * pixel_error.squaredNorm();
+        }
+
+        *out_reprojection_error = static_cast<float>(sqrt(error_sum / total_weight));
+    }
+
+    return true;
+}
+
 bool
 eigen_quaternion_compute_weighted_average(
     const Eigen::Quaternionf *quaternions,
@@ -113,6 +113,19 @@ eigen_alignment_fit_focal_cone_to_sphere(
     Eigen::Vector3f *out_sphere_center,
     EigenFitEllipse *out_ellipse_projection= nullptr);
 
+// Least squares triangulation of a point seen by several cameras (weighted DLT).
+// Each camera is a 3x4 pinhole matrix taking world points to homogeneous pixel coordinates.
+// The weights scale each camera's squared pixel error.
+// Optionally returns the weighted RMS reprojection error in pixels.
+bool
+eigen_alignment_triangulate_point(
+    const Eigen::Matrix<float, 3, 4> *pinhole_matrices,
+    const Eigen::Vector2f *pixel_points,
+    const float *weights,
+    const int camera_count,
+    Eigen::Vector3f *out_point,
+    float *out_reprojection_error= nullptr);
+
 // Compute the weighted average of multiple quaternions
 bool
 eigen_quaternion_compute_weighted_average(
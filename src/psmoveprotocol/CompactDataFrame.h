@@ -0,0 +1,140 @@
+#ifndef COMPACT_DATA_FRAME_H
+#define COMPACT_DATA_FRAME_H
+
+//-- includes -----
+#include <boost/cstdint.hpp>
+#include <boost/predef/other/endian.h>
+#include <cstddef>
+#include <cstring>
+
+// The layout is little-endian on the wire and gets copied straight in and out of the datagram
+#if !BOOST_ENDIAN_LITTLE_BYTE
+#error "Compact data frames need a little-endian host"
+#endif
+
+//-- constants -----
+// Starts every compact data frame ("PSMC" in byte order).
+// Protobuf data frames start with their big-endian length, which never gets near 2^24,
+// so their first byte is always zero and the two can't be mistaken for one another.
+#define COMPACT_DATA_FRAME_MAGIC 0x434D5350
+#define COMPACT_DATA_FRAME_VERSION 1
+
+//-- definitions -----
+/// Fixed layout controller data frame, an opt-in alternative to the protobuf DeviceOutputDataFrame.
+/**
+Streams started with compact_data_frame get one of these per datagram instead of a packed protobuf message.
+It carries the pose, physics, buttons, analog inputs and tracking flags (but not the raw sensor or tracker data)
+at fixed offsets, so either side can memcpy it or read it in place.
+
+Versioning: later versions only ever add fields to the end and bump the version and size.
+A reader takes the prefix it knows and ignores the rest.
+*/
+struct CompactControllerDataFrame
+{
+    enum eFlags
+    {
+        IsConnected = 0x01,
+        ValidHardwareCalibration = 0x02,
+        IsTrackingEnabled = 0x04,
+        IsCurrentlyTracking = 0x08,
+        IsOrientationValid = 0x10,
+        IsPositionValid = 0x20,
+        HasPhysicsData = 0x40, // the velocities and accelerations are zero without it
+    };
+
+    // Header
+    boost::uint32_t magic;                  // 0: COMPACT_DATA_FRAME_MAGIC
+    boost::uint16_t version;                // 4: COMPACT_DATA_FRAME_VERSION
+    boost::uint16_t size;                   // 6: size of the whole data frame in bytes
+
+    // Controller state
+    boost::int64_t sample_time_us;          // 8: when the service read the state, on its own clock (only the deltas mean anything)
+    boost::int32_t controller_id;           // 16
+    boost::int32_t controller_type;         // 20: PSMoveProtocol::ControllerType
+    boost::int32_t sequence_num;            // 24
+    boost::uint32_t flags;                  // 28: eFlags
+    boost::uint32_t button_down_bitmask;    // 32: indexed by PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket::ButtonType
+    float position[3];                      // 36: x, y, z (zero unless the stream includes position data)
+    float orientation[4];                   // 48: w, x, y, z
+    float velocity[3];                      // 64
+    float acceleration[3];                  // 76
+    float angular_velocity[3];              // 88
+    float angular_acceleration[3];          // 100
+    boost::int32_t trigger_value;           // 112: PSMove and PSNavi, [0, 255]
+    boost::int32_t stick_xaxis;             // 116: PSNavi, [0, 255]
+    boost::int32_t stick_yaxis;             // 120: PSNavi, [0, 255]
+    float left_thumbstick_x;                // 124: DualShock4
+    float left_thumbstick_y;                // 128: DualShock4
+    float right_thumbstick_x;               // 132: DualShock4
+    float right_thumbstick_y;               // 136: DualShock4
+    float left_trigger_value;               // 140: DualShock4, [0, 1]
+    float right_trigger_value;              // 144: DualShock4, [0, 1]
+    boost::uint32_t reserved;               // 148: zero
+
+    inline void Clear()
+    {
+        memset(this, 0, sizeof(CompactControllerDataFrame));
+        magic = COMPACT_DATA_FRAME_MAGIC;
+        version = COMPACT_DATA_FRAME_VERSION;
+        size = static_cast<boost::uint16_t>(sizeof(CompactControllerDataFrame));
+    }
+
+    inline bool getFlag(eFlags flag) const
+    {
+        return (flags & flag) != 0;
+    }
+
+    inline void setFlag(eFlags flag, bool bValue)
+    {
+        flags = bValue ? (flags | flag) : (flags & ~static_cast<boost::uint32_t>(flag));
+    }
+
+    /// Whether the datagram holds a compact data frame (rather than a protobuf one)
+    static bool isCompactDataFrame(const boost::uint8_t *buffer, size_t buffer_size)
+    {
+        boost::uint32_t magic_value = 0;
+
+        if (buffer_size >= sizeof(magic_value))
+        {
+            memcpy(&magic_value, buffer, sizeof(magic_value));
+        }
+
+        return magic_value == COMPACT_DATA_FRAME_MAGIC;
+    }
+
+    /// Copies the data frame into the buffer, which needs to have at least sizeof(CompactControllerDataFrame) bytes
+    inline size_t pack(boost::uint8_t *buffer) const
+    {
+        memcpy(buffer, this, sizeof(CompactControllerDataFrame));
+
+        return sizeof(CompactControllerDataFrame);
+    }
+
+    /// Fills the data frame in from the datagram. False if the datagram isn't a compact data frame we can read.
+    inline bool unpack(const boost::uint8_t *buffer, size_t buffer_size)
+    {
+        const size_t k_header_size = offsetof(CompactControllerDataFrame, sample_time_us);
+        bool bSuccess = false;
+
+        if (buffer_size >= k_header_size && isCompactDataFrame(buffer, buffer_size))
+        {
+            memcpy(this, buffer, k_header_size);
+
+            // Newer versions can be longer, but never shorter
+            if (version >= 1 && size >= sizeof(CompactControllerDataFrame) && size <= buffer_size)
+            {
+                memcpy(this, buffer, sizeof(CompactControllerDataFrame));
+                bSuccess = true;
+            }
+        }
+
+        return bSuccess;
+    }
+};
+
+static_assert(offsetof(CompactControllerDataFrame, sample_time_us) == 8, "Compact data frame layout changed");
+static_assert(offsetof(CompactControllerDataFrame, position) == 36, "Compact data frame layout changed");
+static_assert(offsetof(CompactControllerDataFrame, trigger_value) == 112, "Compact data frame layout changed");
+static_assert(sizeof(CompactControllerDataFrame) == 152, "Compact data frame layout changed");
+
+#endif // COMPACT_DATA_FRAME_H
@@ -16,6 +16,7 @@ namespace PSMoveProtocol
 	class Request;
 	class Response;
 };
+struct CompactControllerDataFrame;
 
 typedef std::shared_ptr<PSMoveProtocol::DeviceOutputDataFrame> DeviceOutputDataFramePtr;
 typedef std::shared_ptr<PSMoveProtocol::DeviceInputDataFrame> DeviceInputDataFramePtr;
@@ -33,6 +34,7 @@ class IDataFrameListener
 {
 public:
     virtual void handle_data_frame(DeviceOutputDataFramePtr data_frame) = 0;
+    virtual void handle_compact_controller_data_frame(const CompactControllerDataFrame &data_frame) = 0;
 };
 
 class IResponseListener
@@ -0,0 +1,127 @@
+#ifndef SHARED_CONTROLLER_STATE_H
+#define SHARED_CONTROLLER_STATE_H
+
+//-- includes -----
+#include "CompactDataFrame.h"
+#include <atomic>
+#include <boost/cstdint.hpp>
+
+// The sequence numbers get shared between processes, which only works if they never fall back on a lock
+#if ATOMIC_INT_LOCK_FREE != 2
+#error "Shared controller state needs lock free atomic ints"
+#endif
+
+//-- constants -----
+#define SHARED_CONTROLLER_STATE_NAME "PSMoveService_ControllerState"
+#define SHARED_CONTROLLER_STATE_MAGIC 0x53434D50 // "PMCS" in byte order
+#define SHARED_CONTROLLER_STATE_VERSION 1
+#define SHARED_CONTROLLER_STATE_SLOT_COUNT 5 // one per controller id, same as ControllerManager::k_max_devices
+
+//-- definitions -----
+/// The latest state of one controller, guarded by a sequence lock.
+/**
+The service is the only writer. It makes the sequence number odd, copies the new data frame in
+and then makes it even again. Readers copy the data frame out between two reads of the sequence number
+and keep the copy only if the sequence number was even and didn't change, so they never block the service
+(or each other) and the service never waits on them.
+*/
+struct alignas(64) SharedControllerStateSlot
+{
+    std::atomic<boost::uint32_t> sequence; // odd while the service is writing, zero until the first write
+    CompactControllerDataFrame data_frame;
+
+    SharedControllerStateSlot()
+        : sequence(0)
+    {
+        data_frame.Clear();
+    }
+
+    void write(const CompactControllerDataFrame &in_data_frame)
+    {
+        const boost::uint32_t sequence_num = sequence.load(std::memory_order_relaxed);
+
+        sequence.store(sequence_num + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&data_frame, &in_data_frame, sizeof(CompactControllerDataFrame));
+        sequence.store(sequence_num + 2, std::memory_order_release);
+    }
+
+    /// Copies the data frame out if it has been written since last_sequence and the service
+    /// wasn't in the middle of writing it. Gives up after max_attempts rather than waiting on the service.
+    bool read(boost::uint32_t last_sequence, CompactControllerDataFrame &out_data_frame, boost::uint32_t &out_sequence, int max_attempts = 4) const
+    {
+        bool bSuccess = false;
+
+        for (int attempt = 0; !bSuccess && attempt < max_attempts; ++attempt)
+        {
+            const boost::uint32_t begin_sequence = sequence.load(std::memory_order_acquire);
+
+            if (begin_sequence == last_sequence)
+            {
+                // Nothing new
+                break;
+            }
+
+            if ((begin_sequence & 1) == 0)
+            {
+                memcpy(&out_data_frame, &data_frame, sizeof(CompactControllerDataFrame));
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (sequence.load(std::memory_order_relaxed) == begin_sequence)
+                {
+                    out_sequence = begin_sequence;
+                    bSuccess = true;
+                }
+            }
+        }
+
+        return bSuccess;
+    }
+};
+
+/// The start of the shared controller state memory, followed by SHARED_CONTROLLER_STATE_SLOT_COUNT slots
+/// indexed by controller id
+struct alignas(64) SharedControllerStateHeader
+{
+    boost::uint32_t magic;      // SHARED_CONTROLLER_STATE_MAGIC
+    boost::uint32_t version;    // SHARED_CONTROLLER_STATE_VERSION
+    boost::uint32_t slot_count;
+    boost::uint32_t slot_size;  // sizeof(SharedControllerStateSlot)
+
+    SharedControllerStateHeader()
+        : magic(SHARED_CONTROLLER_STATE_MAGIC)
+        , version(SHARED_CONTROLLER_STATE_VERSION)
+        , slot_count(SHARED_CONTROLLER_STATE_SLOT_COUNT)
+        , slot_size(sizeof(SharedControllerStateSlot))
+    {
+    }
+
+    /// Whether the service that made the shared memory lays it out the same way we do
+    bool isCompatible(size_t region_size) const
+    {
+        return
+            region_size >= computeTotalSize() &&
+            magic == SHARED_CONTROLLER_STATE_MAGIC &&
+            version == SHARED_CONTROLLER_STATE_VERSION &&
+            slot_count == SHARED_CONTROLLER_STATE_SLOT_COUNT &&
+            slot_size == sizeof(SharedControllerStateSlot);
+    }
+
+    const SharedControllerStateSlot *getSlot(int controller_id) const
+    {
+        return reinterpret_cast<const SharedControllerStateSlot *>(
+            reinterpret_cast<const unsigned char *>(this) + sizeof(SharedControllerStateHeader)) + controller_id;
+    }
+
+    SharedControllerStateSlot *getSlotMutable(int controller_id)
+    {
+        return const_cast<SharedControllerStateSlot *>(getSlot(controller_id));
+    }
+
+    static size_t computeTotalSize()
+    {
+        return sizeof(SharedControllerStateHeader) + SHARED_CONTROLLER_STATE_SLOT_COUNT*sizeof(SharedControllerStateSlot);
+    }
+};
+
+#endif // SHARED_CONTROLLER_STATE_H
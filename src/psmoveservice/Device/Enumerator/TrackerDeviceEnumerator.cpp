@@ -1,8 +1,10 @@
 // -- includes -----
 #include "TrackerDeviceEnumerator.h"
+#include "ReplayTracker.h"
 #include "ServerUtility.h"
 #include "assert.h"
 #include "libusb.h"
+#include "stdio.h"
 #include "string.h"
 
 // -- private definitions -----
@@ -17,12 +19,13 @@
 // -- globals -----
 USBDeviceInfo g_supported_tracker_infos[MAX_CAMERA_TYPE_INDEX] = {
     { 0x1415, 0x2000 }, // PS3Eye
+    { 0x0000, 0x0000 }, // Replay tracker (recordings on disk, not a usb device)
     //{0x2833, 0x0201 }, // RiftDK2 Sensor
     //{0x045e, 0x02ae}, // V1 Kinect
 };
 
 // -- methods -----
-TrackerDeviceEnumerator::TrackerDeviceEnumerator()
+TrackerDeviceEnumerator::TrackerDeviceEnumerator(const std::vector<std::string> &replayFilePaths)
     : DeviceEnumerator(CommonDeviceState::PS3EYE)
     , usb_context(nullptr)
     , devs(nullptr)
@@ -30,6 +33,8 @@ TrackerDeviceEnumerator::TrackerDeviceEnumerator()
     , dev_index(0)
     , dev_count(0)
     , camera_index(-1)
+    , replay_file_paths(replayFilePaths)
+    , replay_index(0)
 {
     assert(m_deviceType >= 0 && GET_DEVICE_TYPE_INDEX(m_deviceType) < MAX_CAMERA_TYPE_INDEX);
 
@@ -49,7 +54,9 @@ TrackerDeviceEnumerator::TrackerDeviceEnumerator()
     }
 }
 
-TrackerDeviceEnumerator::TrackerDeviceEnumerator(CommonDeviceState::eDeviceType deviceType)
+TrackerDeviceEnumerator::TrackerDeviceEnumerator(
+    CommonDeviceState::eDeviceType deviceType,
+    const std::vector<std::string> &replayFilePaths)
     : DeviceEnumerator(deviceType)
     , devs(nullptr)
     , cur_dev(nullptr)
@@ -57,6 +64,8 @@ TrackerDeviceEnumerator::TrackerDeviceEnumerator(CommonDeviceState::eDeviceType
     , dev_count(0)
     , camera_index(-1)
     , dev_valid(false)
+    , replay_file_paths(replayFilePaths)
+    , replay_index(0)
 {
     assert(m_deviceType >= 0 && GET_DEVICE_TYPE_INDEX(m_deviceType) < MAX_CAMERA_TYPE_INDEX);
 
@@ -91,7 +100,15 @@ const char *TrackerDeviceEnumerator::get_path() const
 {
     const char *result = nullptr;
 
-    if (cur_dev != nullptr)
+    if (m_deviceType == CommonDeviceState::ReplayTracker)
+    {
+        // The recording's file path identifies a replay tracker
+        if (replay_index < static_cast<int>(replay_file_paths.size()))
+        {
+            result = replay_file_paths[replay_index].c_str();
+        }
+    }
+    else if (cur_dev != nullptr)
     {
         struct libusb_device_descriptor dev_desc;
         libusb_get_device_descriptor(cur_dev, &dev_desc);
@@ -116,7 +133,25 @@ bool TrackerDeviceEnumerator::recompute_current_device_validity()
 {
     dev_valid = false;
 
-    if (cur_dev != nullptr)
+    if (m_deviceType == CommonDeviceState::ReplayTracker)
+    {
+        if (replay_index < static_cast<int>(replay_file_paths.size()))
+        {
+            // Only list recordings that are actually there
+            std::string file_path;
+            int camera_index;
+            ReplayTracker::splitReplayPath(replay_file_paths[replay_index], file_path, camera_index);
+
+            FILE *fp = fopen(file_path.c_str(), "rb");
+
+            if (fp != nullptr)
+            {
+                fclose(fp);
+                dev_valid = true;
+            }
+        }
+    }
+    else if (cur_dev != nullptr)
     {
         USBDeviceInfo &dev_info = g_supported_tracker_infos[GET_DEVICE_TYPE_INDEX(m_deviceType)];
         struct libusb_device_descriptor dev_desc;
@@ -167,7 +202,7 @@ bool TrackerDeviceEnumerator::next()
 {
     bool foundValid = false;
 
-    while (cur_dev != nullptr && !foundValid)
+    while (m_deviceType != CommonDeviceState::ReplayTracker && cur_dev != nullptr && !foundValid)
     {
         ++dev_index;
         cur_dev = (dev_index < dev_count) ? devs[dev_index] : nullptr;
@@ -184,6 +219,25 @@ bool TrackerDeviceEnumerator::next()
             // Reset the device iterator
             dev_index = 0;
             cur_dev = (devs != nullptr) ? devs[0] : nullptr;
+            replay_index = 0;
+            foundValid = recompute_current_device_validity();
+        }
+    }
+
+    // No usb devices to walk through at all (e.g. no usb bus), go straight to the recordings
+    if (!foundValid && cur_dev == nullptr && m_deviceType != CommonDeviceState::ReplayTracker && !replay_file_paths.empty())
+    {
+        m_deviceType = CommonDeviceState::ReplayTracker;
+        replay_index = 0;
+        foundValid = recompute_current_device_validity();
+    }
+
+    // Replay trackers aren't on the usb bus, so step through the recording list instead
+    if (m_deviceType == CommonDeviceState::ReplayTracker && !foundValid)
+    {
+        while (!foundValid && replay_index < static_cast<int>(replay_file_paths.size()))
+        {
+            ++replay_index;
             foundValid = recompute_current_device_validity();
         }
     }
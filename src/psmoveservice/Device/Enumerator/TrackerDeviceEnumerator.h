@@ -2,12 +2,17 @@
 #define TRACKER_DEVICE_ENUMERATOR_H
 
 #include "DeviceEnumerator.h"
+#include <string>
+#include <vector>
 
 class TrackerDeviceEnumerator : public DeviceEnumerator
 {
 public:
-    TrackerDeviceEnumerator();
-    TrackerDeviceEnumerator(CommonDeviceState::eDeviceType deviceType);
+    // Once the usb cameras run out, the given recordings are enumerated as ReplayTracker devices
+    TrackerDeviceEnumerator(const std::vector<std::string> &replayFilePaths = std::vector<std::string>());
+    TrackerDeviceEnumerator(
+        CommonDeviceState::eDeviceType deviceType,
+        const std::vector<std::string> &replayFilePaths = std::vector<std::string>());
     ~TrackerDeviceEnumerator();
 
     bool is_valid() const override;
@@ -26,6 +31,8 @@ private:
     int dev_index, dev_count;
     int camera_index;
     bool dev_valid;
+    std::vector<std::string> replay_file_paths;
+    int replay_index;
 };
 
 #endif // TRACKER_DEVICE_ENUMERATOR_H
\ No newline at end of file
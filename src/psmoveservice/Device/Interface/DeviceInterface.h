@@ -2,6 +2,7 @@
 #define DEVICE_INTERFACE_H
 
 // -- includes -----
+#include <chrono>
 #include <string>
 #include <tuple>
 
@@ -175,7 +176,8 @@ struct CommonDeviceState
         SUPPORTED_CONTROLLER_TYPE_COUNT = Controller + 0x03,
         
         PS3EYE = TrackingCamera + 0x00,
-        SUPPORTED_CAMERA_TYPE_COUNT = TrackingCamera + 0x01,
+        ReplayTracker = TrackingCamera + 0x01, // recorded video frames played back from disk
+        SUPPORTED_CAMERA_TYPE_COUNT = TrackingCamera + 0x02,
     };
     
     eDeviceType DeviceType;
@@ -210,6 +212,9 @@ struct CommonDeviceState
         case PS3EYE:
             result = "PSEYE";
             break;
+        case ReplayTracker:
+            result = "ReplayTracker";
+            break;
         default:
             result = "UNKNOWN";
         }
@@ -343,6 +348,13 @@ public:
 class IControllerInterface : public IDeviceInterface
 {
 public:
+    // Called with every raw input report right after the driver reads it off the device
+    typedef void(*t_input_report_callback)(
+        const IControllerInterface *controller,
+        const unsigned char *report,
+        size_t report_size,
+        void *userdata);
+
     // Sets the address of the bluetooth adapter on the host PC with the controller
     virtual bool setHostBluetoothAddress(const std::string &address) = 0;
 
@@ -364,6 +376,10 @@ public:
 
     // Get the tracking shape use by the controller
     virtual void getTrackingShape(CommonDeviceTrackingShape &outTrackingShape) const = 0;
+
+    // -- Setters
+    // Sets the function to hand every raw input report to (nullptr to stop)
+    virtual void setInputReportCallback(t_input_report_callback callback, void *userdata) = 0;
 };
 
 /// Abstract class for Tracker interface. Implemented Tracker classes
@@ -376,6 +392,7 @@ public:
         CL,
         CLMulti,
         Generic_Webcam,
+        Replay,
 
         SUPPORTED_DRIVER_TYPE_COUNT,
     };
@@ -393,6 +410,14 @@ public:
     // Returns a pointer to the last video frame buffer captured
     virtual const unsigned char *getVideoFrameBuffer() const = 0;
 
+    // Returns a pointer to the raw BayerGB sensor image of the last video frame captured,
+    // or nullptr if the driver only provides demosaiced frames
+    virtual const unsigned char *getVideoFrameBayerBuffer() const = 0;
+
+    // Returns when the last video frame captured was handed over by the camera driver
+    // (rather than when the tracker happened to get polled)
+    virtual std::chrono::time_point<std::chrono::high_resolution_clock> getVideoFrameCaptureTimestamp() const = 0;
+
     static const char *getDriverTypeString(eDriverType device_type)
     {
         const char *result = nullptr;
@@ -411,6 +436,9 @@ public:
         case Generic_Webcam:
             result = "Generic_Webcam";
             break;
+        case Replay:
+            result = "Replay";
+            break;
         default:
             result = "UNKNOWN";
         }
@@ -431,6 +459,16 @@ public:
         float focalLengthX, float focalLengthY,
         float principalX, float principalY) = 0;
 
+    // OpenCV lens distortion coefficients: radial k1, k2, k3 and tangential p1, p2
+    virtual void getCameraDistortion(
+        float &outK1, float &outK2,
+        float &outP1, float &outP2,
+        float &outK3) const = 0;
+    virtual void setCameraDistortion(
+        float k1, float k2,
+        float p1, float p2,
+        float k3) = 0;
+
     virtual CommonDevicePose getTrackerPose() const = 0;
     virtual void setTrackerPose(const struct CommonDevicePose *pose) = 0;
 
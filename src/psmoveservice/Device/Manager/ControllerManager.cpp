@@ -3,17 +3,31 @@
 #include "BluetoothQueries.h"
 #include "ControllerDeviceEnumerator.h"
 #include "OrientationFilter.h"
+#include "OrientationFilterBatch.h"
 #include "ServerLog.h"
 #include "ServerControllerView.h"
 #include "ServerDeviceView.h"
+#include "ServerJobPool.h"
 #include "ServerNetworkManager.h"
+#include "ServerRequestHandler.h"
+#include "ServerTrackerView.h"
+#include "ServerTrace.h"
 #include "ServerUtility.h"
 #include "hidapi.h"
 
+#include <algorithm>
+
 //-- methods -----
 ControllerManager::ControllerManager()
     : DeviceTypeManager(1000, 2)
+    , batch_filter_updates(false)
+    , m_orientation_filter_batch(new OrientationFilterBatch)
+{
+}
+
+ControllerManager::~ControllerManager()
 {
+    delete m_orientation_filter_batch;
 }
 
 bool
@@ -62,18 +76,167 @@ ControllerManager::shutdown()
     hid_exit();
 }
 
+void
+ControllerManager::publish()
+{
+    DeviceTypeManager::publish();
+
+    ServerRequestHandler::get_instance()->flush_controller_data_bundles();
+}
+
 void
 ControllerManager::updateStateAndPredict(TrackerManager* tracker_manager)
+{
+    SERVER_TRACE_SCOPE("ControllerManager::updateStateAndPredict");
+
+    beginOpticalPoseEstimation(tracker_manager);
+    updateOpticalPoseEstimation(tracker_manager);
+    finishOpticalPoseEstimation();
+    updateStateFilters(tracker_manager);
+}
+
+void
+ControllerManager::beginOpticalPoseEstimation(TrackerManager* tracker_manager)
 {
+    for (int device_id = 0; device_id < getMaxDevices(); ++device_id)
+    {
+        getControllerViewPtr(device_id)->beginOpticalPoseEstimation(tracker_manager);
+    }
+}
+
+void
+ControllerManager::finishOpticalPoseEstimation()
+{
+    for (int device_id = 0; device_id < getMaxDevices(); ++device_id)
+    {
+        getControllerViewPtr(device_id)->finishOpticalPoseEstimation();
+    }
+}
+
+void
+ControllerManager::updateOpticalPoseEstimation(TrackerManager* tracker_manager)
+{
+    SERVER_TRACE_SCOPE("ControllerManager::updateOpticalPoseEstimation");
+    ServerJobPool *job_pool = tracker_manager->getJobPool();
+
+    // Segment each new video frame for all tracked colors in a single pass
+    // rather than re-filtering the whole frame once per controller.
+    // Each tracker only touches its own frame buffers, so the trackers can be done in parallel.
+    for (int tracker_id = 0; tracker_id < tracker_manager->getMaxDevices(); ++tracker_id)
+    {
+        ServerTrackerViewPtr tracker = tracker_manager->getTrackerViewPtr(tracker_id);
+
+        if (tracker->getIsOpen() && tracker->getHasUnpublishedState())
+        {
+            job_pool->addJob([this, tracker]() {
+                tracker->computeTrackingColorSegmentation(this);
+            });
+        }
+    }
+    job_pool->runJobs();
+
+    // Find every controller in every tracker's video frame in parallel.
+    // Each (tracker, controller) job only writes to that controller's pose estimate for that tracker.
     for (int device_id = 0; device_id < getMaxDevices(); ++device_id)
     {
         ServerControllerViewPtr controllerView = getControllerViewPtr(device_id);
 
-		if (controllerView->getIsOpen() && controllerView->getIsBluetooth())
-		{
-			controllerView->updateOpticalPoseEstimation(tracker_manager);
-			controllerView->updateStateAndPredict();
-		}
+        if (controllerView->getOpticalSnapshot()->bIsTracked)
+        {
+            for (int tracker_id = 0; tracker_id < tracker_manager->getMaxDevices(); ++tracker_id)
+            {
+                job_pool->addJob([tracker_manager, controllerView, tracker_id]() {
+                    controllerView->updateTrackerPoseEstimation(tracker_manager, tracker_id);
+                });
+            }
+        }
+    }
+    job_pool->runJobs();
+}
+
+void
+ControllerManager::updateStateFilters(TrackerManager* tracker_manager)
+{
+    SERVER_TRACE_SCOPE("ControllerManager::updateStateFilters");
+
+    // Triangulate the per-tracker estimates and update the filters
+    if (batch_filter_updates)
+    {
+        update_filters_batched(tracker_manager);
+    }
+    else
+    {
+        for (int device_id = 0; device_id < getMaxDevices(); ++device_id)
+        {
+            ServerControllerViewPtr controllerView = getControllerViewPtr(device_id);
+
+            if (controllerView->getIsOpen() && controllerView->getIsBluetooth())
+            {
+                controllerView->updateMulticamPoseEstimation(tracker_manager);
+                controllerView->updateStateAndPredict();
+            }
+        }
+    }
+}
+
+void
+ControllerManager::update_filters_batched(TrackerManager* tracker_manager)
+{
+    ServerControllerView *pendingViews[k_max_devices];
+    int pendingOrientationUpdateCounts[k_max_devices];
+    int pendingViewCount = 0;
+    int maxOrientationUpdateCount = 0;
+
+    for (int device_id = 0; device_id < getMaxDevices(); ++device_id)
+    {
+        ServerControllerView *controllerView = getControllerViewPtr(device_id).get();
+
+        if (controllerView->getIsOpen() && controllerView->getIsBluetooth())
+        {
+            controllerView->updateMulticamPoseEstimation(tracker_manager);
+
+            if (controllerView->beginStateUpdate())
+            {
+                const int orientationUpdateCount = controllerView->getPendingOrientationUpdateCount();
+
+                pendingViews[pendingViewCount] = controllerView;
+                pendingOrientationUpdateCounts[pendingViewCount] = orientationUpdateCount;
+                ++pendingViewCount;
+
+                maxOrientationUpdateCount = std::max(maxOrientationUpdateCount, orientationUpdateCount);
+            }
+        }
+    }
+
+    // Each round steps every controller that still has IMU frames left through one orientation filter update.
+    // Controllers whose fusion type can't be batched get updated on the spot when staged.
+    for (int update_index = 0; update_index < maxOrientationUpdateCount; ++update_index)
+    {
+        m_orientation_filter_batch->clear();
+
+        for (int view_index = 0; view_index < pendingViewCount; ++view_index)
+        {
+            if (update_index < pendingOrientationUpdateCounts[view_index])
+            {
+                pendingViews[view_index]->stageOrientationUpdate(update_index, m_orientation_filter_batch);
+            }
+        }
+
+        m_orientation_filter_batch->update();
+
+        for (int view_index = 0; view_index < pendingViewCount; ++view_index)
+        {
+            if (update_index < pendingOrientationUpdateCounts[view_index])
+            {
+                pendingViews[view_index]->finishOrientationUpdate(update_index, m_orientation_filter_batch);
+            }
+        }
+    }
+
+    // The position filters only read the orientations, so they can go afterwards
+    for (int view_index = 0; view_index < pendingViewCount; ++view_index)
+    {
+        pendingViews[view_index]->finishStateUpdate();
     }
 }
 
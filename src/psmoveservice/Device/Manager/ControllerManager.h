@@ -19,15 +19,29 @@ class ControllerManager : public DeviceTypeManager
 {
 public:
     ControllerManager();
+    virtual ~ControllerManager();
 
     /// Call hid_init()
     bool startup() override;
 
     /// Call hid_close()
     void shutdown() override;
+
+    /// Also sends out the controller data frames bundled up while publishing
+    void publish() override;
     
     void updateStateAndPredict(TrackerManager* tracker_manager);
 
+    // updateStateAndPredict() in its two halves, for when they run on separate threads:
+    // Find the controllers in the latest video frames.
+    // Only the begin and finish steps need the device state lock,
+    // the video frames get searched in between without it.
+    void beginOpticalPoseEstimation(TrackerManager* tracker_manager);
+    void updateOpticalPoseEstimation(TrackerManager* tracker_manager);
+    void finishOpticalPoseEstimation();
+    // Combine the optical estimates with the polled controller states in the filters
+    void updateStateFilters(TrackerManager* tracker_manager);
+
     static const int k_max_devices = 5;
     int getMaxDevices() const override
     {
@@ -48,6 +62,9 @@ public:
     void claimTrackingColorID(eCommonTrackingColorID color_id);
     void freeTrackingColorID(eCommonTrackingColorID color_id);
 
+    // Update the orientation filters of all the controllers together in one batch, rather than one after the other
+    bool batch_filter_updates;
+
 protected:
     class DeviceEnumerator *allocate_device_enumerator() override;
     void free_device_enumerator(class DeviceEnumerator *) override;
@@ -59,9 +76,12 @@ protected:
     }
 
 private:
+    void update_filters_batched(TrackerManager* tracker_manager);
+
     static const PSMoveProtocol::Response_ResponseType k_list_udpated_response_type = PSMoveProtocol::Response_ResponseType_CONTROLLER_LIST_UPDATED;
     std::deque<eCommonTrackingColorID> m_available_controller_color_ids;
     std::string m_bluetooth_host_address;
+    class OrientationFilterBatch *m_orientation_filter_batch;
 };
 
 #endif // CONTROLLER_MANAGER_H
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "ControllerManager.h"
 #include "DeviceEnumerator.h"
+#include "DeviceScheduler.h"
 #include "OrientationFilter.h"
 #include "ServerControllerView.h"
 #include "ServerTrackerView.h"
@@ -10,17 +11,27 @@
 #include "ServerLog.h"
 #include "ServerDeviceView.h"
 #include "ServerNetworkManager.h"
+#include "ServerTrace.h"
 #include "ServerUtility.h"
+#include "SessionRecording.h"
 #include "PSMoveProtocol.pb.h"
 #include "PSMoveConfig.h"
 #include "TrackerManager.h"
 #include <chrono>
+#include <sstream>
 
 //-- constants -----
 static const int k_default_controller_reconnect_interval= 1000; // ms
 static const int k_default_controller_poll_interval= 2; // ms
 static const int k_default_tracker_reconnect_interval= 10000; // ms
 static const int k_default_tracker_poll_interval= 13; // 1000/75 ms
+static const int k_default_session_recording_keyframe_interval= 60; // frames
+static const bool k_default_batch_filter_updates= false;
+static const bool k_default_use_device_threads= false;
+static const int k_default_pose_publish_rate= 500; // Hz
+static const int k_default_controller_input_idle_wait= 1000; // us, about one controller report interval
+static const int k_default_latency_log_interval= 0; // s
+static const char *k_default_trace_dump_path= "psmoveservice_trace.json";
 
 class DeviceManagerConfig : public PSMoveConfig
 {
@@ -31,6 +42,14 @@ public:
         , controller_poll_interval(k_default_controller_poll_interval)
         , tracker_reconnect_interval(k_default_tracker_reconnect_interval)
         , tracker_poll_interval(k_default_tracker_poll_interval)
+        , session_recording_path()
+        , session_recording_keyframe_interval(k_default_session_recording_keyframe_interval)
+        , batch_filter_updates(k_default_batch_filter_updates)
+        , use_device_threads(k_default_use_device_threads)
+        , pose_publish_rate(k_default_pose_publish_rate)
+        , controller_input_idle_wait(k_default_controller_input_idle_wait)
+        , latency_log_interval(k_default_latency_log_interval)
+        , trace_dump_path(k_default_trace_dump_path)
     {};
 
     const boost::property_tree::ptree
@@ -42,6 +61,14 @@ public:
         pt.put("controller_poll_interval", controller_poll_interval);
         pt.put("tracker_reconnect_interval", tracker_reconnect_interval);
         pt.put("tracker_poll_interval", tracker_poll_interval);
+        pt.put("session_recording_path", session_recording_path);
+        pt.put("session_recording_keyframe_interval", session_recording_keyframe_interval);
+        pt.put("batch_filter_updates", batch_filter_updates);
+        pt.put("use_device_threads", use_device_threads);
+        pt.put("pose_publish_rate", pose_publish_rate);
+        pt.put("controller_input_idle_wait", controller_input_idle_wait);
+        pt.put("latency_log_interval", latency_log_interval);
+        pt.put("trace_dump_path", trace_dump_path);
 
         return pt;
     }
@@ -53,12 +80,28 @@ public:
         controller_poll_interval = pt.get<int>("controller_poll_interval", k_default_controller_poll_interval);
         tracker_reconnect_interval = pt.get<int>("tracker_reconnect_interval", k_default_tracker_reconnect_interval);
         tracker_poll_interval = pt.get<int>("tracker_poll_interval", k_default_tracker_poll_interval);
+        session_recording_path = pt.get<std::string>("session_recording_path", "");
+        session_recording_keyframe_interval = pt.get<int>("session_recording_keyframe_interval", k_default_session_recording_keyframe_interval);
+        batch_filter_updates = pt.get<bool>("batch_filter_updates", k_default_batch_filter_updates);
+        use_device_threads = pt.get<bool>("use_device_threads", k_default_use_device_threads);
+        pose_publish_rate = pt.get<int>("pose_publish_rate", k_default_pose_publish_rate);
+        controller_input_idle_wait = pt.get<int>("controller_input_idle_wait", k_default_controller_input_idle_wait);
+        latency_log_interval = pt.get<int>("latency_log_interval", k_default_latency_log_interval);
+        trace_dump_path = pt.get<std::string>("trace_dump_path", k_default_trace_dump_path);
     }
 
     int controller_reconnect_interval;
     int controller_poll_interval;
     int tracker_reconnect_interval;
     int tracker_poll_interval;
+    std::string session_recording_path; // record camera frames and controller reports here (if set)
+    int session_recording_keyframe_interval;
+    bool batch_filter_updates; // run the orientation filters of all the controllers as one batch
+    bool use_device_threads; // read the controllers, process video and publish poses on their own threads
+    int pose_publish_rate; // Hz, how often the device threads publish controller poses
+    int controller_input_idle_wait; // us, how long the controller input thread waits after a poll with no new reports
+    int latency_log_interval; // s, how often to log the latency stats of every device (0 to never)
+    std::string trace_dump_path; // where a DUMP_TRACE request writes the trace (builds with PSMOVESERVICE_TRACING only)
 };
 
 // DeviceManager - This is the interface used by PSMoveService
@@ -66,8 +109,11 @@ DeviceManager *DeviceManager::m_instance= nullptr;
 
 DeviceManager::DeviceManager()
     : m_config() // NULL config until startup
+    , m_last_latency_log_time()
     , m_controller_manager(new ControllerManager())
     , m_tracker_manager(new TrackerManager())
+    , m_session_recorder(nullptr)
+    , m_scheduler(nullptr)
 {
 }
 
@@ -75,6 +121,16 @@ DeviceManager::~DeviceManager()
 {
     delete m_controller_manager;
     delete m_tracker_manager;
+
+    if (m_session_recorder != nullptr)
+    {
+        delete m_session_recorder;
+    }
+
+    if (m_scheduler != nullptr)
+    {
+        delete m_scheduler;
+    }
 }
 
 bool
@@ -84,9 +140,22 @@ DeviceManager::startup()
 
     m_config = DeviceManagerConfigPtr(new DeviceManagerConfig);
     m_config->load();
+
+    if (!m_config->session_recording_path.empty())
+    {
+        m_session_recorder = new ServerSessionRecorder();
+
+        if (!m_session_recorder->startup(m_config->session_recording_path, m_config->session_recording_keyframe_interval))
+        {
+            // Not worth failing startup over
+            delete m_session_recorder;
+            m_session_recorder = nullptr;
+        }
+    }
     
     m_controller_manager->reconnect_interval = m_config->controller_reconnect_interval;
     m_controller_manager->poll_interval = m_config->controller_poll_interval;
+    m_controller_manager->batch_filter_updates = m_config->batch_filter_updates;
     success &= m_controller_manager->startup();
     
     m_tracker_manager->reconnect_interval = m_config->tracker_reconnect_interval;
@@ -94,6 +163,13 @@ DeviceManager::startup()
     success &= m_tracker_manager->startup();
 
     m_instance= this;
+    m_last_latency_log_time = std::chrono::high_resolution_clock::now();
+
+    if (m_config->use_device_threads)
+    {
+        // Exists before any tracker opens, the tracker capture threads notify it of new frames
+        m_scheduler = new DeviceScheduler(this);
+    }
     
     return success;
 }
@@ -101,6 +177,25 @@ DeviceManager::startup()
 void
 DeviceManager::update()
 {
+    SERVER_TRACE_SCOPE("DeviceManager::update");
+
+    if (m_config->latency_log_interval > 0)
+    {
+        const std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+
+        if (now - m_last_latency_log_time >= std::chrono::seconds(m_config->latency_log_interval))
+        {
+            logLatencyStats();
+            m_last_latency_log_time = now;
+        }
+    }
+
+    if (getIsDeviceThreadsRunning())
+    {
+        // The device threads take care of it
+        return;
+    }
+
     m_controller_manager->poll(); // Update controller counts and poll button/IMU state
     m_tracker_manager->poll(); // Update tracker count and poll video frames
 
@@ -115,12 +210,102 @@ DeviceManager::shutdown()
 {
     m_config->save();
 
+    stopDeviceThreads();
+
+    if (m_session_recorder != nullptr)
+    {
+        m_session_recorder->shutdown();
+        delete m_session_recorder;
+        m_session_recorder = nullptr;
+    }
+
     m_controller_manager->shutdown();
     m_tracker_manager->shutdown();
 
+    // Only now that the tracker capture threads are gone, since they notify the scheduler of new frames
+    if (m_scheduler != nullptr)
+    {
+        delete m_scheduler;
+        m_scheduler = nullptr;
+    }
+
     m_instance= nullptr;
 }
 
+void
+DeviceManager::startDeviceThreads()
+{
+    if (m_scheduler != nullptr && !m_scheduler->getIsRunning())
+    {
+        m_scheduler->startup(m_config->pose_publish_rate, m_config->controller_input_idle_wait);
+    }
+}
+
+void
+DeviceManager::stopDeviceThreads()
+{
+    if (m_scheduler != nullptr)
+    {
+        m_scheduler->shutdown();
+    }
+}
+
+bool
+DeviceManager::getIsDeviceThreadsRunning() const
+{
+    return m_scheduler != nullptr && m_scheduler->getIsRunning();
+}
+
+static void
+log_device_latency_stats(const char *device_name, int device_id, const DeviceLatencyStats &latency_stats)
+{
+    if (!latency_stats.getHasSamples())
+    {
+        return;
+    }
+
+    std::ostringstream stage_stats;
+
+    for (int stage_index = 0; stage_index < MAX_LATENCY_STAGES; ++stage_index)
+    {
+        const eLatencyStage stage = static_cast<eLatencyStage>(stage_index);
+        const LatencyHistogram &histogram = latency_stats.getHistogram(stage);
+
+        if (histogram.getSampleCount() > 0)
+        {
+            stage_stats
+                << " " << DeviceLatencyStats::getStageName(stage) << "="
+                << static_cast<double>(histogram.getPercentile(0.5f)) / 1000.0 << "/"
+                << static_cast<double>(histogram.getPercentile(0.99f)) / 1000.0 << "/"
+                << static_cast<double>(histogram.getMax()) / 1000.0;
+        }
+    }
+
+    SERVER_LOG_INFO("DeviceManager::logLatencyStats") <<
+        device_name << " " << device_id << " latency p50/p99/max ms:" << stage_stats.str();
+}
+
+void
+DeviceManager::logLatencyStats()
+{
+    // The stats keep accumulating, only a GET_LATENCY_STATS request resets them
+    for (int controller_id = 0; controller_id < getControllerViewMaxCount(); ++controller_id)
+    {
+        log_device_latency_stats("Controller", controller_id, *getControllerViewPtr(controller_id)->getLatencyStats());
+    }
+
+    for (int tracker_id = 0; tracker_id < getTrackerViewMaxCount(); ++tracker_id)
+    {
+        log_device_latency_stats("Tracker", tracker_id, *getTrackerViewPtr(tracker_id)->getLatencyStats());
+    }
+}
+
+bool
+DeviceManager::dumpTrace()
+{
+    return ServerTrace::dumpToFile(m_config->trace_dump_path);
+}
+
 int 
 DeviceManager::getControllerViewMaxCount() const
 {
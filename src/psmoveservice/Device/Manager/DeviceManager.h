@@ -3,6 +3,7 @@
 
 //-- includes -----
 #include <memory>
+#include <mutex>
 #include <chrono>
 //#include "PSMoveProtocol.pb.h"
 
@@ -25,8 +26,20 @@ public:
     virtual ~DeviceManager();
 
     bool startup(); /**< Initialize the interfaces for each specific manager. */
-    void update();  /**< Poll all connected devices for each specific manager. */
+    void update();  /**< Poll all connected devices for each specific manager (unless the device threads do). */
     void shutdown();/**< Shutdown the interfaces for each specific manager. */
+    void startDeviceThreads(); /**< Hand the device updates over to their own threads (if configured to). */
+    void stopDeviceThreads(); /**< Stop the device threads (if running) so nothing gets published from them anymore. */
+    bool dumpTrace(); /**< Write out the recorded trace markers (if built with PSMOVESERVICE_TRACING). */
+
+    /// Whether the device threads are doing the device updates instead of update()
+    bool getIsDeviceThreadsRunning() const;
+
+    /// Held by whatever is touching the device state.
+    /// Only ever contended when the device threads are running.
+    /// Recursive, since the network callbacks take it whether or not the main loop already holds it.
+    inline std::recursive_mutex &getDeviceStateMutex()
+    { return m_device_state_mutex; }
 
     static inline DeviceManager *getInstance()
     { return m_instance; }
@@ -38,7 +51,11 @@ public:
     ServerTrackerViewPtr getTrackerViewPtr(int tracker_id);
     
 private:
+    void logLatencyStats();
+
     DeviceManagerConfigPtr m_config;
+    std::recursive_mutex m_device_state_mutex;
+    std::chrono::time_point<std::chrono::high_resolution_clock> m_last_latency_log_time;
 
     /// Singleton instance of the class
     /// Assigned in startup, cleared in teardown
@@ -47,6 +64,8 @@ private:
 public:
     class ControllerManager *m_controller_manager;
     class TrackerManager *m_tracker_manager;
+    class ServerSessionRecorder *m_session_recorder; // null unless a session is being recorded
+    class DeviceScheduler *m_scheduler; // null unless the devices are configured to update on their own threads
 };
 
 #endif  // DEVICE_MANAGER_H
\ No newline at end of file
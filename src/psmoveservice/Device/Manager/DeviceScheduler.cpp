@@ -0,0 +1,258 @@
+//-- includes -----
+#include "DeviceScheduler.h"
+#include "ControllerManager.h"
+#include "DeviceManager.h"
+#include "ServerControllerView.h"
+#include "ServerLog.h"
+#include "ServerTrace.h"
+#include "TrackerManager.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <mmsystem.h>
+#pragma comment (lib, "winmm.lib")     /* link with Windows MultiMedia lib */
+#endif // _WIN32
+
+//-- constants -----
+static const int k_min_pose_publish_rate = 1; // Hz
+static const int k_max_pose_publish_rate = 1000; // Hz
+
+//-- public implementation -----
+DeviceScheduler::DeviceScheduler(DeviceManager *device_manager)
+    : m_device_manager(device_manager)
+    , m_video_frame_count(0)
+    , m_exit_requested(false)
+    , m_pose_publish_rate(0)
+    , m_controller_input_idle_wait(0)
+    , m_controller_input_thread(nullptr)
+    , m_vision_thread(nullptr)
+    , m_pose_publish_thread(nullptr)
+{
+}
+
+DeviceScheduler::~DeviceScheduler()
+{
+    shutdown();
+}
+
+void DeviceScheduler::startup(int pose_publish_rate, int controller_input_idle_wait)
+{
+    assert(m_controller_input_thread == nullptr);
+
+    m_pose_publish_rate = std::min(std::max(pose_publish_rate, k_min_pose_publish_rate), k_max_pose_publish_rate);
+    m_controller_input_idle_wait = std::max(controller_input_idle_wait, 0);
+    m_exit_requested = false;
+
+    SERVER_LOG_INFO("DeviceScheduler::startup") <<
+        "Starting device threads, publishing poses at " << m_pose_publish_rate << "Hz";
+
+#ifdef _WIN32
+    // The default timer resolution (~15ms) is far too coarse for the publisher
+    timeBeginPeriod(1);
+#endif // _WIN32
+
+    // Publish poses predicted to when they go out, rather than as of the latest filter state
+    ControllerManager *controller_manager = m_device_manager->m_controller_manager;
+
+    for (int controller_id = 0; controller_id < controller_manager->getMaxDevices(); ++controller_id)
+    {
+        controller_manager->getControllerViewPtr(controller_id)->setPredictToPublishTime(true);
+    }
+
+    m_controller_input_thread = new boost::thread(boost::bind(&DeviceScheduler::controllerInputThreadFunc, this));
+    m_vision_thread = new boost::thread(boost::bind(&DeviceScheduler::visionThreadFunc, this));
+    m_pose_publish_thread = new boost::thread(boost::bind(&DeviceScheduler::posePublishThreadFunc, this));
+}
+
+void DeviceScheduler::shutdown()
+{
+    if (m_controller_input_thread != nullptr)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_exit_requested = true;
+        }
+        m_exit_condition.notify_all();
+        m_video_frame_condition.notify_all();
+
+        boost::thread *threads[] = { m_controller_input_thread, m_vision_thread, m_pose_publish_thread };
+        for (boost::thread *thread : threads)
+        {
+            thread->join();
+            delete thread;
+        }
+
+        m_controller_input_thread = nullptr;
+        m_vision_thread = nullptr;
+        m_pose_publish_thread = nullptr;
+
+#ifdef _WIN32
+        timeEndPeriod(1);
+#endif // _WIN32
+    }
+}
+
+void DeviceScheduler::notifyNewVideoFrame()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex);
+        ++m_video_frame_count;
+    }
+    m_video_frame_condition.notify_one();
+}
+
+//-- private implementation -----
+void DeviceScheduler::controllerInputThreadFunc()
+{
+    SERVER_TRACE_THREAD_NAME("controller input");
+
+    ControllerManager *controller_manager = m_device_manager->m_controller_manager;
+    TrackerManager *tracker_manager = m_device_manager->m_tracker_manager;
+
+    for (;;)
+    {
+        bool bAnyNewData;
+
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_device_manager->getDeviceStateMutex());
+
+            bAnyNewData = controller_manager->poll(true);
+
+            if (bAnyNewData)
+            {
+                controller_manager->updateStateFilters(tracker_manager);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(m_wake_mutex);
+
+        if (!bAnyNewData)
+        {
+            // Nothing came in, so there's probably nothing queued up either
+            m_exit_condition.wait_for(
+                lock,
+                std::chrono::microseconds(m_controller_input_idle_wait),
+                [this] { return m_exit_requested; });
+        }
+
+        if (m_exit_requested)
+        {
+            break;
+        }
+    }
+}
+
+void DeviceScheduler::visionThreadFunc()
+{
+    SERVER_TRACE_THREAD_NAME("vision");
+
+    ControllerManager *controller_manager = m_device_manager->m_controller_manager;
+    TrackerManager *tracker_manager = m_device_manager->m_tracker_manager;
+    unsigned int last_video_frame_count = 0;
+
+    for (;;)
+    {
+        bool bNewVideoFrame;
+
+        {
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+
+            bNewVideoFrame = m_video_frame_condition.wait_for(
+                lock,
+                std::chrono::milliseconds(tracker_manager->poll_interval),
+                [this, last_video_frame_count] { return m_exit_requested || m_video_frame_count != last_video_frame_count; });
+
+            if (m_exit_requested)
+            {
+                break;
+            }
+
+            last_video_frame_count = m_video_frame_count;
+        }
+
+        bool bHasNewTrackerState;
+
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_device_manager->getDeviceStateMutex());
+
+            // Without a new frame this is the regular poll, which also picks up tracker connection changes
+            bHasNewTrackerState = tracker_manager->poll(bNewVideoFrame);
+
+            if (bHasNewTrackerState)
+            {
+                controller_manager->beginOpticalPoseEstimation(tracker_manager);
+            }
+        }
+
+        // The video frames get searched without the lock, so the controller input
+        // and pose publisher threads don't stall behind the image processing
+        if (bHasNewTrackerState)
+        {
+            controller_manager->updateOpticalPoseEstimation(tracker_manager);
+        }
+
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_device_manager->getDeviceStateMutex());
+
+            if (bHasNewTrackerState)
+            {
+                controller_manager->finishOpticalPoseEstimation();
+            }
+
+            tracker_manager->publish();
+        }
+    }
+}
+
+void DeviceScheduler::posePublishThreadFunc()
+{
+    SERVER_TRACE_THREAD_NAME("pose publisher");
+
+    ControllerManager *controller_manager = m_device_manager->m_controller_manager;
+    const std::chrono::high_resolution_clock::duration publish_period =
+        std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+            std::chrono::duration<double>(1.0 / static_cast<double>(m_pose_publish_rate)));
+    std::chrono::time_point<std::chrono::high_resolution_clock> next_publish_time =
+        std::chrono::high_resolution_clock::now();
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_device_manager->getDeviceStateMutex());
+
+            // Every tracked controller goes out every period, whether or not it sent a new report since the last one
+            for (int controller_id = 0; controller_id < controller_manager->getMaxDevices(); ++controller_id)
+            {
+                ServerControllerViewPtr controller_view = controller_manager->getControllerViewPtr(controller_id);
+
+                if (controller_view->getIsOpen() && controller_view->getIsBluetooth())
+                {
+                    controller_view->markStateAsUnpublished();
+                }
+            }
+
+            controller_manager->publish();
+        }
+
+        // Fall behind rather than send a burst to catch up
+        const std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+
+        next_publish_time = std::max(next_publish_time + publish_period, now);
+
+        std::unique_lock<std::mutex> lock(m_wake_mutex);
+
+        m_exit_condition.wait_until(lock, next_publish_time, [this] { return m_exit_requested; });
+
+        if (m_exit_requested)
+        {
+            break;
+        }
+    }
+}
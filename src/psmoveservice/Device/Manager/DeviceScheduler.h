@@ -0,0 +1,67 @@
+#ifndef DEVICE_SCHEDULER_H
+#define DEVICE_SCHEDULER_H
+
+//-- includes -----
+#include <condition_variable>
+#include <mutex>
+
+//-- pre-declarations -----
+namespace boost
+{
+    class thread;
+};
+
+//-- definitions -----
+/// Runs the device updates on their own threads instead of the main loop.
+/**
+- The controller input thread reads the controllers and runs their filters as soon as new reports arrive.
+  HID reads don't block, so while reports keep coming it polls back to back
+  and otherwise idles for about a report interval.
+- The vision thread sleeps until a tracker's capture thread delivers a new video frame
+  (or the tracker poll interval runs out, for trackers without a capture thread)
+  then finds the controllers in it and publishes the tracker state.
+- The pose publisher thread sends out every tracked controller's pose at a fixed rate,
+  predicted forward to the moment it gets sent.
+
+All three share the device state with the main thread (which still handles the requests and network traffic,
+blocking on the network in between) through the device manager's device state mutex. The vision thread only holds it to poll and publish the trackers
+and to swap the controllers' optical snapshots in and out, not while it searches the video frames.
+*/
+class DeviceScheduler
+{
+public:
+    DeviceScheduler(class DeviceManager *device_manager);
+    ~DeviceScheduler();
+
+    void startup(int pose_publish_rate, int controller_input_idle_wait);
+    void shutdown();
+
+    inline bool getIsRunning() const
+    { return m_controller_input_thread != nullptr; }
+
+    /// Wake up the vision thread. Safe to call from any thread, whether or not the threads are running.
+    void notifyNewVideoFrame();
+
+private:
+    void controllerInputThreadFunc();
+    void visionThreadFunc();
+    void posePublishThreadFunc();
+
+    class DeviceManager *m_device_manager;
+
+    // Wakes up the sleeping threads, either to exit or for a new video frame
+    std::mutex m_wake_mutex;
+    std::condition_variable m_exit_condition;
+    std::condition_variable m_video_frame_condition;
+    unsigned int m_video_frame_count;
+    bool m_exit_requested;
+
+    int m_pose_publish_rate; // Hz
+    int m_controller_input_idle_wait; // microseconds
+
+    boost::thread *m_controller_input_thread;
+    boost::thread *m_vision_thread;
+    boost::thread *m_pose_publish_thread;
+};
+
+#endif // DEVICE_SCHEDULER_H
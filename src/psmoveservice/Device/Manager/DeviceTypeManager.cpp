@@ -66,17 +66,18 @@ DeviceTypeManager::shutdown()
 }
 
 /// Calls poll_devices and update_connected_devices if poll_interval and reconnect_interval has elapsed, respectively.
-void
-DeviceTypeManager::poll()
+bool
+DeviceTypeManager::poll(bool bPollDevicesNow)
 {
     std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+    bool bAnyNewData = false;
 
     // See if it's time to poll controllers for data
     std::chrono::duration<double, std::milli> update_diff = now - m_last_poll_time;
 
-    if (update_diff.count() >= poll_interval)
+    if (bPollDevicesNow || update_diff.count() >= poll_interval)
     {
-        poll_devices();
+        bAnyNewData = poll_devices();
         m_last_poll_time = now;
     }
 
@@ -89,6 +90,8 @@ DeviceTypeManager::poll()
             m_last_reconnect_time = now;
         }
     }
+
+    return bAnyNewData;
 }
 
 bool
@@ -237,9 +240,11 @@ DeviceTypeManager::can_update_connected_devices()
     return !ServerRequestHandler::get_instance()->any_active_bluetooth_requests();
 }
 
-void
+bool
 DeviceTypeManager::poll_devices()
 {
+    bool bAnyNewData = false;
+
     if (can_poll_connected_devices())
     {
         bool bAllUpdatedOk = true;
@@ -247,7 +252,10 @@ DeviceTypeManager::poll_devices()
         for (int device_id = 0; device_id < getMaxDevices(); ++device_id)
         {
             ServerDeviceViewPtr device = getDeviceViewPtr(device_id);
+            const auto last_new_data_timestamp = device->getLastNewDataTimestamp();
+
             bAllUpdatedOk &= device->poll();
+            bAnyNewData |= device->getLastNewDataTimestamp() != last_new_data_timestamp;
         }
 
         if (!bAllUpdatedOk)
@@ -255,6 +263,8 @@ DeviceTypeManager::poll_devices()
             send_device_list_changed_notification();
         }
     }
+
+    return bAnyNewData;
 }
 
 int
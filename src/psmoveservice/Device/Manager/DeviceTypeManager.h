@@ -21,8 +21,10 @@ public:
     virtual bool startup();
     virtual void shutdown();
 
-    void poll();
-    void publish();
+    /// Returns true if any device had new data.
+    /// bPollDevicesNow polls the devices whether or not poll_interval has elapsed.
+    bool poll(bool bPollDevicesNow = false);
+    virtual void publish();
 
     virtual int getMaxDevices() const = 0;
 
@@ -39,7 +41,7 @@ public:
     int poll_interval;
 
 protected:
-    void poll_devices();
+    bool poll_devices();
 
     /** This method tries make the list of open devices in m_devices match
     the list of connected devices in the device enumerator.
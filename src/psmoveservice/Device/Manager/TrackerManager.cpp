@@ -14,6 +14,14 @@ TrackerManagerConfig::TrackerManagerConfig(const std::string &fnamebase)
     : PSMoveConfig(fnamebase)
 {
     optical_tracking_timeout= 100;
+    use_tracking_roi= true;
+    tracking_roi_miss_limit= 10;
+    use_capture_thread= true;
+    optical_pose_worker_count= -1;
+    use_subpixel_contour_refinement= false;
+    replay_frame_rate= -1.f;
+    replay_loop= false;
+    replay_start_time= 0.f;
     default_tracker_profile.exposure = 32;
     default_tracker_profile.gain = 32;
 	default_tracker_profile.color_preset_table.table_name= "default_tracker_profile";
@@ -33,6 +41,28 @@ TrackerManagerConfig::config2ptree()
     pt.put("version", TrackerManagerConfig::CONFIG_VERSION);
 
     pt.put("optical_tracking_timeout", optical_tracking_timeout);
+    pt.put("use_tracking_roi", use_tracking_roi);
+    pt.put("tracking_roi_miss_limit", tracking_roi_miss_limit);
+    pt.put("use_capture_thread", use_capture_thread);
+    pt.put("optical_pose_worker_count", optical_pose_worker_count);
+    pt.put("use_subpixel_contour_refinement", use_subpixel_contour_refinement);
+
+    {
+        boost::property_tree::ptree replay_paths;
+
+        for (auto it = replay_tracker_paths.begin(); it != replay_tracker_paths.end(); ++it)
+        {
+            boost::property_tree::ptree replay_path;
+
+            replay_path.put("", *it);
+            replay_paths.push_back(std::make_pair("", replay_path));
+        }
+
+        pt.add_child("replay_tracker_paths", replay_paths);
+    }
+    pt.put("replay_frame_rate", replay_frame_rate);
+    pt.put("replay_loop", replay_loop);
+    pt.put("replay_start_time", replay_start_time);
     
     pt.put("default_tracker_profile.exposure", default_tracker_profile.exposure);
     pt.put("default_tracker_profile.gain", default_tracker_profile.gain);
@@ -58,6 +88,23 @@ TrackerManagerConfig::ptree2config(const boost::property_tree::ptree &pt)
     if (version == TrackerManagerConfig::CONFIG_VERSION)
     {
         optical_tracking_timeout= pt.get<int>("optical_tracking_timeout", optical_tracking_timeout);
+        use_tracking_roi= pt.get<bool>("use_tracking_roi", use_tracking_roi);
+        tracking_roi_miss_limit= pt.get<int>("tracking_roi_miss_limit", tracking_roi_miss_limit);
+        use_capture_thread= pt.get<bool>("use_capture_thread", use_capture_thread);
+        optical_pose_worker_count= pt.get<int>("optical_pose_worker_count", optical_pose_worker_count);
+        use_subpixel_contour_refinement= pt.get<bool>("use_subpixel_contour_refinement", use_subpixel_contour_refinement);
+
+        replay_tracker_paths.clear();
+        if (auto replay_paths = pt.get_child_optional("replay_tracker_paths"))
+        {
+            for (auto it = replay_paths->begin(); it != replay_paths->end(); ++it)
+            {
+                replay_tracker_paths.push_back(it->second.get_value<std::string>());
+            }
+        }
+        replay_frame_rate= pt.get<float>("replay_frame_rate", replay_frame_rate);
+        replay_loop= pt.get<bool>("replay_loop", replay_loop);
+        replay_start_time= pt.get<float>("replay_start_time", replay_start_time);
 
         default_tracker_profile.exposure = pt.get<float>("default_tracker_profile.exposure", 32);
         default_tracker_profile.gain = pt.get<float>("default_tracker_profile.gain", 32);
@@ -102,11 +149,22 @@ TrackerManager::startup()
 
         // Refresh the tracker list
         mark_tracker_list_dirty();
+
+        // Spin up the threads used to find controllers in the video frames
+        m_job_pool.startup(cfg.optical_pose_worker_count);
     }
 
     return bSuccess;
 }
 
+void
+TrackerManager::shutdown()
+{
+    m_job_pool.shutdown();
+
+    DeviceTypeManager::shutdown();
+}
+
 void
 TrackerManager::closeAllTrackers()
 {
@@ -142,7 +200,7 @@ TrackerManager::mark_tracker_list_dirty()
 DeviceEnumerator *
 TrackerManager::allocate_device_enumerator()
 {
-    return new TrackerDeviceEnumerator;
+    return new TrackerDeviceEnumerator(cfg.replay_tracker_paths);
 }
 
 void
@@ -3,11 +3,14 @@
 
 //-- includes -----
 #include <memory>
+#include <string>
+#include <vector>
 #include "DeviceTypeManager.h"
 #include "DeviceEnumerator.h"
 #include "DeviceInterface.h"
 #include "PSMoveConfig.h"
 #include "PSMoveProtocol.pb.h"
+#include "ServerJobPool.h"
 
 //-- typedefs -----
 
@@ -45,6 +48,15 @@ public:
 
     long version;
     int optical_tracking_timeout;
+    bool use_tracking_roi;
+    int tracking_roi_miss_limit;
+    bool use_capture_thread;
+    int optical_pose_worker_count;
+    bool use_subpixel_contour_refinement; // move sphere hull points onto the sub-pixel bulb edge before fitting (opt-in)
+    std::vector<std::string> replay_tracker_paths; // recordings to open as replay trackers ("<session>#<n>" picks a session's nth camera)
+    float replay_frame_rate; // <0: recorded timing, 0: as fast as possible, >0: fixed frames per second
+    bool replay_loop;
+    float replay_start_time; // seconds into the recording to start (and loop back to)
     CommonDevicePose hmd_tracking_origin_pose;
     TrackerProfile default_tracker_profile;
 };
@@ -55,6 +67,7 @@ public:
     TrackerManager();
 
     bool startup() override;
+    void shutdown() override;
 
     void closeAllTrackers();
 
@@ -93,6 +106,12 @@ public:
         return cfg;
     }
 
+    // Worker threads used to process the tracker video frames in parallel
+    inline ServerJobPool *getJobPool()
+    {
+        return &m_job_pool;
+    }
+
 protected:
     bool can_update_connected_devices() override;
     void mark_tracker_list_dirty();
@@ -111,6 +130,7 @@ private:
 
     TrackerManagerConfig cfg;
     bool m_tracker_list_dirty;
+    ServerJobPool m_job_pool;
 };
 
 #endif // TRACKER_MANAGER_H
\ No newline at end of file
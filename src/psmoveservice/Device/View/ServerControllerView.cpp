@@ -3,11 +3,13 @@
 
 #include "BluetoothRequests.h"
 #include "ControllerManager.h"
+#include "DeviceClockModel.h"
 #include "DeviceManager.h"
 #include "MathAlignment.h"
 #include "ServerLog.h"
 #include "ServerRequestHandler.h"
 #include "OrientationFilter.h"
+#include "OrientationFilterBatch.h"
 #include "PositionFilter.h"
 #include "PSDualShock4Controller.h"
 #include "PSMoveController.h"
@@ -16,33 +18,54 @@
 #include "PSMoveProtocol.pb.h"
 #include "ServerUtility.h"
 #include "ServerTrackerView.h"
+#include "SessionRecording.h"
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
+
 //-- constants -----
 static const float k_min_time_delta_seconds = 1 / 120.f;
 static const float k_max_time_delta_seconds = 1 / 30.f;
+static const float k_min_sample_time_delta_seconds = 1 / 2000.f; // keeps the filters moving forward when two states carry the same timestamp
+static const int k_controller_timestamp_bits = 16; // width of the sensor timestamp counter in PSMove and DS4 reports
+static const float k_half_quality_reprojection_error = 4.f; // pixels of multicam triangulation error that halve the position quality
+static const float k_max_capture_alignment_seconds = 1 / 20.f; // furthest a tracker view gets extrapolated to line up with the others
 
 //-- macros -----
 #define SET_BUTTON_BIT(bitmask, bit_index, button_state) \
     bitmask|= (button_state == CommonControllerState::Button_DOWN || button_state == CommonControllerState::Button_PRESSED) ? (0x1 << (bit_index)) : 0x0;
 
 //-- private methods -----
+static float compute_triangulation_quality_factor(const float reprojection_error);
+static bool get_controller_state_raw_timestamp(const CommonControllerState *controllerState, unsigned int &out_raw_ticks);
+static int get_imu_frames_per_state(const CommonDeviceState::eDeviceType device_type);
+static void record_controller_input_report(
+    const IControllerInterface *controller, const unsigned char *report, size_t report_size, void *userdata);
 static void init_filters_for_psmove(
     const PSMoveController *psmoveController, 
     OrientationFilter *orientation_filter, PositionFilter *position_filter);
-static void update_filters_for_psmove(
-    const PSMoveController *psmoveController, const PSMoveControllerState *psmoveState, const float delta_time,
-    const ControllerOpticalPoseEstimation *positionEstimation,
-    OrientationFilter *orientationFilter, PositionFilter *position_filter);
+static void get_orientation_sensor_packet_for_psmove(
+    const PSMoveControllerState *psmoveState, const int frame, 
+    const OrientationFilter *orientationFilter, OrientationSensorPacket &out_sensor_packet);
+static void update_position_filter_for_psmove(
+    const PSMoveController *psmoveController, const PSMoveControllerState *psmoveState, 
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time, const float delta_time,
+    const ControllerOpticalPoseEstimation *positionEstimation, const bool bIsNewOpticalMeasurement,
+    const CommonDeviceQuaternion orientationFrames[2], PositionFilter *position_filter);
 
 static void init_filters_for_psdualshock4(
     const PSDualShock4Controller *psdualshock4Controller,
     OrientationFilter *orientation_filter, PositionFilter *position_filter);
-static void update_filters_for_psdualshock4(
-    const PSDualShock4Controller *psdualshock4Controller, const PSDualShock4ControllerState *psmoveState, const float delta_time,
-    const ControllerOpticalPoseEstimation *positionEstimation,
-    OrientationFilter *orientationFilter, PositionFilter *position_filter);
+static void get_orientation_sensor_packet_for_psdualshock4(
+    const PSDualShock4Controller *psdualshock4Controller, const PSDualShock4ControllerState *psdualshock4State,
+    const ControllerOpticalPoseEstimation *poseEstimation, const OrientationFilter *orientationFilter,
+    OrientationSensorPacket &out_sensor_packet);
+static void update_position_filter_for_psdualshock4(
+    const PSDualShock4Controller *psdualshock4Controller, const PSDualShock4ControllerState *psmoveState, 
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time, const float delta_time,
+    const ControllerOpticalPoseEstimation *positionEstimation, const bool bIsNewOpticalMeasurement,
+    const CommonDeviceQuaternion &orientation, PositionFilter *position_filter);
 
 static void generate_psmove_data_frame_for_stream(
     const ServerControllerView *controller_view, const ControllerStreamInfo *stream_info, DeviceOutputDataFramePtr &data_frame);
@@ -61,18 +84,36 @@ ServerControllerView::ServerControllerView(const int device_id)
     , m_device(nullptr)
     , m_tracker_pose_estimation(nullptr)
     , m_multicam_pose_estimation(nullptr)
+    , m_optical_snapshot(new ControllerOpticalSnapshot)
     , m_orientation_filter(nullptr)
     , m_position_filter(nullptr)
+    , m_clock_model(nullptr)
     , m_lastPollSeqNumProcessed(-1)
     , m_last_filter_update_timestamp()
     , m_last_filter_update_timestamp_valid(false)
+    , m_last_filter_sample_time()
+    , m_last_filter_sample_time_valid(false)
+    , m_last_optical_capture_timestamp()
+    , m_pending_filter_updates()
+    , m_staged_orientation_lane(-1)
+    , m_predict_to_publish_time(false)
 {
     m_tracking_color = std::make_tuple(0x00, 0x00, 0x00);
     m_LED_override_color = std::make_tuple(0x00, 0x00, 0x00);
+
+    m_optical_snapshot->bIsTracked = false;
+    m_optical_snapshot->bTrackingShapeValid = false;
+    m_optical_snapshot->tracking_color_id = eCommonTrackingColorID::INVALID_COLOR;
+    m_optical_snapshot->speed = 0.f;
+    for (int tracker_index = 0; tracker_index < TrackerManager::k_max_devices; ++tracker_index)
+    {
+        m_optical_snapshot->tracker_pose_estimation[tracker_index].clear();
+    }
 }
 
 ServerControllerView::~ServerControllerView()
 {
+    delete m_optical_snapshot;
 }
 
 bool ServerControllerView::allocate_device_interface(
@@ -85,6 +126,7 @@ bool ServerControllerView::allocate_device_interface(
             m_device = new PSMoveController();
             m_orientation_filter = new OrientationFilter();
             m_position_filter = new PositionFilter();
+            m_clock_model = new DeviceClockModel(k_controller_timestamp_bits);
 
             m_tracker_pose_estimation = new ControllerOpticalPoseEstimation[TrackerManager::k_max_devices];
             for (int tracker_index = 0; tracker_index < TrackerManager::k_max_devices; ++tracker_index)
@@ -100,6 +142,7 @@ bool ServerControllerView::allocate_device_interface(
             m_device= new PSNaviController();
             m_orientation_filter= nullptr;
             m_position_filter = nullptr;
+            m_clock_model = nullptr;
             m_multicam_pose_estimation = nullptr;
         } break;
     case CommonDeviceState::PSDualShock4:
@@ -107,6 +150,7 @@ bool ServerControllerView::allocate_device_interface(
             m_device = new PSDualShock4Controller();
             m_orientation_filter = new OrientationFilter();
             m_position_filter = new PositionFilter();
+            m_clock_model = new DeviceClockModel(k_controller_timestamp_bits);
 
             m_tracker_pose_estimation = new ControllerOpticalPoseEstimation[TrackerManager::k_max_devices];
             for (int tracker_index = 0; tracker_index < TrackerManager::k_max_devices; ++tracker_index)
@@ -150,6 +194,12 @@ void ServerControllerView::free_device_interface()
         m_position_filter = nullptr;
     }
 
+    if (m_clock_model != nullptr)
+    {
+        delete m_clock_model;
+        m_clock_model = nullptr;
+    }
+
     if (m_device != nullptr)
     {
         delete m_device;  // Deleting abstract object should be OK because
@@ -211,6 +261,12 @@ bool ServerControllerView::open(const class DeviceEnumerator *enumerator)
 
         // Reset the poll sequence number high water mark
         m_lastPollSeqNumProcessed= -1;
+
+        // Have the driver hand us its raw input reports if a session is being recorded
+        if (DeviceManager::getInstance()->m_session_recorder != nullptr)
+        {
+            m_device->setInputReportCallback(record_controller_input_report, nullptr);
+        }
     }
 
     // If needed for this kind of controller, assign a tracking color id
@@ -223,6 +279,15 @@ bool ServerControllerView::open(const class DeviceEnumerator *enumerator)
     // Clear the filter update timestamp
     m_last_filter_update_timestamp = std::chrono::time_point<std::chrono::high_resolution_clock>();
     m_last_filter_update_timestamp_valid= false;
+    m_last_filter_sample_time = std::chrono::time_point<std::chrono::high_resolution_clock>();
+    m_last_filter_sample_time_valid = false;
+    m_last_optical_capture_timestamp = std::chrono::time_point<std::chrono::high_resolution_clock>();
+
+    // The controller's timestamp counter starts over when it reconnects
+    if (m_clock_model != nullptr)
+    {
+        m_clock_model->reset();
+    }
 
     return bSuccess;
 }
@@ -241,16 +306,135 @@ void ServerControllerView::close()
     ServerDeviceView::close();
 }
 
-void ServerControllerView::updateOpticalPoseEstimation(TrackerManager* tracker_manager)
+void ServerControllerView::beginOpticalPoseEstimation(TrackerManager* tracker_manager)
 {
-    const std::chrono::time_point<std::chrono::high_resolution_clock> now= std::chrono::high_resolution_clock::now();
+    ControllerOpticalSnapshot &snapshot = *m_optical_snapshot;
 
+    snapshot.bIsTracked = getIsOpen() && getIsBluetooth() && getIsTrackingEnabled();
+
+    if (snapshot.bIsTracked)
+    {
+        snapshot.bTrackingShapeValid = getTrackingShape(snapshot.tracking_shape);
+        snapshot.tracking_color_id = m_tracking_color_id;
+        snapshot.speed = (m_position_filter != nullptr) ? m_position_filter->getVelocity().norm() : 0.f;
+
+        for (int tracker_id = 0; tracker_id < tracker_manager->getMaxDevices(); ++tracker_id)
+        {
+            ServerTrackerViewPtr tracker = tracker_manager->getTrackerViewPtr(tracker_id);
+
+            if (m_tracking_color_id != eCommonTrackingColorID::INVALID_COLOR && tracker->getIsOpen())
+            {
+                tracker->getTrackingColorPreset(this, m_tracking_color_id, &snapshot.hsv_color_ranges[tracker_id]);
+            }
+
+            snapshot.tracker_pose_estimation[tracker_id] = m_tracker_pose_estimation[tracker_id];
+        }
+    }
+}
+
+void ServerControllerView::finishOpticalPoseEstimation()
+{
+    // Tracking may have been turned off (or the controller closed) while the video frames were searched
+    if (m_optical_snapshot->bIsTracked && getIsTrackingEnabled())
+    {
+        std::copy(
+            m_optical_snapshot->tracker_pose_estimation,
+            m_optical_snapshot->tracker_pose_estimation + TrackerManager::k_max_devices,
+            m_tracker_pose_estimation);
+    }
+}
+
+void ServerControllerView::updateTrackerPoseEstimation(TrackerManager* tracker_manager, int tracker_id)
+{
     // TODO: Probably need to first update IMU state to get velocity.
     // If velocity is too high, don't bother getting a new position.
     // Though it may be enough to just use the camera ROI as the limit.
-    
+
+    // Only the snapshot is safe to touch here, the controller itself may change under us
+    if (!m_optical_snapshot->bIsTracked)
+    {
+        return;
+    }
+
+    ServerTrackerViewPtr tracker = tracker_manager->getTrackerViewPtr(tracker_id);
+    ControllerOpticalPoseEstimation &trackerPoseEstimateRef = m_optical_snapshot->tracker_pose_estimation[tracker_id];
+
+    const bool bWasTracking= trackerPoseEstimateRef.bCurrentlyTracking;
+
+    // See how long it's been since we got a new video frame
+    const std::chrono::time_point<std::chrono::high_resolution_clock> now= 
+        std::chrono::high_resolution_clock::now();
+
+    // Assume we're going to lose tracking this frame
+    trackerPoseEstimateRef.bCurrentlyTracking = false;
+
+    if (tracker->getIsOpen())
+    {
+        const std::chrono::duration<float, std::milli> timeSinceNewDataMillis= 
+            now - tracker->getLastNewDataTimestamp();
+        const float timeoutMilli= 
+            static_cast<float>(DeviceManager::getInstance()->m_tracker_manager->getConfig().optical_tracking_timeout);
+
+        // Can't compute tracking on video data that's too old
+        if (timeSinceNewDataMillis.count() < timeoutMilli)
+        {
+            // Initially the newTrackerPoseEstimate is a copy of the existing pose
+            bool bIsVisibleThisUpdate= false;
+
+            // If a new video frame is available this tick, 
+            // attempt to update the tracking location
+            if (tracker->getHasUnpublishedState())
+            {
+                ControllerOpticalPoseEstimation newTrackerPoseEstimate= trackerPoseEstimateRef;
+                CommonDevicePose poseGuess= {trackerPoseEstimateRef.position, trackerPoseEstimateRef.orientation};
+
+                if (tracker->computePoseForController(
+                        this, 
+                        trackerPoseEstimateRef.bOrientationValid ? &poseGuess : nullptr,
+                        &newTrackerPoseEstimate))
+                {
+                    bIsVisibleThisUpdate= true;
+
+                    trackerPoseEstimateRef= newTrackerPoseEstimate;
+                    trackerPoseEstimateRef.last_visible_timestamp = now;
+                    trackerPoseEstimateRef.missed_frame_count = 0;
+                }
+                else
+                {
+                    // Used to decide when to give up on the tracking ROI and search the whole frame
+                    ++trackerPoseEstimateRef.missed_frame_count;
+                }
+            }
+
+            // If the position estimate isn't too old (or updated this tick), 
+            // say we have a valid tracked location
+            if (bWasTracking || bIsVisibleThisUpdate)
+            {
+                const std::chrono::duration<float, std::milli> timeSinceLastVisibleMillis= 
+                    now - trackerPoseEstimateRef.last_visible_timestamp;
+
+                if (timeSinceLastVisibleMillis.count() < timeoutMilli)
+                {
+                    // Flag this pose estimate as valid
+                    trackerPoseEstimateRef.bCurrentlyTracking = true;
+                }
+            }
+        }
+    }
+
+    // Keep track of the last time the position estimate was updated
+    trackerPoseEstimateRef.last_update_timestamp = now;
+    trackerPoseEstimateRef.bValidTimestamps = true;
+}
+
+void ServerControllerView::updateMulticamPoseEstimation(TrackerManager* tracker_manager)
+{
+    const std::chrono::time_point<std::chrono::high_resolution_clock> now= std::chrono::high_resolution_clock::now();
+
     if (getIsTrackingEnabled())
     {
+        const std::chrono::time_point<std::chrono::high_resolution_clock> last_capture_timestamp =
+            m_multicam_pose_estimation->capture_timestamp;
         Eigen::Quaternionf controller_world_orientations[TrackerManager::k_max_devices];
         float controller_orientation_weights[TrackerManager::k_max_devices];
         int orientations_found = 0;
@@ -260,154 +444,124 @@ void ServerControllerView::updateOpticalPoseEstimation(TrackerManager* tracker_m
 
         float screen_area_sum= 0;
 
-        // Compute an estimated 3d tracked position of the controller 
-        // from the perspective of each tracker
+        // Gather up the trackers that currently have a valid tracked location
         for (int tracker_id = 0; tracker_id < tracker_manager->getMaxDevices(); ++tracker_id)
         {
-            ServerTrackerViewPtr tracker = tracker_manager->getTrackerViewPtr(tracker_id);
-            ControllerOpticalPoseEstimation &trackerPoseEstimateRef = m_tracker_pose_estimation[tracker_id];
+            const ControllerOpticalPoseEstimation &trackerPoseEstimateRef = m_tracker_pose_estimation[tracker_id];
 
-            const bool bWasTracking= trackerPoseEstimateRef.bCurrentlyTracking;
-
-            // Assume we're going to lose tracking this frame
-            trackerPoseEstimateRef.bCurrentlyTracking = false;
-
-            if (tracker->getIsOpen())
+            if (trackerPoseEstimateRef.bCurrentlyTracking)
             {
-                // See how long it's been since we got a new video frame
-                const std::chrono::time_point<std::chrono::high_resolution_clock> now= 
-                    std::chrono::high_resolution_clock::now();
-                const std::chrono::duration<float, std::milli> timeSinceNewDataMillis= 
-                    now - tracker->getLastNewDataTimestamp();
-                const float timeoutMilli= 
-                    static_cast<float>(DeviceManager::getInstance()->m_tracker_manager->getConfig().optical_tracking_timeout);
-
-                // Can't compute tracking on video data that's too old
-                if (timeSinceNewDataMillis.count() < timeoutMilli)
-                {
-                    // Initially the newTrackerPoseEstimate is a copy of the existing pose
-                    bool bIsVisibleThisUpdate= false;
-
-                    // If a new video frame is available this tick, 
-                    // attempt to update the tracking location
-                    if (tracker->getHasUnpublishedState())
-                    {
-                        ControllerOpticalPoseEstimation newTrackerPoseEstimate= trackerPoseEstimateRef;
-                        CommonDevicePose poseGuess= {trackerPoseEstimateRef.position, trackerPoseEstimateRef.orientation};
+                ServerTrackerViewPtr tracker = tracker_manager->getTrackerViewPtr(tracker_id);
+                const float tracker_screen_area= trackerPoseEstimateRef.projection.screen_area;
 
-                        if (tracker->computePoseForController(
-                                this, 
-                                trackerPoseEstimateRef.bOrientationValid ? &poseGuess : nullptr,
-                                &newTrackerPoseEstimate))
-                        {
-                            bIsVisibleThisUpdate= true;
-
-                            trackerPoseEstimateRef= newTrackerPoseEstimate;
-                            trackerPoseEstimateRef.last_visible_timestamp = now;
-                        }
-                    }
+                // Sum up the tracking screen area over all of the trackers that can see the controller
+                screen_area_sum+= tracker_screen_area;
 
-                    // If the position estimate isn't too old (or updated this tick), 
-                    // say we have a valid tracked location
-                    if (bWasTracking || bIsVisibleThisUpdate)
-                    {
-                        const std::chrono::duration<float, std::milli> timeSinceLastVisibleMillis= 
-                            now - trackerPoseEstimateRef.last_visible_timestamp;
+                // If this tracker has a valid position for the controller
+                // add it to the tracker id list
+                valid_position_tracker_ids[positions_found] = tracker_id;
+                ++positions_found;
 
-                        if (timeSinceLastVisibleMillis.count() < timeoutMilli)
-                        {
-                            const float tracker_screen_area= trackerPoseEstimateRef.projection.screen_area;
-
-                            // Sum up the tracking screen area over all of the trackers that can see the controller
-                            screen_area_sum+= tracker_screen_area;
-
-                            // If this tracker has a valid position for the controller
-                            // add it to the tracker id list
-                            valid_position_tracker_ids[positions_found] = tracker_id;
-                            ++positions_found;
-
-                            // If the pose has a valid tracker relative orientation,
-                            // convert the orientation to world space and add it
-                            // to a weighted list of orientations
-                            if (trackerPoseEstimateRef.bOrientationValid)
-                            {
-                                const CommonDeviceQuaternion &tracker_relative_quaternion = trackerPoseEstimateRef.orientation;
-                                const CommonDeviceQuaternion &world_quaternion =
-                                    tracker->computeWorldOrientation(&tracker_relative_quaternion);
-                                const Eigen::Quaternionf eigen_quaternion(
-                                    world_quaternion.w, world_quaternion.x, world_quaternion.y, world_quaternion.z);
-
-                                controller_world_orientations[orientations_found]= eigen_quaternion;
-                                controller_orientation_weights[orientations_found]= tracker_screen_area;
-                                ++orientations_found;
-                            }
-
-                            // Flag this pose estimate as invalid
-                            trackerPoseEstimateRef.bCurrentlyTracking = true;
-                        }
-                    }
+                // If the pose has a valid tracker relative orientation,
+                // convert the orientation to world space and add it
+                // to a weighted list of orientations
+                if (trackerPoseEstimateRef.bOrientationValid)
+                {
+                    const CommonDeviceQuaternion &tracker_relative_quaternion = trackerPoseEstimateRef.orientation;
+                    const CommonDeviceQuaternion &world_quaternion =
+                        tracker->computeWorldOrientation(&tracker_relative_quaternion);
+                    const Eigen::Quaternionf eigen_quaternion(
+                        world_quaternion.w, world_quaternion.x, world_quaternion.y, world_quaternion.z);
+
+                    controller_world_orientations[orientations_found]= eigen_quaternion;
+                    controller_orientation_weights[orientations_found]= tracker_screen_area;
+                    ++orientations_found;
                 }
             }
-
-            // Keep track of the last time the position estimate was updated
-            trackerPoseEstimateRef.last_update_timestamp = now;
-            trackerPoseEstimateRef.bValidTimestamps = true;
         }
 
         // If multiple trackers can see the controller, 
-        // triangulate all pairs of trackers and average the results
+        // triangulate the position that best fits all of their views at once
         if (positions_found > 1)
         {
+            // The cameras aren't synchronized, so the views were captured up to a frame apart
+            // (or more for a view that has gone stale). Line them all up with the newest view
+            // by moving each one along the filtered velocity.
+            std::chrono::time_point<std::chrono::high_resolution_clock> reference_timestamp =
+                m_tracker_pose_estimation[valid_position_tracker_ids[0]].capture_timestamp;
+            for (int list_index = 1; list_index < positions_found; ++list_index)
+            {
+                reference_timestamp = std::max(
+                    reference_timestamp, 
+                    m_tracker_pose_estimation[valid_position_tracker_ids[list_index]].capture_timestamp);
+            }
+
+            const Eigen::Vector3f velocity = 
+                (m_position_filter != nullptr) ? m_position_filter->getVelocity() : Eigen::Vector3f::Zero(); // cm/s
+
             // Project the tracker relative 3d tracking position back on to the tracker camera plane
+            const ServerTrackerView *tracker_list[TrackerManager::k_max_devices];
             CommonDeviceScreenLocation position2d_list[TrackerManager::k_max_devices];
+            CommonDeviceVector capture_offset_list[TrackerManager::k_max_devices];
+            float weight_list[TrackerManager::k_max_devices];
             for (int list_index = 0; list_index < positions_found; ++list_index)
             {
                 const int tracker_id = valid_position_tracker_ids[list_index];
                 const ServerTrackerViewPtr tracker = tracker_manager->getTrackerViewPtr(tracker_id);
                 const ControllerOpticalPoseEstimation &positionEstimate = m_tracker_pose_estimation[tracker_id];
                 
+                tracker_list[list_index] = tracker.get();
                 position2d_list[list_index] = tracker->projectTrackerRelativePosition(&positionEstimate.position);
-            }
-
-            int pair_count = 0;
-            CommonDevicePosition average_world_position = { 0.f, 0.f, 0.f };
-            for (int list_index = 0; list_index < positions_found; ++list_index)
-            {
-                const int tracker_id = valid_position_tracker_ids[list_index];
-                const CommonDeviceScreenLocation &screen_location = position2d_list[list_index];
-                const ServerTrackerViewPtr tracker = tracker_manager->getTrackerViewPtr(tracker_id);
-
-                for (int other_list_index = list_index + 1; other_list_index < positions_found; ++other_list_index)
-                {
-                    const int other_tracker_id = valid_position_tracker_ids[other_list_index];
-                    const CommonDeviceScreenLocation &other_screen_location = position2d_list[other_list_index];
-                    const ServerTrackerViewPtr other_tracker = tracker_manager->getTrackerViewPtr(other_tracker_id);
 
-                    // Using the screen locations on two different trackers we can triangulate a world position
-                    CommonDevicePosition world_position =
-                        ServerTrackerView::triangulateWorldPosition(
-                            tracker.get(), &screen_location,
-                            other_tracker.get(), &other_screen_location);
+                // Where the controller was, relative to the reference time position, when this view was captured
+                const std::chrono::duration<float> capture_age_seconds = 
+                    reference_timestamp - positionEstimate.capture_timestamp;
+                const Eigen::Vector3f capture_offset = 
+                    -velocity * clampf(capture_age_seconds.count(), 0.f, k_max_capture_alignment_seconds);
 
-                    average_world_position.x += world_position.x;
-                    average_world_position.y += world_position.y;
-                    average_world_position.z += world_position.z;
+                capture_offset_list[list_index].i = capture_offset.x();
+                capture_offset_list[list_index].j = capture_offset.y();
+                capture_offset_list[list_index].k = capture_offset.z();
 
-                    ++pair_count;
-                }
+                // Bigger projections give more precise screen locations
+                weight_list[list_index] = positionEstimate.projection.screen_area;
             }
 
-            if (pair_count > 1)
+            CommonDevicePosition world_position;
+            float reprojection_error;
+            if (ServerTrackerView::triangulateWorldPosition(
+                    tracker_list, position2d_list, capture_offset_list, weight_list, positions_found,
+                    &world_position, &reprojection_error))
+            {
+                m_multicam_pose_estimation->position = world_position;
+                m_multicam_pose_estimation->reprojection_error = reprojection_error;
+            }
+            else
             {
-                const float N = static_cast<float>(pair_count);
+                // Degenerate camera setup (e.g. parallel views), fall back to the best single view
+                int best_list_index = 0;
+                for (int list_index = 1; list_index < positions_found; ++list_index)
+                {
+                    if (weight_list[list_index] > weight_list[best_list_index])
+                    {
+                        best_list_index = list_index;
+                    }
+                }
 
-                average_world_position.x /= N;
-                average_world_position.y /= N;
-                average_world_position.z /= N;
+                const int tracker_id = valid_position_tracker_ids[best_list_index];
+                const CommonDevicePosition &tracker_relative_position = m_tracker_pose_estimation[tracker_id].position;
+                const CommonDeviceVector &capture_offset = capture_offset_list[best_list_index];
+                const CommonDevicePosition view_world_position =
+                    tracker_manager->getTrackerViewPtr(tracker_id)->computeWorldPosition(&tracker_relative_position);
+
+                m_multicam_pose_estimation->position.set(
+                    view_world_position.x - capture_offset.i,
+                    view_world_position.y - capture_offset.j,
+                    view_world_position.z - capture_offset.k);
+                m_multicam_pose_estimation->reprojection_error = 0.f;
             }
 
-            // Store the averaged tracking position
-            m_multicam_pose_estimation->position = average_world_position;
+            m_multicam_pose_estimation->capture_timestamp = reference_timestamp;
             m_multicam_pose_estimation->bCurrentlyTracking = true;
 
             // Compute the average projection area.
@@ -425,6 +579,8 @@ void ServerControllerView::updateOpticalPoseEstimation(TrackerManager* tracker_m
 
             // Only one tracker can see the controller
             m_multicam_pose_estimation->position = tracker->computeWorldPosition(&tracker_relative_position);
+            m_multicam_pose_estimation->reprojection_error = 0.f;
+            m_multicam_pose_estimation->capture_timestamp = m_tracker_pose_estimation[tracker_id].capture_timestamp;
             m_multicam_pose_estimation->bCurrentlyTracking = true;
 
             // The average screen area is just the sum
@@ -471,14 +627,38 @@ void ServerControllerView::updateOpticalPoseEstimation(TrackerManager* tracker_m
         }
         m_multicam_pose_estimation->last_update_timestamp = now;
         m_multicam_pose_estimation->bValidTimestamps = true;
+
+        // The same views get combined again until new ones come in, only time the first go
+        if (positions_found > 0 && m_multicam_pose_estimation->capture_timestamp != last_capture_timestamp)
+        {
+            m_latency_stats->record(LatencyStage_Triangulation, m_multicam_pose_estimation->capture_timestamp);
+        }
     }
 }
 
 void ServerControllerView::updateStateAndPredict()
 {
+    if (beginStateUpdate())
+    {
+        const int orientation_update_count = getPendingOrientationUpdateCount();
+
+        for (int update_index = 0; update_index < orientation_update_count; ++update_index)
+        {
+            stageOrientationUpdate(update_index, nullptr);
+            finishOrientationUpdate(update_index, nullptr);
+        }
+
+        finishStateUpdate();
+    }
+}
+
+bool ServerControllerView::beginStateUpdate()
+{
+    m_pending_filter_updates.clear();
+
     if (!getHasUnpublishedState())
     {
-        return;
+        return false;
     }
 
     // Look backward in time to find the first controller update state with a poll sequence number 
@@ -492,7 +672,12 @@ void ServerControllerView::updateStateAndPredict()
         testLookBack++;
         state= getState(testLookBack);
     }
-    assert(firstLookBackIndex >= 0);
+
+    if (firstLookBackIndex < 0)
+    {
+        // The filters have seen every polled state already, it just hasn't been published yet
+        return false;
+    }
 
     // Compute the time in seconds since the last update
     const std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
@@ -512,15 +697,189 @@ void ServerControllerView::updateStateAndPredict()
     m_last_filter_update_timestamp = now;
     m_last_filter_update_timestamp_valid = true;
 
-    // Evenly apply the list of controller state updates over the time since last filter update
+    // Without usable sensor timestamps,
+    // evenly apply the list of controller state updates over the time since last filter update
     float per_state_time_delta_seconds = time_delta_seconds / static_cast<float>(firstLookBackIndex + 1);
+    const std::chrono::high_resolution_clock::duration per_state_time_delta =
+        std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+            std::chrono::duration<float>(per_state_time_delta_seconds));
+
+    // The optical pose shows up a video frame plus processing time after the IMU samples taken at the same time.
+    // When there's a new one, the filters rewind to when its frame was captured
+    // and replay the IMU samples since then with it, before the new IMU samples go in.
+    bool bIsNewOpticalMeasurement = false;
+    if (getIsTrackingEnabled() &&
+        m_multicam_pose_estimation->bCurrentlyTracking &&
+        m_multicam_pose_estimation->capture_timestamp != m_last_optical_capture_timestamp)
+    {
+        bIsNewOpticalMeasurement = true;
+        m_last_optical_capture_timestamp = m_multicam_pose_estimation->capture_timestamp;
+    }
+
+    // Queue up the polled controller states forward in time
+    m_pending_filter_updates.reserve(firstLookBackIndex + 1);
 
-    // Process the polled controller states forward in time
-    // computing the new orientation along the way.
     for (int lookBackIndex= firstLookBackIndex; lookBackIndex >= 0; --lookBackIndex)
     {
         const CommonControllerState *controllerState= getState(lookBackIndex);
 
+        // Bluetooth delivers states in bursts and the poll loop picks them up whenever it gets to them,
+        // so prefer the controller's own record of when each one was sampled.
+        // All the new states were read by the last poll that found any.
+        std::chrono::time_point<std::chrono::high_resolution_clock> sample_time;
+        float sample_time_delta_seconds;
+        unsigned int raw_ticks;
+        bool bHasDeviceSampleTime = false;
+
+        if (m_clock_model != nullptr && get_controller_state_raw_timestamp(controllerState, raw_ticks))
+        {
+            bHasDeviceSampleTime = m_clock_model->update(raw_ticks, getLastNewDataTimestamp(), sample_time);
+
+            if (bHasDeviceSampleTime)
+            {
+                m_latency_stats->record(LatencyStage_Capture, sample_time, getLastNewDataTimestamp());
+            }
+        }
+
+        if (bHasDeviceSampleTime && m_last_filter_sample_time_valid)
+        {
+            const std::chrono::duration<float> sample_time_delta = sample_time - m_last_filter_sample_time;
+
+            // Don't integrate across a gap in the stream as if it were one long step
+            sample_time_delta_seconds = std::min(sample_time_delta.count(), k_max_time_delta_seconds);
+        }
+        else
+        {
+            sample_time = now - per_state_time_delta * lookBackIndex;
+            sample_time_delta_seconds = per_state_time_delta_seconds;
+        }
+
+        // Keep the filter history in order when switching between the two time sources
+        if (m_last_filter_sample_time_valid && sample_time_delta_seconds < k_min_sample_time_delta_seconds)
+        {
+            sample_time_delta_seconds = k_min_sample_time_delta_seconds;
+            sample_time =
+                m_last_filter_sample_time +
+                std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+                    std::chrono::duration<float>(k_min_sample_time_delta_seconds));
+        }
+        else if (m_last_filter_sample_time_valid && sample_time <= m_last_filter_sample_time)
+        {
+            sample_time =
+                m_last_filter_sample_time +
+                std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+                    std::chrono::duration<float>(sample_time_delta_seconds));
+        }
+
+        m_last_filter_sample_time = sample_time;
+        m_last_filter_sample_time_valid = true;
+
+        ControllerFilterUpdateState pending;
+        pending.controller_state = controllerState;
+        pending.sample_time = sample_time;
+        pending.delta_time = sample_time_delta_seconds;
+        pending.bIsNewOpticalMeasurement = bIsNewOpticalMeasurement;
+        pending.orientation_frames[0].clear();
+        pending.orientation_frames[1].clear();
+        m_pending_filter_updates.push_back(pending);
+
+        // Only gets rewound in once, the following states just carry it like the first one did
+        bIsNewOpticalMeasurement = false;
+    }
+
+    return !m_pending_filter_updates.empty();
+}
+
+int ServerControllerView::getPendingOrientationUpdateCount() const
+{
+    return 
+        (m_orientation_filter != nullptr)
+        ? static_cast<int>(m_pending_filter_updates.size()) * get_imu_frames_per_state(getControllerDeviceType())
+        : 0;
+}
+
+void ServerControllerView::stageOrientationUpdate(const int update_index, OrientationFilterBatch *batch)
+{
+    const int frame_count = get_imu_frames_per_state(getControllerDeviceType());
+    const int frame = update_index % frame_count;
+    const ControllerFilterUpdateState &pending = m_pending_filter_updates[update_index / frame_count];
+
+    // The IMU frames in a state were sampled evenly over the time since the previous state
+    const float frame_delta_time = pending.delta_time / static_cast<float>(frame_count);
+    const std::chrono::time_point<std::chrono::high_resolution_clock> frame_sample_time =
+        pending.sample_time -
+        std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+            std::chrono::duration<float>(frame_delta_time * static_cast<float>(frame_count - 1 - frame)));
+
+    OrientationSensorPacket sensorPacket;
+
+    switch (pending.controller_state->DeviceType)
+    {
+    case CommonControllerState::PSMove:
+        {
+            const PSMoveControllerState *psmoveState= static_cast<const PSMoveControllerState *>(pending.controller_state);
+
+            get_orientation_sensor_packet_for_psmove(psmoveState, frame, m_orientation_filter, sensorPacket);
+        } break;
+    case CommonControllerState::PSDualShock4:
+        {
+            const PSDualShock4Controller *psdualshock4Controller = this->castCheckedConst<PSDualShock4Controller>();
+            const PSDualShock4ControllerState *psdualshock4State = 
+                static_cast<const PSDualShock4ControllerState *>(pending.controller_state);
+
+            get_orientation_sensor_packet_for_psdualshock4(
+                psdualshock4Controller, psdualshock4State, 
+                m_multicam_pose_estimation, m_orientation_filter, 
+                sensorPacket);
+
+            // A new optical orientation goes in back at the time its video frame was captured
+            if (pending.bIsNewOpticalMeasurement && sensorPacket.orientation_source == OrientationSource_Optical)
+            {
+                m_orientation_filter->applyLateOpticalOrientation(
+                    m_multicam_pose_estimation->capture_timestamp, sensorPacket.orientation, sensorPacket.orientation_quality);
+            }
+        } break;
+    default:
+        assert(0 && "Unhandled controller type");
+    }
+
+    m_staged_orientation_lane = -1;
+    if (batch == nullptr || 
+        !m_orientation_filter->stageBatchedUpdate(
+            frame_sample_time, frame_delta_time, sensorPacket, *batch, m_staged_orientation_lane))
+    {
+        m_orientation_filter->update(frame_sample_time, frame_delta_time, sensorPacket);
+    }
+}
+
+void ServerControllerView::finishOrientationUpdate(const int update_index, const OrientationFilterBatch *batch)
+{
+    const int frame_count = get_imu_frames_per_state(getControllerDeviceType());
+    ControllerFilterUpdateState &pending = m_pending_filter_updates[update_index / frame_count];
+
+    if (m_staged_orientation_lane != -1)
+    {
+        assert(batch != nullptr);
+        m_orientation_filter->finishBatchedUpdate(*batch, m_staged_orientation_lane);
+        m_staged_orientation_lane = -1;
+    }
+
+    // Remember the orientation for the position filter to transform the accelerometer frame with
+    const Eigen::Quaternionf orientation = m_orientation_filter->getOrientation();
+    CommonDeviceQuaternion &orientation_frame = pending.orientation_frames[update_index % frame_count];
+
+    orientation_frame.w = orientation.w();
+    orientation_frame.x = orientation.x();
+    orientation_frame.y = orientation.y();
+    orientation_frame.z = orientation.z();
+}
+
+void ServerControllerView::finishStateUpdate()
+{
+    for (const ControllerFilterUpdateState &pending : m_pending_filter_updates)
+    {
+        const CommonControllerState *controllerState= pending.controller_state;
+
         switch (controllerState->DeviceType)
         {
         case CommonControllerState::PSMove:
@@ -529,11 +888,11 @@ void ServerControllerView::updateStateAndPredict()
                 const PSMoveControllerState *psmoveState= static_cast<const PSMoveControllerState *>(controllerState);
 
                 // Only update the position filter when tracking is enabled
-                update_filters_for_psmove(
+                update_position_filter_for_psmove(
                     psmoveController, psmoveState, 
-                    per_state_time_delta_seconds,
-                    m_multicam_pose_estimation, 
-                    m_orientation_filter, 
+                    pending.sample_time, pending.delta_time,
+                    m_multicam_pose_estimation, pending.bIsNewOpticalMeasurement,
+                    pending.orientation_frames,
                     getIsTrackingEnabled() ? m_position_filter : nullptr);
             } break;
         case CommonControllerState::PSNavi:
@@ -549,11 +908,11 @@ void ServerControllerView::updateStateAndPredict()
                     static_cast<const PSDualShock4ControllerState *>(controllerState);
 
                 // Only update the position filter when tracking is enabled
-                update_filters_for_psdualshock4(
+                update_position_filter_for_psdualshock4(
                     psdualshock4Controller, psdualshock4State,
-                    per_state_time_delta_seconds,
-                    m_multicam_pose_estimation,
-                    m_orientation_filter,
+                    pending.sample_time, pending.delta_time,
+                    m_multicam_pose_estimation, pending.bIsNewOpticalMeasurement,
+                    pending.orientation_frames[0],
                     getIsTrackingEnabled() ? m_position_filter : nullptr);
             } break;
         default:
@@ -563,6 +922,13 @@ void ServerControllerView::updateStateAndPredict()
         // Consider this controller state sequence num processed
         m_lastPollSeqNumProcessed= controllerState->PollSequenceNumber;
     }
+
+    if (!m_pending_filter_updates.empty())
+    {
+        m_latency_stats->record(LatencyStage_Filter, getLastNewDataTimestamp());
+    }
+
+    m_pending_filter_updates.clear();
 }
 
 bool ServerControllerView::setHostBluetoothAddress(
@@ -600,6 +966,24 @@ ServerControllerView::getFilteredPose(float time) const
     return pose;
 }
 
+float
+ServerControllerView::getPublishPredictionTime(float prediction_time) const
+{
+    float time = prediction_time;
+
+    if (m_predict_to_publish_time && m_last_filter_sample_time_valid)
+    {
+        // Account for how long ago the filters' latest state was sampled,
+        // but don't extrapolate a stalled controller off into the distance
+        const std::chrono::duration<float> state_age =
+            std::chrono::high_resolution_clock::now() - m_last_filter_sample_time;
+
+        time += clampf(state_age.count(), 0.f, k_max_time_delta_seconds);
+    }
+
+    return time;
+}
+
 CommonDevicePhysics 
 ServerControllerView::getFilteredPhysics() const
 {
@@ -944,7 +1328,8 @@ static void generate_psmove_data_frame_for_stream(
     const PositionFilter *position_filter= controller_view->getPositionFilter();
     const PSMoveControllerConfig *psmove_config= psmove_controller->getConfig();
     const CommonControllerState *controller_state= controller_view->getState();
-    const CommonDevicePose controller_pose = controller_view->getFilteredPose(psmove_config->prediction_time);
+    const CommonDevicePose controller_pose =
+        controller_view->getFilteredPose(controller_view->getPublishPredictionTime(psmove_config->prediction_time));
 
     auto *controller_data_frame= data_frame->mutable_controller_data_packet();
     auto *psmove_data_frame = controller_data_frame->mutable_psmove_state();
@@ -1169,7 +1554,8 @@ static void generate_psdualshock4_data_frame_for_stream(
     const PositionFilter *position_filter= controller_view->getPositionFilter();
     const PSDualShock4ControllerConfig *psmove_config = ds4_controller->getConfig();
     const CommonControllerState *controller_state = controller_view->getState();
-    const CommonDevicePose controller_pose = controller_view->getFilteredPose(psmove_config->prediction_time);
+    const CommonDevicePose controller_pose =
+        controller_view->getFilteredPose(controller_view->getPublishPredictionTime(psmove_config->prediction_time));
 
     auto *controller_data_frame = data_frame->mutable_controller_data_packet();
     auto *psds4_data_frame = controller_data_frame->mutable_psdualshock4_state();
@@ -1367,6 +1753,58 @@ static void generate_psdualshock4_data_frame_for_stream(
     controller_data_frame->set_controller_type(PSMoveProtocol::PSDUALSHOCK4);
 }
 
+// Scale down the position quality of triangulations whose views disagree.
+// Never reaches zero, so a poorly calibrated multicam setup still gets tracked.
+static float
+compute_triangulation_quality_factor(const float reprojection_error)
+{
+    return 1.f / (1.f + fmaxf(reprojection_error, 0.f) / k_half_quality_reprojection_error);
+}
+
+// The sensor timestamp counter the controller stamped the state with, if it has one
+static bool
+get_controller_state_raw_timestamp(const CommonControllerState *controllerState, unsigned int &out_raw_ticks)
+{
+    bool bHasTimestamp = true;
+
+    switch (controllerState->DeviceType)
+    {
+    case CommonControllerState::PSMove:
+        out_raw_ticks = static_cast<const PSMoveControllerState *>(controllerState)->RawTimeStamp;
+        break;
+    case CommonControllerState::PSDualShock4:
+        out_raw_ticks = static_cast<const PSDualShock4ControllerState *>(controllerState)->RawTimeStamp;
+        break;
+    default:
+        bHasTimestamp = false;
+        break;
+    }
+
+    return bHasTimestamp;
+}
+
+static int
+get_imu_frames_per_state(const CommonDeviceState::eDeviceType device_type)
+{
+    // The PSMove packs two IMU readings into each report
+    return (device_type == CommonDeviceState::PSMove) ? 2 : 1;
+}
+
+static void
+record_controller_input_report(
+    const IControllerInterface *controller,
+    const unsigned char *report,
+    size_t report_size,
+    void *userdata)
+{
+    ServerSessionRecorder *recorder = DeviceManager::getInstance()->m_session_recorder;
+
+    if (recorder != nullptr)
+    {
+        recorder->recordHIDReport(controller->getSerial(), controller->getDeviceType(), report, report_size);
+    }
+}
+
 static void
 init_filters_for_psmove(
     const PSMoveController *psmoveController, 
@@ -1403,58 +1841,65 @@ init_filters_for_psmove(
         position_filter->setFilterSpace(filterSpace);
 
         // Use the LowPass filter by default
-        position_filter->setFusionType(PositionFilter::FusionTypeLowPassOptical);
+        position_filter->setFusionType(
+            psmove_config->use_kalman_position_filter 
+            ? PositionFilter::FusionTypeKalmanOpticalIMU 
+            : PositionFilter::FusionTypeLowPassOptical);
         position_filter->setAccelerometerNoiseRadius(psmove_config->accelerometer_noise_radius);
         position_filter->setMaxVelocity(psmove_config->max_velocity);
     }
 }
 
+static void
+get_orientation_sensor_packet_for_psmove(
+    const PSMoveControllerState *psmoveState,
+    const int frame,
+    const OrientationFilter *orientationFilter,
+    OrientationSensorPacket &out_sensor_packet)
+{
+    out_sensor_packet.orientation = orientationFilter->getOrientation();
+    out_sensor_packet.orientation_source = OrientationSource_PreviousFrame;
+    out_sensor_packet.orientation_quality= -1.f; // not relevant for previous frame
+
+    // Each state update contains two readings (one earlier and one later) of accelerometer and gyro data
+    out_sensor_packet.accelerometer =
+        Eigen::Vector3f(
+            psmoveState->CalibratedAccel[frame][0], 
+            psmoveState->CalibratedAccel[frame][1], 
+            psmoveState->CalibratedAccel[frame][2]);
+    out_sensor_packet.gyroscope =
+        Eigen::Vector3f(
+            psmoveState->CalibratedGyro[frame][0], 
+            psmoveState->CalibratedGyro[frame][1], 
+            psmoveState->CalibratedGyro[frame][2]);
+
+    // NOTE: The magnetometer reading is the same for both sensor readings.
+    out_sensor_packet.magnetometer =
+        Eigen::Vector3f(
+            psmoveState->CalibratedMag[0],
+            psmoveState->CalibratedMag[1],
+            psmoveState->CalibratedMag[2]);
+}
+
 static void                
-update_filters_for_psmove(
+update_position_filter_for_psmove(
     const PSMoveController *psmoveController, 
     const PSMoveControllerState *psmoveState,
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time,
     const float delta_time,
     const ControllerOpticalPoseEstimation *poseEstimation,
-    OrientationFilter *orientationFilter,
+    const bool bIsNewOpticalMeasurement,
+    const CommonDeviceQuaternion orientationFrames[2],
     PositionFilter *position_filter)
 {
     const PSMoveControllerConfig *config = psmoveController->getConfig();
-    Eigen::Quaternionf orientationFrames[2] = {Eigen::Quaternionf::Identity(), Eigen::Quaternionf::Identity()};
 
-    // Update the orientation filter
-    if (orientationFilter != nullptr)
-    {
-        OrientationSensorPacket sensorPacket;
-
-        sensorPacket.magnetometer =
-            Eigen::Vector3f(
-                psmoveState->CalibratedMag[0],
-                psmoveState->CalibratedMag[1],
-                psmoveState->CalibratedMag[2]);
-
-        // Each state update contains two readings (one earlier and one later) of accelerometer and gyro data
-        for (int frame = 0; frame < 2; ++frame)
-        {
-            sensorPacket.orientation = orientationFilter->getOrientation();
-            sensorPacket.orientation_source = OrientationSource_PreviousFrame;
-            sensorPacket.orientation_quality= -1.f; // not relevant for previous frame
-
-            sensorPacket.accelerometer =
-                Eigen::Vector3f(
-                    psmoveState->CalibratedAccel[frame][0], 
-                    psmoveState->CalibratedAccel[frame][1], 
-                    psmoveState->CalibratedAccel[frame][2]);
-            sensorPacket.gyroscope =
-                Eigen::Vector3f(
-                    psmoveState->CalibratedGyro[frame][0], 
-                    psmoveState->CalibratedGyro[frame][1], 
-                    psmoveState->CalibratedGyro[frame][2]);
-
-            // Update the orientation filter using the sensor packet.
-            // NOTE: The magnetometer reading is the same for both sensor readings.
-            orientationFilter->update(delta_time / 2.f, sensorPacket);
-        }
-    }
+    // Each state update contains two readings (one earlier and one later) of accelerometer and gyro data
+    const std::chrono::time_point<std::chrono::high_resolution_clock> frameSampleTimes[2] = {
+        sample_time - std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+            std::chrono::duration<float>(delta_time / 2.f)),
+        sample_time
+    };
 
     // Update the position filter
     if (position_filter != nullptr)
@@ -1474,7 +1919,8 @@ update_filters_for_psmove(
                     safe_divide_with_default(
                         poseEstimation->projection.screen_area - config->min_position_quality_screen_area,
                         config->max_position_quality_screen_area - config->min_position_quality_screen_area,
-                        1.f));
+                        1.f))
+                * compute_triangulation_quality_factor(poseEstimation->reprojection_error);
         }
         else
         {
@@ -1483,6 +1929,13 @@ update_filters_for_psmove(
             sensorPacket.position_quality= -1.f; // not relevant for previous frame
         }
 
+        // A new optical position goes in back at the time its video frame was captured
+        if (bIsNewOpticalMeasurement && sensorPacket.position_source == PositionSource_Optical)
+        {
+            position_filter->applyLateOpticalPosition(
+                poseEstimation->capture_timestamp, sensorPacket.world_position, sensorPacket.position_quality);
+        }
+
         switch (position_filter->getFusionType())
         {
         case PositionFilter::FusionTypeNone:
@@ -1494,16 +1947,22 @@ update_filters_for_psmove(
                 sensorPacket.accelerometer= Eigen::Vector3f::Zero();
 
                 // Update the orientation filter using the sensor packet.
-                position_filter->update(delta_time, sensorPacket);
+                position_filter->update(sample_time, delta_time, sensorPacket);
             } break;
         case PositionFilter::FusionTypeLowPassIMU:
         case PositionFilter::FusionTypeComplimentaryOpticalIMU:
+        case PositionFilter::FusionTypeKalmanOpticalIMU:
             {
                 // Each state update contains two readings (one earlier and one later) of accelerometer data
                 for (int frame = 0; frame < 2; ++frame)
                 {
-                    // Use the latest estimated orientation for the frame
-                    sensorPacket.world_orientation = orientationFrames[frame];
+                    // Use the orientation the orientation filter estimated for the frame
+                    sensorPacket.world_orientation = 
+                        Eigen::Quaternionf(
+                            orientationFrames[frame].w,
+                            orientationFrames[frame].x,
+                            orientationFrames[frame].y,
+                            orientationFrames[frame].z);
 
                     // The filter will use the current orientation and the identity gravity direction
                     // to subtract out gravity and get acceleration of the controller in world space
@@ -1514,7 +1973,7 @@ update_filters_for_psmove(
                             psmoveState->CalibratedAccel[frame][2]);
 
                     // Update the orientation filter using the sensor packet for each frame.
-                    position_filter->update(delta_time / 2.f, sensorPacket);
+                    position_filter->update(frameSampleTimes[frame], delta_time / 2.f, sensorPacket);
                 }
             } break;
         default:
@@ -1563,68 +2022,74 @@ init_filters_for_psdualshock4(
 
         position_filter->setFilterSpace(filterSpace);
 
-        // Use the LowPass filter by default
-        position_filter->setFusionType(PositionFilter::FusionTypeComplimentaryOpticalIMU);
+        // Use the complimentary filter by default
+        position_filter->setFusionType(
+            ds4_config->use_kalman_position_filter 
+            ? PositionFilter::FusionTypeKalmanOpticalIMU 
+            : PositionFilter::FusionTypeComplimentaryOpticalIMU);
         position_filter->setAccelerometerNoiseRadius(ds4_config->accelerometer_noise_radius);
         position_filter->setMaxVelocity(ds4_config->max_velocity);
     }
 }
 
 static void
-update_filters_for_psdualshock4(
+get_orientation_sensor_packet_for_psdualshock4(
     const PSDualShock4Controller *psmoveController,
     const PSDualShock4ControllerState *psdualShock4State,
-    const float delta_time,
     const ControllerOpticalPoseEstimation *poseEstimation,
-    OrientationFilter *orientationFilter,
-    PositionFilter *position_filter)
+    const OrientationFilter *orientationFilter,
+    OrientationSensorPacket &out_sensor_packet)
 {
     const PSDualShock4ControllerConfig *config = psmoveController->getConfig();
 
-    // Update the orientation filter
-    if (orientationFilter != nullptr)
+    if (poseEstimation->bOrientationValid)
     {
-        OrientationSensorPacket sensorPacket;
-
-        if (poseEstimation->bOrientationValid)
-        {
-            sensorPacket.orientation = 
-                Eigen::Quaternionf(
-                    poseEstimation->orientation.w, 
-                    poseEstimation->orientation.x,
-                    poseEstimation->orientation.y,
-                    poseEstimation->orientation.z);
-            sensorPacket.orientation_source= OrientationSource_Optical;
-            sensorPacket.orientation_quality= 
-                clampf01(
-                    safe_divide_with_default(
-                        poseEstimation->projection.screen_area - config->min_orientation_quality_screen_area,
-                        config->max_orientation_quality_screen_area - config->min_orientation_quality_screen_area,
-                        1.f));
-        }
-        else
-        {
-            sensorPacket.orientation = orientationFilter->getOrientation();
-            sensorPacket.orientation_source= OrientationSource_PreviousFrame;
-            sensorPacket.orientation_quality= -1.f; // not relevant for previous frame
-        }
+        out_sensor_packet.orientation = 
+            Eigen::Quaternionf(
+                poseEstimation->orientation.w, 
+                poseEstimation->orientation.x,
+                poseEstimation->orientation.y,
+                poseEstimation->orientation.z);
+        out_sensor_packet.orientation_source= OrientationSource_Optical;
+        out_sensor_packet.orientation_quality= 
+            clampf01(
+                safe_divide_with_default(
+                    poseEstimation->projection.screen_area - config->min_orientation_quality_screen_area,
+                    config->max_orientation_quality_screen_area - config->min_orientation_quality_screen_area,
+                    1.f));
+    }
+    else
+    {
+        out_sensor_packet.orientation = orientationFilter->getOrientation();
+        out_sensor_packet.orientation_source= OrientationSource_PreviousFrame;
+        out_sensor_packet.orientation_quality= -1.f; // not relevant for previous frame
+    }
 
-        sensorPacket.accelerometer =
-            Eigen::Vector3f(
-                psdualShock4State->CalibratedAccelerometer.i,
-                psdualShock4State->CalibratedAccelerometer.j,
-                psdualShock4State->CalibratedAccelerometer.k);
-        sensorPacket.gyroscope =
-            Eigen::Vector3f(
-                psdualShock4State->CalibratedGyro.i, 
-                psdualShock4State->CalibratedGyro.j,
-                psdualShock4State->CalibratedGyro.k);
-        sensorPacket.magnetometer= Eigen::Vector3f::Zero();
+    out_sensor_packet.accelerometer =
+        Eigen::Vector3f(
+            psdualShock4State->CalibratedAccelerometer.i,
+            psdualShock4State->CalibratedAccelerometer.j,
+            psdualShock4State->CalibratedAccelerometer.k);
+    out_sensor_packet.gyroscope =
+        Eigen::Vector3f(
+            psdualShock4State->CalibratedGyro.i, 
+            psdualShock4State->CalibratedGyro.j,
+            psdualShock4State->CalibratedGyro.k);
+    out_sensor_packet.magnetometer= Eigen::Vector3f::Zero();
+}
 
-        // Update the orientation filter using the sensor packet.
-        // NOTE: The magnetometer reading is the same for both sensor readings.
-        orientationFilter->update(delta_time, sensorPacket);
-    }
+static void
+update_position_filter_for_psdualshock4(
+    const PSDualShock4Controller *psmoveController,
+    const PSDualShock4ControllerState *psdualShock4State,
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time,
+    const float delta_time,
+    const ControllerOpticalPoseEstimation *poseEstimation,
+    const bool bIsNewOpticalMeasurement,
+    const CommonDeviceQuaternion &orientation,
+    PositionFilter *position_filter)
+{
+    const PSDualShock4ControllerConfig *config = psmoveController->getConfig();
 
     // Update the position filter
     if (position_filter != nullptr)
@@ -1644,7 +2109,8 @@ update_filters_for_psdualshock4(
                     safe_divide_with_default(
                         poseEstimation->projection.screen_area - config->min_position_quality_screen_area,
                         config->max_position_quality_screen_area - config->min_position_quality_screen_area,
-                        1.f));
+                        1.f))
+                * compute_triangulation_quality_factor(poseEstimation->reprojection_error);
         }
         else
         {
@@ -1653,8 +2119,15 @@ update_filters_for_psdualshock4(
             sensorPacket.position_quality= -1.f; // not relevant for previous frame
         }
 
-        // Use the latest estimated orientation 
-        sensorPacket.world_orientation = orientationFilter->getOrientation();
+        // A new optical position goes in back at the time its video frame was captured
+        if (bIsNewOpticalMeasurement && sensorPacket.position_source == PositionSource_Optical)
+        {
+            position_filter->applyLateOpticalPosition(
+                poseEstimation->capture_timestamp, sensorPacket.world_position, sensorPacket.position_quality);
+        }
+
+        // Use the orientation the orientation filter estimated for the state
+        sensorPacket.world_orientation = Eigen::Quaternionf(orientation.w, orientation.x, orientation.y, orientation.z);
         
         // The filter will use the current orientation and the identity gravity direction
         // to subtract out gravity and get acceleration of the controller in world space
@@ -1665,6 +2138,6 @@ update_filters_for_psdualshock4(
                 psdualShock4State->CalibratedAccelerometer.k);
 
         // Update the orientation filter using the sensor packet.
-        position_filter->update(delta_time, sensorPacket);
+        position_filter->update(sample_time, delta_time, sensorPacket);
     }
 }
\ No newline at end of file
@@ -7,17 +7,21 @@
 #include "PSMoveProtocolInterface.h"
 #include "TrackerManager.h"
 #include <chrono>
+#include <vector>
 
 // -- declarations -----
 struct ControllerOpticalPoseEstimation
 {
     std::chrono::time_point<std::chrono::high_resolution_clock> last_update_timestamp;
     std::chrono::time_point<std::chrono::high_resolution_clock> last_visible_timestamp;
+    std::chrono::time_point<std::chrono::high_resolution_clock> capture_timestamp; // when the video frame(s) the estimate came from were captured
     bool bValidTimestamps;
 
     CommonDevicePosition position;
     CommonDeviceTrackingProjection projection;
     bool bCurrentlyTracking;
+    int missed_frame_count; // consecutive video frames the controller couldn't be found in
+    float reprojection_error; // multicam only: weighted RMS pixel error of the triangulation (0 for a single view)
 
     CommonDeviceQuaternion orientation;
     bool bOrientationValid;
@@ -26,10 +30,13 @@ struct ControllerOpticalPoseEstimation
     {
         last_update_timestamp = std::chrono::time_point<std::chrono::high_resolution_clock>();
         last_visible_timestamp = std::chrono::time_point<std::chrono::high_resolution_clock>();
+        capture_timestamp = std::chrono::time_point<std::chrono::high_resolution_clock>();
         bValidTimestamps= false;
 
         position.clear();
         bCurrentlyTracking= false;
+        missed_frame_count= 0;
+        reprojection_error= 0.f;
 
         orientation.clear();
         bOrientationValid= false;
@@ -39,6 +46,30 @@ struct ControllerOpticalPoseEstimation
     }
 };
 
+// A polled controller state waiting on the filters, see ServerControllerView::beginStateUpdate()
+struct ControllerFilterUpdateState
+{
+    const CommonControllerState *controller_state;
+    std::chrono::time_point<std::chrono::high_resolution_clock> sample_time;
+    float delta_time;
+    bool bIsNewOpticalMeasurement;
+    CommonDeviceQuaternion orientation_frames[2]; // filtered orientation after each IMU frame in the state
+};
+
+// What the vision pass needs from a controller, copied out under the device state lock
+// so that the video frames can be searched without holding it.
+// See ServerControllerView::beginOpticalPoseEstimation()
+struct ControllerOpticalSnapshot
+{
+    bool bIsTracked; // open, connected over bluetooth and tracking enabled
+    bool bTrackingShapeValid;
+    CommonDeviceTrackingShape tracking_shape;
+    eCommonTrackingColorID tracking_color_id;
+    CommonHSVColorRange hsv_color_ranges[TrackerManager::k_max_devices]; // the tracking color as configured on each tracker
+    float speed; // filtered speed in cm/s, used to size the tracking ROI
+    ControllerOpticalPoseEstimation tracker_pose_estimation[TrackerManager::k_max_devices]; // worked on by the vision pass
+};
+
 class ServerControllerView : public ServerDeviceView
 {
 public:
@@ -48,10 +79,31 @@ public:
     bool open(const class DeviceEnumerator *enumerator) override;
     void close() override;
 
-    // Compute pose/prediction of tracking blob+IMU state
-    void updateOpticalPoseEstimation(TrackerManager* tracker_manager);
+    // Compute pose/prediction of tracking blob+IMU state:
+    // Copy what the vision pass needs into the optical snapshot (device state lock held)
+    void beginOpticalPoseEstimation(TrackerManager* tracker_manager);
+    // Update the snapshot's pose estimate as seen from a single tracker (no lock needed).
+    // Safe to run in parallel with the same call for other trackers or other controllers.
+    void updateTrackerPoseEstimation(TrackerManager* tracker_manager, int tracker_id);
+    // Hand the snapshot's pose estimates back to the filters (device state lock held)
+    void finishOpticalPoseEstimation();
+    // Combine the per-tracker pose estimates into the multicam pose estimate
+    void updateMulticamPoseEstimation(TrackerManager* tracker_manager);
     void updateStateAndPredict();
 
+    // updateStateAndPredict() in phases, so the controller manager can run
+    // the orientation filter updates of all the controllers as one batch:
+    // Gather the polled states the filters haven't seen yet, returns false if there aren't any
+    bool beginStateUpdate();
+    // How many orientation filter updates the gathered states take (each PSMove state has two IMU frames)
+    int getPendingOrientationUpdateCount() const;
+    // Add the given orientation filter update to the batch, or apply it right away if it can't be batched
+    void stageOrientationUpdate(const int update_index, class OrientationFilterBatch *batch);
+    // Pick up the result of the given orientation filter update once the batch has run
+    void finishOrientationUpdate(const int update_index, const class OrientationFilterBatch *batch);
+    // Update the position filter with the gathered states and the orientations they ended up at
+    void finishStateUpdate();
+
     // Registers the address of the bluetooth adapter on the host PC with the controller
     bool setHostBluetoothAddress(const std::string &address);
     
@@ -64,6 +116,13 @@ public:
     // Estimate the given pose if the controller at some point into the future
     CommonDevicePose getFilteredPose(float time= 0.f) const;
 
+    // When set, published poses are predicted forward to when they get published
+    // rather than to when the state the filters last saw was sampled
+    inline void setPredictToPublishTime(bool bPredict) { m_predict_to_publish_time = bPredict; }
+
+    // How far ahead to predict the published pose, given the controller's configured prediction time
+    float getPublishPredictionTime(float prediction_time) const;
+
     // Get the current physics from the filter position and orientation
     CommonDevicePhysics getFilteredPhysics() const;
 
@@ -125,6 +184,9 @@ public:
         return (m_tracker_pose_estimation != nullptr) ? &m_tracker_pose_estimation[trackerId] : nullptr;
     }
 
+    // Get the copy of the controller the vision pass is working on
+    inline const ControllerOpticalSnapshot *getOpticalSnapshot() const { return m_optical_snapshot; }
+
     // Get the pose estimate derived from multicam pose tracking
     inline const ControllerOpticalPoseEstimation *getMulticamPoseEstimate() const { 
         return m_multicam_pose_estimation; 
@@ -166,11 +228,19 @@ private:
     // Filter state
     ControllerOpticalPoseEstimation *m_tracker_pose_estimation; // array of size TrackerManager::k_max_devices
     ControllerOpticalPoseEstimation *m_multicam_pose_estimation;
+    ControllerOpticalSnapshot *m_optical_snapshot; // kept for the lifetime of the view, unlike the device state
     class OrientationFilter *m_orientation_filter;
     class PositionFilter *m_position_filter;
+    class DeviceClockModel *m_clock_model; // maps the controller's sensor timestamps onto the host clock
     int m_lastPollSeqNumProcessed;
     std::chrono::time_point<std::chrono::high_resolution_clock> m_last_filter_update_timestamp;
     bool m_last_filter_update_timestamp_valid;
+    std::chrono::time_point<std::chrono::high_resolution_clock> m_last_filter_sample_time; // when the last state given to the filters was sampled
+    bool m_last_filter_sample_time_valid;
+    std::chrono::time_point<std::chrono::high_resolution_clock> m_last_optical_capture_timestamp; // newest optical measurement given to the filters
+    std::vector<ControllerFilterUpdateState> m_pending_filter_updates;
+    int m_staged_orientation_lane; // batch lane of the orientation update between stage and finish, -1 if none
+    bool m_predict_to_publish_time;
 };
 
 #endif // SERVER_CONTROLLER_VIEW_H
\ No newline at end of file
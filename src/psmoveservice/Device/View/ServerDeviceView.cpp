@@ -12,6 +12,7 @@ ServerDeviceView::ServerDeviceView(
     : m_bHasUnpublishedState(false)
     , m_pollNoDataCount(0)
     , m_sequence_number(0)
+    , m_latency_stats(new DeviceLatencyStats)
     , m_deviceID(device_id)
 {
 }
@@ -36,6 +37,9 @@ ServerDeviceView::open(const DeviceEnumerator *enumerator)
     {
         // Consider a successful opening as an update
         m_pollNoDataCount= 0;
+
+        // Don't mix the timings of whatever device had this slot before in with this one's
+        m_latency_stats->reset();
     }
 
     return bSuccess;
@@ -3,6 +3,7 @@
 
 //-- includes -----
 #include "DeviceInterface.h"
+#include "ServerLatencyStats.h"
 #include <chrono>
 #include <assert.h>
 
@@ -55,6 +56,9 @@ public:
     { return m_bHasUnpublishedState; }
     inline std::chrono::time_point<std::chrono::high_resolution_clock> getLastNewDataTimestamp() const
     { return m_lastNewDataTimestamp; }
+    // Where the time went between the device readings coming in and going out to clients
+    inline const DeviceLatencyStatsPtr &getLatencyStats() const
+    { return m_latency_stats; }
     
     // setters
     inline void markStateAsUnpublished()
@@ -69,6 +73,7 @@ protected:
     int m_pollNoDataCount;
     int m_sequence_number;
     std::chrono::time_point<std::chrono::high_resolution_clock> m_lastNewDataTimestamp;
+    DeviceLatencyStatsPtr m_latency_stats;
     
 private:
     int m_deviceID;
@@ -1,28 +1,50 @@
 //-- includes -----
 #include "ServerTrackerView.h"
 #include "ServerControllerView.h"
+#include "ControllerManager.h"
+#include "DeviceManager.h"
 #include "DeviceEnumerator.h"
+#include "DeviceScheduler.h"
 #include "MathUtility.h"
 #include "MathEigen.h"
 #include "MathGLM.h"
 #include "MathAlignment.h"
 #include "PS3EyeTracker.h"
+#include "PSEyeBayerConversion.h"
+#include "ReplayTracker.h"
 #include "PSMoveProtocol.pb.h"
 #include "ServerUtility.h"
 #include "ServerLog.h"
 #include "ServerRequestHandler.h"
+#include "ServerTrace.h"
+#include "SessionRecording.h"
 #include "SharedTrackerState.h"
+#include "TrackerBlobExtractor.h"
+#include "TrackerContourRefiner.h"
+#include "TrackerUndistortionMap.h"
 
 #include <boost/interprocess/shared_memory_object.hpp>
 #include <boost/interprocess/mapped_region.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <cstring>
 
 #include "opencv2/opencv.hpp"
 #include "opencv2/calib3d/calib3d.hpp"
 
 #define USE_OPEN_CV_ELLIPSE_FIT
 
+// -- constants -----
+static const float k_roi_min_padding_px = 16.f; // minimum border added around the last projection
+static const float k_roi_extent_padding_factor = 0.5f; // border added as a fraction of the projection size
+static const float k_roi_min_frame_time = 1.f / 60.f; // time between frames assumed when growing the ROI by velocity
+
 //-- private methods -----
 class SharedVideoFrameReadWriteAccessor
 {
@@ -234,21 +256,38 @@ public:
     OpenCVBufferState(int width, int height)
         : frameWidth(width)
         , frameHeight(height)
+        , bayerBuffer(nullptr)
+        , bayerScratchBuffer(nullptr)
         , bgrBuffer(nullptr)
         , hsvBuffer(nullptr)
         , gsLowerBuffer(nullptr)
         , gsUpperBuffer(nullptr)
         , maskedBuffer(nullptr)
+        , labelBuffer(nullptr)
+        , segmentedColorCount(0)
+        , bSegmentationValid(false)
+        , bFullFrameHSVValid(false)
+        , bIsBayerSource(false)
+        , bFullFrameBGRValid(false)
     {
+        bayerBuffer = new cv::Mat(height, width, CV_8UC1);
+        bayerScratchBuffer = new unsigned char[pseye_bayer_get_scratch_buffer_size(width)];
         bgrBuffer = new cv::Mat(height, width, CV_8UC3);
         hsvBuffer = new cv::Mat(height, width, CV_8UC3);
         gsLowerBuffer = new cv::Mat(height, width, CV_8UC1);
         gsUpperBuffer = new cv::Mat(height, width, CV_8UC1);
         maskedBuffer = new cv::Mat(height, width, CV_8UC3);
+        labelBuffer = new cv::Mat(height, width, CV_8UC1);
     }
 
     virtual ~OpenCVBufferState()
     {
+        if (labelBuffer != nullptr)
+        {
+            delete labelBuffer;
+            labelBuffer = nullptr;
+        }
+
         if (maskedBuffer != nullptr)
         {
             delete maskedBuffer;
@@ -278,6 +317,18 @@ public:
             delete bgrBuffer;
             bgrBuffer = nullptr;
         }
+
+        if (bayerScratchBuffer != nullptr)
+        {
+            delete[] bayerScratchBuffer;
+            bayerScratchBuffer = nullptr;
+        }
+
+        if (bayerBuffer != nullptr)
+        {
+            delete bayerBuffer;
+            bayerBuffer = nullptr;
+        }
     }
 
     void writeVideoFrame(const unsigned char *video_buffer)
@@ -286,19 +337,240 @@ public:
 
         // Copy and Flip image about the x-axis
         cv::flip(videoBufferMat, *bgrBuffer, 1);
+        bIsBayerSource = false;
+        bFullFrameBGRValid = true;
 
-        // Convert the video buffer to the HSV color space
-        cv::cvtColor(*bgrBuffer, *hsvBuffer, cv::COLOR_BGR2HSV);
+        invalidateDerivedBuffers();
+    }
+
+    void writeBayerVideoFrame(const unsigned char *bayer_buffer)
+    {
+        // Keep the raw sensor image. The demosaic, flip and HSV conversion
+        // happen in one fused pass, and only over the regions that get searched.
+        std::memcpy(bayerBuffer->data, bayer_buffer, frameWidth*frameHeight);
+        bIsBayerSource = true;
+        bFullFrameBGRValid = false;
+
+        invalidateDerivedBuffers();
+    }
+
+    // Returns the flipped BGR video frame, demosaicing it first if needed
+    const unsigned char *getBGRFrame()
+    {
+        if (!bFullFrameBGRValid)
+        {
+            // Fill in the HSV image on the same pass if it isn't already done
+            pseye_bayer_gb_to_mirrored_hsv(
+                bayerBuffer->data, frameWidth, frameHeight,
+                0, 0, frameWidth, frameHeight,
+                bFullFrameHSVValid ? nullptr : hsvBuffer->data,
+                bgrBuffer->data,
+                bayerScratchBuffer);
+            bFullFrameBGRValid = true;
+            bFullFrameHSVValid = true;
+        }
+
+        return bgrBuffer->data;
+    }
+
+    inline cv::Rect getFullFrameRect() const
+    {
+        return cv::Rect(0, 0, frameWidth, frameHeight);
+    }
+
+    // Convert the given region of the BGR buffer to the HSV color space,
+    // skipping the work if that region has already been converted this frame
+    void convertHSVRegion(const cv::Rect &roi)
+    {
+        if (bFullFrameHSVValid)
+        {
+            return;
+        }
+
+        for (auto it = hsvValidRegions.begin(); it != hsvValidRegions.end(); ++it)
+        {
+            if ((*it & roi) == roi)
+            {
+                return;
+            }
+        }
+
+        if (bIsBayerSource)
+        {
+            pseye_bayer_gb_to_mirrored_hsv(
+                bayerBuffer->data, frameWidth, frameHeight,
+                roi.x, roi.y, roi.width, roi.height,
+                hsvBuffer->data, nullptr,
+                bayerScratchBuffer);
+        }
+        else
+        {
+            const cv::Mat bgrRegion = (*bgrBuffer)(roi);
+            cv::Mat hsvRegion = (*hsvBuffer)(roi);
+            cv::cvtColor(bgrRegion, hsvRegion, cv::COLOR_BGR2HSV);
+        }
+
+        if (roi == getFullFrameRect())
+        {
+            bFullFrameHSVValid = true;
+        }
+        else
+        {
+            hsvValidRegions.push_back(roi);
+        }
+    }
+
+    // Register a color range (and the window to search for it in) to be included in the next segmentation pass.
+    // Returns false if the label image has run out of color bits.
+    bool addSegmentationColor(const CommonHSVColorRange &hsvColorRange, const cv::Rect &roi)
+    {
+        const int existing_color_index = findSegmentationColorIndex(hsvColorRange);
+
+        if (existing_color_index != -1)
+        {
+            // Search the union of the windows for controllers sharing a color range
+            segmentedColorROIs[existing_color_index] |= roi;
+            bSegmentationValid = false;
+
+            return true;
+        }
+
+        if (segmentedColorCount >= k_max_segmentation_colors)
+        {
+            return false;
+        }
+
+        segmentedColorRanges[segmentedColorCount] = hsvColorRange;
+        segmentedColorROIs[segmentedColorCount] = roi;
+        ++segmentedColorCount;
+        bSegmentationValid = false;
+
+        return true;
+    }
+
+    // Classify every pixel of the HSV buffer against all registered color ranges in one pass.
+    // Bit N of each pixel in the label buffer is set when the pixel falls in color range N.
+    // Only pixels inside one of the registered search windows are converted and labeled.
+    // Rather than testing each range per pixel, the ranges are folded into per-channel
+    // lookup tables so the per pixel cost is three table lookups regardless of the color count.
+    void computeColorSegmentation()
+    {
+        unsigned char hueLUT[256];
+        unsigned char saturationLUT[256];
+        unsigned char valueLUT[256];
+
+        std::memset(hueLUT, 0, sizeof(hueLUT));
+        std::memset(saturationLUT, 0, sizeof(saturationLUT));
+        std::memset(valueLUT, 0, sizeof(valueLUT));
+
+        for (int color_index = 0; color_index < segmentedColorCount; ++color_index)
+        {
+            const unsigned char color_bit = static_cast<unsigned char>(1 << color_index);
+            HSVThresholds thresholds;
+
+            computeHSVThresholds(segmentedColorRanges[color_index], thresholds);
+
+            for (int interval_index = 0; interval_index < thresholds.hue_interval_count; ++interval_index)
+            {
+                for (int hue = thresholds.hue_min[interval_index]; hue <= thresholds.hue_max[interval_index]; ++hue)
+                {
+                    hueLUT[hue] |= color_bit;
+                }
+            }
+
+            for (int saturation = thresholds.saturation_min; saturation <= thresholds.saturation_max; ++saturation)
+            {
+                saturationLUT[saturation] |= color_bit;
+            }
+
+            for (int value = thresholds.value_min; value <= thresholds.value_max; ++value)
+            {
+                valueLUT[value] |= color_bit;
+            }
+        }
+
+        for (int color_index = 0; color_index < segmentedColorCount; ++color_index)
+        {
+            const cv::Rect &roi = segmentedColorROIs[color_index];
+
+            // Skip windows already labeled on behalf of an earlier color
+            bool bAlreadyLabeled = false;
+            for (int prev_color_index = 0; prev_color_index < color_index; ++prev_color_index)
+            {
+                if ((segmentedColorROIs[prev_color_index] & roi) == roi)
+                {
+                    bAlreadyLabeled = true;
+                    break;
+                }
+            }
+
+            if (bAlreadyLabeled)
+            {
+                continue;
+            }
+
+            convertHSVRegion(roi);
+
+            for (int row = roi.y; row < roi.y + roi.height; ++row)
+            {
+                const unsigned char *hsv_row = hsvBuffer->ptr<unsigned char>(row);
+                unsigned char *label_row = labelBuffer->ptr<unsigned char>(row);
+
+                for (int col = roi.x; col < roi.x + roi.width; ++col)
+                {
+                    const unsigned char *hsv = hsv_row + col*3;
+
+                    label_row[col] = hueLUT[hsv[0]] & saturationLUT[hsv[1]] & valueLUT[hsv[2]];
+                }
+            }
+        }
+
+        for (int color_index = 0; color_index < segmentedColorCount; ++color_index)
+        {
+            segmentedColorBlobs[color_index].bValid = false;
+        }
+
+        bSegmentationValid = true;
     }
 
     // Return points in raw image space:
     // i.e. [0, 0] at lower left  to [frameWidth-1, frameHeight-1] at lower right
+    // Safe to call for several controllers at once once the frame has been segmented.
     bool computeBiggestContour(
         const CommonHSVColorRange &hsvColorRange,
         std::vector<cv::Point> &out_biggest_contour)
     {
-        // Clamp the HSV image, taking into account wrapping the hue angle
+        const int color_index = bSegmentationValid ? findSegmentationColorIndex(hsvColorRange) : -1;
+
+        if (color_index != -1)
         {
+            // Search for this color's bit in the shared label image,
+            // limited to the window the color was segmented in.
+            // Controllers sharing a color range share the result.
+            SegmentedColorBlob &colorBlob = segmentedColorBlobs[color_index];
+            std::lock_guard<std::mutex> blobLock(colorBlob.mutex);
+
+            if (!colorBlob.bValid)
+            {
+                const unsigned char color_bit = static_cast<unsigned char>(1 << color_index);
+                const cv::Rect &roi = segmentedColorROIs[color_index];
+
+                colorBlob.extractor.findLargestBlob(labelBuffer->data, labelBuffer->step, roi, color_bit, colorBlob.outline);
+                removeContourPointsOnROIEdge(roi, colorBlob.outline);
+                colorBlob.bValid = true;
+            }
+
+            out_biggest_contour = colorBlob.outline;
+        }
+        else
+        {
+            // Filtering the whole frame goes through the shared scratch buffers
+            std::lock_guard<std::mutex> scratchLock(scratchBufferMutex);
+            const cv::Rect roi = getFullFrameRect();
+
+            convertHSVRegion(roi);
+
+            // Clamp the HSV image, taking into account wrapping the hue angle
             const float hue_min = hsvColorRange.hue_range.center - hsvColorRange.hue_range.range;
             const float hue_max = hsvColorRange.hue_range.center + hsvColorRange.hue_range.range;
             const float saturation_min = clampf(hsvColorRange.saturation_range.center - hsvColorRange.saturation_range.range, 0, 255);
@@ -342,70 +614,582 @@ public:
                     cv::Scalar(hue_max, saturation_max, value_max),
                     *gsLowerBuffer);
             }
+
+            // Find the largest blob in the filtered grayscale buffer
+            scratchBlobExtractor.findLargestBlob(gsLowerBuffer->data, gsLowerBuffer->step, roi, 0xff, out_biggest_contour);
+            removeContourPointsOnROIEdge(roi, out_biggest_contour);
+        }
+
+        //TODO: If our contour is suddenly much smaller than last frame,
+        // but is next to an almost-as-big contour, then maybe these
+        // 2 contours should be joined.
+        // (i.e. if a finger is blocking the middle of the bulb)
+
+        return (out_biggest_contour.size() > 5);
+    }
+
+    // Move the points of a convex hull out onto the sub-pixel edge of the blob in the HSV value channel
+    void refineConvexHullEdges(
+        const std::vector<cv::Point> &convex_hull,
+        std::vector<cv::Point2f> &out_refined_hull)
+    {
+        const int padding = TrackerContourRefiner::getSamplePadding();
+        const cv::Rect hull_bounds = cv::boundingRect(convex_hull);
+        const cv::Rect sample_region =
+            cv::Rect(
+                hull_bounds.x - padding, hull_bounds.y - padding,
+                hull_bounds.width + 2*padding, hull_bounds.height + 2*padding)
+            & getFullFrameRect();
+
+        // The edge profiles can reach just past the window the color was segmented in
+        std::lock_guard<std::mutex> scratchLock(scratchBufferMutex);
+        convertHSVRegion(sample_region);
+
+        scratchContourRefiner.refineHullEdges(
+            hsvBuffer->data, hsvBuffer->step, 3, 2, getFullFrameRect(),
+            convex_hull, out_refined_hull);
+    }
+
+    int frameWidth;
+    int frameHeight;
+    cv::Mat *bayerBuffer; // raw sensor video frame (when the tracker provides one)
+    unsigned char *bayerScratchBuffer; // planar rows the raw sensor frame gets demosaiced through
+    cv::Mat *bgrBuffer; // source video frame
+    cv::Mat *hsvBuffer; // source frame converted to HSV color space
+    cv::Mat *gsLowerBuffer; // HSV image clamped by HSV range into grayscale mask
+    cv::Mat *gsUpperBuffer; // HSV image clamped by HSV range into grayscale mask
+    cv::Mat *maskedBuffer; // bgr image ANDed together with grayscale mask
+    cv::Mat *labelBuffer; // per-pixel bitmask of which segmented color ranges the pixel falls in
+
+    static const int k_max_segmentation_colors = 8; // one bit per color in labelBuffer
+    CommonHSVColorRange segmentedColorRanges[k_max_segmentation_colors];
+    cv::Rect segmentedColorROIs[k_max_segmentation_colors]; // window each color range is searched in
+    int segmentedColorCount;
+    bool bSegmentationValid;
+
+    std::vector<cv::Rect> hsvValidRegions; // regions of hsvBuffer converted for the current frame
+    bool bFullFrameHSVValid;
+    bool bIsBayerSource;
+    bool bFullFrameBGRValid;
+    std::mutex scratchBufferMutex; // guards the gs*Buffers, scratch extractor/refiner and lazy HSV conversion during parallel contour searches
+    TrackerBlobExtractor scratchBlobExtractor;
+    TrackerContourRefiner scratchContourRefiner;
+
+    // Largest blob found for each segmented color this frame, shared by the controllers using that color
+    struct SegmentedColorBlob
+    {
+        SegmentedColorBlob() : bValid(false) {}
+
+        std::mutex mutex;
+        TrackerBlobExtractor extractor;
+        std::vector<cv::Point> outline;
+        bool bValid;
+    };
+    SegmentedColorBlob segmentedColorBlobs[k_max_segmentation_colors];
+
+    std::chrono::time_point<std::chrono::high_resolution_clock> captureTimestamp; // when the driver handed the frame over
+
+private:
+    // Remove any points in the contour on the edge of the camera/ROI
+    static void removeContourPointsOnROIEdge(const cv::Rect &roi, std::vector<cv::Point> &contour)
+    {
+        if (contour.size() > 6)
+        {
+            const int roi_right = roi.x + roi.width - 1;
+            const int roi_bottom = roi.y + roi.height - 1;
+
+            contour.erase(
+                std::remove_if(
+                    contour.begin(), contour.end(),
+                    [&roi, roi_right, roi_bottom](const cv::Point &p) {
+                        return p.x == roi.x || p.x == roi_right || p.y == roi.y || p.y == roi_bottom;
+                    }),
+                contour.end());
+        }
+    }
+
+    void invalidateDerivedBuffers()
+    {
+        // The HSV conversion is deferred until we know which regions of the frame get searched
+        bFullFrameHSVValid = false;
+        hsvValidRegions.clear();
+
+        // Any color segmentation from the previous frame is now stale
+        bSegmentationValid = false;
+        segmentedColorCount = 0;
+    }
+
+    // Integer HSV bounds, rounded to nearest the same way cv::inRange saturate_casts
+    // its float Scalar bounds down to the 8-bit image depth
+    struct HSVThresholds
+    {
+        int hue_min[2], hue_max[2];
+        int hue_interval_count;
+        int saturation_min, saturation_max;
+        int value_min, value_max;
+    };
+
+    static void computeHSVThresholds(const CommonHSVColorRange &hsvColorRange, HSVThresholds &out_thresholds)
+    {
+        const float hue_min = hsvColorRange.hue_range.center - hsvColorRange.hue_range.range;
+        const float hue_max = hsvColorRange.hue_range.center + hsvColorRange.hue_range.range;
+        const float saturation_min = clampf(hsvColorRange.saturation_range.center - hsvColorRange.saturation_range.range, 0, 255);
+        const float saturation_max = clampf(hsvColorRange.saturation_range.center + hsvColorRange.saturation_range.range, 0, 255);
+        const float value_min = clampf(hsvColorRange.value_range.center - hsvColorRange.value_range.range, 0, 255);
+        const float value_max = clampf(hsvColorRange.value_range.center + hsvColorRange.value_range.range, 0, 255);
+
+        // Split the hue range into two intervals when it wraps around the hue circle
+        if (hue_min < 0)
+        {
+            out_thresholds.hue_min[0] = 0;
+            out_thresholds.hue_max[0] = cv::saturate_cast<uchar>(clampf(hue_max, 0, 180));
+            out_thresholds.hue_min[1] = cv::saturate_cast<uchar>(clampf(180 + hue_min, 0, 180));
+            out_thresholds.hue_max[1] = 180;
+            out_thresholds.hue_interval_count = 2;
         }
+        else if (hue_max > 180)
+        {
+            out_thresholds.hue_min[0] = 0;
+            out_thresholds.hue_max[0] = cv::saturate_cast<uchar>(clampf(hue_max - 180, 0, 180));
+            out_thresholds.hue_min[1] = cv::saturate_cast<uchar>(clampf(hue_min, 0, 180));
+            out_thresholds.hue_max[1] = 180;
+            out_thresholds.hue_interval_count = 2;
+        }
+        else
+        {
+            out_thresholds.hue_min[0] = cv::saturate_cast<uchar>(hue_min);
+            out_thresholds.hue_max[0] = cv::saturate_cast<uchar>(hue_max);
+            out_thresholds.hue_interval_count = 1;
+        }
+
+        out_thresholds.saturation_min = cv::saturate_cast<uchar>(saturation_min);
+        out_thresholds.saturation_max = cv::saturate_cast<uchar>(saturation_max);
+        out_thresholds.value_min = cv::saturate_cast<uchar>(value_min);
+        out_thresholds.value_max = cv::saturate_cast<uchar>(value_max);
+    }
+
+    int findSegmentationColorIndex(const CommonHSVColorRange &hsvColorRange) const
+    {
+        for (int color_index = 0; color_index < segmentedColorCount; ++color_index)
+        {
+            if (std::memcmp(&segmentedColorRanges[color_index], &hsvColorRange, sizeof(CommonHSVColorRange)) == 0)
+            {
+                return color_index;
+            }
+        }
+
+        return -1;
+    }
+};
+
+// Pulls video frames off of the tracker device and hands the newest one to the main thread.
+// When threaded, the (blocking) device poll happens on a dedicated capture thread
+// and frames are passed through a lock-free triple buffer:
+// the capture thread fills the back buffer, the main thread reads the front buffer,
+// and the two swap through the middle buffer with a single atomic exchange.
+// A frame the main thread never got to is simply overwritten by a newer one.
+// The device mutex is never held across the poll, since the poll blocks until the next frame.
+// Exposure and gain go through the same video capture device the poll is blocked in,
+// so changes to those get queued up and applied by the polling thread in between frames.
+class TrackerCaptureWorker
+{
+public:
+    TrackerCaptureWorker(ITrackerInterface *device, std::mutex &device_mutex, int width, int height)
+        : m_device(device)
+        , m_device_mutex(device_mutex)
+        , m_capture_thread(nullptr)
+        , m_exit_requested(false)
+        , m_capture_failed(false)
+        , m_preprocess_full_frame(false)
+        , m_settings_pending(false)
+        , m_bExposurePending(false)
+        , m_pending_exposure(0.0)
+        , m_bGainPending(false)
+        , m_pending_gain(0.0)
+        , m_back_index(0)
+        , m_middle_state(1)
+        , m_front_index(2)
+    {
+        for (int buffer_index = 0; buffer_index < k_buffer_count; ++buffer_index)
+        {
+            m_buffers[buffer_index] = new OpenCVBufferState(width, height);
+        }
+    }
+
+    ~TrackerCaptureWorker()
+    {
+        stopThread();
+
+        for (int buffer_index = 0; buffer_index < k_buffer_count; ++buffer_index)
+        {
+            delete m_buffers[buffer_index];
+            m_buffers[buffer_index] = nullptr;
+        }
+    }
+
+    void startThread()
+    {
+        assert(m_capture_thread == nullptr);
+        m_exit_requested = false;
+        m_capture_failed = false;
+        m_capture_thread = new boost::thread(boost::bind(&TrackerCaptureWorker::threadFunc, this));
+    }
+
+    void stopThread()
+    {
+        if (m_capture_thread != nullptr)
+        {
+            m_exit_requested = true;
+            m_capture_thread->join();
+
+            delete m_capture_thread;
+            m_capture_thread = nullptr;
+        }
+    }
+
+    inline bool getIsThreaded() const
+    {
+        return m_capture_thread != nullptr;
+    }
+
+    // Set when the capture thread gave up on the device (read failure or too many empty polls)
+    inline bool getHasFailed() const
+    {
+        return m_capture_failed;
+    }
+
+    // Have the capture thread do the full frame color conversion up front
+    // (when the whole frame is going to be needed anyway)
+    inline void setPreprocessFullFrame(bool bPreprocess)
+    {
+        m_preprocess_full_frame = bPreprocess;
+    }
+
+    // Queue up an exposure or gain change (caller holds the device mutex)
+    void requestExposure(double value)
+    {
+        m_pending_exposure = value;
+        m_bExposurePending = true;
+        m_settings_pending = true;
+    }
+
+    void requestGain(double value)
+    {
+        m_pending_gain = value;
+        m_bGainPending = true;
+        m_settings_pending = true;
+    }
+
+    // The queued value (if any), so that reading a setting right after changing it
+    // sees the new value (caller holds the device mutex)
+    bool getPendingExposure(double &out_value) const
+    {
+        if (m_bExposurePending)
+        {
+            out_value = m_pending_exposure;
+        }
+
+        return m_bExposurePending;
+    }
+
+    bool getPendingGain(double &out_value) const
+    {
+        if (m_bGainPending)
+        {
+            out_value = m_pending_gain;
+        }
+
+        return m_bGainPending;
+    }
+
+    // Apply any queued settings changes. Only called by the thread polling the device.
+    void applyPendingSettings()
+    {
+        if (m_settings_pending)
+        {
+            // setExposure() and setGain() also save the tracker config
+            std::lock_guard<std::mutex> deviceLock(m_device_mutex);
+
+            if (m_bExposurePending)
+            {
+                m_device->setExposure(m_pending_exposure);
+                m_bExposurePending = false;
+            }
+
+            if (m_bGainPending)
+            {
+                m_device->setGain(m_pending_gain);
+                m_bGainPending = false;
+            }
+
+            m_settings_pending = false;
+        }
+    }
+
+    // Copy the device's latest video frame into the back buffer and publish it.
+    // Only called by the thread polling the device, so the device's frame buffers are ours to read.
+    void captureDeviceFrame()
+    {
+        OpenCVBufferState *back_buffer = m_buffers[m_back_index];
+
+        // Prefer the raw bayer frame so that we can skip the driver's full frame demosaic
+        const unsigned char *bayer_buffer = m_device->getVideoFrameBayerBuffer();
+        const unsigned char *buffer = (bayer_buffer == nullptr) ? m_device->getVideoFrameBuffer() : nullptr;
+
+        if (bayer_buffer != nullptr)
+        {
+            back_buffer->writeBayerVideoFrame(bayer_buffer);
+        }
+        else if (buffer != nullptr)
+        {
+            back_buffer->writeVideoFrame(buffer);
+        }
+        else
+        {
+            return;
+        }
+
+        back_buffer->captureTimestamp = m_device->getVideoFrameCaptureTimestamp();
+
+        if (m_preprocess_full_frame)
+        {
+            if (back_buffer->bIsBayerSource)
+            {
+                // Demosaics and converts to HSV in the same pass
+                back_buffer->getBGRFrame();
+            }
+            else
+            {
+                back_buffer->convertHSVRegion(back_buffer->getFullFrameRect());
+            }
+        }
+
+        // Swap the back buffer with the middle buffer and flag the middle buffer as fresh
+        const int old_middle_state = m_middle_state.exchange(m_back_index | k_fresh_frame_flag, std::memory_order_acq_rel);
+        m_back_index = old_middle_state & k_buffer_index_mask;
+
+        // Wake up the vision thread (if the devices are running on their own threads)
+        DeviceScheduler *scheduler = DeviceManager::getInstance()->m_scheduler;
+
+        if (scheduler != nullptr)
+        {
+            scheduler->notifyNewVideoFrame();
+        }
+    }
+
+    // Swap in the newest published frame (if there is one) as the front buffer.
+    // Returns false if no new frame has arrived since the last fetch.
+    bool fetchLatestFrame()
+    {
+        if ((m_middle_state.load(std::memory_order_acquire) & k_fresh_frame_flag) == 0)
+        {
+            return false;
+        }
+
+        const int old_middle_state = m_middle_state.exchange(m_front_index, std::memory_order_acq_rel);
+        m_front_index = old_middle_state & k_buffer_index_mask;
+
+        return true;
+    }
+
+    // The frame most recently fetched by the main thread
+    inline OpenCVBufferState *getLatestFrame() const
+    {
+        return m_buffers[m_front_index];
+    }
+
+private:
+    void threadFunc()
+    {
+        const long max_no_data_count = m_device->getMaxPollFailureCount();
+        long no_data_count = 0;
+
+        while (!m_exit_requested)
+        {
+            applyPendingSettings();
+
+            const IDeviceInterface::ePollResult poll_result = m_device->poll();
+
+            switch (poll_result)
+            {
+            case IDeviceInterface::_PollResultSuccessNewData:
+                {
+                    no_data_count = 0;
+                    captureDeviceFrame();
+                } break;
+            case IDeviceInterface::_PollResultSuccessNoData:
+                {
+                    ++no_data_count;
+
+                    if (no_data_count > max_no_data_count)
+                    {
+                        SERVER_LOG_INFO("TrackerCaptureWorker::threadFunc") <<
+                            "Giving up on tracker after " << max_no_data_count << " failed poll attempts";
+                        m_capture_failed = true;
+                    }
+                    else
+                    {
+                        // Don't spin on a device that isn't producing frames
+                        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+                    }
+                } break;
+            case IDeviceInterface::_PollResultFailure:
+                {
+                    m_capture_failed = true;
+                } break;
+            }
+
+            if (m_capture_failed)
+            {
+                // The main thread closes the device once it sees the failure
+                break;
+            }
+        }
+    }
+
+    static const int k_buffer_count = 3;
+    static const int k_buffer_index_mask = 0x3;
+    static const int k_fresh_frame_flag = 0x4;
+
+    ITrackerInterface *m_device;
+    std::mutex &m_device_mutex; // owned by the tracker view
+    boost::thread *m_capture_thread;
+    std::atomic_bool m_exit_requested;
+    std::atomic_bool m_capture_failed;
+    std::atomic_bool m_preprocess_full_frame;
+
+    // Queued up settings changes (guarded by the device mutex)
+    std::atomic_bool m_settings_pending; // lets the polling thread skip the mutex when nothing is queued
+    bool m_bExposurePending;
+    double m_pending_exposure;
+    bool m_bGainPending;
+    double m_pending_gain;
+
+    OpenCVBufferState *m_buffers[k_buffer_count];
+    int m_back_index; // only touched by the capture thread
+    std::atomic_int m_middle_state; // buffer index + fresh frame flag, shared by both threads
+    int m_front_index; // only touched by the main thread
+};
+
+// Everything derived from the tracker pose and intrinsics that the pose estimation needs
+// per frame: the camera <-> world transforms, the OpenCV and Eigen projection matrices
+// and the mapping from pixels back to world space rays.
+// The ServerTrackerView setters only flag it as dirty. It gets rebuilt at the start of the next
+// tracker poll, on the same thread as the pose estimation, so the pose estimation jobs can read it freely.
+// It also caches the frame size and lens model so that nothing per frame has to go through the device.
+class TrackerCameraModel
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    TrackerCameraModel()
+        : frameWidth(0)
+        , frameHeight(0)
+    {
+        CommonDevicePose identity_pose;
+        identity_pose.clear();
+
+        lens.k1 = lens.k2 = lens.p1 = lens.p2 = lens.k3 = 0.f;
+
+        rebuild(identity_pose, 1.f, 1.f, 0.f, 0.f);
+    }
 
-        // Find the largest convex blob in the filtered grayscale buffer
-        {
-            std::vector<std::vector<cv::Point> > contours;
-            cv::findContours(*gsLowerBuffer, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+    // Caller holds the device mutex
+    void rebuild(const ITrackerInterface *tracker_device)
+    {
+        float F_PX, F_PY;
+        float PrincipalX, PrincipalY;
+        tracker_device->getCameraIntrinsics(F_PX, F_PY, PrincipalX, PrincipalY);
+        tracker_device->getCameraDistortion(lens.k1, lens.k2, lens.p1, lens.p2, lens.k3);
 
-            if (contours.size() > 0)
-            {
-                double contArea = 0;
-                double newArea = 0;
-                for (auto it = contours.begin(); it != contours.end(); ++it) 
-                {
-                    newArea = cv::contourArea(*it);
+        rebuild(tracker_device->getTrackerPose(), F_PX, F_PY, PrincipalX, PrincipalY);
+    }
 
-                    if (newArea > contArea)
-                    {
-                        contArea = newArea;
-                        out_biggest_contour = *it;
-                    }
-                }
-            }
+    void rebuild(
+        const CommonDevicePose &pose,
+        const float F_PX, const float F_PY,
+        const float PrincipalX, const float PrincipalY)
+    {
+        const CommonDeviceQuaternion &quat = pose.Orientation;
+        const CommonDevicePosition &pos = pose.Position;
+
+        focalLengthX = F_PX;
+        focalLengthY = F_PY;
+        principalX = PrincipalX;
+        principalY = PrincipalY;
+
+        lens.focal_length_x = F_PX;
+        lens.focal_length_y = F_PY;
+        lens.principal_x = PrincipalX;
+        lens.principal_y = PrincipalY;
+
+        // Tracker relative -> world space
+        cameraQuaternion = glm::quat(quat.w, quat.x, quat.y, quat.z);
+        cameraPosition = glm::vec3(pos.x, pos.y, pos.z);
+        cameraTransform = glm_mat4_from_pose(cameraQuaternion, cameraPosition);
 
-            //TODO: If our contour is suddenly much smaller than last frame,
-            // but is next to an almost-as-big contour, then maybe these
-            // 2 contours should be joined.
-            // (i.e. if a finger is blocking the middle of the bulb)
-            if (out_biggest_contour.size() > 6)
+        // Extrinsic matrix is the inverse of the camera pose matrix
+        const glm::mat4 glm_mat = glm::inverse(cameraTransform);
+
+        extrinsicMatrix(0, 0) = glm_mat[0][0]; extrinsicMatrix(0, 1) = glm_mat[1][0]; extrinsicMatrix(0, 2) = glm_mat[2][0]; extrinsicMatrix(0, 3) = glm_mat[3][0];
+        extrinsicMatrix(1, 0) = glm_mat[0][1]; extrinsicMatrix(1, 1) = glm_mat[1][1]; extrinsicMatrix(1, 2) = glm_mat[2][1]; extrinsicMatrix(1, 3) = glm_mat[3][1];
+        extrinsicMatrix(2, 0) = glm_mat[0][2]; extrinsicMatrix(2, 1) = glm_mat[1][2]; extrinsicMatrix(2, 2) = glm_mat[2][2]; extrinsicMatrix(2, 3) = glm_mat[3][2];
+
+        intrinsicMatrix(0, 0) = F_PX; intrinsicMatrix(0, 1) = 0.f; intrinsicMatrix(0, 2) = PrincipalX;
+        intrinsicMatrix(1, 0) = 0.f; intrinsicMatrix(1, 1) = F_PY; intrinsicMatrix(1, 2) = PrincipalY;
+        intrinsicMatrix(2, 0) = 0.f; intrinsicMatrix(2, 1) = 0.f; intrinsicMatrix(2, 2) = 1.f;
+
+        // World space -> homogeneous pixel
+        // See: http://docs.opencv.org/2.4/modules/calib3d/doc/camera_calibration_and_3d_reconstruction.html
+        pinholeMatrix = intrinsicMatrix * extrinsicMatrix;
+
+        for (int row = 0; row < 3; ++row)
+        {
+            for (int col = 0; col < 4; ++col)
             {
-                // Remove any points in contour on edge of camera/ROI
-                std::vector<cv::Point>::iterator it = out_biggest_contour.begin();
-                while (it != out_biggest_contour.end()) {
-                    if (it->x == 0 || it->x == (frameWidth-1) || it->y == 0 || it->y == (frameHeight-1)) 
-                    {
-                        it = out_biggest_contour.erase(it);
-                    }
-                    else 
-                    {
-                        ++it;
-                    }
-                }
+                eigenPinholeMatrix(row, col) = pinholeMatrix(row, col);
             }
         }
 
-        return (out_biggest_contour.size() > 5);
+        // Pixel (x, y, 1) -> world space ray direction through that pixel,
+        // i.e. the camera rotation times the inverse intrinsic matrix
+        const float inv_F_PX = safe_divide_with_default(1.f, F_PX, 0.f);
+        const float inv_F_PY = safe_divide_with_default(1.f, F_PY, 0.f);
+        const glm::mat3 inverse_intrinsics(
+            inv_F_PX, 0.f, 0.f,
+            0.f, inv_F_PY, 0.f,
+            -PrincipalX*inv_F_PX, -PrincipalY*inv_F_PY, 1.f);
+
+        pixelToWorldRay = glm::mat3(cameraTransform) * inverse_intrinsics;
     }
 
-    int frameWidth;
-    int frameHeight;
-    cv::Mat *bgrBuffer; // source video frame
-    cv::Mat *hsvBuffer; // source frame converted to HSV color space
-    cv::Mat *gsLowerBuffer; // HSV image clamped by HSV range into grayscale mask
-    cv::Mat *gsUpperBuffer; // HSV image clamped by HSV range into grayscale mask
-    cv::Mat *maskedBuffer; // bgr image ANDed together with grayscale mask
+    // Direction of the world space ray leaving the camera through the given pinhole pixel
+    // (OpenCV pixel space, i.e. the same space pinholeMatrix projects into)
+    inline glm::vec3 computeWorldRayDirection(const float pixel_x, const float pixel_y) const
+    {
+        return glm::normalize(pixelToWorldRay * glm::vec3(pixel_x, pixel_y, 1.f));
+    }
+
+    int frameWidth, frameHeight; // fixed for the lifetime of the device, set when it gets opened
+    float focalLengthX, focalLengthY;
+    float principalX, principalY;
+    TrackerLensModel lens; // intrinsics plus distortion, for the contour undistortion grid
+
+    glm::quat cameraQuaternion; // tracker relative -> world space rotation
+    glm::vec3 cameraPosition; // camera center in world space, the origin of every pixel ray
+    glm::mat4 cameraTransform; // tracker relative -> world space
+    glm::mat3 pixelToWorldRay;
+
+    cv::Matx34f extrinsicMatrix; // world space -> tracker relative
+    cv::Matx33f intrinsicMatrix; // tracker relative -> pixel
+    cv::Matx34f pinholeMatrix; // world space -> pixel
+    Eigen::Matrix<float, 3, 4> eigenPinholeMatrix; // same as pinholeMatrix, for the triangulation
 };
 
 // -- Utility Methods -----
-static glm::quat computeGLMCameraTransformQuaternion(const ITrackerInterface *tracker_device);
-static glm::mat4 computeGLMCameraTransformMatrix(const ITrackerInterface *tracker_device);
-static cv::Matx34f computeOpenCVCameraExtrinsicMatrix(const ITrackerInterface *tracker_device);
-static cv::Matx33f computeOpenCVCameraIntrinsicMatrix(const ITrackerInterface *tracker_device);
-static cv::Matx34f computeOpenCVCameraPinholeMatrix(const ITrackerInterface *tracker_device);
 static bool computeTrackerRelativeLightBarContourPose(
-    const ITrackerInterface *tracker_device,
+    const TrackerCameraModel *camera_model,
+    const TrackerUndistortionMap *undistortion_map,
     const CommonDeviceTrackingShape *tracking_shape,
     const std::vector<cv::Point> &opencv_contour,
     const CommonDevicePose *tracker_relative_pose_guess,
@@ -435,13 +1219,23 @@ static void angleAxisVectorToEulerAngles(
 static void angleAxisVectorToCommonDeviceOrientation(
     const float axis_x, const float axis_y, const float axis_z, const float radians,
     CommonDeviceQuaternion &orientation);
+static cv::Rect computeTrackingROI(
+    const TrackerCameraModel *camera_model,
+    const int frame_width, const int frame_height,
+    const ControllerOpticalPoseEstimation *prior_pose_estimate,
+    const float speed_cm_per_sec,
+    const int miss_limit);
 
 //-- public implementation -----
 ServerTrackerView::ServerTrackerView(const int device_id)
     : ServerDeviceView(device_id)
     , m_shared_memory_accesor(nullptr)
     , m_shared_memory_video_stream_count(0)
+    , m_capture_worker(nullptr)
     , m_opencv_buffer_state(nullptr)
+    , m_undistortion_map(new TrackerUndistortionMap)
+    , m_camera_model(new TrackerCameraModel)
+    , m_bCameraModelDirty(false)
     , m_device(nullptr)
 {
     ServerUtility::format_string(m_shared_memory_name, sizeof(m_shared_memory_name), "tracker_view_%d", device_id);
@@ -454,15 +1248,19 @@ ServerTrackerView::~ServerTrackerView()
         delete m_shared_memory_accesor;
     }
 
-    if (m_opencv_buffer_state != nullptr)
+    // Stops the capture thread before the device goes away
+    if (m_capture_worker != nullptr)
     {
-        delete m_opencv_buffer_state;
+        delete m_capture_worker;
     }
 
     if (m_device != nullptr)
     {
         delete m_device;
     }
+
+    delete m_undistortion_map;
+    delete m_camera_model;
 }
 
 CommonDeviceState::eDeviceType
@@ -497,12 +1295,19 @@ bool ServerTrackerView::open(const class DeviceEnumerator *enumerator)
     {
         int width, height, stride;
 
+        // Cache the camera model for the pose and intrinsics loaded from the tracker config
+        m_camera_model->rebuild(m_device);
+
         // Make sure the shared memory block has been removed first
         boost::interprocess::shared_memory_object::remove(m_shared_memory_name);
 
         // Query the video frame first so that we know how big to make the buffer
         if (m_device->getVideoFrameDimensions(&width, &height, &stride))
         {
+            m_camera_model->frameWidth = width;
+            m_camera_model->frameHeight = height;
+            updateUndistortionMap();
+
             assert(m_shared_memory_accesor == nullptr);
             m_shared_memory_accesor = new SharedVideoFrameReadWriteAccessor();
 
@@ -515,7 +1320,15 @@ bool ServerTrackerView::open(const class DeviceEnumerator *enumerator)
             }
 
             // Allocate the OpenCV scratch buffers used for finding tracking blobs
-            m_opencv_buffer_state = new OpenCVBufferState(width, height);
+            assert(m_capture_worker == nullptr);
+            m_capture_worker = new TrackerCaptureWorker(m_device, m_device_mutex, width, height);
+            m_opencv_buffer_state = m_capture_worker->getLatestFrame();
+
+            // Grab frames off the device on a separate thread so that the main loop never blocks on the camera
+            if (DeviceManager::getInstance()->m_tracker_manager->getConfig().use_capture_thread)
+            {
+                m_capture_worker->startThread();
+            }
         }
         else
         {
@@ -528,6 +1341,19 @@ bool ServerTrackerView::open(const class DeviceEnumerator *enumerator)
 
 void ServerTrackerView::close()
 {
+    // Make sure the capture thread is done with the device before it gets closed
+    if (m_capture_worker != nullptr)
+    {
+        m_capture_worker->stopThread();
+
+        // Don't drop a settings change that came in after the last poll
+        m_capture_worker->applyPendingSettings();
+
+        delete m_capture_worker;
+        m_capture_worker = nullptr;
+        m_opencv_buffer_state = nullptr;
+    }
+
     if (m_shared_memory_accesor != nullptr)
     {
         delete m_shared_memory_accesor;
@@ -550,28 +1376,117 @@ void ServerTrackerView::stopSharedMemoryVideoStream()
 
 bool ServerTrackerView::poll()
 {
-    bool bSuccess = ServerDeviceView::poll();
+    SERVER_TRACE_SCOPE("ServerTrackerView::poll");
+
+    bool bSuccess = true;
+    bool bNewFrame = false;
 
-    if (bSuccess && m_device != nullptr)
+    // Pick up any pose or lens change before this frame's pose estimation
+    if (m_bCameraModelDirty.exchange(false))
     {
-        const unsigned char *buffer = m_device->getVideoFrameBuffer();
+        {
+            std::lock_guard<std::mutex> deviceLock(m_device_mutex);
+            m_camera_model->rebuild(m_device);
+        }
+
+        updateUndistortionMap();
+    }
 
-        if (buffer != nullptr)
+    if (m_capture_worker != nullptr && m_capture_worker->getIsThreaded())
+    {
+        // The capture thread does the device polling, we just pick up the newest frame (if any)
+        if (m_capture_worker->getHasFailed())
         {
-            // Cache the raw video frame and convert it to an HSV buffer for filtering later
-            if (m_opencv_buffer_state != nullptr)
-            {
-                m_opencv_buffer_state->writeVideoFrame(buffer);
+            SERVER_LOG_INFO("ServerTrackerView::poll") <<
+                "Device id " << getDeviceID() << " closing due to failed read";
+            close();
 
-                // Copy the video frame to shared memory (if requested)
-                if (m_shared_memory_accesor != nullptr && m_shared_memory_video_stream_count > 0)
-                {
-                    m_shared_memory_accesor->writeVideoFrame(m_opencv_buffer_state->bgrBuffer->data);
-                }
+            bSuccess = false;
+        }
+        else if (m_capture_worker->fetchLatestFrame())
+        {
+            m_opencv_buffer_state = m_capture_worker->getLatestFrame();
+
+            m_pollNoDataCount = 0;
+            m_lastNewDataTimestamp = m_opencv_buffer_state->captureTimestamp;
+
+            // If we got a new video frame, then we have new state to publish
+            markStateAsUnpublished();
+
+            bNewFrame = true;
+        }
+    }
+    else
+    {
+        const auto last_new_data_timestamp = m_lastNewDataTimestamp;
+
+        if (m_capture_worker != nullptr)
+        {
+            m_capture_worker->applyPendingSettings();
+        }
+
+        bSuccess = ServerDeviceView::poll();
+
+        if (bSuccess && m_capture_worker != nullptr && m_lastNewDataTimestamp != last_new_data_timestamp)
+        {
+            // Cache the raw video frame. It gets converted to HSV for filtering later.
+            m_capture_worker->captureDeviceFrame();
+            m_capture_worker->fetchLatestFrame();
+            m_opencv_buffer_state = m_capture_worker->getLatestFrame();
+
+            // Same as the threaded path: the frame is as new as its capture, not the poll
+            m_lastNewDataTimestamp = m_opencv_buffer_state->captureTimestamp;
+
+            bNewFrame = true;
+        }
+    }
+
+    if (bNewFrame)
+    {
+        m_latency_stats->record(LatencyStage_Capture, m_opencv_buffer_state->captureTimestamp);
+
+        // Copy the video frame to shared memory (if requested)
+        if (m_shared_memory_accesor != nullptr && m_shared_memory_video_stream_count > 0)
+        {
+            m_shared_memory_accesor->writeVideoFrame(m_opencv_buffer_state->getBGRFrame());
+        }
+
+        // Record the video frame as it came off the device (if a session is being recorded)
+        ServerSessionRecorder *recorder = DeviceManager::getInstance()->m_session_recorder;
+
+        if (recorder != nullptr)
+        {
+            if (m_opencv_buffer_state->bIsBayerSource)
+            {
+                recorder->recordVideoFrame(
+                    m_device->getUSBDevicePath(), m_device->getDeviceType(),
+                    m_opencv_buffer_state->frameWidth, m_opencv_buffer_state->frameHeight,
+                    SessionPixelFormat_BayerGB, m_opencv_buffer_state->bayerBuffer->data,
+                    m_opencv_buffer_state->captureTimestamp);
+            }
+            else
+            {
+                // The cached BGR frame has already been mirrored
+                cv::Mat unflippedFrame;
+                cv::flip(*m_opencv_buffer_state->bgrBuffer, unflippedFrame, 1);
+
+                recorder->recordVideoFrame(
+                    m_device->getUSBDevicePath(), m_device->getDeviceType(),
+                    m_opencv_buffer_state->frameWidth, m_opencv_buffer_state->frameHeight,
+                    SessionPixelFormat_BGR, unflippedFrame.data,
+                    m_opencv_buffer_state->captureTimestamp);
             }
         }
     }
 
+    if (m_capture_worker != nullptr)
+    {
+        // Have the capture thread convert the whole frame up front when we know all of it gets used
+        const bool bUseTrackingROI = DeviceManager::getInstance()->m_tracker_manager->getConfig().use_tracking_roi;
+
+        m_capture_worker->setPreprocessFullFrame(!bUseTrackingROI || m_shared_memory_video_stream_count > 0);
+    }
+
     return bSuccess;
 }
 
@@ -583,6 +1498,10 @@ bool ServerTrackerView::allocate_device_interface(const class DeviceEnumerator *
     {
         m_device = new PS3EyeTracker();
     } break;
+    case CommonDeviceState::ReplayTracker:
+    {
+        m_device = new ReplayTracker();
+    } break;
     default:
         break;
     }
@@ -625,6 +1544,7 @@ void ServerTrackerView::generate_tracker_data_frame_for_stream(
     switch (tracker_view->getTrackerDeviceType())
     {
     case CommonDeviceState::PS3EYE:
+    case CommonDeviceState::ReplayTracker:
         {
             //TODO: PS3EYE tracker location
         } break;
@@ -641,28 +1561,65 @@ void ServerTrackerView::generate_tracker_data_frame_for_stream(
 
 double ServerTrackerView::getExposure() const
 {
-    return m_device->getExposure();
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
+    double value;
+
+    if (m_capture_worker == nullptr || !m_capture_worker->getPendingExposure(value))
+    {
+        value = m_device->getExposure();
+    }
+
+    return value;
 }
 
 void ServerTrackerView::setExposure(double value)
 {
-    m_device->setExposure(value);
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
+
+    if (m_capture_worker != nullptr)
+    {
+        // Applied by the thread polling the device, in between frames
+        m_capture_worker->requestExposure(value);
+    }
+    else
+    {
+        m_device->setExposure(value);
+    }
 }
 
 double ServerTrackerView::getGain() const
 {
-	return m_device->getGain();
+	std::lock_guard<std::mutex> deviceLock(m_device_mutex);
+	double value;
+
+	if (m_capture_worker == nullptr || !m_capture_worker->getPendingGain(value))
+	{
+		value = m_device->getGain();
+	}
+
+	return value;
 }
 
 void ServerTrackerView::setGain(double value)
 {
-	m_device->setGain(value);
+	std::lock_guard<std::mutex> deviceLock(m_device_mutex);
+
+	if (m_capture_worker != nullptr)
+	{
+		// Applied by the thread polling the device, in between frames
+		m_capture_worker->requestGain(value);
+	}
+	else
+	{
+		m_device->setGain(value);
+	}
 }
 
 void ServerTrackerView::getCameraIntrinsics(
     float &outFocalLengthX, float &outFocalLengthY,
     float &outPrincipalX, float &outPrincipalY) const
 {
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     m_device->getCameraIntrinsics(
         outFocalLengthX, outFocalLengthY,
         outPrincipalX, outPrincipalY);
@@ -672,52 +1629,78 @@ void ServerTrackerView::setCameraIntrinsics(
     float focalLengthX, float focalLengthY,
     float principalX, float principalY)
 {
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     m_device->setCameraIntrinsics(focalLengthX, focalLengthY, principalX, principalY);
+    m_bCameraModelDirty = true;
+}
+
+void ServerTrackerView::getCameraDistortion(
+    float &outK1, float &outK2,
+    float &outP1, float &outP2,
+    float &outK3) const
+{
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
+    m_device->getCameraDistortion(outK1, outK2, outP1, outP2, outK3);
+}
+
+void ServerTrackerView::setCameraDistortion(
+    float k1, float k2,
+    float p1, float p2,
+    float k3)
+{
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
+    m_device->setCameraDistortion(k1, k2, p1, p2, k3);
+    m_bCameraModelDirty = true;
 }
 
 CommonDevicePose ServerTrackerView::getTrackerPose() const
 {
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     return m_device->getTrackerPose();
 }
 
 void ServerTrackerView::setTrackerPose(
     const struct CommonDevicePose *pose)
 {
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     m_device->setTrackerPose(pose);
+    m_bCameraModelDirty = true;
 }
 
 void ServerTrackerView::getPixelDimensions(float &outWidth, float &outHeight) const
 {
-    int pixelWidth, pixelHeight;
-
-    m_device->getVideoFrameDimensions(&pixelWidth, &pixelHeight, nullptr);
-
-    outWidth = static_cast<float>(pixelWidth);
-    outHeight = static_cast<float>(pixelHeight);
+    // Cached when the device was opened, the frame size never changes after that
+    outWidth = static_cast<float>(m_camera_model->frameWidth);
+    outHeight = static_cast<float>(m_camera_model->frameHeight);
 }
 
 void ServerTrackerView::getFOV(float &outHFOV, float &outVFOV) const
 {
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     m_device->getFOV(outHFOV, outVFOV);
 }
 
 void ServerTrackerView::getZRange(float &outZNear, float &outZFar) const
 {
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     m_device->getZRange(outZNear, outZFar);
 }
 
 void ServerTrackerView::gatherTrackerOptions(PSMoveProtocol::Response_ResultTrackerSettings* settings) const
 {
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     m_device->gatherTrackerOptions(settings);
 }
 
 bool ServerTrackerView::setOptionIndex(const std::string &option_name, int option_index)
 {
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     return m_device->setOptionIndex(option_name, option_index);
 }
 
 bool ServerTrackerView::getOptionIndex(const std::string &option_name, int &out_option_index) const
 {
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     return m_device->getOptionIndex(option_name, out_option_index);
 }
 
@@ -727,6 +1710,7 @@ void ServerTrackerView::gatherTrackingColorPresets(
 {
 	std::string controller_id= (controller != nullptr) ? controller->getConfigIdentifier() : "";
 
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     return m_device->gatherTrackingColorPresets(controller_id, settings);
 }
 
@@ -737,6 +1721,7 @@ void ServerTrackerView::setTrackingColorPreset(
 {
 	std::string controller_id= (controller != nullptr) ? controller->getConfigIdentifier() : "";
 
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     return m_device->setTrackingColorPreset(controller_id, color, preset);
 }
 
@@ -747,58 +1732,105 @@ void ServerTrackerView::getTrackingColorPreset(
 {
 	std::string controller_id= (controller != nullptr) ? controller->getConfigIdentifier() : "";
 
+    std::lock_guard<std::mutex> deviceLock(m_device_mutex);
     return m_device->getTrackingColorPreset(controller_id, color, out_preset);
 }
 
+void
+ServerTrackerView::computeTrackingColorSegmentation(ControllerManager *controller_manager)
+{
+    if (m_opencv_buffer_state == nullptr)
+    {
+        return;
+    }
+
+    const TrackerManagerConfig &cfg = DeviceManager::getInstance()->m_tracker_manager->getConfig();
+    const cv::Rect full_frame_roi = m_opencv_buffer_state->getFullFrameRect();
+
+    // Gather the color range and search window of every controller we may be asked to find this frame.
+    // Runs without the device state lock, so only the controllers' optical snapshots get looked at.
+    for (int controller_id = 0; controller_id < controller_manager->getMaxDevices(); ++controller_id)
+    {
+        const ControllerOpticalSnapshot *snapshot =
+            controller_manager->getControllerViewPtr(controller_id)->getOpticalSnapshot();
+
+        if (snapshot->bIsTracked)
+        {
+            if (snapshot->tracking_color_id != eCommonTrackingColorID::INVALID_COLOR)
+            {
+                // Only search the window around where we last saw the controller,
+                // unless we've gone too many frames without finding it there
+                const cv::Rect roi =
+                    cfg.use_tracking_roi
+                    ? computeTrackingROI(
+                        m_camera_model,
+                        m_opencv_buffer_state->frameWidth,
+                        m_opencv_buffer_state->frameHeight,
+                        &snapshot->tracker_pose_estimation[getDeviceID()],
+                        snapshot->speed,
+                        cfg.tracking_roi_miss_limit)
+                    : full_frame_roi;
+
+                if (!m_opencv_buffer_state->addSegmentationColor(snapshot->hsv_color_ranges[getDeviceID()], roi))
+                {
+                    // Out of label bits, remaining colors get filtered individually
+                    break;
+                }
+            }
+        }
+    }
+
+    if (m_opencv_buffer_state->segmentedColorCount > 0)
+    {
+        m_opencv_buffer_state->computeColorSegmentation();
+
+        m_latency_stats->record(LatencyStage_HSVConversion, m_opencv_buffer_state->captureTimestamp);
+    }
+}
+
 bool
 ServerTrackerView::computePoseForController(
     const ServerControllerView* tracked_controller,
     const CommonDevicePose *tracker_pose_guess,
     ControllerOpticalPoseEstimation *out_pose_estimate)
 {
+    SERVER_TRACE_SCOPE("ServerTrackerView::computePoseForController");
+
+    // Runs without the device state lock, so the controller's tracking shape and color
+    // come from the copy made in ServerControllerView::beginOpticalPoseEstimation()
+    const ControllerOpticalSnapshot *snapshot = tracked_controller->getOpticalSnapshot();
     bool bSuccess = true;
 
     // Get the tracking shape used by the controller
-    CommonDeviceTrackingShape tracking_shape;
+    const CommonDeviceTrackingShape &tracking_shape = snapshot->tracking_shape;
     if (bSuccess)
     {
-        bSuccess = tracked_controller->getTrackingShape(tracking_shape);
+        bSuccess = snapshot->bTrackingShapeValid;
     }
 
     // Get the HSV filter used to find the tracking blob
-    CommonHSVColorRange hsvColorRange;
+    const CommonHSVColorRange &hsvColorRange = snapshot->hsv_color_ranges[getDeviceID()];
     if (bSuccess)
     {
-        eCommonTrackingColorID tracked_color_id = tracked_controller->getTrackingColorID();
-
-        if (tracked_color_id != eCommonTrackingColorID::INVALID_COLOR)
-        {
-            getTrackingColorPreset(tracked_controller, tracked_color_id, &hsvColorRange);
-        }
-        else
-        {
-            bSuccess = false;
-        }
+        bSuccess = snapshot->tracking_color_id != eCommonTrackingColorID::INVALID_COLOR;
     }
 
     // Find the contour associated with the controller
     std::vector<cv::Point> biggest_contour;
     if (bSuccess)
     {
-        ///###HipsterSloth $TODO - ROI seed on last known position, clamp to frame edges. 
+        // The search is limited to the ROI computed for this color in computeTrackingColorSegmentation()
         bSuccess = m_opencv_buffer_state->computeBiggestContour(hsvColorRange, biggest_contour);
+
+        if (bSuccess)
+        {
+            m_latency_stats->record(LatencyStage_Contour, m_opencv_buffer_state->captureTimestamp);
+        }
     }
 
     // Compute the tracker relative 3d position of the controller from the contour
     if (bSuccess)
     {
-        float F_PX, F_PY;
-        float PrincipalX, PrincipalY;
-        m_device->getCameraIntrinsics(F_PX, F_PY, PrincipalX, PrincipalY);
-
-        // TODO: cv::undistortPoints  http://docs.opencv.org/3.1.0/da/d54/group__imgproc__transform.html#ga55c716492470bfe86b0ee9bf3a1f0f7e&gsc.tab=0
-        // Then replace F_PX with -1.
-
         switch (tracking_shape.shape_type)
         {
         case eCommonTrackingShapeType::Sphere:
@@ -810,17 +1842,29 @@ ServerTrackerView::computePoseForController(
                 std::vector<cv::Point> convex_contour;
                 cv::convexHull(biggest_contour, convex_contour);
 
+                // Snap the hull to the sub-pixel edge of the bulb so it doesn't hop a whole pixel at a time
+                std::vector<cv::Point2f> refined_contour;
+                if (DeviceManager::getInstance()->m_tracker_manager->getConfig().use_subpixel_contour_refinement)
+                {
+                    m_opencv_buffer_state->refineConvexHullEdges(convex_contour, refined_contour);
+                }
+                else
+                {
+                    refined_contour.assign(convex_contour.begin(), convex_contour.end());
+                }
+
+                // Remove the lens distortion so the fit sees what an ideal pinhole camera would
+                m_undistortion_map->undistortPoints(refined_contour);
+
                 // Convert opencv_contour in raw pixel space:
                 // i.e. [0, 0]x[frameWidth-1, frameHeight-1]
                 // eigen_contour in CommonDeviceScreenLocation space:
                 // i.e. [-frameWidth/2, -frameHeight/2]x[frameWidth/2, frameHeight/2]   
-                // TODO: Replace this with cv::undistortPoints
-                //http://docs.opencv.org/3.1.0/da/d54/group__imgproc__transform.html#ga55c716492470bfe86b0ee9bf3a1f0f7e&gsc.tab=0
                 std::vector<Eigen::Vector2f> eigen_contour;
                 std::for_each(
-                    convex_contour.begin(),
-                    convex_contour.end(),
-                    [frameWidth, frameHeight, &eigen_contour](cv::Point& p) {
+                    refined_contour.begin(),
+                    refined_contour.end(),
+                    [frameWidth, frameHeight, &eigen_contour](cv::Point2f& p) {
                         eigen_contour.push_back(Eigen::Vector2f(p.x - (frameWidth / 2), (frameHeight / 2) - p.y));
                     });
 
@@ -831,7 +1875,7 @@ ServerTrackerView::computePoseForController(
                     eigen_contour.data(),
                     static_cast<int>(eigen_contour.size()),
                     tracking_shape.shape.sphere.radius,
-                    F_PX,
+                    m_camera_model->focalLengthX,
                     &sphere_center,
                     &ellipse_projection);
 
@@ -842,9 +1886,18 @@ ServerTrackerView::computePoseForController(
                 out_pose_estimate->orientation.clear();
                 out_pose_estimate->bOrientationValid = false;
 
-                // Save off the projection of the sphere (an ellipse)
+                // Save off the projection of the sphere (an ellipse),
+                // with the center put back where it appears in the distorted video frame
+                const cv::Point2f projected_center =
+                    m_undistortion_map->distortPoint(
+                        cv::Point2f(
+                            ellipse_projection.center.x() + (frameWidth / 2),
+                            (frameHeight / 2) - ellipse_projection.center.y()));
+
                 out_pose_estimate->projection.shape_type = eCommonTrackingProjectionType::ProjectionType_Ellipse;
-                out_pose_estimate->projection.shape.ellipse.center.set(ellipse_projection.center.x(), ellipse_projection.center.y());
+                out_pose_estimate->projection.shape.ellipse.center.set(
+                    projected_center.x - (frameWidth / 2),
+                    (frameHeight / 2) - projected_center.y);
                 out_pose_estimate->projection.shape.ellipse.half_x_extent = ellipse_projection.extents.x();
                 out_pose_estimate->projection.shape.ellipse.half_y_extent = ellipse_projection.extents.y();
                 out_pose_estimate->projection.shape.ellipse.angle = ellipse_projection.angle;
@@ -856,7 +1909,8 @@ ServerTrackerView::computePoseForController(
             {
                 bSuccess= 
                     computeTrackerRelativeLightBarContourPose(
-                        m_device,
+                        m_camera_model,
+                        m_undistortion_map,
                         &tracking_shape,
                         biggest_contour,
                         tracker_pose_guess,
@@ -868,6 +1922,14 @@ ServerTrackerView::computePoseForController(
         }
     }
 
+    // Keep the time the estimate is valid for, so views from other trackers can be lined up with it
+    if (bSuccess)
+    {
+        out_pose_estimate->capture_timestamp = m_opencv_buffer_state->captureTimestamp;
+
+        tracked_controller->getLatencyStats()->record(LatencyStage_Fit, m_opencv_buffer_state->captureTimestamp);
+    }
+
     return bSuccess;
 }
 
@@ -876,8 +1938,7 @@ ServerTrackerView::computeWorldPosition(
     const CommonDevicePosition *tracker_relative_position)
 {
     const glm::vec4 rel_pos(tracker_relative_position->x, tracker_relative_position->y, tracker_relative_position->z, 1.f);
-    const glm::mat4 cameraTransform= computeGLMCameraTransformMatrix(m_device);
-    const glm::vec4 world_pos = cameraTransform * rel_pos;
+    const glm::vec4 world_pos = m_camera_model->cameraTransform * rel_pos;
     
     CommonDevicePosition result;
     result.set(world_pos.x, world_pos.y, world_pos.z);
@@ -894,9 +1955,8 @@ ServerTrackerView::computeWorldOrientation(
         tracker_relative_orientation->x,
         tracker_relative_orientation->y,
         tracker_relative_orientation->z);    
-    const glm::quat camera_quat= computeGLMCameraTransformQuaternion(m_device);
     // combined_rotation = second_rotation * first_rotation;
-    const glm::quat world_quat = camera_quat * rel_orientation;
+    const glm::quat world_quat = m_camera_model->cameraQuaternion * rel_orientation;
     
     CommonDeviceQuaternion result;
     result.w= world_quat.w;
@@ -933,167 +1993,122 @@ ServerTrackerView::triangulateWorldPose(
     return pose;
 }
 
-CommonDevicePosition
+bool
 ServerTrackerView::triangulateWorldPosition(
-    const ServerTrackerView *tracker, 
-    const CommonDeviceScreenLocation *screen_location,
-    const ServerTrackerView *other_tracker,
-    const CommonDeviceScreenLocation *other_screen_location)
-{
-    // Convert the tracker screen locations in CommonDeviceScreenLocation space
-    // i.e. [-frameWidth/2, -frameHeight/2]x[frameWidth/2, frameHeight/2] 
-    // into OpenCV pixel space
-    // i.e. [0, 0]x[frameWidth, frameHeight]
-    float screenWidth, screenHeight;
-    tracker->getPixelDimensions(screenWidth, screenHeight);
-
-    float otherScreenWidth, otherScreenHeight;
-    tracker->getPixelDimensions(otherScreenWidth, otherScreenHeight);
-
-    cv::Mat projPoints1 = 
-        cv::Mat(cv::Point2f(
-            screen_location->x + (screenWidth / 2), 
-            screen_location->y + (screenHeight / 2)));
-    cv::Mat projPoints2 = 
-        cv::Mat(cv::Point2f(
-            other_screen_location->x + (otherScreenWidth / 2),
-            other_screen_location->y + (otherScreenHeight / 2)));
-
-    // Compute the pinhole camera matrix for each tracker that allows you to raycast
-    // from the tracker center in world space through the screen location, into the world
-    // See: http://docs.opencv.org/2.4/modules/calib3d/doc/camera_calibration_and_3d_reconstruction.html
-    cv::Mat projMat1 = cv::Mat(computeOpenCVCameraPinholeMatrix(tracker->m_device));
-    cv::Mat projMat2 = cv::Mat(computeOpenCVCameraPinholeMatrix(other_tracker->m_device));
-
-    // Triangulate the world position from the two cameras
-    cv::Mat point3D(1, 1, CV_32FC4);
-    cv::triangulatePoints(projMat1, projMat2, projPoints1, projPoints2, point3D);
-
-    // Return the world space position
-    CommonDevicePosition result;
-    const float w = point3D.at<float>(3, 0);
-    result.x = point3D.at<float>(0, 0) / w;
-    result.y = point3D.at<float>(1, 0) / w;
-    result.z = point3D.at<float>(2, 0) / w;
-
-    return result;
-}
-
-CommonDeviceScreenLocation
-ServerTrackerView::projectTrackerRelativePosition(const CommonDevicePosition *trackerRelativePosition) const
+    const ServerTrackerView * const *trackers,
+    const CommonDeviceScreenLocation *screen_locations,
+    const CommonDeviceVector *capture_offsets,
+    const float *weights,
+    const int tracker_count,
+    CommonDevicePosition *out_position,
+    float *out_reprojection_error)
 {
-    CommonDeviceScreenLocation screenLocation;
+    Eigen::Matrix<float, 3, 4> pinhole_matrices[TrackerManager::k_max_devices];
+    Eigen::Vector2f pixel_points[TrackerManager::k_max_devices];
 
-    // Assume no distortion
-    // TODO: Probably should get the distortion coefficients out of the tracker
-    cv::Mat cvDistCoeffs(4, 1, cv::DataType<float>::type);
-    cvDistCoeffs.at<float>(0) = 0;
-    cvDistCoeffs.at<float>(1) = 0;
-    cvDistCoeffs.at<float>(2) = 0;
-    cvDistCoeffs.at<float>(3) = 0;
-
-    // Use the identity transform for tracker relative positions
-    cv::Mat rvec(3, 1, cv::DataType<double>::type, double(0));
-    cv::Mat tvec(3, 1, cv::DataType<double>::type, double(0));
-
-    // Only one point to project
-    std::vector<cv::Point3f> cvObjectPoints;
-    cvObjectPoints.push_back(
-        cv::Point3f(
-        trackerRelativePosition->x,
-        trackerRelativePosition->y,
-        trackerRelativePosition->z));
-
-    // Compute the camera intrinsic matrix in opencv format
-    cv::Matx33f cvCameraMatrix = computeOpenCVCameraIntrinsicMatrix(m_device);
-
-    // Projected point 
-    std::vector<cv::Point2f> projectedPoints;
-    cv::projectPoints(cvObjectPoints, rvec, tvec, cvCameraMatrix, cvDistCoeffs, projectedPoints);
-
-    // cv::projectPoints() returns position in pixel coordinates where:
-    //  (0, 0) is the lower left of the screen and +y is pointing up
-    // Convert this to CommonDeviceScreenLocation space where:
-    //  (0, 0) in the center of the screen with +y is pointing up
+    if (tracker_count < 2 || tracker_count > TrackerManager::k_max_devices)
     {
-        float screenWidth, screenHeight;
-        getPixelDimensions(screenWidth, screenHeight);
-
-        screenLocation.x = projectedPoints[0].x - (screenWidth / 2);
-        screenLocation.y = projectedPoints[0].y - (screenHeight / 2);
+        return false;
     }
 
-    return screenLocation;
-}
+    for (int tracker_index = 0; tracker_index < tracker_count; ++tracker_index)
+    {
+        const ServerTrackerView *tracker = trackers[tracker_index];
+        const CommonDeviceScreenLocation &screen_location = screen_locations[tracker_index];
 
+        // Convert the tracker screen location in CommonDeviceScreenLocation space
+        // i.e. [-frameWidth/2, -frameHeight/2]x[frameWidth/2, frameHeight/2] 
+        // into OpenCV pixel space
+        // i.e. [0, 0]x[frameWidth, frameHeight]
+        float screenWidth, screenHeight;
+        tracker->getPixelDimensions(screenWidth, screenHeight);
 
-// -- Tracker Utility Methods -----
-static glm::quat computeGLMCameraTransformQuaternion(const ITrackerInterface *tracker_device)
-{
+        // Screen locations line up with the (distorted) video frame,
+        // the triangulation wants them where the pinhole camera would have seen them
+        const cv::Point2f undistorted =
+            tracker->m_undistortion_map->undistortPoint(
+                cv::Point2f(screen_location.x + (screenWidth / 2), (screenHeight / 2) - screen_location.y));
 
-    const CommonDevicePose pose = tracker_device->getTrackerPose();
-    const CommonDeviceQuaternion &quat = pose.Orientation;
+        pixel_points[tracker_index] = Eigen::Vector2f(undistorted.x, screenHeight - undistorted.y);
 
-    const glm::quat glm_quat(quat.w, quat.x, quat.y, quat.z);
+        // The pinhole camera matrix of each tracker lets you raycast from the tracker center
+        // in world space through the screen location, into the world
+        pinhole_matrices[tracker_index] = tracker->m_camera_model->eigenPinholeMatrix;
 
-    return glm_quat;
-}
+        // The target was at X + offset when this view was captured.
+        // Seeing X + offset is the same as seeing X from a camera moved by -offset,
+        // i.e. P*[X + offset; 1] = P*[X; 1] + P.leftCols(3)*offset
+        if (capture_offsets != nullptr)
+        {
+            const CommonDeviceVector &offset = capture_offsets[tracker_index];
 
-static glm::mat4 computeGLMCameraTransformMatrix(const ITrackerInterface *tracker_device)
-{
+            pinhole_matrices[tracker_index].col(3) +=
+                pinhole_matrices[tracker_index].leftCols<3>() * Eigen::Vector3f(offset.i, offset.j, offset.k);
+        }
+    }
 
-    const CommonDevicePose pose = tracker_device->getTrackerPose();
-    const CommonDeviceQuaternion &quat = pose.Orientation;
-    const CommonDevicePosition &pos = pose.Position;
+    // Solve for the world position that best fits all of the views at once
+    Eigen::Vector3f world_position;
+    if (!eigen_alignment_triangulate_point(
+            pinhole_matrices, pixel_points, weights, tracker_count,
+            &world_position, out_reprojection_error))
+    {
+        return false;
+    }
 
-    const glm::quat glm_quat(quat.w, quat.x, quat.y, quat.z);
-    const glm::vec3 glm_pos(pos.x, pos.y, pos.z);
-    const glm::mat4 glm_camera_xform = glm_mat4_from_pose(glm_quat, glm_pos);
+    out_position->set(world_position.x(), world_position.y(), world_position.z());
 
-    return glm_camera_xform;
+    return true;
 }
 
-static cv::Matx34f computeOpenCVCameraExtrinsicMatrix(const ITrackerInterface *tracker_device)
+CommonDeviceScreenLocation
+ServerTrackerView::projectTrackerRelativePosition(const CommonDevicePosition *trackerRelativePosition) const
 {
-    cv::Matx34f out;
-
-    // Extrinsic matrix is the inverse of the camera pose matrix
-    const glm::mat4 glm_camera_xform = computeGLMCameraTransformMatrix(tracker_device);
-    const glm::mat4 glm_mat = glm::inverse(glm_camera_xform);
-
-    out(0, 0) = glm_mat[0][0]; out(0, 1) = glm_mat[1][0]; out(0, 2) = glm_mat[2][0]; out(0, 3) = glm_mat[3][0];
-    out(1, 0) = glm_mat[0][1]; out(1, 1) = glm_mat[1][1]; out(1, 2) = glm_mat[2][1]; out(1, 3) = glm_mat[3][1];
-    out(2, 0) = glm_mat[0][2]; out(2, 1) = glm_mat[1][2]; out(2, 2) = glm_mat[2][2]; out(2, 3) = glm_mat[3][2];
+    CommonDeviceScreenLocation screenLocation;
 
-    return out;
-}
+    // Project onto the ideal pinhole image first, the lens distortion gets applied below.
+    // Tracker relative positions need no extrinsic transform, so this is just the intrinsic matrix
+    // (same as cv::projectPoints() with an identity pose, without the allocations).
+    const float inv_z = safe_divide_with_default(1.f, trackerRelativePosition->z, 0.f);
+    const cv::Point2f projectedPoint(
+        m_camera_model->focalLengthX * trackerRelativePosition->x * inv_z + m_camera_model->principalX,
+        m_camera_model->focalLengthY * trackerRelativePosition->y * inv_z + m_camera_model->principalY);
 
-static cv::Matx33f computeOpenCVCameraIntrinsicMatrix(const ITrackerInterface *tracker_device)
-{
-    cv::Matx33f out;
+    // The projection is in pixel coordinates where:
+    //  (0, 0) is the lower left of the screen and +y is pointing up
+    // Convert this to CommonDeviceScreenLocation space where:
+    //  (0, 0) in the center of the screen with +y is pointing up
+    {
+        float screenWidth, screenHeight;
+        getPixelDimensions(screenWidth, screenHeight);
 
-    float F_PX, F_PY;
-    float PrincipalX, PrincipalY;
-    tracker_device->getCameraIntrinsics(F_PX, F_PY, PrincipalX, PrincipalY);
+        // Distort in raw (y-down) pixel space so the location lines up with the video frame
+        const cv::Point2f distortedPoint =
+            m_undistortion_map->distortPoint(
+                cv::Point2f(projectedPoint.x, screenHeight - projectedPoint.y));
 
-    out(0, 0) = F_PX; out(0, 1) = 0.f; out(0, 2) = PrincipalX;
-    out(1, 0) = 0.f; out(1, 1) = F_PY; out(1, 2) = PrincipalY;
-    out(2, 0) = 0.f; out(2, 1) = 0.f; out(2, 2) = 1.f;
+        screenLocation.x = distortedPoint.x - (screenWidth / 2);
+        screenLocation.y = (screenHeight / 2) - distortedPoint.y;
+    }
 
-    return out;
+    return screenLocation;
 }
 
-static cv::Matx34f computeOpenCVCameraPinholeMatrix(const ITrackerInterface *tracker_device)
+void ServerTrackerView::updateUndistortionMap()
 {
-    cv::Matx34f extrinsic_matrix = computeOpenCVCameraExtrinsicMatrix(tracker_device);
-    cv::Matx33f intrinsic_matrix = computeOpenCVCameraIntrinsicMatrix(tracker_device);
-    cv::Matx34f pinhole_matrix = intrinsic_matrix * extrinsic_matrix;
-
-    return pinhole_matrix;
+    if (m_undistortion_map->update(m_camera_model->lens, m_camera_model->frameWidth, m_camera_model->frameHeight) &&
+        !m_undistortion_map->getIsIdentity())
+    {
+        SERVER_LOG_INFO("ServerTrackerView::updateUndistortionMap") <<
+            "Device id " << getDeviceID() << " rebuilt contour undistortion grid";
+    }
 }
 
+
+// -- Tracker Utility Methods -----
 static bool computeTrackerRelativeLightBarContourPose(
-    const ITrackerInterface *tracker_device,
+    const TrackerCameraModel *camera_model,
+    const TrackerUndistortionMap *undistortion_map,
     const CommonDeviceTrackingShape *tracking_shape,
     const std::vector<cv::Point> &opencv_contour,
     const CommonDevicePose *tracker_relative_pose_guess,
@@ -1102,12 +2117,13 @@ static bool computeTrackerRelativeLightBarContourPose(
     assert(tracking_shape->shape_type == eCommonTrackingShapeType::LightBar);
 
     // Get the pixel width and height of the tracker image
-    int pixelWidth, pixelHeight;
-    tracker_device->getVideoFrameDimensions(&pixelWidth, &pixelHeight, nullptr);
+    const int pixelWidth = camera_model->frameWidth;
+    const int pixelHeight = camera_model->frameHeight;
 
     bool bValidTrackerPose= true;
     float projectionArea= 0.f;
-    std::vector<cv::Point2f> cvImagePoints;
+    std::vector<cv::Point2f> cvImagePoints; // where the corners appear in the video frame
+    std::vector<cv::Point2f> cvUndistortedImagePoints; // where the pinhole camera would have seen them
     {
         cv::Point2f tri_top, tri_bottom_left, tri_bottom_right;
         cv::Point2f quad_top_right, quad_top_left, quad_bottom_left, quad_bottom_right;
@@ -1152,13 +2168,19 @@ static bool computeTrackerRelativeLightBarContourPose(
                     cv::norm(quad_bottom_right-quad_bottom_left)
                     *cv::norm(quad_bottom_left-quad_top_left));
 
+            // Only the corners need undistorting, not the whole contour
+            cvUndistortedImagePoints= cvImagePoints;
+            undistortion_map->undistortPoints(cvUndistortedImagePoints);
+
             // Image pixel coordinates
             // intrinsic camera transform
             for (auto list_index = 0; list_index < cvImagePoints.size(); ++list_index)
             {
                 cv::Point2f &cvPoint= cvImagePoints[list_index];
+                cv::Point2f &cvUndistortedPoint= cvUndistortedImagePoints[list_index];
 
                 cvPoint.y= pixelHeight - cvPoint.y;
+                cvUndistortedPoint.y= pixelHeight - cvUndistortedPoint.y;
             }                    
         }
     }
@@ -1186,8 +2208,7 @@ static bool computeTrackerRelativeLightBarContourPose(
             cvObjectPoints.push_back(cv::Point3f(corner.x, corner.y, corner.z));
         }
 
-        // Assume no distortion
-        // TODO: Probably should get the distortion coefficients out of the tracker
+        // The image points have already been undistorted
         cv::Mat cvDistCoeffs(4, 1, cv::DataType<float>::type);
         cvDistCoeffs.at<float>(0) = 0;
         cvDistCoeffs.at<float>(1) = 0;
@@ -1195,7 +2216,7 @@ static bool computeTrackerRelativeLightBarContourPose(
         cvDistCoeffs.at<float>(3) = 0;
 
         // Get the tracker "intrinsic" matrix that encodes the camera FOV
-        cv::Matx33f cvCameraMatrix = computeOpenCVCameraIntrinsicMatrix(tracker_device);
+        const cv::Matx33f &cvCameraMatrix = camera_model->intrinsicMatrix;
 
         // Fill out the initial guess in OpenCV format for the contour pose
         // if a guess pose was provided
@@ -1229,7 +2250,7 @@ static bool computeTrackerRelativeLightBarContourPose(
         // solve for the object position and orientation that would allow
         // us to re-project the 3D points back onto the 2D pixel locations
         if (cv::solvePnP(
-                cvObjectPoints, cvImagePoints, 
+                cvObjectPoints, cvUndistortedImagePoints, 
                 cvCameraMatrix, cvDistCoeffs, 
                 rvec, tvec, 
                 bUseExtrinsicGuess, cv::SOLVEPNP_ITERATIVE))
@@ -1554,4 +2575,95 @@ static void angleAxisVectorToCommonDeviceOrientation(
     {
         orientation.clear();
     }
-}
\ No newline at end of file
+}
+
+static cv::Rect computeTrackingROI(
+    const TrackerCameraModel *camera_model,
+    const int frame_width, const int frame_height,
+    const ControllerOpticalPoseEstimation *prior_pose_estimate,
+    const float speed_cm_per_sec,
+    const int miss_limit)
+{
+    const cv::Rect full_frame_roi(0, 0, frame_width, frame_height);
+
+    // Fall back to a full frame search if we have no prior projection to seed from
+    // or we keep failing to find the controller in the window
+    if (prior_pose_estimate == nullptr ||
+        !prior_pose_estimate->bValidTimestamps ||
+        prior_pose_estimate->missed_frame_count >= miss_limit ||
+        prior_pose_estimate->position.z <= 0.f)
+    {
+        return full_frame_roi;
+    }
+
+    // Compute the bounds of the last projection in CommonDeviceScreenLocation space
+    // i.e. [-frameWidth/2, -frameHeight/2]x[frameWidth/2, frameHeight/2]
+    const CommonDeviceTrackingProjection &projection = prior_pose_estimate->projection;
+    float min_x, max_x, min_y, max_y;
+
+    switch (projection.shape_type)
+    {
+    case eCommonTrackingProjectionType::ProjectionType_Ellipse:
+        {
+            // The largest half extent bounds the ellipse at any angle
+            const float radius = std::max(projection.shape.ellipse.half_x_extent, projection.shape.ellipse.half_y_extent);
+
+            min_x = projection.shape.ellipse.center.x - radius;
+            max_x = projection.shape.ellipse.center.x + radius;
+            min_y = projection.shape.ellipse.center.y - radius;
+            max_y = projection.shape.ellipse.center.y + radius;
+        } break;
+    case eCommonTrackingProjectionType::ProjectionType_LightBar:
+        {
+            min_x = max_x = projection.shape.lightbar.triangle[0].x;
+            min_y = max_y = projection.shape.lightbar.triangle[0].y;
+
+            for (int index = 1; index < 3; ++index)
+            {
+                const CommonDeviceScreenLocation &point = projection.shape.lightbar.triangle[index];
+
+                min_x = std::min(min_x, point.x); max_x = std::max(max_x, point.x);
+                min_y = std::min(min_y, point.y); max_y = std::max(max_y, point.y);
+            }
+
+            for (int index = 0; index < 4; ++index)
+            {
+                const CommonDeviceScreenLocation &point = projection.shape.lightbar.quad[index];
+
+                min_x = std::min(min_x, point.x); max_x = std::max(max_x, point.x);
+                min_y = std::min(min_y, point.y); max_y = std::max(max_y, point.y);
+            }
+        } break;
+    default:
+        return full_frame_roi;
+    }
+
+    // Grow the window by how far the controller could have moved on screen since we last saw it.
+    // Use the filtered speed so that the window is independent of the direction of travel.
+    const std::chrono::duration<float> time_since_visible =
+        std::chrono::high_resolution_clock::now() - prior_pose_estimate->last_visible_timestamp;
+    const float elapsed_seconds = std::max(time_since_visible.count(), 0.f) + k_roi_min_frame_time;
+    const float motion_padding_px = camera_model->focalLengthX * speed_cm_per_sec * elapsed_seconds / prior_pose_estimate->position.z;
+
+    const float extent_padding_px = k_roi_extent_padding_factor * std::max(max_x - min_x, max_y - min_y);
+    const float max_padding_px = static_cast<float>(std::max(frame_width, frame_height));
+    float padding_px = k_roi_min_padding_px + extent_padding_px + motion_padding_px;
+
+    // Written so that a NaN velocity also falls through to the clamp
+    if (!(padding_px < max_padding_px))
+    {
+        padding_px = max_padding_px;
+    }
+
+    // Convert to raw pixel space, i.e. [0, 0]x[frameWidth-1, frameHeight-1] (y-down), and clamp to the frame edges
+    const float half_width = static_cast<float>(frame_width) / 2.f;
+    const float half_height = static_cast<float>(frame_height) / 2.f;
+    const int left = static_cast<int>(floorf(min_x + half_width - padding_px));
+    const int right = static_cast<int>(ceilf(max_x + half_width + padding_px));
+    const int top = static_cast<int>(floorf(half_height - max_y - padding_px));
+    const int bottom = static_cast<int>(ceilf(half_height - min_y + padding_px));
+
+    const cv::Rect roi = cv::Rect(left, top, right - left + 1, bottom - top + 1) & full_frame_roi;
+
+    return (roi.area() > 0) ? roi : full_frame_roi;
+}
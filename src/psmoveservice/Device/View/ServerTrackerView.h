@@ -4,6 +4,8 @@
 //-- includes -----
 #include "ServerDeviceView.h"
 #include "PSMoveProtocolInterface.h"
+#include <atomic>
+#include <mutex>
 
 // -- pre-declarations -----
 namespace PSMoveProtocol
@@ -27,7 +29,7 @@ public:
     void startSharedMemoryVideoStream();
     void stopSharedMemoryVideoStream();
 
-    // Fetch the next video frame and copy to shared memory
+    // Fetch the newest video frame (from the capture thread, if running) and copy to shared memory
     bool poll() override;
 
     IDeviceInterface* getDevice() const override {return m_device;}
@@ -50,6 +52,10 @@ public:
     double getGain() const;
     void setGain(double value);
     
+    // Segment the latest video frame against the tracking colors of every tracked controller at once.
+    // Like computePoseForController(), only reads the controllers' optical snapshots.
+    void computeTrackingColorSegmentation(class ControllerManager *controller_manager);
+
     bool computePoseForController(
         const class ServerControllerView* tracked_controller, 
         const CommonDevicePose *tracker_pose_guess,
@@ -60,10 +66,15 @@ public:
     CommonDevicePosition computeWorldPosition(const CommonDevicePosition *tracker_relative_position);
     CommonDeviceQuaternion computeWorldOrientation(const CommonDeviceQuaternion *tracker_relative_orientation);
 
-    /// Given screen locations on two different trackers, compute the triangulated world space location
-    static CommonDevicePosition triangulateWorldPosition(
-        const ServerTrackerView *tracker, const CommonDeviceScreenLocation *screen_location,
-        const ServerTrackerView *other_tracker, const CommonDeviceScreenLocation *other_screen_location);
+    /// Given screen locations on two or more trackers, compute the least squares world space location.
+    /// If the views were captured at different times, capture_offsets holds where the target was
+    /// relative to the solved position when each one was captured (or nullptr if they line up).
+    /// Each tracker's squared pixel error is scaled by its weight.
+    /// Optionally returns the weighted RMS reprojection error in pixels.
+    static bool triangulateWorldPosition(
+        const ServerTrackerView * const *trackers, const CommonDeviceScreenLocation *screen_locations,
+        const CommonDeviceVector *capture_offsets, const float *weights, const int tracker_count,
+        CommonDevicePosition *out_position, float *out_reprojection_error= nullptr);
 
     /// Given screen projections on two different trackers, compute the triangulated world space location
     static CommonDevicePose triangulateWorldPose(
@@ -77,6 +88,15 @@ public:
         float focalLengthX, float focalLengthY,
         float principalX, float principalY);
 
+    void getCameraDistortion(
+        float &outK1, float &outK2,
+        float &outP1, float &outP2,
+        float &outK3) const;
+    void setCameraDistortion(
+        float k1, float k2,
+        float p1, float p2,
+        float k3);
+
     CommonDevicePose getTrackerPose() const;
     void setTrackerPose(const struct CommonDevicePose *pose);
 
@@ -101,11 +121,19 @@ protected:
         DeviceOutputDataFramePtr &data_frame);
 
 private:
+    // Rebuild the contour undistortion grid from the camera model if the lens settings or frame size changed
+    void updateUndistortionMap();
+
     char m_shared_memory_name[256];
     class SharedVideoFrameReadWriteAccessor *m_shared_memory_accesor;
     int m_shared_memory_video_stream_count;
-    class OpenCVBufferState *m_opencv_buffer_state;
+    class TrackerCaptureWorker *m_capture_worker;
+    class OpenCVBufferState *m_opencv_buffer_state; // latest frame fetched from the capture worker (not owned)
+    class TrackerUndistortionMap *m_undistortion_map;
+    class TrackerCameraModel *m_camera_model; // transforms and projections cached from the pose and intrinsics
+    std::atomic_bool m_bCameraModelDirty; // pose or lens settings changed since the camera model was last rebuilt
     ITrackerInterface *m_device;
+    mutable std::mutex m_device_mutex; // guards the device settings, never held across a (blocking) device poll
 };
 
 #endif // SERVER_TRACKER_VIEW_H
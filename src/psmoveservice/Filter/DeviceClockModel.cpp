@@ -0,0 +1,160 @@
+// -- includes -----
+#include "DeviceClockModel.h"
+#include <algorithm>
+#include <cmath>
+
+//-- constants -----
+// How far back the clock rate fit effectively looks.
+// Long enough to average out the read latency jitter, short enough to follow thermal drift.
+#define k_fit_time_constant_seconds 30.0
+
+// How much history the fit needs before its sample times get used
+#define k_min_fit_seconds 1.0
+#define k_min_fit_samples 30
+
+// Before the clock rate is known, a gap this long between reads might hide a counter wrap
+#define k_max_unsynchronized_read_gap_seconds 0.2
+
+// How fast the lower envelope creeps back up, so it can follow the fitted line if it settles higher
+#define k_envelope_rise_rate 0.001 // seconds per second
+
+// A report read this long after the model says it was sampled means the model has lost track of the device
+// (e.g. the device restarted its counter or enough reports went missing to miscount the wraps)
+#define k_max_read_latency_seconds 0.5
+
+// -- public interface -----
+DeviceClockModel::DeviceClockModel(const int tick_counter_bits)
+    : m_tick_modulus(1LL << tick_counter_bits)
+{
+    reset();
+}
+
+void DeviceClockModel::reset()
+{
+    m_origin_time = timestamp();
+    m_last_raw_ticks = 0;
+    m_unwrapped_ticks = 0;
+    m_last_read_seconds = 0.0;
+    m_sample_count = 0;
+
+    m_weight_sum = 0.0;
+    m_mean_ticks = 0.0;
+    m_mean_seconds = 0.0;
+    m_ticks_variance_sum = 0.0;
+    m_covariance_sum = 0.0;
+
+    m_seconds_per_tick = 0.0;
+    m_envelope_offset_seconds = 0.0;
+    m_bIsSynchronized = false;
+}
+
+bool DeviceClockModel::update(
+    const unsigned int raw_ticks,
+    const timestamp &read_time,
+    timestamp &out_sample_time)
+{
+    if (m_sample_count == 0)
+    {
+        restart(raw_ticks, read_time);
+        return false;
+    }
+
+    const std::chrono::duration<double> read_duration = read_time - m_origin_time;
+    const double read_seconds = read_duration.count();
+    const double read_gap_seconds = std::max(read_seconds - m_last_read_seconds, 0.0);
+
+    // Unwrap the counter.
+    // Normally it advances less than a full wrap between reports,
+    // but after a long gap the fitted clock rate says how many wraps went by.
+    long long delta_ticks = static_cast<long long>(raw_ticks - m_last_raw_ticks) & (m_tick_modulus - 1);
+
+    if (m_bIsSynchronized)
+    {
+        const double expected_delta_ticks = read_gap_seconds / m_seconds_per_tick;
+
+        if (expected_delta_ticks > static_cast<double>(m_tick_modulus / 2))
+        {
+            const double missed_wraps =
+                std::floor((expected_delta_ticks - static_cast<double>(delta_ticks)) / static_cast<double>(m_tick_modulus) + 0.5);
+
+            delta_ticks += static_cast<long long>(std::max(missed_wraps, 0.0)) * m_tick_modulus;
+        }
+    }
+    else if (read_gap_seconds > k_max_unsynchronized_read_gap_seconds)
+    {
+        restart(raw_ticks, read_time);
+        return false;
+    }
+
+    m_last_raw_ticks = raw_ticks;
+    m_unwrapped_ticks += delta_ticks;
+    m_last_read_seconds = read_seconds;
+    ++m_sample_count;
+
+    // Fold the report into the exponentially weighted fit of read time against ticks
+    const double ticks = static_cast<double>(m_unwrapped_ticks);
+    const double decay = std::exp(-read_gap_seconds / k_fit_time_constant_seconds);
+    const double ticks_error = ticks - m_mean_ticks;
+
+    m_weight_sum = decay*m_weight_sum + 1.0;
+    m_mean_ticks += ticks_error / m_weight_sum;
+    m_mean_seconds += (read_seconds - m_mean_seconds) / m_weight_sum;
+    m_ticks_variance_sum = decay*m_ticks_variance_sum + ticks_error*(ticks - m_mean_ticks);
+    m_covariance_sum = decay*m_covariance_sum + ticks_error*(read_seconds - m_mean_seconds);
+
+    if (m_ticks_variance_sum <= 0.0 || m_covariance_sum <= 0.0)
+    {
+        // The counter isn't advancing (yet)
+        return false;
+    }
+
+    m_seconds_per_tick = m_covariance_sum / m_ticks_variance_sum;
+
+    const double residual_seconds = read_seconds - (m_mean_seconds + m_seconds_per_tick*(ticks - m_mean_ticks));
+
+    if (m_bIsSynchronized)
+    {
+        m_envelope_offset_seconds =
+            std::min(m_envelope_offset_seconds + k_envelope_rise_rate*read_gap_seconds, residual_seconds);
+
+        if (residual_seconds - m_envelope_offset_seconds > k_max_read_latency_seconds)
+        {
+            restart(raw_ticks, read_time);
+            return false;
+        }
+    }
+    else if (read_seconds >= k_min_fit_seconds && m_sample_count >= k_min_fit_samples)
+    {
+        m_envelope_offset_seconds = residual_seconds;
+        m_bIsSynchronized = true;
+    }
+
+    if (m_bIsSynchronized)
+    {
+        // Never later than the report was read, which the envelope guarantees up to rounding
+        const double sample_seconds = std::min(computeEnvelopeSeconds(ticks), read_seconds);
+
+        out_sample_time =
+            m_origin_time +
+            std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+                std::chrono::duration<double>(sample_seconds));
+    }
+
+    return m_bIsSynchronized;
+}
+
+// -- private methods -----
+void DeviceClockModel::restart(const unsigned int raw_ticks, const timestamp &read_time)
+{
+    reset();
+
+    m_origin_time = read_time;
+    m_last_raw_ticks = raw_ticks;
+    m_sample_count = 1;
+    m_weight_sum = 1.0;
+}
+
+double DeviceClockModel::computeEnvelopeSeconds(const double ticks) const
+{
+    return m_mean_seconds + m_seconds_per_tick*(ticks - m_mean_ticks) + m_envelope_offset_seconds;
+}
@@ -0,0 +1,68 @@
+#ifndef DEVICE_CLOCK_MODEL_H
+#define DEVICE_CLOCK_MODEL_H
+
+//-- includes -----
+#include <chrono>
+
+//-- declarations -----
+/// Maps the wrapping tick counter a controller stamps its reports with onto the host clock.
+/**
+Reports come over bluetooth in bursts and get read whenever the service gets around to polling,
+so the host time a report is read at says little about when its sensors were sampled.
+The device counter does, it just counts in its own units from its own origin and wraps around.
+
+The model unwraps the counter and fits host time as a linear function of device ticks:
+- The slope (host seconds per tick, i.e. the device clock rate including its drift against the host clock)
+  comes from an exponentially weighted least squares fit of read time against ticks.
+- The intercept follows the lower envelope of the read times about that line,
+  since a report can only ever be read after it was sampled, and the least delayed ones tell the most.
+The counter's units don't have to be known up front, the fit learns them.
+*/
+class DeviceClockModel
+{
+public:
+    typedef std::chrono::time_point<std::chrono::high_resolution_clock> timestamp;
+
+    DeviceClockModel(const int tick_counter_bits);
+
+    /// Forget everything learned about the device clock, e.g. when the device reconnects
+    void reset();
+
+    /// Feed the model the next raw counter value along with the host time the report it came in was read at.
+    /// Reports must be fed in the order the device sent them.
+    /// Returns true and the host time the report was sampled at once the model has locked on.
+    bool update(const unsigned int raw_ticks, const timestamp &read_time, timestamp &out_sample_time);
+
+    /// True once there's enough history for update() to produce sample times
+    inline bool getIsSynchronized() const
+    { return m_bIsSynchronized; }
+
+    /// The fitted duration of one device tick in host seconds
+    inline double getSecondsPerTick() const
+    { return m_seconds_per_tick; }
+
+private:
+    void restart(const unsigned int raw_ticks, const timestamp &read_time);
+    double computeEnvelopeSeconds(const double ticks) const;
+
+    const long long m_tick_modulus;
+
+    timestamp m_origin_time; // host time of the first report read since the last restart
+    unsigned int m_last_raw_ticks;
+    long long m_unwrapped_ticks; // ticks since the first report read since the last restart
+    double m_last_read_seconds; // host seconds from the origin of the last report read
+    int m_sample_count;
+
+    // Exponentially weighted fit of read seconds against ticks
+    double m_weight_sum;
+    double m_mean_ticks;
+    double m_mean_seconds;
+    double m_ticks_variance_sum;
+    double m_covariance_sum;
+
+    double m_seconds_per_tick;
+    double m_envelope_offset_seconds; // lower envelope of the read times relative to the fitted line
+    bool m_bIsSynchronized;
+};
+
+#endif // DEVICE_CLOCK_MODEL_H
@@ -0,0 +1,108 @@
+#ifndef FILTER_HISTORY_H
+#define FILTER_HISTORY_H
+
+//-- includes -----
+#include "MathEigen.h"
+#include <chrono>
+
+//-- declarations -----
+/// A fixed size ring buffer of the packets a filter applied, along with the filter state from before each one.
+/**
+Lets a filter rewind to the state it was in at some point in the recent past
+and re-apply the packets from then on, e.g. when a measurement shows up that
+was taken before some of the packets that have already been applied.
+Once full, recording a packet overwrites the oldest one.
+*/
+template <typename t_fusion_state, typename t_filter_packet, int t_capacity>
+class FilterHistory
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef std::chrono::time_point<std::chrono::high_resolution_clock> timestamp;
+
+    struct Entry
+    {
+        timestamp sample_time;
+        float delta_time;
+        t_filter_packet packet;
+        t_fusion_state state_before; // the fusion state the packet got applied to
+    };
+
+    FilterHistory()
+        : m_oldest_index(0)
+        , m_count(0)
+    {
+    }
+
+    inline void clear()
+    {
+        m_oldest_index = 0;
+        m_count = 0;
+    }
+
+    inline int getCount() const
+    {
+        return m_count;
+    }
+
+    /// Entries in the order they were recorded, 0 being the oldest
+    inline Entry &getEntry(int index)
+    {
+        return m_entries[(m_oldest_index + index) % t_capacity];
+    }
+
+    inline Entry &record(
+        const timestamp &sample_time,
+        const float delta_time,
+        const t_filter_packet &packet,
+        const t_fusion_state &state_before)
+    {
+        Entry *entry;
+
+        if (m_count < t_capacity)
+        {
+            entry = &getEntry(m_count);
+            ++m_count;
+        }
+        else
+        {
+            entry = &m_entries[m_oldest_index];
+            m_oldest_index = (m_oldest_index + 1) % t_capacity;
+        }
+
+        entry->sample_time = sample_time;
+        entry->delta_time = delta_time;
+        entry->packet = packet;
+        entry->state_before = state_before;
+
+        return *entry;
+    }
+
+    /// The index of the first entry sampled at or after the given time,
+    /// getCount() if they were all sampled before it,
+    /// or -1 if the time is older than the history goes back.
+    inline int findFirstEntryIndexAtOrAfter(const timestamp &time)
+    {
+        if (m_count == 0 || time < getEntry(0).sample_time)
+        {
+            return -1;
+        }
+
+        // Late measurements are almost always for one of the last few packets
+        int index = m_count;
+        while (index > 0 && getEntry(index - 1).sample_time >= time)
+        {
+            --index;
+        }
+
+        return index;
+    }
+
+private:
+    Entry m_entries[t_capacity];
+    int m_oldest_index;
+    int m_count;
+};
+
+#endif // FILTER_HISTORY_H
@@ -1,5 +1,7 @@
 // -- includes -----
 #include "OrientationFilter.h"
+#include "FilterHistory.h"
+#include "OrientationFilterBatch.h"
 #include "MathAlignment.h"
 #include "ServerLog.h"
 #include <deque>
@@ -26,7 +28,8 @@ const Eigen::Matrix3f *k_eigen_sensor_transform_opengl= &g_eigen_sensor_transfor
 #define k_base_earth_frame_align_weight 0.02f
 
 // Max length of the orientation history we keep
-#define k_orientation_history_max 16
+// (enough packets to rewind a couple of camera frames at the controller's IMU rate)
+#define k_orientation_history_max 64
 
 // -- private definitions -----
 struct MadgwickMARGState
@@ -74,6 +77,11 @@ struct OrientationSensorFusionState
     }
 };
 
+struct OrientationFilterHistory : 
+    public FilterHistory<OrientationSensorFusionState, OrientationFilterPacket, k_orientation_history_max>
+{
+};
+
 // -- globals -----
 
 // -- private methods -----
@@ -163,14 +171,15 @@ void OrientationFilterSpace::convertSensorPacketToFilterPacket(
     outFilterPacket.normalized_accelerometer= m_SensorTransform * sensorPacket.accelerometer;
     outFilterPacket.normalized_magnetometer= m_SensorTransform * sensorPacket.magnetometer;
         
-    eigen_vector3f_normalize_with_default(outFilterPacket.normalized_accelerometer, Eigen::Vector3f());
-    eigen_vector3f_normalize_with_default(outFilterPacket.normalized_magnetometer, Eigen::Vector3f());
+    eigen_vector3f_normalize_with_default(outFilterPacket.normalized_accelerometer, Eigen::Vector3f::Zero());
+    eigen_vector3f_normalize_with_default(outFilterPacket.normalized_magnetometer, Eigen::Vector3f::Zero());
 }
 
 //-- Orientation Filter -----
 OrientationFilter::OrientationFilter()
     : m_FilterSpace()
     , m_FusionState(new OrientationSensorFusionState)
+    , m_History(new OrientationFilterHistory)
 {
     m_FusionState->fusion_type = FusionTypeNone;
     m_FusionState->initialize();
@@ -179,6 +188,7 @@ OrientationFilter::OrientationFilter()
 OrientationFilter::~OrientationFilter()
 {
     delete m_FusionState;
+    delete m_History;
 }
 
 
@@ -230,11 +240,13 @@ void OrientationFilter::setFilterSpace(const OrientationFilterSpace &filterSpace
 {
     m_FilterSpace= filterSpace;
     m_FusionState->initialize();
+    m_History->clear();
 }
 
 void OrientationFilter::setFusionType(OrientationFilter::FusionType fusionType)
 {
     m_FusionState->fusion_type = fusionType;
+    m_History->clear();
 
     switch (m_FusionState->fusion_type)
     {
@@ -270,20 +282,67 @@ void OrientationFilter::resetOrientation()
 
     eigen_quaternion_normalize_with_default(q_inverse, Eigen::Quaternionf::Identity());
     m_FusionState->reset_orientation= q_inverse;
+
+    // Rewinding past this point would undo the reset
+    m_History->clear();
 }
 
 void OrientationFilter::resetFilterState()
 {
     m_FusionState->initialize();
+    m_History->clear();
 }
 
 void OrientationFilter::update(
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time,
     const float delta_time, 
     const OrientationSensorPacket &sensorPacket)
 {
     OrientationFilterPacket filterPacket;
     m_FilterSpace.convertSensorPacketToFilterPacket(sensorPacket, filterPacket);
 
+    m_History->record(sample_time, delta_time, filterPacket, *m_FusionState);
+    applyFilterPacket(delta_time, filterPacket);
+}
+
+bool OrientationFilter::applyLateOpticalOrientation(
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &capture_time,
+    const Eigen::Quaternionf &orientation,
+    const float orientation_quality)
+{
+    const int first_index = m_History->findFirstEntryIndexAtOrAfter(capture_time);
+
+    if (first_index < 0)
+    {
+        return false;
+    }
+
+    // Rewind to the first packet sampled after the video frame was captured
+    // and replay everything since then with the optical orientation attached
+    if (first_index < m_History->getCount())
+    {
+        *m_FusionState = m_History->getEntry(first_index).state_before;
+    }
+
+    for (int entry_index = first_index; entry_index < m_History->getCount(); ++entry_index)
+    {
+        OrientationFilterHistory::Entry &entry = m_History->getEntry(entry_index);
+
+        entry.packet.orientation = orientation;
+        entry.packet.orientation_source = OrientationSource_Optical;
+        entry.packet.orientation_quality = orientation_quality;
+        entry.state_before = *m_FusionState;
+
+        applyFilterPacket(entry.delta_time, entry.packet);
+    }
+
+    return true;
+}
+
+void OrientationFilter::applyFilterPacket(
+    const float delta_time, 
+    const OrientationFilterPacket &filterPacket)
+{
     const Eigen::Quaternionf orientation_backup= m_FusionState->orientation;
     const Eigen::Vector3f first_derivative_backup = m_FusionState->angular_velocity;
     const Eigen::Vector3f second_derivative_backup = m_FusionState->angular_acceleration;
@@ -322,6 +381,97 @@ void OrientationFilter::update(
         break;
     }
 
+    validateFusionState(orientation_backup, first_derivative_backup, second_derivative_backup);
+}
+
+bool OrientationFilter::getSupportsBatchedUpdate() const
+{
+    return 
+        m_FusionState->fusion_type == FusionTypeMadgwickARG ||
+        m_FusionState->fusion_type == FusionTypeMadgwickMARG ||
+        m_FusionState->fusion_type == FusionTypeComplementaryOpticalARG;
+}
+
+bool OrientationFilter::stageBatchedUpdate(
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time,
+    const float delta_time,
+    const OrientationSensorPacket &sensorPacket,
+    OrientationFilterBatch &batch,
+    int &out_lane)
+{
+    if (!getSupportsBatchedUpdate() || batch.getIsFull())
+    {
+        return false;
+    }
+
+    OrientationFilterPacket filterPacket;
+    m_FilterSpace.convertSensorPacketToFilterPacket(sensorPacket, filterPacket);
+
+    m_History->record(sample_time, delta_time, filterPacket, *m_FusionState);
+
+    // Same choices the scalar updates make, as lane masks
+    const Eigen::Vector3f &current_g= filterPacket.normalized_accelerometer;
+    const Eigen::Vector3f &current_m= filterPacket.normalized_magnetometer;
+    const bool bIsMARG = m_FusionState->fusion_type == FusionTypeMadgwickMARG;
+    const bool bIsOpticalARG = m_FusionState->fusion_type == FusionTypeComplementaryOpticalARG;
+
+    OrientationFilterBatchInput input;
+    input.orientation = m_FusionState->orientation;
+    input.gyroscope_bias = 
+        bIsMARG
+        ? Eigen::Vector3f(m_FusionState->fusion_state.madgwick_marg_state.omega_bias.vec())
+        : Eigen::Vector3f::Zero();
+    input.gyroscope = filterPacket.gyroscope;
+    input.normalized_accelerometer = current_g;
+    input.normalized_magnetometer = current_m;
+    input.gravity_calibration_direction = m_FilterSpace.getGravityCalibrationDirection();
+    input.magnetometer_calibration_direction = m_FilterSpace.getMagnetometerCalibrationDirection();
+    input.bUseMagnetometer = bIsMARG && !current_g.isZero(k_normal_epsilon) && !current_m.isZero(k_normal_epsilon);
+    input.bUseGravity = input.bUseMagnetometer || !current_g.isApprox(Eigen::Vector3f::Zero(), k_normal_epsilon);
+    input.bBlendOptical = 
+        bIsOpticalARG && 
+        (filterPacket.orientation_source == OrientationSource_Optical || filterPacket.orientation_quality > k_real_epsilon);
+    input.optical_orientation = filterPacket.orientation;
+    input.optical_weight = 
+        input.bBlendOptical
+        ? clampf(filterPacket.orientation_quality, 0, k_max_optical_orientation_weight)
+        : 0.f;
+    input.beta = sqrtf(3.0f / 4.0f) * m_gyroError;
+    input.zeta = sqrtf(3.0f / 4.0f) * m_gyroDrift;
+    input.delta_time = delta_time;
+
+    out_lane = batch.addLane(input);
+
+    return true;
+}
+
+void OrientationFilter::finishBatchedUpdate(const OrientationFilterBatch &batch, const int lane)
+{
+    const Eigen::Quaternionf orientation_backup= m_FusionState->orientation;
+    const Eigen::Vector3f first_derivative_backup = m_FusionState->angular_velocity;
+    const Eigen::Vector3f second_derivative_backup = m_FusionState->angular_acceleration;
+    const Eigen::Vector3f angular_velocity = batch.getAngularVelocity(lane);
+
+    if (m_FusionState->fusion_type == FusionTypeMadgwickMARG)
+    {
+        const Eigen::Vector3f omega_bias = batch.getGyroscopeBias(lane);
+
+        m_FusionState->fusion_state.madgwick_marg_state.omega_bias = 
+            Eigen::Quaternionf(0.f, omega_bias.x(), omega_bias.y(), omega_bias.z());
+    }
+
+    m_FusionState->orientation = batch.getOrientation(lane);
+    m_FusionState->angular_velocity = angular_velocity;
+    m_FusionState->angular_acceleration = (angular_velocity - m_FusionState->angular_velocity) / batch.getDeltaTime(lane);
+
+    validateFusionState(orientation_backup, first_derivative_backup, second_derivative_backup);
+}
+
+void OrientationFilter::validateFusionState(
+    const Eigen::Quaternionf &orientation_backup,
+    const Eigen::Vector3f &first_derivative_backup,
+    const Eigen::Vector3f &second_derivative_backup)
+{
     if (!eigen_quaternion_is_valid(m_FusionState->orientation)) 
     {
         SERVER_LOG_WARNING("OrientationFilter") << "Orientation is NaN!" << std::endl;
@@ -557,6 +707,7 @@ static void orientation_fusion_complementary_optical_arg_update(
             filter_space,
             filter_packet,
             fusion_state);
+        return;
     }
 
     const Eigen::Vector3f &current_omega= filter_packet->gyroscope;
@@ -3,6 +3,7 @@
 
 //-- includes -----
 #include "MathEigen.h"
+#include <chrono>
 
 //-- constants -----
 // Calibration Pose transform
@@ -120,11 +121,42 @@ public:
 
     void resetOrientation();
     void resetFilterState();
-    void update(const float delta_time, const OrientationSensorPacket &packet);
+    /// Apply a packet of sensor data sampled at sample_time, delta_time after the previous packet
+    void update(
+        const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time,
+        const float delta_time, 
+        const OrientationSensorPacket &packet);
+    /// Apply an optical orientation captured at capture_time, which is usually older than the last packets applied:
+    /// the filter rewinds to capture_time and re-applies every packet since then as if it had come with this orientation.
+    /// Returns false if capture_time is further back than the filter keeps packets for.
+    bool applyLateOpticalOrientation(
+        const std::chrono::time_point<std::chrono::high_resolution_clock> &capture_time,
+        const Eigen::Quaternionf &orientation,
+        const float orientation_quality);
+
+    /// True if the fusion type can be updated as one lane of an OrientationFilterBatch
+    bool getSupportsBatchedUpdate() const;
+    /// update() split in two around OrientationFilterBatch::update(), so one pass can update several filters.
+    /// Returns false without doing anything if the fusion type can't be batched or the batch is full,
+    /// in which case call update() instead.
+    bool stageBatchedUpdate(
+        const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time,
+        const float delta_time,
+        const OrientationSensorPacket &packet,
+        class OrientationFilterBatch &batch,
+        int &out_lane);
+    void finishBatchedUpdate(const class OrientationFilterBatch &batch, const int lane);
 
 private:
+    void applyFilterPacket(const float delta_time, const OrientationFilterPacket &filterPacket);
+    void validateFusionState(
+        const Eigen::Quaternionf &orientation_backup,
+        const Eigen::Vector3f &first_derivative_backup,
+        const Eigen::Vector3f &second_derivative_backup);
+
     OrientationFilterSpace m_FilterSpace;
     struct OrientationSensorFusionState *m_FusionState;
+    struct OrientationFilterHistory *m_History;
 
     float m_gyroError; // rad/s^2
     float m_gyroDrift; // rad/s
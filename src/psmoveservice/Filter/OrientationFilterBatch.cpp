@@ -0,0 +1,208 @@
+// -- includes -----
+#include "OrientationFilterBatch.h"
+#include "MathUtility.h"
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+
+// -- private methods -----
+// Adds weight * J(q;d)*f(q;d,s) to the gradient, where f(q;d,s) = (q^-1 * d * q) - s.
+// Same as eigen_alignment_compute_objective_vector() and eigen_alignment_compute_objective_jacobian()
+// written out per component so it inlines into the lane loop.
+static inline void accumulate_alignment_gradient(
+    const float qw, const float qx, const float qy, const float qz,
+    const float dx, const float dy, const float dz,
+    const float sx, const float sy, const float sz,
+    const float weight,
+    float &gw, float &gx, float &gy, float &gz)
+{
+    // The reference direction rotated into the sensor frame, minus the measured direction
+    const float fx = (1.f - 2.f*(qy*qy + qz*qz))*dx + 2.f*(qx*qy + qw*qz)*dy + 2.f*(qx*qz - qw*qy)*dz - sx;
+    const float fy = 2.f*(qx*qy - qw*qz)*dx + (1.f - 2.f*(qx*qx + qz*qz))*dy + 2.f*(qy*qz + qw*qx)*dz - sy;
+    const float fz = 2.f*(qx*qz + qw*qy)*dx + 2.f*(qy*qz - qw*qx)*dy + (1.f - 2.f*(qx*qx + qy*qy))*dz - sz;
+
+    const float two_dxq1 = 2.f*dx*qw, two_dxq2 = 2.f*dx*qx, two_dxq3 = 2.f*dx*qy, two_dxq4 = 2.f*dx*qz;
+    const float two_dyq1 = 2.f*dy*qw, two_dyq2 = 2.f*dy*qx, two_dyq3 = 2.f*dy*qy, two_dyq4 = 2.f*dy*qz;
+    const float two_dzq1 = 2.f*dz*qw, two_dzq2 = 2.f*dz*qx, two_dzq3 = 2.f*dz*qy, two_dzq4 = 2.f*dz*qz;
+
+    gw += weight*(
+        (two_dyq4 - two_dzq3)*fx +
+        (-two_dxq4 + two_dzq2)*fy +
+        (two_dxq3 - two_dyq2)*fz);
+    gx += weight*(
+        (two_dyq3 + two_dzq4)*fx +
+        (two_dxq3 - 2.f*two_dyq2 + two_dzq1)*fy +
+        (two_dxq4 - two_dyq1 - 2.f*two_dzq2)*fz);
+    gy += weight*(
+        (-2.f*two_dxq3 + two_dyq2 - two_dzq1)*fx +
+        (two_dxq2 + two_dzq4)*fy +
+        (two_dxq1 + two_dyq4 - 2.f*two_dzq3)*fz);
+    gz += weight*(
+        (-2.f*two_dxq4 + two_dyq1 + two_dzq2)*fx +
+        (-two_dxq1 - 2.f*two_dyq4 + two_dzq3)*fy +
+        (two_dxq2 + two_dyq3)*fz);
+}
+
+// -- public interface -----
+OrientationFilterBatch::OrientationFilterBatch()
+    : m_lane_count(0)
+{
+}
+
+int OrientationFilterBatch::addLane(const OrientationFilterBatchInput &input)
+{
+    if (getIsFull())
+    {
+        return -1;
+    }
+
+    const int lane = m_lane_count;
+    ++m_lane_count;
+
+    m_qw[lane] = input.orientation.w();
+    m_qx[lane] = input.orientation.x();
+    m_qy[lane] = input.orientation.y();
+    m_qz[lane] = input.orientation.z();
+    m_bias_x[lane] = input.gyroscope_bias.x();
+    m_bias_y[lane] = input.gyroscope_bias.y();
+    m_bias_z[lane] = input.gyroscope_bias.z();
+
+    m_gyro_x[lane] = input.gyroscope.x();
+    m_gyro_y[lane] = input.gyroscope.y();
+    m_gyro_z[lane] = input.gyroscope.z();
+    m_accel_x[lane] = input.normalized_accelerometer.x();
+    m_accel_y[lane] = input.normalized_accelerometer.y();
+    m_accel_z[lane] = input.normalized_accelerometer.z();
+    m_mag_x[lane] = input.normalized_magnetometer.x();
+    m_mag_y[lane] = input.normalized_magnetometer.y();
+    m_mag_z[lane] = input.normalized_magnetometer.z();
+
+    m_gravity_x[lane] = input.gravity_calibration_direction.x();
+    m_gravity_y[lane] = input.gravity_calibration_direction.y();
+    m_gravity_z[lane] = input.gravity_calibration_direction.z();
+    m_field_x[lane] = input.magnetometer_calibration_direction.x();
+    m_field_y[lane] = input.magnetometer_calibration_direction.y();
+    m_field_z[lane] = input.magnetometer_calibration_direction.z();
+
+    m_optical_qw[lane] = input.optical_orientation.w();
+    m_optical_qx[lane] = input.optical_orientation.x();
+    m_optical_qy[lane] = input.optical_orientation.y();
+    m_optical_qz[lane] = input.optical_orientation.z();
+    m_optical_weight[lane] = input.bBlendOptical ? input.optical_weight : 0.f;
+
+    m_gravity_mask[lane] = input.bUseGravity ? 1.f : 0.f;
+    m_magnetometer_mask[lane] = input.bUseMagnetometer ? 1.f : 0.f;
+    m_beta[lane] = input.beta;
+    m_zeta[lane] = input.zeta;
+    m_delta_time[lane] = input.delta_time;
+
+    return lane;
+}
+
+void OrientationFilterBatch::update()
+{
+    const int lane_count = m_lane_count;
+
+    for (int lane = 0; lane < lane_count; ++lane)
+    {
+        // Current orientation from earth frame to sensor frame
+        const float qw = m_qw[lane], qx = m_qx[lane], qy = m_qy[lane], qz = m_qz[lane];
+        const float magnetometer_mask = m_magnetometer_mask[lane];
+        const float delta_time = m_delta_time[lane];
+
+        // Eqn 34) gradient_F= J_gb(SEq, Eb)*f(SEq, Sa, Eb, Sm)
+        float gw = 0.f, gx = 0.f, gy = 0.f, gz = 0.f;
+        accumulate_alignment_gradient(
+            qw, qx, qy, qz,
+            m_gravity_x[lane], m_gravity_y[lane], m_gravity_z[lane],
+            m_accel_x[lane], m_accel_y[lane], m_accel_z[lane],
+            m_gravity_mask[lane],
+            gw, gx, gy, gz);
+        accumulate_alignment_gradient(
+            qw, qx, qy, qz,
+            m_field_x[lane], m_field_y[lane], m_field_z[lane],
+            m_mag_x[lane], m_mag_y[lane], m_mag_z[lane],
+            magnetometer_mask,
+            gw, gx, gy, gz);
+
+        // normalize the gradient to estimate direction of the gyroscope error
+        // (clamped rather than branched around, so the loop stays branch free)
+        const float gradient_length = std::sqrt(gw*gw + gx*gx + gy*gy + gz*gz);
+        const float gradient_mask = (gradient_length > k_real_epsilon) ? 1.f : 0.f;
+        const float inv_gradient_length = gradient_mask / std::max(gradient_length, k_real_epsilon);
+        gw *= inv_gradient_length; gx *= inv_gradient_length; gy *= inv_gradient_length; gz *= inv_gradient_length;
+
+        // Eqn 47) omega_err= 2*SEq*SEqHatDot
+        // Eqn 48) net_omega_bias+= zeta*omega_err
+        // (no bias should accumulate on the w-component, and only the MARG update learns it)
+        const float bias_step = 2.f*m_zeta[lane]*delta_time*magnetometer_mask;
+        const float bias_x = m_bias_x[lane] + bias_step*(qw*gx + qx*gw + qy*gz - qz*gy);
+        const float bias_y = m_bias_y[lane] + bias_step*(qw*gy - qx*gz + qy*gw + qz*gx);
+        const float bias_z = m_bias_z[lane] + bias_step*(qw*gz + qx*gy - qy*gx + qz*gw);
+
+        // Eqn 49) omega_corrected = omega - net_omega_bias
+        const float omega_x = m_gyro_x[lane] - magnetometer_mask*bias_x;
+        const float omega_y = m_gyro_y[lane] - magnetometer_mask*bias_y;
+        const float omega_z = m_gyro_z[lane] - magnetometer_mask*bias_z;
+
+        // Eqn 12) q_dot = 0.5*q*omega
+        // Eqn 43) SEq_est = SEqDot_omega - beta*SEqHatDot
+        const float beta = m_beta[lane];
+        const float dw = 0.5f*(-qx*omega_x - qy*omega_y - qz*omega_z) - beta*gw;
+        const float dx = 0.5f*(qw*omega_x + qy*omega_z - qz*omega_y) - beta*gx;
+        const float dy = 0.5f*(qw*omega_y - qx*omega_z + qz*omega_x) - beta*gy;
+        const float dz = 0.5f*(qw*omega_z + qx*omega_y - qy*omega_x) - beta*gz;
+
+        // Eqn 42) SEq_new = SEq + SEqDot_est*delta_t
+        float new_w = qw + dw*delta_time;
+        float new_x = qx + dx*delta_time;
+        float new_y = qy + dy*delta_time;
+        float new_z = qz + dz*delta_time;
+
+        // Make sure the net quaternion is a pure rotation quaternion
+        const float new_length_sq = new_w*new_w + new_x*new_x + new_y*new_y + new_z*new_z;
+        const float inv_new_length = 1.f / std::sqrt(std::max(new_length_sq, k_real_epsilon));
+        new_w *= inv_new_length; new_x *= inv_new_length; new_y *= inv_new_length; new_z *= inv_new_length;
+
+        // The complementary optical update blends towards the optical orientation
+        // (the other lanes have no optical weight, so this just leaves them normalized)
+        const float optical_weight = m_optical_weight[lane];
+        float blend_w = new_w*(1.f - optical_weight) + m_optical_qw[lane]*optical_weight;
+        float blend_x = new_x*(1.f - optical_weight) + m_optical_qx[lane]*optical_weight;
+        float blend_y = new_y*(1.f - optical_weight) + m_optical_qy[lane]*optical_weight;
+        float blend_z = new_z*(1.f - optical_weight) + m_optical_qz[lane]*optical_weight;
+        const float blend_length_sq = blend_w*blend_w + blend_x*blend_x + blend_y*blend_y + blend_z*blend_z;
+        const float inv_blend_length = 1.f / std::sqrt(std::max(blend_length_sq, k_real_epsilon));
+        blend_w *= inv_blend_length; blend_x *= inv_blend_length; blend_y *= inv_blend_length; blend_z *= inv_blend_length;
+
+        m_qw[lane] = blend_w;
+        m_qx[lane] = blend_x;
+        m_qy[lane] = blend_y;
+        m_qz[lane] = blend_z;
+
+        m_bias_x[lane] = bias_x;
+        m_bias_y[lane] = bias_y;
+        m_bias_z[lane] = bias_z;
+        m_omega_x[lane] = omega_x;
+        m_omega_y[lane] = omega_y;
+        m_omega_z[lane] = omega_z;
+    }
+}
+
+Eigen::Quaternionf OrientationFilterBatch::getOrientation(int lane) const
+{
+    assert(lane >= 0 && lane < m_lane_count);
+    return Eigen::Quaternionf(m_qw[lane], m_qx[lane], m_qy[lane], m_qz[lane]);
+}
+
+Eigen::Vector3f OrientationFilterBatch::getGyroscopeBias(int lane) const
+{
+    assert(lane >= 0 && lane < m_lane_count);
+    return Eigen::Vector3f(m_bias_x[lane], m_bias_y[lane], m_bias_z[lane]);
+}
+
+Eigen::Vector3f OrientationFilterBatch::getAngularVelocity(int lane) const
+{
+    assert(lane >= 0 && lane < m_lane_count);
+    return Eigen::Vector3f(m_omega_x[lane], m_omega_y[lane], m_omega_z[lane]);
+}
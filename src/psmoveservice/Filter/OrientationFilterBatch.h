@@ -0,0 +1,93 @@
+#ifndef ORIENTATION_FILTER_BATCH_H
+#define ORIENTATION_FILTER_BATCH_H
+
+//-- includes -----
+#include "MathEigen.h"
+
+//-- declarations -----
+/// Everything one orientation filter update needs, gathered by OrientationFilter::stageBatchedUpdate()
+struct OrientationFilterBatchInput
+{
+    Eigen::Quaternionf orientation;
+    Eigen::Vector3f gyroscope_bias; // Madgwick MARG only, zero otherwise
+    Eigen::Vector3f gyroscope;
+    Eigen::Vector3f normalized_accelerometer;
+    Eigen::Vector3f normalized_magnetometer;
+    Eigen::Vector3f gravity_calibration_direction;
+    Eigen::Vector3f magnetometer_calibration_direction;
+    Eigen::Quaternionf optical_orientation;
+    float optical_weight;
+    bool bUseGravity; // steer towards the gravity direction
+    bool bUseMagnetometer; // steer towards the magnetic field direction and learn the gyro bias (Madgwick MARG)
+    bool bBlendOptical; // blend the result with the optical orientation (complementary optical ARG)
+    float beta; // gyro measurement error gain
+    float zeta; // gyro drift gain
+    float delta_time;
+};
+
+/// Runs the Madgwick style orientation filter update for several controllers at once.
+/**
+The lanes are kept in structure-of-arrays form and every step of the update is a
+branch free loop across them, which the compiler turns into SIMD code.
+The per-mode differences (with or without gravity, magnetometer or optical blend)
+are masks rather than branches, so controllers using different fusion types still share one pass.
+
+Computes the same thing as the scalar orientation_fusion_madgwick_arg_update(),
+orientation_fusion_madgwick_marg_update() and orientation_fusion_complementary_optical_arg_update().
+*/
+class OrientationFilterBatch
+{
+public:
+    static const int k_max_lanes = 8;
+
+    OrientationFilterBatch();
+
+    inline void clear()
+    { m_lane_count = 0; }
+    inline int getLaneCount() const
+    { return m_lane_count; }
+    inline bool getIsFull() const
+    { return m_lane_count >= k_max_lanes; }
+
+    /// Returns the lane the input went in, or -1 if the batch is full
+    int addLane(const OrientationFilterBatchInput &input);
+
+    /// Update every lane added since the last clear()
+    void update();
+
+    Eigen::Quaternionf getOrientation(int lane) const;
+    Eigen::Vector3f getGyroscopeBias(int lane) const;
+    Eigen::Vector3f getAngularVelocity(int lane) const; // the bias corrected gyroscope reading
+    inline float getDeltaTime(int lane) const
+    { return m_delta_time[lane]; }
+
+private:
+    int m_lane_count;
+
+    // Filter state
+    float m_qw[k_max_lanes], m_qx[k_max_lanes], m_qy[k_max_lanes], m_qz[k_max_lanes];
+    float m_bias_x[k_max_lanes], m_bias_y[k_max_lanes], m_bias_z[k_max_lanes];
+    float m_omega_x[k_max_lanes], m_omega_y[k_max_lanes], m_omega_z[k_max_lanes];
+
+    // Sensor readings
+    float m_gyro_x[k_max_lanes], m_gyro_y[k_max_lanes], m_gyro_z[k_max_lanes];
+    float m_accel_x[k_max_lanes], m_accel_y[k_max_lanes], m_accel_z[k_max_lanes];
+    float m_mag_x[k_max_lanes], m_mag_y[k_max_lanes], m_mag_z[k_max_lanes];
+
+    // Filter space
+    float m_gravity_x[k_max_lanes], m_gravity_y[k_max_lanes], m_gravity_z[k_max_lanes];
+    float m_field_x[k_max_lanes], m_field_y[k_max_lanes], m_field_z[k_max_lanes];
+
+    // Optical orientation
+    float m_optical_qw[k_max_lanes], m_optical_qx[k_max_lanes], m_optical_qy[k_max_lanes], m_optical_qz[k_max_lanes];
+    float m_optical_weight[k_max_lanes];
+
+    // Parameters and per-lane mode masks (0 or 1)
+    float m_gravity_mask[k_max_lanes];
+    float m_magnetometer_mask[k_max_lanes];
+    float m_beta[k_max_lanes];
+    float m_zeta[k_max_lanes];
+    float m_delta_time[k_max_lanes];
+};
+
+#endif // ORIENTATION_FILTER_BATCH_H
@@ -1,12 +1,14 @@
 // -- includes -----
 #include "PositionFilter.h"
+#include "FilterHistory.h"
 #include "MathEigen.h"
 #include "ServerLog.h"
 #include <deque>
 
 //-- constants -----
 // Max length of the position history we keep
-#define k_position_history_max 16
+// (enough packets to rewind a couple of camera frames at the controller's IMU rate)
+#define k_position_history_max 64
 
 // The max distance between samples that we apply low pass filter on the optical position filter
 #define k_max_lowpass_smoothing_distance 10.f * k_centimeters_to_meters // meters
@@ -27,6 +29,20 @@
 // IMU extrapolation of an unseen controller
 #define k_max_unseen_position_timeout 10000.f // ms
 
+// Kalman filter noise model
+// Variance of an optical position with a quality of 1 (lower quality positions are trusted proportionally less)
+#define k_kalman_optical_position_variance 0.0001f // m^2, i.e. 1cm standard deviation
+// Variance of the white noise on the gravity compensated accelerometer reading (covers the unmodeled jerk too)
+#define k_kalman_acceleration_variance 4.f // (m/s^2)^2
+// How fast the accelerometer bias wanders (mostly orientation error leaking some gravity into the acceleration)
+#define k_kalman_acceleration_bias_variance_rate 0.01f // (m/s^2)^2 per second
+// Uncertainty of the velocity and accelerometer bias when the filter starts from a single optical position
+#define k_kalman_initial_velocity_variance 1.f // (m/s)^2
+#define k_kalman_initial_acceleration_bias_variance 0.25f // (m/s^2)^2
+// An optical position this many standard deviations from the prediction restarts the filter there
+// (e.g. tracking picked the controller back up after it was lost)
+#define k_kalman_max_innovation_sigmas 8.f
+
 // 1 g-unit is equal 980.66499997877 gal (cm/s)
 #define k_g_units_to_gal  980.665000f // gal (cm/s)
 #define k_g_units_to_ms2  9.80665000f // m/s
@@ -51,6 +67,14 @@ struct PositionSensorFusionState
     Eigen::Vector3f velocity; // meters/s
     Eigen::Vector3f acceleration; // accelerometer minus gravity in meters/s^2
 
+    /// Kalman filter state.
+    /// The axes are independent and share the same noise model, 
+    /// so one 3x3 covariance of [position, velocity, acceleration bias] covers all three of them.
+    Eigen::Vector3f acceleration_bias; // meters/s^2 in world space
+    Eigen::Matrix3f kalman_covariance;
+    Eigen::Vector3f last_fused_optical_position; // meters, fused once even though it rides along on several packets
+    bool bLast_fused_optical_position_valid;
+
     /// Position that's considered the origin position 
     Eigen::Vector3f origin_position; // meters
 
@@ -68,11 +92,20 @@ struct PositionSensorFusionState
         acceleration = Eigen::Vector3f::Zero();
         accelerometer = Eigen::Vector3f::Zero();
         accelerometer_derivative = Eigen::Vector3f::Zero();
+        acceleration_bias = Eigen::Vector3f::Zero();
+        kalman_covariance = Eigen::Matrix3f::Zero();
+        last_fused_optical_position = Eigen::Vector3f::Zero();
+        bLast_fused_optical_position_valid = false;
         origin_position = Eigen::Vector3f::Zero();
         bLast_visible_position_timestamp_valid= false;
     }
 };
 
+struct PositionFilterHistory : 
+    public FilterHistory<PositionSensorFusionState, PositionFilterPacket, k_position_history_max>
+{
+};
+
 // -- globals -----
 
 // -- private methods -----
@@ -88,6 +121,10 @@ static void position_fusion_complimentary_optical_imu_update(
     const float delta_time,
     const PositionFilterConstants *constants, const PositionFilterSpace *space, const PositionFilterPacket *packet,
     PositionSensorFusionState *fusion_state);
+static void position_fusion_kalman_optical_imu_update(
+    const float delta_time,
+    const PositionFilterConstants *constants, const PositionFilterSpace *space, const PositionFilterPacket *packet,
+    PositionSensorFusionState *fusion_state);
 
 // -- public interface -----
 
@@ -142,6 +179,7 @@ void PositionFilterSpace::convertSensorPacketToFilterPacket(
 PositionFilter::PositionFilter()
     : m_FilterSpace()
     , m_FusionState(new PositionSensorFusionState)
+    , m_History(new PositionFilterHistory)
 {
     memset(&m_FilterConstants, 0, sizeof(PositionFilterConstants));
     m_FusionState->initialize();
@@ -150,6 +188,7 @@ PositionFilter::PositionFilter()
 PositionFilter::~PositionFilter()
 {
     delete m_FusionState;
+    delete m_History;
 }
 
 PositionFilter::FusionType PositionFilter::getFusionType() const
@@ -168,10 +207,22 @@ Eigen::Vector3f PositionFilter::getPosition(float time) const
 
     if (m_FusionState->bIsValid)
     {
+        Eigen::Vector3f predicted_velocity = m_FusionState->velocity;
+
+        if (m_FusionState->fusion_type == FusionTypeKalmanOpticalIMU)
+        {
+            // Scale the velocity back by how much of it stands out from its uncertainty,
+            // so that a controller held still doesn't get its noise extrapolated
+            const float speed_squared = predicted_velocity.squaredNorm();
+            const float velocity_variance = 3.f*m_FusionState->kalman_covariance(1, 1);
+
+            predicted_velocity *= safe_divide_with_default(speed_squared, speed_squared + velocity_variance, 0.f);
+        }
+
         Eigen::Vector3f predicted_position = 
             is_nearly_zero(time)
             ? m_FusionState->position
-            : m_FusionState->position + m_FusionState->velocity * time;
+            : m_FusionState->position + predicted_velocity * time;
 
         result= predicted_position - m_FusionState->origin_position;
         result= result * k_meters_to_centimeters;
@@ -198,41 +249,99 @@ void PositionFilter::setFilterSpace(const PositionFilterSpace &filterSpace)
 {
     m_FilterSpace = filterSpace;
     m_FusionState->initialize();
+    m_History->clear();
 }
 
 void PositionFilter::setFusionType(PositionFilter::FusionType fusionType)
 {
     m_FusionState->fusion_type = fusionType;
+    m_History->clear();
 }
 
 void PositionFilter::resetPosition()
 {
     m_FusionState->origin_position = m_FusionState->position;
+
+    // Rewinding past this point would undo the reset
+    m_History->clear();
 }
 
 void PositionFilter::resetFilterState()
 {
     m_FusionState->initialize();
+    m_History->clear();
 }
 
 void PositionFilter::update(
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time,
     const float delta_time,
     const PositionSensorPacket &sensorPacket)
 {
     PositionFilterPacket filterPacket;
     m_FilterSpace.convertSensorPacketToFilterPacket(sensorPacket, filterPacket);
 
-    Eigen::Vector3f position_backup = m_FusionState->position;
-    Eigen::Vector3f velocity_backup = m_FusionState->velocity;
-    Eigen::Vector3f acceleration_backup = m_FusionState->acceleration;
-    Eigen::Vector3f jerk_backup = m_FusionState->accelerometer_derivative;
-
     if (sensorPacket.position_quality > 0)
     {
         m_FusionState->last_visible_position_timestamp= std::chrono::high_resolution_clock::now();
         m_FusionState->bLast_visible_position_timestamp_valid= true;
     }
 
+    m_History->record(sample_time, delta_time, filterPacket, *m_FusionState);
+    applyFilterPacket(delta_time, filterPacket);
+}
+
+bool PositionFilter::applyLateOpticalPosition(
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &capture_time,
+    const Eigen::Vector3f &world_position,
+    const float position_quality)
+{
+    const int first_index = m_History->findFirstEntryIndexAtOrAfter(capture_time);
+
+    if (first_index < 0)
+    {
+        return false;
+    }
+
+    // Same conversion as PositionFilterSpace::convertSensorPacketToFilterPacket()
+    const Eigen::Vector3f filter_position = world_position * k_centimeters_to_meters;
+
+    // Rewind to the first packet sampled after the video frame was captured
+    // and replay everything since then with the optical position attached
+    if (first_index < m_History->getCount())
+    {
+        *m_FusionState = m_History->getEntry(first_index).state_before;
+    }
+
+    if (position_quality > 0)
+    {
+        m_FusionState->last_visible_position_timestamp= std::chrono::high_resolution_clock::now();
+        m_FusionState->bLast_visible_position_timestamp_valid= true;
+    }
+
+    for (int entry_index = first_index; entry_index < m_History->getCount(); ++entry_index)
+    {
+        PositionFilterHistory::Entry &entry = m_History->getEntry(entry_index);
+
+        entry.packet.position = filter_position;
+        entry.packet.position_source = PositionSource_Optical;
+        entry.packet.position_quality = position_quality;
+        entry.state_before = *m_FusionState;
+
+        applyFilterPacket(entry.delta_time, entry.packet);
+    }
+
+    return true;
+}
+
+void PositionFilter::applyFilterPacket(
+    const float delta_time,
+    const PositionFilterPacket &filterPacket)
+{
+    Eigen::Vector3f position_backup = m_FusionState->position;
+    Eigen::Vector3f velocity_backup = m_FusionState->velocity;
+    Eigen::Vector3f acceleration_backup = m_FusionState->acceleration;
+    Eigen::Vector3f jerk_backup = m_FusionState->accelerometer_derivative;
+
     switch (m_FusionState->fusion_type)
     {
     case FusionTypeNone:
@@ -249,7 +358,9 @@ void PositionFilter::update(
     case FusionTypeComplimentaryOpticalIMU:
         position_fusion_complimentary_optical_imu_update(delta_time, &m_FilterConstants, &m_FilterSpace, &filterPacket, m_FusionState);
         break;
-    // TODO: Kalman
+    case FusionTypeKalmanOpticalIMU:
+        position_fusion_kalman_optical_imu_update(delta_time, &m_FilterConstants, &m_FilterSpace, &filterPacket, m_FusionState);
+        break;
     default:
         assert(0 && "unreachable");
     }
@@ -504,6 +615,25 @@ position_fusion_lowpass_imu_update(
     }
 }
 
+// Make sure it hasn't been too long since we've last seen the controller.
+// IMU integration will get bad pretty quickly.
+static bool has_recent_visible_position(const PositionSensorFusionState *fusion_state)
+{
+    bool bValidRecentPosition= false;
+
+    if (fusion_state->bLast_visible_position_timestamp_valid)
+    {
+        const std::chrono::duration<float, std::milli> time_delta =
+            std::chrono::high_resolution_clock::now() - fusion_state->last_visible_position_timestamp;
+        const float time_delta_milli = time_delta.count();
+
+        static float g_max_unseen_position_timeout= k_max_unseen_position_timeout;
+        bValidRecentPosition= time_delta_milli < g_max_unseen_position_timeout;
+    }
+
+    return bValidRecentPosition;
+}
+
 static void
 position_fusion_complimentary_optical_imu_update(
     const float delta_time,
@@ -514,21 +644,7 @@ position_fusion_complimentary_optical_imu_update(
 {
     if (fusion_state->bIsValid)
     {
-        bool bValidRecentPosition= false;
-
-        // Make sure it hasn't been too long since we've last seen the controller
-        // IMU integration will get bad pretty quickly
-        if (fusion_state->bLast_visible_position_timestamp_valid)
-        {
-            const std::chrono::duration<float, std::milli> time_delta =
-                std::chrono::high_resolution_clock::now() - fusion_state->last_visible_position_timestamp;
-            const float time_delta_milli = time_delta.count();
-
-            static float g_max_unseen_position_timeout= k_max_unseen_position_timeout;
-            bValidRecentPosition= time_delta_milli < g_max_unseen_position_timeout;
-        }
-
-        if (bValidRecentPosition)
+        if (has_recent_visible_position(fusion_state))
         {
             // Compute the new filter state based on the previous filter state and new sensor data
             Eigen::Vector3f imu_position;
@@ -577,3 +693,127 @@ position_fusion_complimentary_optical_imu_update(
         fusion_state->bIsValid = true;
     }
 }
+
+static void
+kalman_restart_at_optical_position(
+    const PositionFilterPacket *filter_packet,
+    const float optical_variance,
+    PositionSensorFusionState *fusion_state)
+{
+    fusion_state->position = filter_packet->position;
+    fusion_state->velocity = Eigen::Vector3f::Zero();
+    fusion_state->acceleration = Eigen::Vector3f::Zero();
+    fusion_state->accelerometer = filter_packet->world_accelerometer;
+    fusion_state->accelerometer_derivative = Eigen::Vector3f::Zero();
+    fusion_state->acceleration_bias = Eigen::Vector3f::Zero();
+    fusion_state->kalman_covariance = 
+        Eigen::Vector3f(
+            optical_variance,
+            k_kalman_initial_velocity_variance,
+            k_kalman_initial_acceleration_bias_variance).asDiagonal();
+    fusion_state->last_fused_optical_position = filter_packet->position;
+    fusion_state->bLast_fused_optical_position_valid = true;
+}
+
+static void
+position_fusion_kalman_optical_imu_update(
+    const float delta_time,
+    const PositionFilterConstants *filter_constants,
+    const PositionFilterSpace *filter_space,
+    const PositionFilterPacket *filter_packet,
+    PositionSensorFusionState *fusion_state)
+{
+    const bool bHasOpticalPosition = 
+        filter_packet->position_quality > 0.f && eigen_vector3f_is_valid(filter_packet->position);
+    const float optical_variance = 
+        bHasOpticalPosition ? k_kalman_optical_position_variance / filter_packet->position_quality : 0.f;
+
+    if (fusion_state->bIsValid)
+    {
+        if (!has_recent_visible_position(fusion_state))
+        {
+            // Zero out the derived state, but leave the sensor state and position state alone
+            fusion_state->velocity = Eigen::Vector3f::Zero();
+            fusion_state->acceleration = Eigen::Vector3f::Zero();
+            fusion_state->accelerometer_derivative = Eigen::Vector3f::Zero();
+
+            // Fusion state is no longer valid
+            fusion_state->bIsValid = false;
+            return;
+        }
+
+        Eigen::Matrix3f &P = fusion_state->kalman_covariance;
+
+        // Predict: integrate the gravity compensated acceleration
+        if (delta_time > k_real_epsilon && eigen_vector3f_is_valid(filter_packet->world_accelerometer))
+        {
+            const float dt = delta_time;
+            const float half_dt_sq = 0.5f*dt*dt;
+            const Eigen::Vector3f acceleration =
+                (filter_packet->world_accelerometer - filter_space->getGravityCalibrationDirection()) * k_g_units_to_ms2
+                - fusion_state->acceleration_bias;
+
+            fusion_state->position += fusion_state->velocity*dt + acceleration*half_dt_sq;
+            fusion_state->velocity += acceleration*dt;
+            fusion_state->acceleration = acceleration;
+            fusion_state->accelerometer = filter_packet->world_accelerometer;
+
+            Eigen::Matrix3f F;
+            F << 1.f, dt, -half_dt_sq,
+                 0.f, 1.f, -dt,
+                 0.f, 0.f, 1.f;
+
+            // Acceleration noise enters through the position and velocity integration,
+            // the bias is a random walk
+            const Eigen::Vector3f noise_gain(half_dt_sq, dt, 0.f);
+            Eigen::Matrix3f Q = (k_kalman_acceleration_variance * noise_gain) * noise_gain.transpose();
+            Q(2, 2) = k_kalman_acceleration_bias_variance_rate * dt;
+
+            P = F*P*F.transpose() + Q;
+        }
+
+        // Correct: fuse each optical position once
+        if (bHasOpticalPosition &&
+            !(fusion_state->bLast_fused_optical_position_valid && 
+              filter_packet->position == fusion_state->last_fused_optical_position))
+        {
+            const Eigen::Vector3f innovation = filter_packet->position - fusion_state->position;
+            const float innovation_variance = P(0, 0) + optical_variance;
+            // The innovation variance is per axis, the squared norm sums all three axes
+            const float max_innovation_sq = 
+                k_kalman_max_innovation_sigmas*k_kalman_max_innovation_sigmas*3.f*innovation_variance;
+
+            if (innovation.squaredNorm() > max_innovation_sq)
+            {
+                kalman_restart_at_optical_position(filter_packet, optical_variance, fusion_state);
+            }
+            else
+            {
+                const Eigen::Vector3f gain = P.col(0) / innovation_variance;
+
+                fusion_state->position += gain.x()*innovation;
+                fusion_state->velocity += gain.y()*innovation;
+                fusion_state->acceleration_bias += gain.z()*innovation;
+
+                // Joseph form keeps the covariance symmetric and positive
+                Eigen::Matrix3f I_KH = Eigen::Matrix3f::Identity();
+                I_KH.col(0) -= gain;
+                P = I_KH*P*I_KH.transpose() + (optical_variance*gain)*gain.transpose();
+
+                fusion_state->last_fused_optical_position = filter_packet->position;
+                fusion_state->bLast_fused_optical_position_valid = true;
+            }
+        }
+
+        // Make sure the velocity doesn't exceed the speed limit
+        fusion_state->velocity = clamp_vector3f(fusion_state->velocity, filter_constants->maxVelocity);
+    }
+    else if (bHasOpticalPosition)
+    {
+        // If this is the first filter packet, just accept the position as gospel
+        kalman_restart_at_optical_position(filter_packet, optical_variance, fusion_state);
+
+        // Fusion state is valid now that we have one sample
+        fusion_state->bIsValid = true;
+    }
+}
@@ -3,6 +3,7 @@
 
 //-- includes -----
 #include "MathEigen.h"
+#include <chrono>
 
 //-- constants -----
 enum PositionSource
@@ -83,7 +84,7 @@ public:
         FusionTypeLowPassOptical,
         FusionTypeLowPassIMU,
         FusionTypeComplimentaryOpticalIMU,
-        // TODO: Kalman
+        FusionTypeKalmanOpticalIMU,
     };
 
     PositionFilter();
@@ -96,7 +97,8 @@ public:
 
     FusionType getFusionType() const;
     bool getIsFusionStateValid() const;
-    /// Estimate the current position of the filter given a time offset into the future
+    /// Estimate the current position of the filter given a time offset into the future.
+    /// The Kalman filter only extrapolates as much of the velocity as it's confident in.
     Eigen::Vector3f getPosition(float time = 0.f) const;
     Eigen::Vector3f getVelocity() const;
     Eigen::Vector3f getAcceleration() const;
@@ -115,12 +117,26 @@ public:
 
     void resetPosition();
     void resetFilterState();
-    void update(const float delta_time, const PositionSensorPacket &packet);
+    /// Apply a packet of sensor data sampled at sample_time, delta_time after the previous packet
+    void update(
+        const std::chrono::time_point<std::chrono::high_resolution_clock> &sample_time,
+        const float delta_time,
+        const PositionSensorPacket &packet);
+    /// Apply an optical world position (cm) captured at capture_time, which is usually older than the last packets applied:
+    /// the filter rewinds to capture_time and re-applies every packet since then as if it had come with this position.
+    /// Returns false if capture_time is further back than the filter keeps packets for.
+    bool applyLateOpticalPosition(
+        const std::chrono::time_point<std::chrono::high_resolution_clock> &capture_time,
+        const Eigen::Vector3f &world_position,
+        const float position_quality);
 
 private:
+    void applyFilterPacket(const float delta_time, const PositionFilterPacket &filterPacket);
+
     PositionFilterConstants m_FilterConstants;
     PositionFilterSpace m_FilterSpace;
     struct PositionSensorFusionState *m_FusionState;
+    struct PositionFilterHistory *m_History;
 };
 
 #endif // POSITION_FILTER_H
\ No newline at end of file
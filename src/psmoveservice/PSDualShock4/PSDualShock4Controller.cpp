@@ -290,6 +290,7 @@ PSDualShock4ControllerConfig::config2ptree()
     pt.put("PositionFilter.MaxQualityScreenArea", max_position_quality_screen_area);
 
     pt.put("PositionFilter.MaxVelocity", max_velocity);
+    pt.put("PositionFilter.UseKalman", use_kalman_position_filter);
 
     pt.put("prediction_time", prediction_time);
     pt.put("max_poll_failure_count", max_poll_failure_count);
@@ -330,6 +331,7 @@ PSDualShock4ControllerConfig::ptree2config(const boost::property_tree::ptree &pt
         min_position_quality_screen_area= pt.get<float>("PositionFilter.MinQualityScreenArea", min_position_quality_screen_area);
         max_position_quality_screen_area= pt.get<float>("PositionFilter.MaxQualityScreenArea", max_position_quality_screen_area);
         max_velocity= pt.get<float>("PositionFilter.MaxVelocity", max_velocity);
+        use_kalman_position_filter= pt.get<bool>("PositionFilter.UseKalman", use_kalman_position_filter);
 
         // Get the calibration direction for "down"
         identity_gravity_direction.i= pt.get<float>("Calibration.Identity.Gravity.X", identity_gravity_direction.i);
@@ -352,6 +354,8 @@ PSDualShock4Controller::PSDualShock4Controller()
     , RumbleRight(0)
     , RumbleLeft(0)
     , bWriteStateDirty(false)
+    , InputReportCallback(nullptr)
+    , InputReportUserData(nullptr)
     , NextPollSequenceNumber(0)
 {
     HIDDetails.Handle = nullptr;
@@ -758,6 +762,12 @@ PSDualShock4Controller::poll()
 
                 // New data available. Keep iterating.
                 result = IControllerInterface::_PollResultSuccessNewData;
+
+                // Hand the raw report to whoever is listening (e.g. a session recording)
+                if (InputReportCallback != nullptr)
+                {
+                    InputReportCallback(this, (unsigned char*)InData, res, InputReportUserData);
+                }
             }
 
             // https://github.com/nitsch/moveonpc/wiki/Input-report
@@ -999,6 +1009,13 @@ PSDualShock4Controller::getTrackingShape(CommonDeviceTrackingShape &outTrackingS
     outTrackingShape.shape_type = eCommonTrackingShapeType::LightBar;
 }
 
+void
+PSDualShock4Controller::setInputReportCallback(t_input_report_callback callback, void *userdata)
+{
+    InputReportCallback = callback;
+    InputReportUserData = userdata;
+}
+
 long PSDualShock4Controller::getMaxPollFailureCount() const
 {
     return cfg.max_poll_failure_count;
@@ -44,6 +44,7 @@ public:
         , version(CONFIG_VERSION)
         , accelerometer_noise_radius(0.f)
         , max_velocity(1.f)
+        , use_kalman_position_filter(false)
         , gyro_gain(0.f)
         , gyro_variance(0.f)
         , gyro_drift(0.f)
@@ -121,6 +122,9 @@ public:
     // Maximum velocity for the controller physics (meters/second)
     float max_velocity;
 
+    // Fuse the optical position with the accelerometer in a Kalman filter instead of the complimentary filter
+    bool use_kalman_position_filter;
+
     // The calibrated "down" direction
     CommonDeviceVector identity_gravity_direction;
 
@@ -266,6 +270,7 @@ public:
     virtual std::string getSerial() const override;
     virtual const std::tuple<unsigned char, unsigned char, unsigned char> getColour() const override;
     virtual void getTrackingShape(CommonDeviceTrackingShape &outTrackingShape) const override;
+    virtual void setInputReportCallback(t_input_report_callback callback, void *userdata) override;
 
     // -- Getters
     inline const PSDualShock4ControllerConfig *getConfig() const
@@ -304,6 +309,8 @@ private:
     std::chrono::time_point<std::chrono::high_resolution_clock> lastWriteStateTime;
 
     // Read Controller State
+    t_input_report_callback InputReportCallback;
+    void *InputReportUserData;
     int NextPollSequenceNumber;
     std::deque<PSDualShock4ControllerState> ControllerStates;
     PSDualShock4DataInput* InData;                        // Buffer to read hidapi reports into
@@ -246,6 +246,7 @@ PSMoveControllerConfig::config2ptree()
     pt.put("PositionFilter.MinQualityScreenArea", min_position_quality_screen_area);
     pt.put("PositionFilter.MaxQualityScreenArea", max_position_quality_screen_area);
     pt.put("PositionFilter.MaxVelocity", max_velocity);
+    pt.put("PositionFilter.UseKalman", use_kalman_position_filter);
 
     return pt;
 }
@@ -311,6 +312,7 @@ PSMoveControllerConfig::ptree2config(const boost::property_tree::ptree &pt)
         min_position_quality_screen_area= pt.get<float>("PositionFilter.MinQualityScreenArea", min_position_quality_screen_area);
         max_position_quality_screen_area= pt.get<float>("PositionFilter.MaxQualityScreenArea", max_position_quality_screen_area);
         max_velocity= pt.get<float>("PositionFilter.MaxVelocity", max_velocity);
+        use_kalman_position_filter= pt.get<bool>("PositionFilter.UseKalman", use_kalman_position_filter);
     }
     else
     {
@@ -343,6 +345,8 @@ PSMoveController::PSMoveController()
     , LedB(0)
     , Rumble(0)
     , bWriteStateDirty(false)
+    , InputReportCallback(nullptr)
+    , InputReportUserData(nullptr)
     , NextPollSequenceNumber(0)
 {
     HIDDetails.Handle = nullptr;
@@ -884,6 +888,12 @@ PSMoveController::poll()
             {
                 // New data available. Keep iterating.
                 result = IControllerInterface::_PollResultSuccessNewData;
+
+                // Hand the raw report to whoever is listening (e.g. a session recording)
+                if (InputReportCallback != nullptr)
+                {
+                    InputReportCallback(this, (unsigned char*)InData, res, InputReportUserData);
+                }
             }
         
             // https://github.com/nitsch/moveonpc/wiki/Input-report
@@ -1048,6 +1058,13 @@ PSMoveController::getTrackingShape(CommonDeviceTrackingShape &outTrackingShape)
     outTrackingShape.shape.sphere.radius = PSMOVE_TRACKING_BULB_RADIUS;
 }
 
+void
+PSMoveController::setInputReportCallback(t_input_report_callback callback, void *userdata)
+{
+    InputReportCallback = callback;
+    InputReportUserData = userdata;
+}
+
 float
 PSMoveController::getTempCelsius() const
 {
@@ -43,6 +43,7 @@ public:
         , min_position_quality_screen_area(0.f)
         , max_position_quality_screen_area(k_real_pi*20.f*20.f) // lightbulb at ideal range is about 40px by 40px 
         , max_velocity(1.f)
+        , use_kalman_position_filter(false)
     {
         magnetometer_identity.clear();
         magnetometer_center.clear();
@@ -87,6 +88,9 @@ public:
 
     // The maximum velocity allowed in the position filter
     float max_velocity;
+
+    // Fuse the optical position with the accelerometer in a Kalman filter instead of low pass filtering it
+    bool use_kalman_position_filter;
 };
 
 // https://code.google.com/p/moveonpc/wiki/InputReport
@@ -189,6 +193,7 @@ public:
     virtual std::string getSerial() const override;
     virtual const std::tuple<unsigned char, unsigned char, unsigned char> getColour() const override;
     virtual void getTrackingShape(CommonDeviceTrackingShape &outTrackingShape) const override;
+    virtual void setInputReportCallback(t_input_report_callback callback, void *userdata) override;
 
     // -- Getters
     inline const PSMoveControllerConfig *getConfig() const
@@ -230,6 +235,8 @@ private:
     std::chrono::time_point<std::chrono::high_resolution_clock> lastWriteStateTime;
 
     // Read Controller State
+    t_input_report_callback InputReportCallback;
+    void *InputReportUserData;
     int NextPollSequenceNumber;
     std::deque<PSMoveControllerState> ControllerStates;
     PSMoveDataInput* InData;                        // Buffer to copy hidapi reports into
@@ -7,6 +7,7 @@
 #include "TrackerDeviceEnumerator.h"
 #include "TrackerManager.h"
 #include "opencv2/opencv.hpp"
+#include <chrono>
 
 // -- constants -----
 #define PS3EYE_STATE_BUFFER_MAX 16
@@ -21,11 +22,19 @@ class PSEyeCaptureData
 public:
     PSEyeCaptureData()
         : frame()
+        , bgr_frame()
+        , bIsBayerFrame(false)
+        , bBGRFrameValid(false)
+        , captureTimestamp()
     {
 
     }
 
     cv::Mat frame;
+    cv::Mat bgr_frame; // demosaiced on demand when the frame is raw bayer
+    bool bIsBayerFrame;
+    bool bBGRFrameValid;
+    std::chrono::time_point<std::chrono::high_resolution_clock> captureTimestamp;
 };
 
 // -- public methods
@@ -42,6 +51,11 @@ PS3EyeTrackerConfig::PS3EyeTrackerConfig(const std::string &fnamebase)
     , focalLengthY(554.2563) // pixels
     , principalX(320.0) // pixels
     , principalY(240.0) // pixels
+    , distortionK1(0.0)
+    , distortionK2(0.0)
+    , distortionK3(0.0)
+    , distortionP1(0.0)
+    , distortionP2(0.0)
     , hfov(60.0) // degrees
     , vfov(45.0) // degrees
     , zNear(10.0) // cm
@@ -71,6 +85,11 @@ PS3EyeTrackerConfig::config2ptree()
     pt.put("focalLengthY", focalLengthY);
     pt.put("principalX", principalX);
     pt.put("principalY", principalY);
+    pt.put("distortionK1", distortionK1);
+    pt.put("distortionK2", distortionK2);
+    pt.put("distortionK3", distortionK3);
+    pt.put("distortionP1", distortionP1);
+    pt.put("distortionP2", distortionP2);
     pt.put("hfov", hfov);
     pt.put("vfov", vfov);
     pt.put("zNear", zNear);
@@ -110,6 +129,11 @@ PS3EyeTrackerConfig::ptree2config(const boost::property_tree::ptree &pt)
         focalLengthY = pt.get<double>("focalLengthY", 554.2563);
         principalX = pt.get<double>("principalX", 320.0);
         principalY = pt.get<double>("principalY", 240.0);
+        distortionK1 = pt.get<double>("distortionK1", 0.0);
+        distortionK2 = pt.get<double>("distortionK2", 0.0);
+        distortionK3 = pt.get<double>("distortionK3", 0.0);
+        distortionP1 = pt.get<double>("distortionP1", 0.0);
+        distortionP2 = pt.get<double>("distortionP2", 0.0);
         hfov = pt.get<double>("hfov", 60.0);
         vfov = pt.get<double>("vfov", 45.0);
         zNear = pt.get<double>("zNear", 10.0);
@@ -178,7 +202,7 @@ PS3EyeTrackerConfig::getColorRangeTable(const std::string &table_name) const
 	return table;
 }
 
-inline CommonHSVColorRangeTable *
+CommonHSVColorRangeTable *
 PS3EyeTrackerConfig::getOrAddColorRangeTable(const std::string &table_name)
 {
 	CommonHSVColorRangeTable *table= nullptr;	
@@ -332,16 +356,33 @@ IDeviceInterface::ePollResult PS3EyeTracker::poll()
 
     if (getIsOpen())
     {
-        if (!VideoCapture->grab() || 
-            !VideoCapture->retrieve(CaptureData->frame, cv::CAP_OPENNI_BGR_IMAGE))
+        // Prefer the raw bayer image when the driver supports it,
+        // so that the tracker can demosaic and color convert in one pass
+        const int retrieve_type =
+            VideoCapture->getIsBayerCapture() ? PSEYE_RETRIEVE_BAYER_IMAGE : cv::CAP_OPENNI_BGR_IMAGE;
+
+        // grab() blocks until the next frame has come in over USB, retrieve() only copies or converts it.
+        // The ps3eye driver doesn't expose when the transfer actually completed,
+        // so stamp the frame right after grab() returns, before any of the conversion work.
+        const bool bGrabbed = VideoCapture->grab();
+        const std::chrono::time_point<std::chrono::high_resolution_clock> grab_timestamp =
+            std::chrono::high_resolution_clock::now();
+
+        if (!bGrabbed || 
+            !VideoCapture->retrieve(CaptureData->frame, retrieve_type))
         {
             // Device still in valid state
             result = IControllerInterface::_PollResultSuccessNoData;
         }
         else
         {
+            CaptureData->captureTimestamp = grab_timestamp;
+
             // New data available. Keep iterating.
             result = IControllerInterface::_PollResultSuccessNewData;
+
+            CaptureData->bIsBayerFrame = (CaptureData->frame.channels() == 1);
+            CaptureData->bBGRFrameValid = !CaptureData->bIsBayerFrame;
         }
 
         {
@@ -476,12 +517,41 @@ const unsigned char *PS3EyeTracker::getVideoFrameBuffer() const
 
     if (CaptureData != nullptr)
     {
+        if (CaptureData->bIsBayerFrame)
+        {
+            // Only pay for the demosaic if someone actually wants the BGR frame
+            if (!CaptureData->bBGRFrameValid)
+            {
+                cv::cvtColor(CaptureData->frame, CaptureData->bgr_frame, CV_BayerGB2BGR);
+                CaptureData->bBGRFrameValid = true;
+            }
+
+            return static_cast<const unsigned char *>(CaptureData->bgr_frame.data);
+        }
+
         return static_cast<const unsigned char *>(CaptureData->frame.data);
     }
 
     return result;
 }
 
+const unsigned char *PS3EyeTracker::getVideoFrameBayerBuffer() const
+{
+    const unsigned char *result = nullptr;
+
+    if (CaptureData != nullptr && CaptureData->bIsBayerFrame)
+    {
+        result = static_cast<const unsigned char *>(CaptureData->frame.data);
+    }
+
+    return result;
+}
+
+std::chrono::time_point<std::chrono::high_resolution_clock> PS3EyeTracker::getVideoFrameCaptureTimestamp() const
+{
+    return (CaptureData != nullptr) ? CaptureData->captureTimestamp : std::chrono::time_point<std::chrono::high_resolution_clock>();
+}
+
 void PS3EyeTracker::setExposure(double value)
 {
     VideoCapture->set(cv::CAP_PROP_EXPOSURE, value);
@@ -527,6 +597,31 @@ void PS3EyeTracker::setCameraIntrinsics(
     cfg.save();
 }
 
+void PS3EyeTracker::getCameraDistortion(
+    float &outK1, float &outK2,
+    float &outP1, float &outP2,
+    float &outK3) const
+{
+    outK1 = static_cast<float>(cfg.distortionK1);
+    outK2 = static_cast<float>(cfg.distortionK2);
+    outP1 = static_cast<float>(cfg.distortionP1);
+    outP2 = static_cast<float>(cfg.distortionP2);
+    outK3 = static_cast<float>(cfg.distortionK3);
+}
+
+void PS3EyeTracker::setCameraDistortion(
+    float k1, float k2,
+    float p1, float p2,
+    float k3)
+{
+    cfg.distortionK1 = k1;
+    cfg.distortionK2 = k2;
+    cfg.distortionP1 = p1;
+    cfg.distortionP2 = p2;
+    cfg.distortionK3 = k3;
+    cfg.save();
+}
+
 CommonDevicePose PS3EyeTracker::getTrackerPose() const
 {
     return cfg.pose;
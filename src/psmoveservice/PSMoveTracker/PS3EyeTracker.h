@@ -33,7 +33,7 @@ public:
     virtual void ptree2config(const boost::property_tree::ptree &pt);
 
 	const CommonHSVColorRangeTable *getColorRangeTable(const std::string &table_name) const;
-	inline CommonHSVColorRangeTable *getOrAddColorRangeTable(const std::string &table_name);
+	CommonHSVColorRangeTable *getOrAddColorRangeTable(const std::string &table_name);
     
     bool is_valid;
     long version;
@@ -44,6 +44,11 @@ public:
     double focalLengthY;
     double principalX;
     double principalY;
+    double distortionK1; // OpenCV radial distortion coefficients
+    double distortionK2;
+    double distortionK3;
+    double distortionP1; // OpenCV tangential distortion coefficients
+    double distortionP2;
     double hfov;
     double vfov;
     double zNear;
@@ -96,6 +101,8 @@ public:
     std::string getUSBDevicePath() const override;
     bool getVideoFrameDimensions(int *out_width, int *out_height, int *out_stride) const override;
     const unsigned char *getVideoFrameBuffer() const override;
+    const unsigned char *getVideoFrameBayerBuffer() const override;
+    std::chrono::time_point<std::chrono::high_resolution_clock> getVideoFrameCaptureTimestamp() const override;
     void setExposure(double value) override;
     double getExposure() const override;
 	void setGain(double value) override;
@@ -106,6 +113,14 @@ public:
     void setCameraIntrinsics(
         float focalLengthX, float focalLengthY,
         float principalX, float principalY) override;
+    void getCameraDistortion(
+        float &outK1, float &outK2,
+        float &outP1, float &outP2,
+        float &outK3) const override;
+    void setCameraDistortion(
+        float k1, float k2,
+        float p1, float p2,
+        float k3) override;
     CommonDevicePose getTrackerPose() const override;
     void setTrackerPose(const struct CommonDevicePose *pose) override;
     void getFOV(float &outHFOV, float &outVFOV) const override;
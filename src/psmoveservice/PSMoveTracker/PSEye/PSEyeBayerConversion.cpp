@@ -0,0 +1,573 @@
+// -- includes -----
+#include "PSEyeBayerConversion.h"
+#include <assert.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PSEYE_HAS_AVX2
+#define PSEYE_HAS_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PSEYE_HAS_SSE2
+#endif
+
+// -- constants -----
+// Hue is stored in [0, 180) so that it fits in a byte (same as OpenCV)
+#define k_hue_scale 30.f // 180 / 6 sectors
+#define k_hue_wrap 180
+
+// -- private definitions -----
+// One row of planar scratch data, only ever as wide as the frame, laid out over the caller's scratch buffer
+struct PlanarRowBuffers
+{
+    unsigned char *b, *g, *r;
+    unsigned char *h, *s, *v;
+
+    PlanarRowBuffers(unsigned char *scratch_buffer, int width)
+    {
+        b = scratch_buffer;
+        g = b + width;
+        r = g + width;
+        h = r + width;
+        s = h + width;
+        v = s + width;
+    }
+};
+
+// -- private methods -----
+static inline int reflect_index(int i, int size)
+{
+    // Reflect without repeating the edge pixel (BORDER_REFLECT_101)
+    // so that the bayer color parity is preserved at the frame edges
+    return (i < 0) ? -i : ((i >= size) ? 2*size - i - 2 : i);
+}
+
+static inline int round_to_int(float x)
+{
+    // Round half to even, same as cvtps2dq in the default rounding mode
+    return static_cast<int>(nearbyintf(x));
+}
+
+static void demosaic_pixel_scalar(
+    const unsigned char *up, const unsigned char *row, const unsigned char *down,
+    const int width, const bool bIsGreenRedRow, const int x,
+    PlanarRowBuffers &rows)
+{
+    const int xl = reflect_index(x - 1, width);
+    const int xr = reflect_index(x + 1, width);
+
+    const int c = row[x];
+    const int horiz2 = (row[xl] + row[xr] + 1) >> 1;
+    const int vert2 = (up[x] + down[x] + 1) >> 1;
+    const int cross4 = (row[xl] + row[xr] + up[x] + down[x] + 2) >> 2;
+    const int diag4 = (up[xl] + up[xr] + down[xl] + down[xr] + 2) >> 2;
+    const bool bIsEvenColumn = (x & 1) == 0;
+
+    if (bIsGreenRedRow)
+    {
+        // G R G R ...
+        rows.b[x] = static_cast<unsigned char>(bIsEvenColumn ? vert2 : diag4);
+        rows.g[x] = static_cast<unsigned char>(bIsEvenColumn ? c : cross4);
+        rows.r[x] = static_cast<unsigned char>(bIsEvenColumn ? horiz2 : c);
+    }
+    else
+    {
+        // B G B G ...
+        rows.b[x] = static_cast<unsigned char>(bIsEvenColumn ? c : horiz2);
+        rows.g[x] = static_cast<unsigned char>(bIsEvenColumn ? cross4 : c);
+        rows.r[x] = static_cast<unsigned char>(bIsEvenColumn ? diag4 : vert2);
+    }
+}
+
+static inline void bgr_to_hsv_pixel_scalar(
+    const int b, const int g, const int r,
+    unsigned char &out_h, unsigned char &out_s, unsigned char &out_v)
+{
+    const int v = (b > g) ? ((b > r) ? b : r) : ((g > r) ? g : r);
+    const int vmin = (b < g) ? ((b < r) ? b : r) : ((g < r) ? g : r);
+    const int diff = v - vmin;
+
+    int hue_numerator;
+    if (v == r)
+    {
+        hue_numerator = g - b;
+    }
+    else if (v == g)
+    {
+        hue_numerator = b - r + 2*diff;
+    }
+    else
+    {
+        hue_numerator = r - g + 4*diff;
+    }
+
+    // Same operation order as the SIMD paths so all paths agree bit for bit
+    const float v_safe = (v > 0) ? static_cast<float>(v) : 1.f;
+    const float diff_safe = (diff > 0) ? static_cast<float>(diff) : 1.f;
+    const int s = round_to_int((static_cast<float>(diff) * 255.f) / v_safe);
+    int h = round_to_int((static_cast<float>(hue_numerator) * k_hue_scale) / diff_safe);
+
+    if (h < 0)
+    {
+        h += k_hue_wrap;
+    }
+
+    out_h = static_cast<unsigned char>(h);
+    out_s = static_cast<unsigned char>(s);
+    out_v = static_cast<unsigned char>(v);
+}
+
+static void demosaic_row_span_scalar(
+    const unsigned char *up, const unsigned char *row, const unsigned char *down,
+    const int width, const bool bIsGreenRedRow, const int x_begin, const int x_end,
+    PlanarRowBuffers &rows)
+{
+    for (int x = x_begin; x < x_end; ++x)
+    {
+        demosaic_pixel_scalar(up, row, down, width, bIsGreenRedRow, x, rows);
+    }
+}
+
+static void hsv_row_span_scalar(const int x_begin, const int x_end, PlanarRowBuffers &rows)
+{
+    for (int x = x_begin; x < x_end; ++x)
+    {
+        bgr_to_hsv_pixel_scalar(rows.b[x], rows.g[x], rows.r[x], rows.h[x], rows.s[x], rows.v[x]);
+    }
+}
+
+#ifdef PSEYE_HAS_SSE2
+static inline __m128i sse2_select(const __m128i mask, const __m128i a, const __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i sse2_average4_epu8(const __m128i a, const __m128i b, const __m128i c, const __m128i d)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+    lo = _mm_add_epi16(lo, _mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+    hi = _mm_add_epi16(hi, _mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+
+    return _mm_packus_epi16(lo, hi);
+}
+
+// Demosaics 16 pixels at a time. Requires 1 <= x_begin and x_end <= width-1.
+static int demosaic_row_span_sse2(
+    const unsigned char *up, const unsigned char *row, const unsigned char *down,
+    const bool bIsGreenRedRow, const int x_begin, const int x_end,
+    PlanarRowBuffers &rows)
+{
+    const __m128i even_lanes = _mm_set1_epi16(0x00FF);
+    int x = x_begin;
+
+    for (; x + 16 <= x_end; x += 16)
+    {
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x - 1));
+        const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x + 1));
+        const __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i *>(up + x));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(down + x));
+        const __m128i ul = _mm_loadu_si128(reinterpret_cast<const __m128i *>(up + x - 1));
+        const __m128i ur = _mm_loadu_si128(reinterpret_cast<const __m128i *>(up + x + 1));
+        const __m128i dl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(down + x - 1));
+        const __m128i dr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(down + x + 1));
+
+        // _mm_avg_epu8 rounds up, same as (a + b + 1) >> 1
+        const __m128i horiz2 = _mm_avg_epu8(l, r);
+        const __m128i vert2 = _mm_avg_epu8(u, d);
+        const __m128i cross4 = sse2_average4_epu8(l, r, u, d);
+        const __m128i diag4 = sse2_average4_epu8(ul, ur, dl, dr);
+
+        // Lane 0 is an even column when x is even
+        const __m128i even = ((x & 1) == 0) ? even_lanes : _mm_xor_si128(even_lanes, _mm_set1_epi8(-1));
+        __m128i b, g, red;
+
+        if (bIsGreenRedRow)
+        {
+            b = sse2_select(even, vert2, diag4);
+            g = sse2_select(even, c, cross4);
+            red = sse2_select(even, horiz2, c);
+        }
+        else
+        {
+            b = sse2_select(even, c, horiz2);
+            g = sse2_select(even, cross4, c);
+            red = sse2_select(even, diag4, vert2);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rows.b + x), b);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rows.g + x), g);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rows.r + x), red);
+    }
+
+    return x;
+}
+
+static inline __m128 sse2_epi16_lo_to_ps(const __m128i x)
+{
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+}
+
+static inline __m128 sse2_epi16_hi_to_ps(const __m128i x)
+{
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+}
+
+// Converts 8 pixels at a time
+static int hsv_row_span_sse2(const int x_begin, const int x_end, PlanarRowBuffers &rows)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 saturation_scale = _mm_set1_ps(255.f);
+    const __m128 hue_scale = _mm_set1_ps(k_hue_scale);
+    const __m128i hue_wrap = _mm_set1_epi32(k_hue_wrap);
+    int x = x_begin;
+
+    for (; x + 8 <= x_end; x += 8)
+    {
+        const __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(rows.b + x)), zero);
+        const __m128i g = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(rows.g + x)), zero);
+        const __m128i r = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(rows.r + x)), zero);
+
+        const __m128i v = _mm_max_epi16(_mm_max_epi16(b, g), r);
+        const __m128i vmin = _mm_min_epi16(_mm_min_epi16(b, g), r);
+        const __m128i diff = _mm_sub_epi16(v, vmin);
+
+        // Pick the hue sector based on which channel is the max (red wins ties, then green)
+        const __m128i v_is_r = _mm_cmpeq_epi16(v, r);
+        const __m128i v_is_g = _mm_andnot_si128(v_is_r, _mm_cmpeq_epi16(v, g));
+        const __m128i hue_r = _mm_sub_epi16(g, b);
+        const __m128i hue_g = _mm_add_epi16(_mm_sub_epi16(b, r), _mm_slli_epi16(diff, 1));
+        const __m128i hue_b = _mm_add_epi16(_mm_sub_epi16(r, g), _mm_slli_epi16(diff, 2));
+        const __m128i hue_numerator = sse2_select(v_is_r, hue_r, sse2_select(v_is_g, hue_g, hue_b));
+
+        __m128i s32[2], h32[2];
+        for (int half = 0; half < 2; ++half)
+        {
+            const __m128 v_ps = (half == 0) ? sse2_epi16_lo_to_ps(v) : sse2_epi16_hi_to_ps(v);
+            const __m128 diff_ps = (half == 0) ? sse2_epi16_lo_to_ps(diff) : sse2_epi16_hi_to_ps(diff);
+            const __m128 hue_ps = (half == 0) ? sse2_epi16_lo_to_ps(hue_numerator) : sse2_epi16_hi_to_ps(hue_numerator);
+
+            s32[half] = _mm_cvtps_epi32(_mm_div_ps(_mm_mul_ps(diff_ps, saturation_scale), _mm_max_ps(v_ps, one)));
+
+            const __m128i h = _mm_cvtps_epi32(_mm_div_ps(_mm_mul_ps(hue_ps, hue_scale), _mm_max_ps(diff_ps, one)));
+            h32[half] = _mm_add_epi32(h, _mm_and_si128(_mm_cmplt_epi32(h, _mm_setzero_si128()), hue_wrap));
+        }
+
+        const __m128i s16 = _mm_packs_epi32(s32[0], s32[1]);
+        const __m128i h16 = _mm_packs_epi32(h32[0], h32[1]);
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(rows.h + x), _mm_packus_epi16(h16, h16));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(rows.s + x), _mm_packus_epi16(s16, s16));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(rows.v + x), _mm_packus_epi16(v, v));
+    }
+
+    return x;
+}
+#endif // PSEYE_HAS_SSE2
+
+#ifdef PSEYE_HAS_AVX2
+static inline __m256i avx2_select(const __m256i mask, const __m256i a, const __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+static inline __m256i avx2_average4_epu8(const __m256i a, const __m256i b, const __m256i c, const __m256i d)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i two = _mm256_set1_epi16(2);
+
+    // unpack/pack both work within 128-bit lanes, so the round trip keeps the pixel order
+    __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+    lo = _mm256_add_epi16(lo, _mm256_add_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero)));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+
+    __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+    hi = _mm256_add_epi16(hi, _mm256_add_epi16(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero)));
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+
+    return _mm256_packus_epi16(lo, hi);
+}
+
+// Demosaics 32 pixels at a time. Requires 1 <= x_begin and x_end <= width-1.
+static int demosaic_row_span_avx2(
+    const unsigned char *up, const unsigned char *row, const unsigned char *down,
+    const bool bIsGreenRedRow, const int x_begin, const int x_end,
+    PlanarRowBuffers &rows)
+{
+    const __m256i even_lanes = _mm256_set1_epi16(0x00FF);
+    int x = x_begin;
+
+    for (; x + 32 <= x_end; x += 32)
+    {
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + x));
+        const __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + x - 1));
+        const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + x + 1));
+        const __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(up + x));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(down + x));
+        const __m256i ul = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(up + x - 1));
+        const __m256i ur = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(up + x + 1));
+        const __m256i dl = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(down + x - 1));
+        const __m256i dr = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(down + x + 1));
+
+        const __m256i horiz2 = _mm256_avg_epu8(l, r);
+        const __m256i vert2 = _mm256_avg_epu8(u, d);
+        const __m256i cross4 = avx2_average4_epu8(l, r, u, d);
+        const __m256i diag4 = avx2_average4_epu8(ul, ur, dl, dr);
+
+        const __m256i even = ((x & 1) == 0) ? even_lanes : _mm256_xor_si256(even_lanes, _mm256_set1_epi8(-1));
+        __m256i b, g, red;
+
+        if (bIsGreenRedRow)
+        {
+            b = avx2_select(even, vert2, diag4);
+            g = avx2_select(even, c, cross4);
+            red = avx2_select(even, horiz2, c);
+        }
+        else
+        {
+            b = avx2_select(even, c, horiz2);
+            g = avx2_select(even, cross4, c);
+            red = avx2_select(even, diag4, vert2);
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(rows.b + x), b);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(rows.g + x), g);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(rows.r + x), red);
+    }
+
+    return x;
+}
+
+// Converts 16 pixels at a time
+static int hsv_row_span_avx2(const int x_begin, const int x_end, PlanarRowBuffers &rows)
+{
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 saturation_scale = _mm256_set1_ps(255.f);
+    const __m256 hue_scale = _mm256_set1_ps(k_hue_scale);
+    const __m256i hue_wrap = _mm256_set1_epi32(k_hue_wrap);
+    int x = x_begin;
+
+    for (; x + 16 <= x_end; x += 16)
+    {
+        const __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows.b + x)));
+        const __m256i g = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows.g + x)));
+        const __m256i r = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(rows.r + x)));
+
+        const __m256i v = _mm256_max_epi16(_mm256_max_epi16(b, g), r);
+        const __m256i vmin = _mm256_min_epi16(_mm256_min_epi16(b, g), r);
+        const __m256i diff = _mm256_sub_epi16(v, vmin);
+
+        const __m256i v_is_r = _mm256_cmpeq_epi16(v, r);
+        const __m256i v_is_g = _mm256_andnot_si256(v_is_r, _mm256_cmpeq_epi16(v, g));
+        const __m256i hue_r = _mm256_sub_epi16(g, b);
+        const __m256i hue_g = _mm256_add_epi16(_mm256_sub_epi16(b, r), _mm256_slli_epi16(diff, 1));
+        const __m256i hue_b = _mm256_add_epi16(_mm256_sub_epi16(r, g), _mm256_slli_epi16(diff, 2));
+        const __m256i hue_numerator = avx2_select(v_is_r, hue_r, avx2_select(v_is_g, hue_g, hue_b));
+
+        __m128i s16[2], h16[2];
+        for (int half = 0; half < 2; ++half)
+        {
+            const __m128i v_half = (half == 0) ? _mm256_castsi256_si128(v) : _mm256_extracti128_si256(v, 1);
+            const __m128i diff_half = (half == 0) ? _mm256_castsi256_si128(diff) : _mm256_extracti128_si256(diff, 1);
+            const __m128i hue_half = (half == 0) ? _mm256_castsi256_si128(hue_numerator) : _mm256_extracti128_si256(hue_numerator, 1);
+
+            const __m256 v_ps = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v_half));
+            const __m256 diff_ps = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(diff_half));
+            const __m256 hue_ps = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(hue_half));
+
+            const __m256i s = _mm256_cvtps_epi32(_mm256_div_ps(_mm256_mul_ps(diff_ps, saturation_scale), _mm256_max_ps(v_ps, one)));
+            __m256i h = _mm256_cvtps_epi32(_mm256_div_ps(_mm256_mul_ps(hue_ps, hue_scale), _mm256_max_ps(diff_ps, one)));
+            h = _mm256_add_epi32(h, _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), h), hue_wrap));
+
+            s16[half] = _mm_packs_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+            h16[half] = _mm_packs_epi32(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1));
+        }
+
+        const __m128i v8 = _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rows.h + x), _mm_packus_epi16(h16[0], h16[1]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rows.s + x), _mm_packus_epi16(s16[0], s16[1]));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rows.v + x), v8);
+    }
+
+    return x;
+}
+#endif // PSEYE_HAS_AVX2
+
+static void demosaic_row_span(
+    ePSEyeBayerConversionPath path,
+    const unsigned char *up, const unsigned char *row, const unsigned char *down,
+    const int width, const bool bIsGreenRedRow, const int x_begin, const int x_end,
+    PlanarRowBuffers &rows)
+{
+    // The vector paths need both horizontal neighbors, so the frame edge columns are always scalar
+    const int inner_begin = (x_begin > 1) ? x_begin : 1;
+    const int inner_end = (x_end < width - 1) ? x_end : width - 1;
+    int x = x_begin;
+
+    if (x < inner_begin)
+    {
+        demosaic_row_span_scalar(up, row, down, width, bIsGreenRedRow, x, inner_begin, rows);
+        x = inner_begin;
+    }
+
+#ifdef PSEYE_HAS_AVX2
+    if (path == PSEyeBayerConversion_AVX2)
+    {
+        x = demosaic_row_span_avx2(up, row, down, bIsGreenRedRow, x, inner_end, rows);
+    }
+#endif
+#ifdef PSEYE_HAS_SSE2
+    if (path == PSEyeBayerConversion_SSE2 || path == PSEyeBayerConversion_AVX2)
+    {
+        x = demosaic_row_span_sse2(up, row, down, bIsGreenRedRow, x, inner_end, rows);
+    }
+#endif
+
+    demosaic_row_span_scalar(up, row, down, width, bIsGreenRedRow, x, x_end, rows);
+}
+
+static void hsv_row_span(
+    ePSEyeBayerConversionPath path,
+    const int x_begin, const int x_end,
+    PlanarRowBuffers &rows)
+{
+    int x = x_begin;
+
+#ifdef PSEYE_HAS_AVX2
+    if (path == PSEyeBayerConversion_AVX2)
+    {
+        x = hsv_row_span_avx2(x, x_end, rows);
+    }
+#endif
+#ifdef PSEYE_HAS_SSE2
+    if (path == PSEyeBayerConversion_SSE2 || path == PSEyeBayerConversion_AVX2)
+    {
+        x = hsv_row_span_sse2(x, x_end, rows);
+    }
+#endif
+
+    hsv_row_span_scalar(x, x_end, rows);
+}
+
+// -- public interface -----
+ePSEyeBayerConversionPath pseye_bayer_get_best_conversion_path()
+{
+#if defined(PSEYE_HAS_AVX2)
+    return PSEyeBayerConversion_AVX2;
+#elif defined(PSEYE_HAS_SSE2)
+    return PSEyeBayerConversion_SSE2;
+#else
+    return PSEyeBayerConversion_Scalar;
+#endif
+}
+
+const char *pseye_bayer_get_conversion_path_name(ePSEyeBayerConversionPath path)
+{
+    switch (path)
+    {
+    case PSEyeBayerConversion_Scalar:
+        return "Scalar";
+    case PSEyeBayerConversion_SSE2:
+        return "SSE2";
+    case PSEyeBayerConversion_AVX2:
+        return "AVX2";
+    }
+
+    return "Unknown";
+}
+
+int pseye_bayer_get_scratch_buffer_size(const int width)
+{
+    // Planar B, G, R, H, S and V rows
+    return width * 6;
+}
+
+void pseye_bayer_gb_to_mirrored_hsv(
+    const unsigned char *bayer_buffer, const int width, const int height,
+    const int roi_x, const int roi_y, const int roi_width, const int roi_height,
+    unsigned char *out_hsv_buffer,
+    unsigned char *out_bgr_buffer,
+    unsigned char *scratch_buffer)
+{
+    pseye_bayer_gb_to_mirrored_hsv_with_path(
+        pseye_bayer_get_best_conversion_path(),
+        bayer_buffer, width, height,
+        roi_x, roi_y, roi_width, roi_height,
+        out_hsv_buffer, out_bgr_buffer,
+        scratch_buffer);
+}
+
+void pseye_bayer_gb_to_mirrored_hsv_with_path(
+    ePSEyeBayerConversionPath path,
+    const unsigned char *bayer_buffer, const int width, const int height,
+    const int roi_x, const int roi_y, const int roi_width, const int roi_height,
+    unsigned char *out_hsv_buffer,
+    unsigned char *out_bgr_buffer,
+    unsigned char *scratch_buffer)
+{
+    assert(width >= 2 && height >= 2);
+    assert(scratch_buffer != nullptr);
+    assert(roi_x >= 0 && roi_y >= 0 && roi_x + roi_width <= width && roi_y + roi_height <= height);
+
+    if (pseye_bayer_get_best_conversion_path() < path)
+    {
+        path = PSEyeBayerConversion_Scalar;
+    }
+
+    if (roi_width <= 0 || roi_height <= 0)
+    {
+        return;
+    }
+
+    PlanarRowBuffers rows(scratch_buffer, width);
+
+    // Output column x comes from source column (width - 1 - x)
+    const int src_x_begin = width - roi_x - roi_width;
+    const int src_x_end = width - roi_x;
+
+    for (int y = roi_y; y < roi_y + roi_height; ++y)
+    {
+        const unsigned char *up = bayer_buffer + reflect_index(y - 1, height) * width;
+        const unsigned char *row = bayer_buffer + y * width;
+        const unsigned char *down = bayer_buffer + reflect_index(y + 1, height) * width;
+        const bool bIsGreenRedRow = (y & 1) == 0;
+
+        demosaic_row_span(path, up, row, down, width, bIsGreenRedRow, src_x_begin, src_x_end, rows);
+
+        if (out_hsv_buffer != nullptr)
+        {
+            hsv_row_span(path, src_x_begin, src_x_end, rows);
+        }
+
+        // Interleave and mirror the planar row into the output images while it's still in cache
+        const int out_row_offset = y * width;
+        for (int src_x = src_x_begin; src_x < src_x_end; ++src_x)
+        {
+            const int out_index = (out_row_offset + (width - 1 - src_x)) * 3;
+
+            if (out_hsv_buffer != nullptr)
+            {
+                out_hsv_buffer[out_index + 0] = rows.h[src_x];
+                out_hsv_buffer[out_index + 1] = rows.s[src_x];
+                out_hsv_buffer[out_index + 2] = rows.v[src_x];
+            }
+
+            if (out_bgr_buffer != nullptr)
+            {
+                out_bgr_buffer[out_index + 0] = rows.b[src_x];
+                out_bgr_buffer[out_index + 1] = rows.g[src_x];
+                out_bgr_buffer[out_index + 2] = rows.r[src_x];
+            }
+        }
+    }
+}
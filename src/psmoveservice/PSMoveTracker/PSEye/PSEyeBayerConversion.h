@@ -0,0 +1,58 @@
+#ifndef PSEYE_BAYER_CONVERSION_H
+#define PSEYE_BAYER_CONVERSION_H
+
+/// Fused conversion of the raw PS3 Eye sensor image into the images the tracker works on.
+/**
+The PS3 Eye sensor delivers a single channel BayerGB mosaic (OpenCV naming, i.e. GRBG rows).
+The tracker wants a horizontally mirrored HSV image (and a mirrored BGR image for video streaming).
+Doing this with OpenCV takes three full-image passes (demosaic, flip, color convert).
+These functions do all of it in a single pass over a region of the frame,
+demosaicing a row at a time into a small scratch buffer that stays in cache.
+
+All buffers are tightly packed (stride == width * channels).
+The region is given in output (mirrored) image coordinates.
+Either output buffer may be null if that image isn't needed.
+The caller owns the scratch row buffer (see pseye_bayer_get_scratch_buffer_size) so that
+converting a frame doesn't allocate.
+
+Demosaicing is bilinear with the same rounding as cv::cvtColor(CV_BayerGB2BGR).
+The HSV conversion matches cv::cvtColor(COLOR_BGR2HSV) to within 1 per channel (hue in [0, 180)).
+The SIMD and scalar paths produce identical output.
+*/
+
+//-- constants -----
+enum ePSEyeBayerConversionPath
+{
+    PSEyeBayerConversion_Scalar,
+    PSEyeBayerConversion_SSE2,
+    PSEyeBayerConversion_AVX2
+};
+
+//-- interface -----
+/// Returns the fastest conversion path this build supports
+ePSEyeBayerConversionPath pseye_bayer_get_best_conversion_path();
+
+/// Returns a printable name for the conversion path
+const char *pseye_bayer_get_conversion_path_name(ePSEyeBayerConversionPath path);
+
+/// Returns the size in bytes of the scratch row buffer needed to convert frames of the given width
+int pseye_bayer_get_scratch_buffer_size(const int width);
+
+/// Converts the given region of a BayerGB frame into mirrored HSV and/or BGR images using the best available path
+void pseye_bayer_gb_to_mirrored_hsv(
+    const unsigned char *bayer_buffer, const int width, const int height,
+    const int roi_x, const int roi_y, const int roi_width, const int roi_height,
+    unsigned char *out_hsv_buffer,
+    unsigned char *out_bgr_buffer,
+    unsigned char *scratch_buffer);
+
+/// Same as above, but forces the given conversion path (falls back to scalar if the path isn't compiled in)
+void pseye_bayer_gb_to_mirrored_hsv_with_path(
+    ePSEyeBayerConversionPath path,
+    const unsigned char *bayer_buffer, const int width, const int height,
+    const int roi_x, const int roi_y, const int roi_width, const int roi_height,
+    unsigned char *out_hsv_buffer,
+    unsigned char *out_bgr_buffer,
+    unsigned char *scratch_buffer);
+
+#endif // PSEYE_BAYER_CONVERSION_H
@@ -158,15 +158,16 @@ public:
         return true;
     }
 
+    // Waits for the next frame, retrieveFrame() only converts it
     bool grabFrame()
     {
         cvGetRawData(m_frame4ch, &pCapBuffer, 0, 0);
+        CLEyeCameraGetFrame(m_eye, pCapBuffer, 33);
         return true;
     }
 
     bool retrieveFrame(int channel, cv::OutputArray outArray)
     {
-        CLEyeCameraGetFrame(m_eye, pCapBuffer, 33);
         const int from_to[] = { 0, 0, 1, 1, 2, 2 };
         const CvArr** src = (const CvArr**)&m_frame4ch;
         CvArr** dst = (CvArr**)&m_frame;
@@ -346,16 +347,30 @@ public:
         return true;
     }
 
+    // Waits for the next frame's USB transfer to complete, retrieveFrame() only copies or converts it
     bool grabFrame()
     {
-        return eye->isStreaming();
+        bool bSuccess = eye->isStreaming();
+
+        if (bSuccess)
+        {
+            eye->getFrame(m_MatBayer.data);
+        }
+
+        return bSuccess;
     }
 
     bool retrieveFrame(int outputType, cv::OutputArray outArray)
     {
-        eye->getFrame(m_MatBayer.data);
-
-        cv::cvtColor(m_MatBayer, outArray, CV_BayerGB2BGR);
+        if (outputType == PSEYE_RETRIEVE_BAYER_IMAGE)
+        {
+            // Let the caller do its own (fused) demosaicing
+            m_MatBayer.copyTo(outArray);
+        }
+        else
+        {
+            cv::cvtColor(m_MatBayer, outArray, CV_BayerGB2BGR);
+        }
         return true;
     }
 
@@ -601,6 +616,15 @@ std::string PSEyeVideoCapture::getUniqueIndentifier() const
     return m_indentifier;
 }
 
+bool PSEyeVideoCapture::getIsBayerCapture() const
+{
+#ifdef HAVE_PS3EYE
+    return !icap.empty() && icap->getCaptureDomain() == PSEYE_CAP_PS3EYE;
+#else
+    return false;
+#endif
+}
+
 cv::Ptr<cv::IVideoCapture> PSEyeVideoCapture::pseyeVideoCapture_create(int index)
 {
     // https://github.com/Itseez/opencv/blob/09e6c82190b558e74e2e6a53df09844665443d6d/modules/videoio/src/cap.cpp#L432
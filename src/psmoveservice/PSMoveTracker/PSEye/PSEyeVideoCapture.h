@@ -3,6 +3,10 @@
 
 #include <opencv2/videoio.hpp>
 
+/// Pass to retrieve() to get the raw single channel BayerGB sensor image
+/// instead of a demosaiced BGR image. Only supported when \ref getIsBayerCapture() is true.
+#define PSEYE_RETRIEVE_BAYER_IMAGE 0x1000
+
 /// Video capture class that prioritizes PS3 Eye devices.
 /**
 Device opening priority:
@@ -48,6 +52,9 @@ public:
 
     /// Get the unique identifier for the camera
     std::string getUniqueIndentifier() const;
+
+    /// Returns true if the capture can hand out the raw Bayer image (PS3EYEDriver only)
+    bool getIsBayerCapture() const;
     
 protected:
     int m_index; /**< Keep track of index. Necessary for PSEYE_CLEYE_DRIVER */
@@ -0,0 +1,792 @@
+// -- includes -----
+#include "ReplayTracker.h"
+#include "DeviceManager.h"
+#include "ServerLog.h"
+#include "SessionRecording.h"
+#include "PSMoveProtocol.pb.h"
+#include "TrackerManager.h"
+#include "opencv2/opencv.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// -- constants -----
+#define REPLAY_TRACKER_STATE_BUFFER_MAX 16
+
+// -- private definitions -----
+// A recording mapped into memory, either a raw frame recording or one camera out of a recorded session.
+// Raw frames are handed out straight from the mapping, session frames get decoded into a frame buffer.
+class ReplayFrameFile
+{
+public:
+    ReplayFrameFile()
+        : m_file_mapping(nullptr)
+        , m_region(nullptr)
+        , m_header(nullptr)
+        , m_frame_stride(0)
+        , m_next_frame_index(0)
+        , m_session(nullptr)
+        , m_session_stream_id(-1)
+        , m_bSessionFrameValid(false)
+        , m_width(0)
+        , m_height(0)
+        , m_bIsBayer(false)
+        , m_current_frame(nullptr)
+        , m_bBGRFrameValid(false)
+    {
+    }
+
+    ~ReplayFrameFile()
+    {
+        if (m_session != nullptr)
+        {
+            delete m_session;
+        }
+
+        if (m_region != nullptr)
+        {
+            delete m_region;
+        }
+
+        if (m_file_mapping != nullptr)
+        {
+            delete m_file_mapping;
+        }
+    }
+
+    bool open(const std::string &replay_path)
+    {
+        std::string path;
+        int camera_index;
+        ReplayTracker::splitReplayPath(replay_path, path, camera_index);
+
+        // Sniff out which kind of recording this is
+        char magic[8];
+        bool bIsSession = false;
+        FILE *fp = fopen(path.c_str(), "rb");
+
+        if (fp != nullptr)
+        {
+            bIsSession =
+                fread(magic, sizeof(magic), 1, fp) == 1 &&
+                std::memcmp(magic, SESSION_RECORDING_MAGIC, sizeof(magic)) == 0;
+            fclose(fp);
+        }
+
+        return bIsSession ? openSession(path, camera_index) : openFrameFile(path);
+    }
+
+    inline int getWidth() const
+    {
+        return m_width;
+    }
+
+    inline int getHeight() const
+    {
+        return m_height;
+    }
+
+    inline bool getIsBayer() const
+    {
+        return m_bIsBayer;
+    }
+
+    inline bool getIsSession() const
+    {
+        return m_session != nullptr;
+    }
+
+    bool getHasNextFrame()
+    {
+        return (m_session != nullptr)
+            ? findNextSessionFrame() != nullptr
+            : m_next_frame_index < static_cast<int>(m_header->frame_count);
+    }
+
+    // Only valid when getHasNextFrame() is true
+    unsigned long long getNextFrameTimestamp()
+    {
+        return (m_session != nullptr)
+            ? findNextSessionFrame()->timestamp_usec
+            : getFrameHeader(m_next_frame_index)->timestamp_usec;
+    }
+
+    // Make the next frame the current frame
+    void advanceFrame()
+    {
+        if (m_session != nullptr)
+        {
+            const SessionChunkHeader *chunk = findNextSessionFrame();
+
+            if (chunk != nullptr)
+            {
+                m_session->readNextChunk();
+                m_bSessionFrameValid = m_session->decodeVideoFrame(chunk, m_bSessionFrameValid, m_session_frame.data());
+                m_current_frame = m_bSessionFrameValid ? m_session_frame.data() : nullptr;
+            }
+        }
+        else if (m_next_frame_index < static_cast<int>(m_header->frame_count))
+        {
+            m_current_frame = getFramePixels(m_next_frame_index);
+            ++m_next_frame_index;
+        }
+
+        m_bBGRFrameValid = false;
+    }
+
+    // Set up the first frame at or after the given time to be the next frame
+    void seekToTime(unsigned long long timestamp_usec)
+    {
+        if (m_session != nullptr)
+        {
+            // Start from a keyframe so the frames in between can be decoded
+            m_session->seekToKeyframe(m_session_stream_id, timestamp_usec);
+            m_bSessionFrameValid = false;
+        }
+        else
+        {
+            m_next_frame_index = 0;
+        }
+
+        while (getHasNextFrame() && getNextFrameTimestamp() < timestamp_usec)
+        {
+            advanceFrame();
+        }
+    }
+
+    const unsigned char *getCurrentBGRFrame()
+    {
+        if (m_current_frame == nullptr || !m_bIsBayer)
+        {
+            return m_current_frame;
+        }
+
+        // Only pay for the demosaic if someone actually wants the BGR frame
+        if (!m_bBGRFrameValid)
+        {
+            const cv::Mat bayer(m_height, m_width, CV_8UC1, const_cast<unsigned char *>(m_current_frame));
+
+            cv::cvtColor(bayer, m_bgr_frame, CV_BayerGB2BGR);
+            m_bBGRFrameValid = true;
+        }
+
+        return m_bgr_frame.data;
+    }
+
+    const unsigned char *getCurrentBayerFrame() const
+    {
+        return m_bIsBayer ? m_current_frame : nullptr;
+    }
+
+private:
+    bool openFrameFile(const std::string &path)
+    {
+        try
+        {
+            m_file_mapping = new boost::interprocess::file_mapping(path.c_str(), boost::interprocess::read_only);
+            m_region = new boost::interprocess::mapped_region(*m_file_mapping, boost::interprocess::read_only);
+        }
+        catch (boost::interprocess::interprocess_exception &e)
+        {
+            SERVER_LOG_ERROR("ReplayFrameFile::open") << "Failed to map recording " << path << ": " << e.what();
+            return false;
+        }
+
+        const size_t file_size = m_region->get_size();
+
+        if (file_size < sizeof(ReplayFrameFileHeader))
+        {
+            SERVER_LOG_ERROR("ReplayFrameFile::open") << "Recording " << path << " is too small to be a frame recording";
+            return false;
+        }
+
+        m_header = reinterpret_cast<const ReplayFrameFileHeader *>(m_region->get_address());
+
+        if (std::memcmp(m_header->magic, REPLAY_FRAME_FILE_MAGIC, sizeof(m_header->magic)) != 0 ||
+            m_header->version != REPLAY_FRAME_FILE_VERSION)
+        {
+            SERVER_LOG_ERROR("ReplayFrameFile::open") << "Recording " << path << " isn't a version " << REPLAY_FRAME_FILE_VERSION << " frame recording";
+            return false;
+        }
+
+        if (m_header->pixel_format != ReplayFramePixelFormat_BayerGB &&
+            m_header->pixel_format != ReplayFramePixelFormat_BGR)
+        {
+            SERVER_LOG_ERROR("ReplayFrameFile::open") << "Recording " << path << " has unknown pixel format " << m_header->pixel_format;
+            return false;
+        }
+
+        m_width = static_cast<int>(m_header->width);
+        m_height = static_cast<int>(m_header->height);
+        m_bIsBayer = m_header->pixel_format == ReplayFramePixelFormat_BayerGB;
+
+        const size_t bytes_per_pixel = m_bIsBayer ? 1 : 3;
+        m_frame_stride = sizeof(ReplayFrameHeader) + m_width*m_height*bytes_per_pixel;
+
+        if (m_width == 0 || m_height == 0 || m_header->frame_count == 0 ||
+            sizeof(ReplayFrameFileHeader) + m_frame_stride*m_header->frame_count > file_size)
+        {
+            SERVER_LOG_ERROR("ReplayFrameFile::open") << "Recording " << path << " is empty or truncated";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool openSession(const std::string &path, int camera_index)
+    {
+        m_session = new SessionRecordingReader;
+
+        if (!m_session->open(path))
+        {
+            return false;
+        }
+
+        m_session_stream_id = m_session->findVideoStream(camera_index);
+
+        if (m_session_stream_id < 0)
+        {
+            SERVER_LOG_ERROR("ReplayFrameFile::open") << "Recording " << path << " has no camera " << camera_index;
+            return false;
+        }
+
+        const SessionStreamInfo *stream_info = m_session->getStreamInfo(m_session_stream_id);
+
+        m_width = static_cast<int>(stream_info->width);
+        m_height = static_cast<int>(stream_info->height);
+        m_bIsBayer = stream_info->pixel_format == SessionPixelFormat_BayerGB;
+        m_session_frame.resize(m_width*m_height*(m_bIsBayer ? 1 : 3));
+
+        SERVER_LOG_INFO("ReplayFrameFile::open") << "Playing back camera "
+            << m_session->getStreamName(m_session_stream_id) << " from recorded session";
+
+        return true;
+    }
+
+    const ReplayFrameHeader *getFrameHeader(int frame_index) const
+    {
+        const unsigned char *frames = reinterpret_cast<const unsigned char *>(m_header + 1);
+
+        return reinterpret_cast<const ReplayFrameHeader *>(frames + frame_index*m_frame_stride);
+    }
+
+    const unsigned char *getFramePixels(int frame_index) const
+    {
+        return reinterpret_cast<const unsigned char *>(getFrameHeader(frame_index) + 1);
+    }
+
+    // Skip past the session's other streams to our camera's next frame
+    const SessionChunkHeader *findNextSessionFrame()
+    {
+        const SessionChunkHeader *chunk = m_session->peekNextChunk();
+
+        while (chunk != nullptr &&
+               (chunk->chunk_type != SessionChunk_VideoFrame ||
+                chunk->stream_id != static_cast<unsigned int>(m_session_stream_id)))
+        {
+            m_session->readNextChunk();
+            chunk = m_session->peekNextChunk();
+        }
+
+        return chunk;
+    }
+
+    // Raw frame recording
+    boost::interprocess::file_mapping *m_file_mapping;
+    boost::interprocess::mapped_region *m_region;
+    const ReplayFrameFileHeader *m_header;
+    size_t m_frame_stride;
+    int m_next_frame_index;
+
+    // Recorded session
+    SessionRecordingReader *m_session;
+    int m_session_stream_id;
+    std::vector<unsigned char> m_session_frame; // the last decoded frame
+    bool m_bSessionFrameValid;
+
+    int m_width;
+    int m_height;
+    bool m_bIsBayer;
+    const unsigned char *m_current_frame;
+    cv::Mat m_bgr_frame; // demosaiced on demand when the recording is raw bayer
+    bool m_bBGRFrameValid;
+};
+
+// -- Replay Tracker
+ReplayTracker::ReplayTracker()
+    : cfg()
+    , ReplayFilePath()
+    , FrameFile(nullptr)
+    , FrameRate(-1.f)
+    , bLoop(false)
+    , StartTimestamp(0)
+    , bPlaybackClockValid(false)
+    , PlaybackClockFrameCount(0)
+    , PlaybackClockFrameTimestamp(0)
+    , FrameCaptureTime()
+    , OutOfFramesPollCount(0)
+    , NextPollSequenceNumber(0)
+    , TrackerStates()
+{
+}
+
+ReplayTracker::~ReplayTracker()
+{
+    if (getIsOpen())
+    {
+        SERVER_LOG_ERROR("~ReplayTracker") << "Tracker deleted without calling close() first!";
+    }
+}
+
+// -- IDeviceInterface
+bool ReplayTracker::matchesDeviceEnumerator(const DeviceEnumerator *enumerator) const
+{
+    bool matches = false;
+
+    if (enumerator->get_device_type() == CommonDeviceState::ReplayTracker)
+    {
+        std::string enumerator_path = enumerator->get_path();
+
+        matches = (enumerator_path == ReplayFilePath);
+    }
+
+    return matches;
+}
+
+bool ReplayTracker::open(const DeviceEnumerator *enumerator)
+{
+    const char *cur_dev_path = enumerator->get_path();
+
+    bool bSuccess = false;
+
+    if (getIsOpen())
+    {
+        SERVER_LOG_WARNING("ReplayTracker::open") << "ReplayTracker(" << cur_dev_path << ") already open. Ignoring request.";
+        bSuccess = true;
+    }
+    else
+    {
+        SERVER_LOG_INFO("ReplayTracker::open") << "Opening ReplayTracker(" << cur_dev_path << ")";
+
+        FrameFile = new ReplayFrameFile;
+
+        if (FrameFile->open(cur_dev_path))
+        {
+            const TrackerManagerConfig &tracker_cfg = DeviceManager::getInstance()->m_tracker_manager->getConfig();
+
+            ReplayFilePath = cur_dev_path;
+            FrameRate = tracker_cfg.replay_frame_rate;
+            bLoop = tracker_cfg.replay_loop;
+            StartTimestamp = static_cast<unsigned long long>(std::max(tracker_cfg.replay_start_time, 0.f) * 1000000.0);
+            bPlaybackClockValid = false;
+            OutOfFramesPollCount = 0;
+            bSuccess = true;
+
+            FrameFile->seekToTime(StartTimestamp);
+
+            SERVER_LOG_INFO("ReplayTracker::open") << "Playing back "
+                << FrameFile->getWidth() << "x" << FrameFile->getHeight()
+                << (FrameFile->getIsBayer() ? " bayer" : " BGR") << " frames";
+        }
+        else
+        {
+            SERVER_LOG_ERROR("ReplayTracker::open") << "Failed to open ReplayTracker(" << cur_dev_path << ")";
+
+            close();
+        }
+    }
+
+    if (bSuccess)
+    {
+        // Calibration is kept per recording (and per camera for recorded sessions)
+        std::string file_path;
+        int camera_index;
+        splitReplayPath(ReplayFilePath, file_path, camera_index);
+
+        std::string config_name = "ReplayTrackerConfig_";
+        config_name.append(boost::filesystem::path(file_path).stem().string());
+        if (camera_index > 0)
+        {
+            config_name.append("_");
+            config_name.append(std::to_string(camera_index));
+        }
+
+        cfg = PS3EyeTrackerConfig(config_name);
+        cfg.load();
+    }
+
+    return bSuccess;
+}
+
+bool ReplayTracker::getIsOpen() const
+{
+    return FrameFile != nullptr;
+}
+
+bool ReplayTracker::getIsReadyToPoll() const
+{
+    return getIsOpen();
+}
+
+IDeviceInterface::ePollResult ReplayTracker::poll()
+{
+    IDeviceInterface::ePollResult result = IDeviceInterface::_PollResultFailure;
+
+    if (getIsOpen())
+    {
+        if (!FrameFile->getHasNextFrame() && bLoop)
+        {
+            FrameFile->seekToTime(StartTimestamp);
+            bPlaybackClockValid = false;
+        }
+
+        if (FrameFile->getHasNextFrame())
+        {
+            const unsigned long long frame_timestamp = FrameFile->getNextFrameTimestamp();
+            const std::chrono::time_point<std::chrono::high_resolution_clock> now =
+                std::chrono::high_resolution_clock::now();
+            bool bFrameDue = true;
+
+            // Hold the frame back until it's due, like a camera would.
+            // A frame rate of zero plays the frames back as fast as they get polled.
+            if (FrameRate != 0.f)
+            {
+                if (!bPlaybackClockValid)
+                {
+                    PlaybackClockFrameCount = 0;
+                    PlaybackClockFrameTimestamp = frame_timestamp;
+                    PlaybackClockTime = now;
+                    bPlaybackClockValid = true;
+                }
+
+                const std::chrono::duration<double, std::micro> time_since_clock_start_usec(
+                    (FrameRate > 0.f)
+                    ? static_cast<double>(PlaybackClockFrameCount) * 1000000.0 / FrameRate
+                    : static_cast<double>(frame_timestamp - PlaybackClockFrameTimestamp));
+                const std::chrono::time_point<std::chrono::high_resolution_clock> due_time =
+                    PlaybackClockTime + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(time_since_clock_start_usec);
+
+                // Don't block the polling thread waiting on it, just report no new frame yet
+                bFrameDue = due_time <= now;
+            }
+
+            if (bFrameDue)
+            {
+                // The frame "comes off the camera" the first time it gets polled once it's due
+                FrameCaptureTime = now;
+                FrameFile->advanceFrame();
+                ++PlaybackClockFrameCount;
+
+                // New data available. Keep iterating.
+                result = IDeviceInterface::_PollResultSuccessNewData;
+            }
+            else
+            {
+                result = IDeviceInterface::_PollResultSuccessNoData;
+            }
+
+            OutOfFramesPollCount = 0;
+        }
+        else if (OutOfFramesPollCount < cfg.max_poll_failure_count)
+        {
+            // Out of frames. The tracker gets closed after enough polls come back empty.
+            ++OutOfFramesPollCount;
+            result = IDeviceInterface::_PollResultSuccessNoData;
+        }
+        else
+        {
+            SERVER_LOG_INFO("ReplayTracker::poll") << "Recording " << ReplayFilePath << " ran out of frames";
+            result = IDeviceInterface::_PollResultFailure;
+        }
+
+        {
+            ReplayTrackerState newState;
+
+            // Increment the sequence for every new polling packet
+            newState.PollSequenceNumber = NextPollSequenceNumber;
+            ++NextPollSequenceNumber;
+
+            // Make room for new entry if at the max queue size
+            if (TrackerStates.size() >= REPLAY_TRACKER_STATE_BUFFER_MAX)
+            {
+                TrackerStates.erase(TrackerStates.begin(), TrackerStates.begin() + TrackerStates.size() - REPLAY_TRACKER_STATE_BUFFER_MAX);
+            }
+
+            TrackerStates.push_back(newState);
+        }
+    }
+
+    return result;
+}
+
+void ReplayTracker::close()
+{
+    if (FrameFile != nullptr)
+    {
+        delete FrameFile;
+        FrameFile = nullptr;
+    }
+}
+
+long ReplayTracker::getMaxPollFailureCount() const
+{
+    // Polls that come back empty because the next frame isn't due yet aren't failures.
+    // poll() gives up on its own once the recording has run out of frames.
+    return LONG_MAX;
+}
+
+CommonDeviceState::eDeviceType ReplayTracker::getDeviceType() const
+{
+    return CommonDeviceState::ReplayTracker;
+}
+
+const CommonDeviceState *ReplayTracker::getState(int lookBack) const
+{
+    const int queueSize = static_cast<int>(TrackerStates.size());
+    const CommonDeviceState * result =
+        (lookBack < queueSize) ? &TrackerStates.at(queueSize - lookBack - 1) : nullptr;
+
+    return result;
+}
+
+// -- ITrackerInterface
+ITrackerInterface::eDriverType ReplayTracker::getDriverType() const
+{
+    return ITrackerInterface::Replay;
+}
+
+std::string ReplayTracker::getUSBDevicePath() const
+{
+    return ReplayFilePath;
+}
+
+bool ReplayTracker::getVideoFrameDimensions(
+    int *out_width,
+    int *out_height,
+    int *out_stride) const
+{
+    bool bSuccess = false;
+
+    if (FrameFile != nullptr)
+    {
+        const int width = FrameFile->getWidth();
+        const int height = FrameFile->getHeight();
+
+        if (out_width != nullptr)
+        {
+            *out_width = width;
+        }
+
+        if (out_height != nullptr)
+        {
+            *out_height = height;
+        }
+
+        // getVideoFrameBuffer() always hands out BGR frames
+        if (out_stride != nullptr)
+        {
+            *out_stride = 3 * width;
+        }
+
+        bSuccess = true;
+    }
+
+    return bSuccess;
+}
+
+const unsigned char *ReplayTracker::getVideoFrameBuffer() const
+{
+    return (FrameFile != nullptr) ? FrameFile->getCurrentBGRFrame() : nullptr;
+}
+
+const unsigned char *ReplayTracker::getVideoFrameBayerBuffer() const
+{
+    return (FrameFile != nullptr) ? FrameFile->getCurrentBayerFrame() : nullptr;
+}
+
+std::chrono::time_point<std::chrono::high_resolution_clock> ReplayTracker::getVideoFrameCaptureTimestamp() const
+{
+    return FrameCaptureTime;
+}
+
+// Exposure and gain are baked into the recording, but keep the settings around for the config tool
+void ReplayTracker::setExposure(double value)
+{
+    cfg.exposure = value;
+    cfg.save();
+}
+
+double ReplayTracker::getExposure() const
+{
+    return cfg.exposure;
+}
+
+void ReplayTracker::setGain(double value)
+{
+    cfg.gain = value;
+    cfg.save();
+}
+
+double ReplayTracker::getGain() const
+{
+    return cfg.gain;
+}
+
+void ReplayTracker::getCameraIntrinsics(
+    float &outFocalLengthX, float &outFocalLengthY,
+    float &outPrincipalX, float &outPrincipalY) const
+{
+    outFocalLengthX = static_cast<float>(cfg.focalLengthX);
+    outFocalLengthY = static_cast<float>(cfg.focalLengthY);
+    outPrincipalX = static_cast<float>(cfg.principalX);
+    outPrincipalY = static_cast<float>(cfg.principalY);
+}
+
+void ReplayTracker::setCameraIntrinsics(
+    float focalLengthX, float focalLengthY,
+    float principalX, float principalY)
+{
+    cfg.focalLengthX = focalLengthX;
+    cfg.focalLengthY = focalLengthY;
+    cfg.principalX = principalX;
+    cfg.principalY = principalY;
+    cfg.save();
+}
+
+void ReplayTracker::getCameraDistortion(
+    float &outK1, float &outK2,
+    float &outP1, float &outP2,
+    float &outK3) const
+{
+    outK1 = static_cast<float>(cfg.distortionK1);
+    outK2 = static_cast<float>(cfg.distortionK2);
+    outP1 = static_cast<float>(cfg.distortionP1);
+    outP2 = static_cast<float>(cfg.distortionP2);
+    outK3 = static_cast<float>(cfg.distortionK3);
+}
+
+void ReplayTracker::setCameraDistortion(
+    float k1, float k2,
+    float p1, float p2,
+    float k3)
+{
+    cfg.distortionK1 = k1;
+    cfg.distortionK2 = k2;
+    cfg.distortionP1 = p1;
+    cfg.distortionP2 = p2;
+    cfg.distortionK3 = k3;
+    cfg.save();
+}
+
+CommonDevicePose ReplayTracker::getTrackerPose() const
+{
+    return cfg.pose;
+}
+
+void ReplayTracker::setTrackerPose(
+    const struct CommonDevicePose *pose)
+{
+    cfg.pose = *pose;
+    cfg.save();
+}
+
+void ReplayTracker::getFOV(float &outHFOV, float &outVFOV) const
+{
+    outHFOV = static_cast<float>(cfg.hfov);
+    outVFOV = static_cast<float>(cfg.vfov);
+}
+
+void ReplayTracker::getZRange(float &outZNear, float &outZFar) const
+{
+    outZNear = static_cast<float>(cfg.zNear);
+    outZFar = static_cast<float>(cfg.zFar);
+}
+
+void ReplayTracker::gatherTrackerOptions(
+    PSMoveProtocol::Response_ResultTrackerSettings* settings) const
+{
+    // No camera options to change on a recording
+}
+
+bool ReplayTracker::setOptionIndex(
+    const std::string &option_name,
+    int option_index)
+{
+    return false;
+}
+
+bool ReplayTracker::getOptionIndex(
+    const std::string &option_name,
+    int &out_option_index) const
+{
+    return false;
+}
+
+void ReplayTracker::gatherTrackingColorPresets(
+    const std::string &controller_serial,
+    PSMoveProtocol::Response_ResultTrackerSettings* settings) const
+{
+    const CommonHSVColorRangeTable *table= cfg.getColorRangeTable(controller_serial);
+
+    for (int list_index = 0; list_index < MAX_TRACKING_COLOR_TYPES; ++list_index)
+    {
+        const CommonHSVColorRange &hsvRange = table->color_presets[list_index];
+        const eCommonTrackingColorID colorType = static_cast<eCommonTrackingColorID>(list_index);
+
+        PSMoveProtocol::TrackingColorPreset *colorPreset= settings->add_color_presets();
+        colorPreset->set_color_type(static_cast<PSMoveProtocol::TrackingColorType>(colorType));
+        colorPreset->set_hue_center(hsvRange.hue_range.center);
+        colorPreset->set_hue_range(hsvRange.hue_range.range);
+        colorPreset->set_saturation_center(hsvRange.saturation_range.center);
+        colorPreset->set_saturation_range(hsvRange.saturation_range.range);
+        colorPreset->set_value_center(hsvRange.value_range.center);
+        colorPreset->set_value_range(hsvRange.value_range.range);
+    }
+}
+
+void ReplayTracker::setTrackingColorPreset(
+    const std::string &controller_serial,
+    eCommonTrackingColorID color,
+    const CommonHSVColorRange *preset)
+{
+    CommonHSVColorRangeTable *table= cfg.getOrAddColorRangeTable(controller_serial);
+
+    table->color_presets[color] = *preset;
+    cfg.save();
+}
+
+void ReplayTracker::getTrackingColorPreset(
+    const std::string &controller_serial,
+    eCommonTrackingColorID color,
+    CommonHSVColorRange *out_preset) const
+{
+    const CommonHSVColorRangeTable *table= cfg.getColorRangeTable(controller_serial);
+
+    *out_preset = table->color_presets[color];
+}
+
+// -- Getters
+void ReplayTracker::splitReplayPath(
+    const std::string &replay_path,
+    std::string &out_file_path,
+    int &out_camera_index)
+{
+    const size_t separator = replay_path.rfind('#');
+
+    out_file_path = replay_path;
+    out_camera_index = 0;
+
+    // Only treat a trailing "#<number>" as a camera index, '#' is valid in a file name
+    if (separator != std::string::npos && separator + 1 < replay_path.size() &&
+        replay_path.find_first_not_of("0123456789", separator + 1) == std::string::npos)
+    {
+        out_file_path = replay_path.substr(0, separator);
+        out_camera_index = std::atoi(replay_path.c_str() + separator + 1);
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef REPLAY_TRACKER_H
+#define REPLAY_TRACKER_H
+
+// -- includes -----
+#include "PS3EyeTracker.h"
+#include "DeviceEnumerator.h"
+#include "DeviceInterface.h"
+#include <chrono>
+#include <string>
+#include <deque>
+
+// -- constants -----
+#define REPLAY_FRAME_FILE_MAGIC "PSMVFRMS"
+#define REPLAY_FRAME_FILE_VERSION 1
+
+enum eReplayFramePixelFormat
+{
+    ReplayFramePixelFormat_BayerGB, // raw PS3EYE sensor image, 1 byte per pixel
+    ReplayFramePixelFormat_BGR,     // demosaiced (unflipped) camera image, 3 bytes per pixel
+};
+
+// -- definitions -----
+/// Layout of a raw video frame recording:
+/// a ReplayFrameFileHeader followed by frame_count frames,
+/// each frame a ReplayFrameHeader followed by the frame's pixels.
+struct ReplayFrameFileHeader
+{
+    char magic[8]; // REPLAY_FRAME_FILE_MAGIC (not null terminated)
+    unsigned int version;
+    unsigned int width;
+    unsigned int height;
+    unsigned int pixel_format; // eReplayFramePixelFormat
+    unsigned int frame_count;
+    unsigned int reserved;
+};
+
+struct ReplayFrameHeader
+{
+    unsigned long long timestamp_usec; // capture time relative to the start of the recording
+};
+
+struct ReplayTrackerState : public CommonDeviceState
+{
+    ReplayTrackerState()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        CommonDeviceState::clear();
+        DeviceType = CommonDeviceState::ReplayTracker;
+    }
+};
+
+/// Plays back a recording of tracker video frames in place of a live camera.
+/// Lets the optical tracking pipeline be run (and timed) without any cameras attached.
+/// Plays either a raw frame recording or one camera out of a recorded session (see SessionRecording.h).
+/// Recordings stand in for a PS3EYE, so they use the same calibration and color preset settings.
+class ReplayTracker : public ITrackerInterface {
+public:
+    ReplayTracker();
+    ~ReplayTracker();
+
+    // -- IDeviceInterface
+    bool matchesDeviceEnumerator(const DeviceEnumerator *enumerator) const override;
+    bool open(const DeviceEnumerator *enumerator) override;
+    bool getIsOpen() const override;
+    bool getIsReadyToPoll() const override;
+    IDeviceInterface::ePollResult poll() override;
+    void close() override;
+    long getMaxPollFailureCount() const override;
+    static CommonDeviceState::eDeviceType getDeviceTypeStatic()
+    { return CommonDeviceState::ReplayTracker; }
+    CommonDeviceState::eDeviceType getDeviceType() const override;
+    const CommonDeviceState *getState(int lookBack = 0) const override;
+
+    // -- ITrackerInterface
+    ITrackerInterface::eDriverType getDriverType() const override;
+    std::string getUSBDevicePath() const override;
+    bool getVideoFrameDimensions(int *out_width, int *out_height, int *out_stride) const override;
+    const unsigned char *getVideoFrameBuffer() const override;
+    const unsigned char *getVideoFrameBayerBuffer() const override;
+    std::chrono::time_point<std::chrono::high_resolution_clock> getVideoFrameCaptureTimestamp() const override;
+    void setExposure(double value) override;
+    double getExposure() const override;
+    void setGain(double value) override;
+    double getGain() const override;
+    void getCameraIntrinsics(
+        float &outFocalLengthX, float &outFocalLengthY,
+        float &outPrincipalX, float &outPrincipalY) const override;
+    void setCameraIntrinsics(
+        float focalLengthX, float focalLengthY,
+        float principalX, float principalY) override;
+    void getCameraDistortion(
+        float &outK1, float &outK2,
+        float &outP1, float &outP2,
+        float &outK3) const override;
+    void setCameraDistortion(
+        float k1, float k2,
+        float p1, float p2,
+        float k3) override;
+    CommonDevicePose getTrackerPose() const override;
+    void setTrackerPose(const struct CommonDevicePose *pose) override;
+    void getFOV(float &outHFOV, float &outVFOV) const override;
+    void getZRange(float &outZNear, float &outZFar) const override;
+    void gatherTrackerOptions(PSMoveProtocol::Response_ResultTrackerSettings* settings) const override;
+    bool setOptionIndex(const std::string &option_name, int option_index) override;
+    bool getOptionIndex(const std::string &option_name, int &out_option_index) const override;
+    void gatherTrackingColorPresets(const std::string &controller_serial, PSMoveProtocol::Response_ResultTrackerSettings* settings) const override;
+    void setTrackingColorPreset(const std::string &controller_serial, eCommonTrackingColorID color, const CommonHSVColorRange *preset) override;
+    void getTrackingColorPreset(const std::string &controller_serial, eCommonTrackingColorID color, CommonHSVColorRange *out_preset) const override;
+
+    // -- Getters
+    inline const PS3EyeTrackerConfig &getConfig() const
+    { return cfg; }
+
+    /// Split a replay path of the form "<file>" or "<session file>#<camera index>"
+    static void splitReplayPath(const std::string &replay_path, std::string &out_file_path, int &out_camera_index);
+
+private:
+    PS3EyeTrackerConfig cfg;
+    std::string ReplayFilePath;
+    class ReplayFrameFile *FrameFile;
+
+    // Playback
+    float FrameRate; // <0: recorded timing, 0: as fast as possible, >0: fixed frames per second
+    bool bLoop;
+    unsigned long long StartTimestamp; // where playback starts (and loops back to)
+    bool bPlaybackClockValid;
+    int PlaybackClockFrameCount;
+    unsigned long long PlaybackClockFrameTimestamp;
+    std::chrono::time_point<std::chrono::high_resolution_clock> PlaybackClockTime;
+    std::chrono::time_point<std::chrono::high_resolution_clock> FrameCaptureTime; // when the current frame was handed out
+    long OutOfFramesPollCount; // polls since the recording ran out of frames
+
+    // Read Tracker State
+    int NextPollSequenceNumber;
+    std::deque<ReplayTrackerState> TrackerStates;
+};
+#endif // REPLAY_TRACKER_H
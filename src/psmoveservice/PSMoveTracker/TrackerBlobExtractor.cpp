@@ -0,0 +1,225 @@
+//-- includes -----
+#include "TrackerBlobExtractor.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+//-- public implementation -----
+TrackerBlobExtractor::TrackerBlobExtractor()
+{
+}
+
+bool TrackerBlobExtractor::findLargestBlob(
+    const unsigned char *image,
+    size_t image_stride,
+    const cv::Rect &roi,
+    unsigned char mask_bits,
+    std::vector<cv::Point> &out_outline,
+    BlobStats *out_stats)
+{
+    const int roi_right = roi.x + roi.width;
+    const int roi_bottom = roi.y + roi.height;
+    const unsigned long long mask_word = mask_bits * 0x0101010101010101ULL;
+
+    m_runs.clear();
+    m_blobs.clear();
+    out_outline.clear();
+
+    // Runs on the previous row are m_runs[prev_row_begin, prev_row_end)
+    size_t prev_row_begin = 0;
+    size_t prev_row_end = 0;
+
+    for (int y = roi.y; y < roi_bottom; ++y)
+    {
+        const unsigned char *row = image + y*image_stride;
+        const size_t row_begin = m_runs.size();
+        size_t prev_run_index = prev_row_begin;
+        int x = roi.x;
+
+        for (;;)
+        {
+            // Step over empty space a word at a time
+            while (x + 8 <= roi_right)
+            {
+                unsigned long long pixels;
+                std::memcpy(&pixels, row + x, sizeof(pixels));
+
+                if ((pixels & mask_word) != 0)
+                {
+                    break;
+                }
+
+                x += 8;
+            }
+
+            while (x < roi_right && (row[x] & mask_bits) == 0)
+            {
+                ++x;
+            }
+
+            if (x >= roi_right)
+            {
+                break;
+            }
+
+            Run run;
+            run.x_begin = x;
+            run.y = y;
+            run.blob_index = -1;
+
+            while (x < roi_right && (row[x] & mask_bits) != 0)
+            {
+                ++x;
+            }
+            run.x_end = x;
+
+            // Skip the runs above that end before this one starts (allowing for diagonal contact)
+            while (prev_run_index < prev_row_end && m_runs[prev_run_index].x_end < run.x_begin)
+            {
+                ++prev_run_index;
+            }
+
+            // Join the blob of every run above that touches this one
+            for (size_t touching_index = prev_run_index;
+                 touching_index < prev_row_end && m_runs[touching_index].x_begin <= run.x_end;
+                 ++touching_index)
+            {
+                const int touching_blob_index = findRootBlob(m_runs[touching_index].blob_index);
+
+                run.blob_index =
+                    (run.blob_index == -1)
+                    ? touching_blob_index
+                    : mergeBlobs(run.blob_index, touching_blob_index);
+            }
+
+            if (run.blob_index == -1)
+            {
+                Blob blob;
+                blob.parent_index = static_cast<int>(m_blobs.size());
+                blob.area = 0;
+                blob.min_x = run.x_begin;
+                blob.min_y = y;
+                blob.max_x = run.x_end - 1;
+                blob.max_y = y;
+
+                run.blob_index = blob.parent_index;
+                m_blobs.push_back(blob);
+            }
+
+            Blob &blob = m_blobs[run.blob_index];
+            blob.area += run.x_end - run.x_begin;
+            blob.min_x = std::min(blob.min_x, run.x_begin);
+            blob.max_x = std::max(blob.max_x, run.x_end - 1);
+            blob.max_y = y;
+
+            m_runs.push_back(run);
+        }
+
+        prev_row_begin = row_begin;
+        prev_row_end = m_runs.size();
+    }
+
+    // Pick the biggest of the root blobs
+    int best_blob_index = -1;
+    for (int blob_index = 0; blob_index < static_cast<int>(m_blobs.size()); ++blob_index)
+    {
+        const Blob &blob = m_blobs[blob_index];
+
+        if (blob.parent_index == blob_index &&
+            (best_blob_index == -1 || blob.area > m_blobs[best_blob_index].area))
+        {
+            best_blob_index = blob_index;
+        }
+    }
+
+    if (best_blob_index == -1)
+    {
+        return false;
+    }
+
+    const Blob &best_blob = m_blobs[best_blob_index];
+    const int row_count = best_blob.max_y - best_blob.min_y + 1;
+
+    // Find the left and right ends of each row of the blob
+    m_row_left.assign(row_count, INT_MAX);
+    m_row_right.assign(row_count, INT_MIN);
+    for (auto it = m_runs.begin(); it != m_runs.end(); ++it)
+    {
+        if (it->y >= best_blob.min_y && findRootBlob(it->blob_index) == best_blob_index)
+        {
+            const int row_index = it->y - best_blob.min_y;
+
+            m_row_left[row_index] = std::min(m_row_left[row_index], it->x_begin);
+            m_row_right[row_index] = std::max(m_row_right[row_index], it->x_end - 1);
+        }
+    }
+
+    // Down the left side and back up the right side
+    out_outline.reserve(2 * row_count);
+    for (int row_index = 0; row_index < row_count; ++row_index)
+    {
+        out_outline.push_back(cv::Point(m_row_left[row_index], best_blob.min_y + row_index));
+    }
+    for (int row_index = row_count - 1; row_index >= 0; --row_index)
+    {
+        out_outline.push_back(cv::Point(m_row_right[row_index], best_blob.min_y + row_index));
+    }
+
+    if (out_stats != nullptr)
+    {
+        out_stats->area = best_blob.area;
+        out_stats->bounding_box = cv::Rect(
+            best_blob.min_x, best_blob.min_y,
+            best_blob.max_x - best_blob.min_x + 1, row_count);
+    }
+
+    return true;
+}
+
+//-- private implementation -----
+int TrackerBlobExtractor::findRootBlob(int blob_index)
+{
+    int root_index = blob_index;
+
+    while (m_blobs[root_index].parent_index != root_index)
+    {
+        root_index = m_blobs[root_index].parent_index;
+    }
+
+    // Point everything along the way straight at the root
+    while (m_blobs[blob_index].parent_index != root_index)
+    {
+        const int next_index = m_blobs[blob_index].parent_index;
+
+        m_blobs[blob_index].parent_index = root_index;
+        blob_index = next_index;
+    }
+
+    return root_index;
+}
+
+// Both blobs must be roots. Returns the root of the merged blob.
+int TrackerBlobExtractor::mergeBlobs(int blob_index, int other_blob_index)
+{
+    if (blob_index == other_blob_index)
+    {
+        return blob_index;
+    }
+
+    // Keep the older blob as the root
+    const int root_index = std::min(blob_index, other_blob_index);
+    const int child_index = std::max(blob_index, other_blob_index);
+    Blob &root = m_blobs[root_index];
+    const Blob &child = m_blobs[child_index];
+
+    root.area += child.area;
+    root.min_x = std::min(root.min_x, child.min_x);
+    root.min_y = std::min(root.min_y, child.min_y);
+    root.max_x = std::max(root.max_x, child.max_x);
+    root.max_y = std::max(root.max_y, child.max_y);
+
+    m_blobs[child_index].parent_index = root_index;
+
+    return root_index;
+}
@@ -0,0 +1,72 @@
+#ifndef TRACKER_BLOB_EXTRACTOR_H
+#define TRACKER_BLOB_EXTRACTOR_H
+
+//-- includes -----
+#include "opencv2/core/core.hpp"
+#include <cstddef>
+#include <vector>
+
+//-- definitions -----
+/// Finds the largest blob in a mask image with a single scanline pass.
+/**
+A pixel is in the mask when (pixel & mask_bits) != 0, so a label image holding
+one bit per color can be searched for any one color without extracting a mask first.
+Each row is split into runs of set pixels. Runs that touch a run on the row above
+(8-connected, same as cv::findContours) join its blob, and blobs that meet get merged
+with a union-find. Area and bounding box are accumulated per blob as the runs are found.
+
+The outline of the largest blob is returned as a closed polygon through the left ends
+of its rows (top to bottom) and then the right ends (bottom to top), in image coordinates.
+It has the same convex hull as the blob, so it can go straight to the shape fitting.
+
+All of the working storage is kept between calls, so once warmed up there are no allocations.
+An extractor must not be used from more than one thread at a time.
+*/
+class TrackerBlobExtractor
+{
+public:
+    struct BlobStats
+    {
+        int area; // in pixels
+        cv::Rect bounding_box;
+    };
+
+    TrackerBlobExtractor();
+
+    /// Search the roi of the image for the largest blob.
+    /// Returns false (with an empty outline) if the roi has no pixels in the mask.
+    bool findLargestBlob(
+        const unsigned char *image,
+        size_t image_stride,
+        const cv::Rect &roi,
+        unsigned char mask_bits,
+        std::vector<cv::Point> &out_outline,
+        BlobStats *out_stats = nullptr);
+
+private:
+    struct Run
+    {
+        int x_begin;
+        int x_end; // one past the last pixel
+        int y;
+        int blob_index;
+    };
+
+    struct Blob
+    {
+        int parent_index; // union-find parent, itself for a root blob
+        int area;
+        int min_x, min_y;
+        int max_x, max_y;
+    };
+
+    int findRootBlob(int blob_index);
+    int mergeBlobs(int blob_index, int other_blob_index);
+
+    std::vector<Run> m_runs;
+    std::vector<Blob> m_blobs;
+    std::vector<int> m_row_left; // per row of the largest blob
+    std::vector<int> m_row_right;
+};
+
+#endif // TRACKER_BLOB_EXTRACTOR_H
@@ -0,0 +1,189 @@
+//-- includes -----
+#include "TrackerContourRefiner.h"
+
+#include <algorithm>
+#include <cmath>
+
+//-- constants -----
+static const float k_profile_sample_spacing_px = 0.5f;
+static const int k_profile_half_sample_count = 6; // profiles reach 3px either side of the hull
+static const int k_profile_sample_count = 2 * k_profile_half_sample_count + 1;
+static const float k_min_edge_contrast = 24.f; // inside minus outside brightness needed to trust an edge
+static const float k_gradient_noise_floor = 2.f; // per step brightness drop ignored as sensor noise
+
+//-- private methods -----
+static inline float sample_bilinear(
+    const unsigned char *image, size_t image_stride, int channel_count, int channel,
+    float x, float y)
+{
+    const int x0 = static_cast<int>(x);
+    const int y0 = static_cast<int>(y);
+    const float fx = x - static_cast<float>(x0);
+    const float fy = y - static_cast<float>(y0);
+
+    const unsigned char *top = image + y0*image_stride + x0*channel_count + channel;
+    const unsigned char *bottom = top + image_stride;
+
+    const float top_value = top[0] + fx*(static_cast<float>(top[channel_count]) - top[0]);
+    const float bottom_value = bottom[0] + fx*(static_cast<float>(bottom[channel_count]) - bottom[0]);
+
+    return top_value + fy*(bottom_value - top_value);
+}
+
+//-- public implementation -----
+TrackerContourRefiner::TrackerContourRefiner()
+{
+}
+
+int TrackerContourRefiner::getSamplePadding()
+{
+    // The furthest sample plus the neighbor pixel the bilinear lookup reads
+    return static_cast<int>(std::ceil(k_profile_half_sample_count * k_profile_sample_spacing_px)) + 1;
+}
+
+void TrackerContourRefiner::refineHullEdges(
+    const unsigned char *image,
+    size_t image_stride,
+    int channel_count,
+    int channel,
+    const cv::Rect &image_bounds,
+    const std::vector<cv::Point> &convex_hull,
+    std::vector<cv::Point2f> &out_points)
+{
+    const int point_count = static_cast<int>(convex_hull.size());
+
+    out_points.resize(point_count);
+    for (int point_index = 0; point_index < point_count; ++point_index)
+    {
+        out_points[point_index] = cv::Point2f(
+            static_cast<float>(convex_hull[point_index].x),
+            static_cast<float>(convex_hull[point_index].y));
+    }
+
+    if (point_count < 3)
+    {
+        return;
+    }
+
+    m_origin_x.resize(point_count);
+    m_origin_y.resize(point_count);
+    m_normal_x.resize(point_count);
+    m_normal_y.resize(point_count);
+    m_profiles.resize(k_profile_sample_count * point_count);
+    m_gradient_sum.assign(point_count, 0.f);
+    m_weighted_gradient_sum.assign(point_count, 0.f);
+
+    // Normals point away from the middle of the hull, whichever way it winds
+    float center_x = 0.f, center_y = 0.f;
+    for (int point_index = 0; point_index < point_count; ++point_index)
+    {
+        center_x += out_points[point_index].x;
+        center_y += out_points[point_index].y;
+    }
+    center_x /= static_cast<float>(point_count);
+    center_y /= static_cast<float>(point_count);
+
+    for (int point_index = 0; point_index < point_count; ++point_index)
+    {
+        const cv::Point2f &prev = out_points[(point_index + point_count - 1) % point_count];
+        const cv::Point2f &point = out_points[point_index];
+        const cv::Point2f &next = out_points[(point_index + 1) % point_count];
+
+        // Perpendicular to the chord through the neighbors, i.e. the bisector of the two hull edges
+        float normal_x = next.y - prev.y;
+        float normal_y = prev.x - next.x;
+        float length = std::sqrt(normal_x*normal_x + normal_y*normal_y);
+
+        if (length <= 0.f)
+        {
+            normal_x = point.x - center_x;
+            normal_y = point.y - center_y;
+            length = std::sqrt(normal_x*normal_x + normal_y*normal_y);
+        }
+
+        if (length > 0.f)
+        {
+            normal_x /= length;
+            normal_y /= length;
+
+            if (normal_x*(point.x - center_x) + normal_y*(point.y - center_y) < 0.f)
+            {
+                normal_x = -normal_x;
+                normal_y = -normal_y;
+            }
+        }
+
+        m_origin_x[point_index] = point.x;
+        m_origin_y[point_index] = point.y;
+        m_normal_x[point_index] = normal_x;
+        m_normal_y[point_index] = normal_y;
+    }
+
+    // Gather the profiles, inside to outside.
+    // Points too close to the border get a flat profile, which fails the contrast test below.
+    const int padding = getSamplePadding();
+    const int min_x = image_bounds.x + padding;
+    const int min_y = image_bounds.y + padding;
+    const int max_x = image_bounds.x + image_bounds.width - 1 - padding;
+    const int max_y = image_bounds.y + image_bounds.height - 1 - padding;
+
+    for (int point_index = 0; point_index < point_count; ++point_index)
+    {
+        const cv::Point &point = convex_hull[point_index];
+        const bool bInBounds = point.x >= min_x && point.x <= max_x && point.y >= min_y && point.y <= max_y;
+
+        for (int sample_index = 0; sample_index < k_profile_sample_count; ++sample_index)
+        {
+            const float offset = (sample_index - k_profile_half_sample_count) * k_profile_sample_spacing_px;
+
+            m_profiles[sample_index*point_count + point_index] =
+                bInBounds
+                ? sample_bilinear(
+                    image, image_stride, channel_count, channel,
+                    m_origin_x[point_index] + offset*m_normal_x[point_index],
+                    m_origin_y[point_index] + offset*m_normal_y[point_index])
+                : 0.f;
+        }
+    }
+
+    // Accumulate the brightness drop between each pair of samples, weighted by where it happens
+    for (int sample_index = 0; sample_index + 1 < k_profile_sample_count; ++sample_index)
+    {
+        const float *inner = &m_profiles[sample_index*point_count];
+        const float *outer = &m_profiles[(sample_index + 1)*point_count];
+        const float step_offset = (sample_index + 0.5f - k_profile_half_sample_count) * k_profile_sample_spacing_px;
+        float *gradient_sum = m_gradient_sum.data();
+        float *weighted_gradient_sum = m_weighted_gradient_sum.data();
+
+        for (int point_index = 0; point_index < point_count; ++point_index)
+        {
+            const float drop = std::max(inner[point_index] - outer[point_index] - k_gradient_noise_floor, 0.f);
+
+            gradient_sum[point_index] += drop;
+            weighted_gradient_sum[point_index] += drop * step_offset;
+        }
+    }
+
+    // The edge sits at the centroid of the drop
+    {
+        const float *inside = &m_profiles[0];
+        const float *outside = &m_profiles[(k_profile_sample_count - 1)*point_count];
+        const float *gradient_sum = m_gradient_sum.data();
+        const float *weighted_gradient_sum = m_weighted_gradient_sum.data();
+        const float max_offset = k_profile_half_sample_count * k_profile_sample_spacing_px;
+
+        for (int point_index = 0; point_index < point_count; ++point_index)
+        {
+            const bool bHasEdge =
+                inside[point_index] - outside[point_index] >= k_min_edge_contrast &&
+                gradient_sum[point_index] > 0.f;
+            const float edge_offset =
+                bHasEdge
+                ? std::min(std::max(weighted_gradient_sum[point_index] / gradient_sum[point_index], -max_offset), max_offset)
+                : 0.f;
+
+            out_points[point_index].x = m_origin_x[point_index] + edge_offset*m_normal_x[point_index];
+            out_points[point_index].y = m_origin_y[point_index] + edge_offset*m_normal_y[point_index];
+        }
+    }
+}
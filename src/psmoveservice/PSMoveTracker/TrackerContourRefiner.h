@@ -0,0 +1,56 @@
+#ifndef TRACKER_CONTOUR_REFINER_H
+#define TRACKER_CONTOUR_REFINER_H
+
+//-- includes -----
+#include "opencv2/core/core.hpp"
+#include <cstddef>
+#include <vector>
+
+//-- definitions -----
+/// Moves the vertices of a blob's convex hull onto the sub-pixel edge of the blob.
+/**
+The hull from the segmentation mask can only land on whole pixels, so the hull of a
+bulb that moves by a fraction of a pixel hops around from frame to frame.
+For each hull vertex the refiner samples a brightness profile along the hull normal
+(bilinear, in half pixel steps from inside the blob to outside it) and puts the edge at
+the centroid of the falling gradient of the profile. Vertices without a clear edge
+(too little contrast, or too close to the image border) are left where they were.
+
+The profiles are stored sample-major so the edge search runs as straight float loops
+across all of the vertices at once, which the compiler vectorizes.
+
+All of the working storage is kept between calls, so once warmed up there are no allocations.
+A refiner must not be used from more than one thread at a time.
+*/
+class TrackerContourRefiner
+{
+public:
+    TrackerContourRefiner();
+
+    /// How far around the hull's bounding box the profiles can sample,
+    /// i.e. how much of the image has to be valid around the hull
+    static int getSamplePadding();
+
+    /// Refine the points of a convex hull (in either winding order) in an 8-bit image with
+    /// channel_count interleaved channels, sampling the given channel.
+    /// image_bounds is the part of the image that may be sampled.
+    void refineHullEdges(
+        const unsigned char *image,
+        size_t image_stride,
+        int channel_count,
+        int channel,
+        const cv::Rect &image_bounds,
+        const std::vector<cv::Point> &convex_hull,
+        std::vector<cv::Point2f> &out_points);
+
+private:
+    std::vector<float> m_origin_x;
+    std::vector<float> m_origin_y;
+    std::vector<float> m_normal_x;
+    std::vector<float> m_normal_y;
+    std::vector<float> m_profiles; // [sample_index * point_count + point_index]
+    std::vector<float> m_gradient_sum;
+    std::vector<float> m_weighted_gradient_sum;
+};
+
+#endif // TRACKER_CONTOUR_REFINER_H
@@ -0,0 +1,178 @@
+//-- includes -----
+#include "TrackerUndistortionMap.h"
+
+#include <algorithm>
+#include <cmath>
+
+//-- constants -----
+static const int k_grid_spacing_px = 8;
+static const float k_inv_grid_spacing_px = 1.f / static_cast<float>(k_grid_spacing_px);
+static const int k_undistort_iterations = 20; // fixed point iterations when inverting the lens model
+
+//-- private methods -----
+static void distort_normalized_point(const TrackerLensModel &lens, float x, float y, float &out_x, float &out_y)
+{
+    const float r2 = x*x + y*y;
+    const float radial = 1.f + r2*(lens.k1 + r2*(lens.k2 + r2*lens.k3));
+
+    out_x = x*radial + 2.f*lens.p1*x*y + lens.p2*(r2 + 2.f*x*x);
+    out_y = y*radial + lens.p1*(r2 + 2.f*y*y) + 2.f*lens.p2*x*y;
+}
+
+// Same fixed point scheme as cv::undistortPoints(), but run to convergence
+static void undistort_normalized_point(const TrackerLensModel &lens, float x, float y, float &out_x, float &out_y)
+{
+    float undistorted_x = x;
+    float undistorted_y = y;
+
+    for (int iteration = 0; iteration < k_undistort_iterations; ++iteration)
+    {
+        const float r2 = undistorted_x*undistorted_x + undistorted_y*undistorted_y;
+        const float radial = 1.f + r2*(lens.k1 + r2*(lens.k2 + r2*lens.k3));
+        const float tangential_x = 2.f*lens.p1*undistorted_x*undistorted_y + lens.p2*(r2 + 2.f*undistorted_x*undistorted_x);
+        const float tangential_y = lens.p1*(r2 + 2.f*undistorted_y*undistorted_y) + 2.f*lens.p2*undistorted_x*undistorted_y;
+
+        undistorted_x = (x - tangential_x) / radial;
+        undistorted_y = (y - tangential_y) / radial;
+    }
+
+    out_x = undistorted_x;
+    out_y = undistorted_y;
+}
+
+//-- public implementation -----
+bool TrackerLensModel::operator==(const TrackerLensModel &other) const
+{
+    return
+        focal_length_x == other.focal_length_x && focal_length_y == other.focal_length_y &&
+        principal_x == other.principal_x && principal_y == other.principal_y &&
+        k1 == other.k1 && k2 == other.k2 && p1 == other.p1 && p2 == other.p2 && k3 == other.k3;
+}
+
+TrackerUndistortionMap::TrackerUndistortionMap()
+    : m_frame_width(0)
+    , m_frame_height(0)
+    , m_bIsIdentity(true)
+    , m_grid_width(0)
+    , m_grid_height(0)
+{
+    m_lens.focal_length_x = m_lens.focal_length_y = 0.f;
+    m_lens.principal_x = m_lens.principal_y = 0.f;
+    m_lens.k1 = m_lens.k2 = m_lens.p1 = m_lens.p2 = m_lens.k3 = 0.f;
+}
+
+bool TrackerUndistortionMap::update(const TrackerLensModel &lens, int frame_width, int frame_height)
+{
+    if (lens == m_lens && frame_width == m_frame_width && frame_height == m_frame_height)
+    {
+        return false;
+    }
+
+    m_lens = lens;
+    m_frame_width = frame_width;
+    m_frame_height = frame_height;
+    m_bIsIdentity =
+        (lens.k1 == 0.f && lens.k2 == 0.f && lens.p1 == 0.f && lens.p2 == 0.f && lens.k3 == 0.f) ||
+        lens.focal_length_x <= 0.f || lens.focal_length_y <= 0.f ||
+        frame_width <= 0 || frame_height <= 0;
+
+    if (m_bIsIdentity)
+    {
+        m_grid_width = m_grid_height = 0;
+        m_offset_x.clear();
+        m_offset_y.clear();
+
+        return true;
+    }
+
+    // Enough nodes to have one on or past the far edge of the frame
+    m_grid_width = (frame_width - 1) / k_grid_spacing_px + 2;
+    m_grid_height = (frame_height - 1) / k_grid_spacing_px + 2;
+    m_offset_x.resize(m_grid_width * m_grid_height);
+    m_offset_y.resize(m_grid_width * m_grid_height);
+
+    const float mirror_x = static_cast<float>(frame_width - 1);
+
+    for (int grid_y = 0; grid_y < m_grid_height; ++grid_y)
+    {
+        for (int grid_x = 0; grid_x < m_grid_width; ++grid_x)
+        {
+            const float mirrored_x = static_cast<float>(grid_x * k_grid_spacing_px);
+            const float pixel_y = static_cast<float>(grid_y * k_grid_spacing_px);
+
+            // Undo the mirroring to get back to the sensor image the lens model describes
+            const float normalized_x = (mirror_x - mirrored_x - lens.principal_x) / lens.focal_length_x;
+            const float normalized_y = (pixel_y - lens.principal_y) / lens.focal_length_y;
+
+            float undistorted_x, undistorted_y;
+            undistort_normalized_point(lens, normalized_x, normalized_y, undistorted_x, undistorted_y);
+
+            const float undistorted_mirrored_x = mirror_x - (undistorted_x*lens.focal_length_x + lens.principal_x);
+            const float undistorted_pixel_y = undistorted_y*lens.focal_length_y + lens.principal_y;
+            const int node_index = grid_y*m_grid_width + grid_x;
+
+            m_offset_x[node_index] = undistorted_mirrored_x - mirrored_x;
+            m_offset_y[node_index] = undistorted_pixel_y - pixel_y;
+        }
+    }
+
+    return true;
+}
+
+cv::Point2f TrackerUndistortionMap::undistortPoint(const cv::Point2f &mirrored_pixel) const
+{
+    if (m_bIsIdentity)
+    {
+        return mirrored_pixel;
+    }
+
+    // Points just off the frame extrapolate from the edge cells
+    const float grid_x = mirrored_pixel.x * k_inv_grid_spacing_px;
+    const float grid_y = mirrored_pixel.y * k_inv_grid_spacing_px;
+    const int cell_x = std::min(std::max(static_cast<int>(std::floor(grid_x)), 0), m_grid_width - 2);
+    const int cell_y = std::min(std::max(static_cast<int>(std::floor(grid_y)), 0), m_grid_height - 2);
+    const float u = grid_x - static_cast<float>(cell_x);
+    const float v = grid_y - static_cast<float>(cell_y);
+
+    const int top_left = cell_y*m_grid_width + cell_x;
+    const int bottom_left = top_left + m_grid_width;
+
+    const float top_offset_x = m_offset_x[top_left] + u*(m_offset_x[top_left + 1] - m_offset_x[top_left]);
+    const float bottom_offset_x = m_offset_x[bottom_left] + u*(m_offset_x[bottom_left + 1] - m_offset_x[bottom_left]);
+    const float top_offset_y = m_offset_y[top_left] + u*(m_offset_y[top_left + 1] - m_offset_y[top_left]);
+    const float bottom_offset_y = m_offset_y[bottom_left] + u*(m_offset_y[bottom_left + 1] - m_offset_y[bottom_left]);
+
+    return cv::Point2f(
+        mirrored_pixel.x + top_offset_x + v*(bottom_offset_x - top_offset_x),
+        mirrored_pixel.y + top_offset_y + v*(bottom_offset_y - top_offset_y));
+}
+
+void TrackerUndistortionMap::undistortPoints(std::vector<cv::Point2f> &in_out_mirrored_pixels) const
+{
+    if (!m_bIsIdentity)
+    {
+        for (auto it = in_out_mirrored_pixels.begin(); it != in_out_mirrored_pixels.end(); ++it)
+        {
+            *it = undistortPoint(*it);
+        }
+    }
+}
+
+cv::Point2f TrackerUndistortionMap::distortPoint(const cv::Point2f &mirrored_pixel) const
+{
+    if (m_bIsIdentity)
+    {
+        return mirrored_pixel;
+    }
+
+    const float mirror_x = static_cast<float>(m_frame_width - 1);
+    const float normalized_x = (mirror_x - mirrored_pixel.x - m_lens.principal_x) / m_lens.focal_length_x;
+    const float normalized_y = (mirrored_pixel.y - m_lens.principal_y) / m_lens.focal_length_y;
+
+    float distorted_x, distorted_y;
+    distort_normalized_point(m_lens, normalized_x, normalized_y, distorted_x, distorted_y);
+
+    return cv::Point2f(
+        mirror_x - (distorted_x*m_lens.focal_length_x + m_lens.principal_x),
+        distorted_y*m_lens.focal_length_y + m_lens.principal_y);
+}
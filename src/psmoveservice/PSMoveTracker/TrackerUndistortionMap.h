@@ -0,0 +1,64 @@
+#ifndef TRACKER_UNDISTORTION_MAP_H
+#define TRACKER_UNDISTORTION_MAP_H
+
+//-- includes -----
+#include "opencv2/core/core.hpp"
+#include <vector>
+
+//-- definitions -----
+/// Camera intrinsics plus OpenCV's radial (k) and tangential (p) lens distortion coefficients,
+/// all in the camera's own (unmirrored) pixel space.
+struct TrackerLensModel
+{
+    float focal_length_x, focal_length_y;
+    float principal_x, principal_y;
+    float k1, k2, p1, p2, k3;
+
+    bool operator==(const TrackerLensModel &other) const;
+    inline bool operator!=(const TrackerLensModel &other) const
+    { return !(*this == other); }
+};
+
+/// Undistorts contour points through a lookup grid instead of remapping whole frames.
+/**
+The grid holds the undistortion offset every few pixels across the frame and is only
+rebuilt when the lens model or frame size changes. Looking a point up is a bilinear
+blend of the four surrounding grid offsets.
+
+Points are in the mirrored video frame the tracker searches, i.e. raw pixel space
+[0, 0]x[frameWidth-1, frameHeight-1] with x flipped relative to the sensor image.
+Undistorted points are where the ideal pinhole camera with the same intrinsics would have seen them.
+
+Lookups are safe from several threads at once, but not while update() is running.
+*/
+class TrackerUndistortionMap
+{
+public:
+    TrackerUndistortionMap();
+
+    /// Rebuild the grid if the lens model or frame size has changed. Returns true if it was rebuilt.
+    bool update(const TrackerLensModel &lens, int frame_width, int frame_height);
+
+    /// True when the lens has no distortion, in which case points pass through untouched
+    inline bool getIsIdentity() const
+    { return m_bIsIdentity; }
+
+    cv::Point2f undistortPoint(const cv::Point2f &mirrored_pixel) const;
+    void undistortPoints(std::vector<cv::Point2f> &in_out_mirrored_pixels) const;
+
+    /// The inverse of undistortPoint(), evaluated directly from the lens model
+    cv::Point2f distortPoint(const cv::Point2f &mirrored_pixel) const;
+
+private:
+    TrackerLensModel m_lens;
+    int m_frame_width;
+    int m_frame_height;
+    bool m_bIsIdentity;
+
+    int m_grid_width; // grid nodes across
+    int m_grid_height; // grid nodes down
+    std::vector<float> m_offset_x; // undistorted minus distorted position, per grid node
+    std::vector<float> m_offset_y;
+};
+
+#endif // TRACKER_UNDISTORTION_MAP_H
@@ -99,6 +99,8 @@ PSNaviController::PSNaviController()
     HIDDetails.Handle = nullptr;
     HIDDetails.Handle_addr = nullptr;
     
+    InputReportCallback = nullptr;
+    InputReportUserData = nullptr;
     NextPollSequenceNumber= 0;
     InData = new PSNaviDataInput;
     InData->type = PSNavi_Req_GetInput;
@@ -480,6 +482,12 @@ PSNaviController::poll()
             {
                 // New data available. Keep iterating.
                 result= IControllerInterface::_PollResultFailure;
+
+                // Hand the raw report to whoever is listening (e.g. a session recording)
+                if (InputReportCallback != nullptr)
+                {
+                    InputReportCallback(this, (unsigned char*)InData, res, InputReportUserData);
+                }
             }
         
             // https://github.com/nitsch/moveonpc/wiki/Input-report
@@ -551,6 +559,13 @@ PSNaviController::getTrackingShape(CommonDeviceTrackingShape &outTrackingShape)
     // Navi isn't a tracked controller
     outTrackingShape.shape_type= eCommonTrackingShapeType::INVALID_SHAPE;
 }
+
+void
+PSNaviController::setInputReportCallback(t_input_report_callback callback, void *userdata)
+{
+    InputReportCallback = callback;
+    InputReportUserData = userdata;
+}
     
 // -- private helper functions -----
 static std::string
@@ -114,6 +114,7 @@ public:
     virtual long getMaxPollFailureCount() const override;
     virtual const std::tuple<unsigned char, unsigned char, unsigned char> getColour() const override;
     virtual void getTrackingShape(CommonDeviceTrackingShape &outTrackingShape) const override;
+    virtual void setInputReportCallback(t_input_report_callback callback, void *userdata) override;
         
 private:    
     bool getBTAddress(std::string& host, std::string& controller);
@@ -124,6 +125,8 @@ private:
     bool IsBluetooth;                               // true if valid serial number on device opening
 
     // Read Controller State
+    t_input_report_callback InputReportCallback;
+    void *InputReportUserData;
     int NextPollSequenceNumber;
     std::deque<PSNaviControllerState> ControllerStates;
     PSNaviDataInput* InData;                        // Buffer to copy hidapi reports into
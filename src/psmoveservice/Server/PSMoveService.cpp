@@ -6,6 +6,7 @@
 #include "ServerRequestHandler.h"
 #include "DeviceManager.h"
 #include "ServerLog.h"
+#include "ServerTrace.h"
 
 #include <boost/asio.hpp>
 #include <boost/application.hpp>
@@ -29,6 +30,8 @@ using namespace boost;
 #endif // defined(BOOST_POSIX_API)
 
 const int PSMOVE_SERVER_PORT = 9512;
+// How long the main loop blocks on the network when the device threads do the device polling
+const int k_network_wait_timeout_ms = 10;
 
 //-- definitions -----
 class PSMoveServiceImpl
@@ -39,7 +42,7 @@ public:
         , m_signals(m_io_service)
         , m_device_manager()
         , m_request_handler(&m_device_manager)
-        , m_network_manager(&m_io_service, PSMOVE_SERVER_PORT, &m_request_handler)
+        , m_network_manager(&m_io_service, PSMOVE_SERVER_PORT, &m_request_handler, &m_device_manager.getDeviceStateMutex())
         , m_status()
     {
         // Register to handle the signals that indicate when the server should exit.
@@ -70,7 +73,15 @@ public:
                         update();
                     }
 
-                    boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+                    if (m_status->state() == application::status::running && m_device_manager.getIsDeviceThreadsRunning())
+                    {
+                        // Nothing to poll, so sleep until the network needs us (or the async requests need an update)
+                        m_network_manager.wait_for_activity(k_network_wait_timeout_ms);
+                    }
+                    else
+                    {
+                        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+                    }
                 }
             }
             else
@@ -134,6 +145,8 @@ private:
     bool startup()
     {
         bool success= true;
+
+        SERVER_TRACE_THREAD_NAME("main");
         
         /** Start listening for client connections */
         if (success)
@@ -165,12 +178,23 @@ private:
             }
         }
 
+        /** Start updating the devices on their own threads (if configured to), now that they can publish */
+        if (success)
+        {
+            m_device_manager.startDeviceThreads();
+        }
+
         return success;
     }
 
     /// Called in the application loop.
     void update()
     {
+        SERVER_TRACE_SCOPE("PSMoveService::update");
+
+        /** The device threads (if running) update the devices in the meantime */
+        std::lock_guard<std::recursive_mutex> lock(m_device_manager.getDeviceStateMutex());
+
         /** Update an async requests still waiting to complete */
         m_request_handler.update();
 
@@ -186,6 +210,9 @@ private:
 
     void shutdown()
     {
+        // Stop the device threads (if running) before they lose the request handler they publish through
+        m_device_manager.stopDeviceThreads();
+
         // Kill any pending request state
         m_request_handler.shutdown();
 
@@ -0,0 +1,215 @@
+//-- includes -----
+#include "ServerJobPool.h"
+#include "ServerLog.h"
+#include "ServerTrace.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <cassert>
+
+//-- public implementation -----
+ServerJobPool::ServerJobPool()
+    : m_batch_index(0)
+    , m_exit_requested(false)
+    , m_unfinished_job_count(0)
+{
+    // The calling thread always has a queue
+    m_job_queues.push_back(new JobQueue);
+}
+
+ServerJobPool::~ServerJobPool()
+{
+    shutdown();
+
+    for (auto it = m_job_queues.begin(); it != m_job_queues.end(); ++it)
+    {
+        delete *it;
+    }
+    m_job_queues.clear();
+}
+
+void ServerJobPool::startup(int worker_thread_count)
+{
+    assert(m_worker_threads.empty());
+
+    if (worker_thread_count < 0)
+    {
+        const int hardware_thread_count = static_cast<int>(boost::thread::hardware_concurrency());
+
+        worker_thread_count = (hardware_thread_count > 1) ? hardware_thread_count - 1 : 0;
+    }
+
+    SERVER_LOG_INFO("ServerJobPool::startup") << "Starting " << worker_thread_count << " worker threads";
+
+    // Worker queues go in front of the calling thread's queue
+    for (int worker_index = 0; worker_index < worker_thread_count; ++worker_index)
+    {
+        m_job_queues.insert(m_job_queues.begin(), new JobQueue);
+    }
+
+    m_exit_requested = false;
+    for (int worker_index = 0; worker_index < worker_thread_count; ++worker_index)
+    {
+        m_worker_threads.push_back(
+            new boost::thread(boost::bind(&ServerJobPool::workerThreadFunc, this, worker_index)));
+    }
+}
+
+void ServerJobPool::shutdown()
+{
+    if (!m_worker_threads.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_exit_requested = true;
+        }
+        m_wake_condition.notify_all();
+
+        for (auto it = m_worker_threads.begin(); it != m_worker_threads.end(); ++it)
+        {
+            (*it)->join();
+            delete *it;
+        }
+        m_worker_threads.clear();
+
+        // Only the calling thread's queue is left
+        while (m_job_queues.size() > 1)
+        {
+            delete m_job_queues.front();
+            m_job_queues.erase(m_job_queues.begin());
+        }
+    }
+}
+
+void ServerJobPool::addJob(const Job &job)
+{
+    m_pending_jobs.push_back(job);
+}
+
+void ServerJobPool::runJobs()
+{
+    if (m_pending_jobs.empty())
+    {
+        return;
+    }
+
+    if (m_worker_threads.empty())
+    {
+        for (auto it = m_pending_jobs.begin(); it != m_pending_jobs.end(); ++it)
+        {
+            (*it)();
+        }
+    }
+    else
+    {
+        const int queue_count = static_cast<int>(m_job_queues.size());
+        const int calling_thread_queue_index = queue_count - 1;
+
+        m_unfinished_job_count = static_cast<int>(m_pending_jobs.size());
+
+        // Deal the jobs out round robin
+        for (int job_index = 0; job_index < static_cast<int>(m_pending_jobs.size()); ++job_index)
+        {
+            JobQueue *queue = m_job_queues[job_index % queue_count];
+            std::lock_guard<std::mutex> lock(queue->mutex);
+
+            queue->jobs.push_back(m_pending_jobs[job_index]);
+        }
+
+        // Wake up the workers
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            ++m_batch_index;
+        }
+        m_wake_condition.notify_all();
+
+        // Help out rather than sit idle
+        runAvailableJobs(calling_thread_queue_index);
+
+        // Wait for the jobs other threads are still running
+        {
+            std::unique_lock<std::mutex> lock(m_done_mutex);
+            m_done_condition.wait(lock, [this] { return m_unfinished_job_count == 0; });
+        }
+    }
+
+    m_pending_jobs.clear();
+}
+
+//-- private implementation -----
+void ServerJobPool::workerThreadFunc(int queue_index)
+{
+    SERVER_TRACE_THREAD_NAME("job worker");
+
+    unsigned int last_batch_index = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            m_wake_condition.wait(lock, [this, last_batch_index] {
+                return m_exit_requested || m_batch_index != last_batch_index;
+            });
+
+            if (m_exit_requested)
+            {
+                break;
+            }
+
+            last_batch_index = m_batch_index;
+        }
+
+        runAvailableJobs(queue_index);
+    }
+}
+
+void ServerJobPool::runAvailableJobs(int queue_index)
+{
+    Job job;
+
+    while (takeJob(queue_index, job))
+    {
+        job();
+
+        if (--m_unfinished_job_count == 0)
+        {
+            // Take the lock so the notify can't slip in between the waiter's check and its wait
+            std::lock_guard<std::mutex> lock(m_done_mutex);
+            m_done_condition.notify_all();
+        }
+    }
+}
+
+bool ServerJobPool::takeJob(int queue_index, Job &out_job)
+{
+    const int queue_count = static_cast<int>(m_job_queues.size());
+
+    // Work through our own queue first
+    {
+        JobQueue *queue = m_job_queues[queue_index];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+
+        if (!queue->jobs.empty())
+        {
+            out_job = queue->jobs.front();
+            queue->jobs.pop_front();
+            return true;
+        }
+    }
+
+    // Then steal from the back of everyone else's
+    for (int offset = 1; offset < queue_count; ++offset)
+    {
+        JobQueue *queue = m_job_queues[(queue_index + offset) % queue_count];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+
+        if (!queue->jobs.empty())
+        {
+            out_job = queue->jobs.back();
+            queue->jobs.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,75 @@
+#ifndef SERVER_JOB_POOL_H
+#define SERVER_JOB_POOL_H
+
+//-- includes -----
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+//-- pre-declarations -----
+namespace boost
+{
+    class thread;
+};
+
+//-- definitions -----
+/// A fixed pool of worker threads for running a batch of independent jobs in parallel.
+/**
+Jobs are queued up with addJob() and then run with runJobs(), which blocks until every job has finished.
+Each worker (and the calling thread, which helps out while it waits) has its own job queue.
+A thread works through its own queue front to back, then steals from the back of the other queues
+so that one slow job doesn't leave the rest of its queue waiting.
+Jobs must not touch any state another job in the same batch writes to.
+*/
+class ServerJobPool
+{
+public:
+    typedef std::function<void()> Job;
+
+    ServerJobPool();
+    ~ServerJobPool();
+
+    /// Start up the worker threads.
+    /// A negative count picks one worker per hardware thread (less the calling thread).
+    /// Zero workers means runJobs() just runs the jobs in order on the calling thread.
+    void startup(int worker_thread_count);
+    void shutdown();
+
+    inline int getWorkerThreadCount() const
+    { return static_cast<int>(m_worker_threads.size()); }
+
+    /// Queue up a job for the next call to runJobs(). Only call from the thread that calls runJobs().
+    void addJob(const Job &job);
+
+    /// Run all of the queued jobs across the pool and wait for them all to finish
+    void runJobs();
+
+private:
+    struct JobQueue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void workerThreadFunc(int queue_index);
+    void runAvailableJobs(int queue_index);
+    bool takeJob(int queue_index, Job &out_job);
+
+    std::vector<boost::thread *> m_worker_threads;
+    std::vector<JobQueue *> m_job_queues; // one per worker, plus one for the calling thread at the end
+    std::vector<Job> m_pending_jobs;
+
+    std::mutex m_wake_mutex;
+    std::condition_variable m_wake_condition;
+    unsigned int m_batch_index;
+    bool m_exit_requested;
+
+    std::mutex m_done_mutex;
+    std::condition_variable m_done_condition;
+    std::atomic_int m_unfinished_job_count;
+};
+
+#endif // SERVER_JOB_POOL_H
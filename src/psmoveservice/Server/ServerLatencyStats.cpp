@@ -0,0 +1,170 @@
+//-- includes -----
+#include "ServerLatencyStats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+//-- LatencyHistogram -----
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::record(long long microseconds)
+{
+    microseconds = std::max(microseconds, 0LL);
+
+    m_buckets[computeBucketIndex(microseconds)].fetch_add(1, std::memory_order_relaxed);
+    m_sample_count.fetch_add(1, std::memory_order_relaxed);
+
+    long long old_max = m_max.load(std::memory_order_relaxed);
+    while (microseconds > old_max &&
+           !m_max.compare_exchange_weak(old_max, microseconds, std::memory_order_relaxed))
+    {
+        // old_max got reloaded, try again
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (int bucket_index = 0; bucket_index < k_bucket_count; ++bucket_index)
+    {
+        m_buckets[bucket_index].store(0, std::memory_order_relaxed);
+    }
+
+    m_sample_count.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+long long LatencyHistogram::getPercentile(float fraction) const
+{
+    const unsigned int sample_count = getSampleCount();
+
+    if (sample_count == 0)
+    {
+        return 0;
+    }
+
+    // The rank of the sample we're after, counting from 1
+    const unsigned int rank =
+        std::max(static_cast<unsigned int>(std::ceil(fraction * static_cast<float>(sample_count))), 1u);
+    unsigned int running_count = 0;
+
+    for (int bucket_index = 0; bucket_index < k_bucket_count; ++bucket_index)
+    {
+        running_count += m_buckets[bucket_index].load(std::memory_order_relaxed);
+
+        if (running_count >= rank)
+        {
+            return std::min(computeBucketUpperBound(bucket_index), getMax());
+        }
+    }
+
+    // Only if samples came in while we were counting
+    return getMax();
+}
+
+int LatencyHistogram::computeBucketIndex(long long microseconds)
+{
+    const long long k_linear_limit = 2LL << k_sub_bucket_bits;
+
+    if (microseconds < k_linear_limit)
+    {
+        // One bucket per microsecond at the low end
+        return static_cast<int>(microseconds);
+    }
+
+    int most_significant_bit = 0;
+    while ((microseconds >> (most_significant_bit + 1)) != 0)
+    {
+        ++most_significant_bit;
+    }
+
+    const int shift = most_significant_bit - k_sub_bucket_bits;
+    const int sub_bucket = static_cast<int>(microseconds >> shift) & ((1 << k_sub_bucket_bits) - 1);
+    const int bucket_index = ((shift + 1) << k_sub_bucket_bits) + sub_bucket;
+
+    return std::min(bucket_index, k_bucket_count - 1);
+}
+
+long long LatencyHistogram::computeBucketUpperBound(int bucket_index)
+{
+    const int k_linear_limit = 2 << k_sub_bucket_bits;
+
+    if (bucket_index < k_linear_limit)
+    {
+        return bucket_index;
+    }
+
+    const int shift = (bucket_index >> k_sub_bucket_bits) - 1;
+    const long long sub_bucket = bucket_index & ((1 << k_sub_bucket_bits) - 1);
+
+    return ((((1LL << k_sub_bucket_bits) + sub_bucket + 1) << shift) - 1);
+}
+
+//-- DeviceLatencyStats -----
+void DeviceLatencyStats::record(eLatencyStage stage, const timestamp &origin_time)
+{
+    record(stage, origin_time, std::chrono::high_resolution_clock::now());
+}
+
+void DeviceLatencyStats::record(eLatencyStage stage, const timestamp &origin_time, const timestamp &stage_time)
+{
+    assert(stage >= 0 && stage < MAX_LATENCY_STAGES);
+
+    if (origin_time != timestamp())
+    {
+        const long long latency_microseconds =
+            std::chrono::duration_cast<std::chrono::microseconds>(stage_time - origin_time).count();
+
+        m_histograms[stage].record(latency_microseconds);
+    }
+}
+
+bool DeviceLatencyStats::getHasSamples() const
+{
+    for (int stage_index = 0; stage_index < MAX_LATENCY_STAGES; ++stage_index)
+    {
+        if (m_histograms[stage_index].getSampleCount() > 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DeviceLatencyStats::reset()
+{
+    for (int stage_index = 0; stage_index < MAX_LATENCY_STAGES; ++stage_index)
+    {
+        m_histograms[stage_index].reset();
+    }
+}
+
+const char *DeviceLatencyStats::getStageName(eLatencyStage stage)
+{
+    switch (stage)
+    {
+    case LatencyStage_Capture:
+        return "capture";
+    case LatencyStage_HSVConversion:
+        return "hsv";
+    case LatencyStage_Contour:
+        return "contour";
+    case LatencyStage_Fit:
+        return "fit";
+    case LatencyStage_Triangulation:
+        return "triangulation";
+    case LatencyStage_Filter:
+        return "filter";
+    case LatencyStage_Serialization:
+        return "serialization";
+    case LatencyStage_Send:
+        return "send";
+    default:
+        assert(0 && "unreachable");
+        return "";
+    }
+}
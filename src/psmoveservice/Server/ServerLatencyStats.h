@@ -0,0 +1,111 @@
+#ifndef SERVER_LATENCY_STATS_H
+#define SERVER_LATENCY_STATS_H
+
+//-- includes -----
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+//-- constants -----
+/// The points along the way from a device reading to the datagram that carries it to a client.
+/// Each one is timed from when the reading came in:
+/// the video frame capture for the optical stages, the HID report read for the rest.
+enum eLatencyStage
+{
+    LatencyStage_Capture, // video frame picked up for processing / IMU sample read off the HID report
+    LatencyStage_HSVConversion, // video frame converted and segmented
+    LatencyStage_Contour, // controller blob outline found in the video frame
+    LatencyStage_Fit, // controller pose fit to the blob outline
+    LatencyStage_Triangulation, // per-tracker poses combined
+    LatencyStage_Filter, // state run through the pose filters
+    LatencyStage_Serialization, // data frame packed into a datagram
+    LatencyStage_Send, // datagram handed to the socket (once per data frame, however many clients it goes to)
+
+    MAX_LATENCY_STAGES
+};
+
+//-- definitions -----
+/// Histogram of latencies in microseconds, in buckets 1/8th of a power of two wide.
+/**
+Recording is a couple of relaxed atomic increments, so it's cheap enough to always leave on
+and safe to do from the worker threads that process several controllers or trackers at once.
+*/
+class LatencyHistogram
+{
+public:
+    static const int k_sub_bucket_bits = 3;
+    static const int k_bucket_count = 184; // up to ~30s
+
+    LatencyHistogram();
+
+    void record(long long microseconds);
+    void reset();
+
+    inline unsigned int getSampleCount() const
+    { return m_sample_count.load(std::memory_order_relaxed); }
+    inline long long getMax() const
+    { return m_max.load(std::memory_order_relaxed); }
+
+    /// The latency the given fraction [0, 1] of the samples came in at or under,
+    /// rounded up to the end of its bucket (but never over the max)
+    long long getPercentile(float fraction) const;
+
+private:
+    static int computeBucketIndex(long long microseconds);
+    static long long computeBucketUpperBound(int bucket_index);
+
+    std::atomic<unsigned int> m_buckets[k_bucket_count];
+    std::atomic<unsigned int> m_sample_count;
+    std::atomic<long long> m_max;
+};
+
+/// The latency histograms of every stage a device's readings go through
+class DeviceLatencyStats
+{
+public:
+    typedef std::chrono::time_point<std::chrono::high_resolution_clock> timestamp;
+
+    /// Record that the reading that came in at origin_time has now made it through the given stage.
+    /// Does nothing if there's no origin time (yet).
+    void record(eLatencyStage stage, const timestamp &origin_time);
+    void record(eLatencyStage stage, const timestamp &origin_time, const timestamp &stage_time);
+
+    inline const LatencyHistogram &getHistogram(eLatencyStage stage) const
+    { return m_histograms[stage]; }
+
+    bool getHasSamples() const;
+    void reset();
+
+    static const char *getStageName(eLatencyStage stage);
+
+private:
+    LatencyHistogram m_histograms[MAX_LATENCY_STAGES];
+};
+typedef std::shared_ptr<DeviceLatencyStats> DeviceLatencyStatsPtr;
+
+/// Which device and reading an outgoing data frame carries, so the network can record its last stages
+struct DeviceLatencyTrace
+{
+    DeviceLatencyStatsPtr stats; // null if the data frame isn't traced
+    DeviceLatencyStats::timestamp origin_time;
+
+    DeviceLatencyTrace()
+        : stats()
+        , origin_time()
+    {}
+
+    DeviceLatencyTrace(const DeviceLatencyStatsPtr &in_stats, const DeviceLatencyStats::timestamp &in_origin_time)
+        : stats(in_stats)
+        , origin_time(in_origin_time)
+    {}
+
+    inline void record(eLatencyStage stage) const
+    {
+        if (stats)
+        {
+            stats->record(stage, origin_time);
+        }
+    }
+};
+
+#endif // SERVER_LATENCY_STATS_H
@@ -1,21 +1,29 @@
 //-- includes -----
 #include "ServerNetworkManager.h"
 #include "ServerRequestHandler.h"
+#include "ServerLatencyStats.h"
 #include "ServerLog.h"
 #include "packedmessage.h"
+#include "CompactDataFrame.h"
 #include "PSMoveProtocolInterface.h"
 #include "PSMoveProtocol.pb.h"
+#include "SharedControllerState.h"
 #include <cassert>
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <deque>
+#include <map>
+#include <mutex>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 //-- pre-declarations -----
 using namespace std;
@@ -32,12 +40,181 @@ typedef map<int, ClientConnectionPtr>::iterator t_client_connection_map_iter;
 typedef std::pair<int, ClientConnectionPtr> t_id_client_connection_pair;
 
 //-- private implementation -----
+// A data frame packed once and then sent as is to every connection that wants it
+typedef std::shared_ptr<const data_buffer> PackedDeviceDataFramePtr;
+
+// One per device whose state a data frame carries, shared by every connection the data frame goes to.
+// The first connection to send the data frame records the send and empties it,
+// so a data frame counts as sent once however many clients it goes out to.
+typedef std::shared_ptr<std::vector<DeviceLatencyTrace>> SharedLatencyTracesPtr;
+
+struct PendingDeviceDataFrame
+{
+    DeviceOutputDataFramePtr data_frame;
+    PackedDeviceDataFramePtr packed_data_frame; // null if the connection packs the data frame itself
+    SharedLatencyTracesPtr latency_traces;
+};
+
+// Which latest-value slot a data frame goes in: (device category, device id)
+typedef std::pair<int, int> t_data_frame_slot_key;
+typedef std::map<t_data_frame_slot_key, PendingDeviceDataFrame> t_data_frame_slot_map;
+
+// The newest state of a bundled controller that hasn't gone out yet,
+// left in the bundle it came in until the connection builds the next bundle to send
+struct PendingBundledControllerPacket
+{
+    DeviceOutputDataFramePtr bundle;
+    int packet_index;
+    DeviceLatencyTrace latency_trace;
+};
+
+// Keyed by controller id
+typedef std::map<int, PendingBundledControllerPacket> t_bundled_controller_slot_map;
+
+// -SharedControllerStateReadWriteAccessor-
+/// Makes the shared controller state memory that same-host clients read the controller state out of
+class SharedControllerStateReadWriteAccessor
+{
+public:
+    SharedControllerStateReadWriteAccessor()
+        : m_shared_memory_object(nullptr)
+        , m_region(nullptr)
+    {}
+
+    ~SharedControllerStateReadWriteAccessor()
+    {
+        dispose();
+    }
+
+    bool initialize()
+    {
+        bool bSuccess = false;
+
+        try
+        {
+            SERVER_LOG_INFO("SharedControllerState::initialize()") << "Allocating shared memory: " << SHARED_CONTROLLER_STATE_NAME;
+
+            // Make sure the shared memory block left behind by a service that didn't shut down cleanly has been removed first
+            boost::interprocess::shared_memory_object::remove(SHARED_CONTROLLER_STATE_NAME);
+
+            // Allow non admin-level processed to access the shared memory
+            boost::interprocess::permissions permissions;
+            permissions.set_unrestricted();
+
+            m_shared_memory_object =
+                new boost::interprocess::shared_memory_object(
+                    boost::interprocess::create_only,
+                    SHARED_CONTROLLER_STATE_NAME,
+                    boost::interprocess::read_write,
+                    permissions);
+            m_shared_memory_object->truncate(SharedControllerStateHeader::computeTotalSize());
+
+            m_region = new boost::interprocess::mapped_region(*m_shared_memory_object, boost::interprocess::read_write);
+
+            // Construct the header and slots in place so the sequence numbers start at zero
+            SharedControllerStateHeader *header = new (getHeader()) SharedControllerStateHeader();
+            for (int controller_id = 0; controller_id < SHARED_CONTROLLER_STATE_SLOT_COUNT; ++controller_id)
+            {
+                new (header->getSlotMutable(controller_id)) SharedControllerStateSlot();
+            }
+
+            bSuccess = true;
+        }
+        catch (boost::interprocess::interprocess_exception &ex)
+        {
+            dispose();
+            SERVER_LOG_ERROR("SharedControllerState::initialize()") << "Failed to allocated shared memory: " << SHARED_CONTROLLER_STATE_NAME
+                << ", reason: " << ex.what();
+        }
+
+        return bSuccess;
+    }
+
+    void dispose()
+    {
+        if (m_region != nullptr)
+        {
+            delete m_region;
+            m_region = nullptr;
+        }
+
+        if (m_shared_memory_object != nullptr)
+        {
+            delete m_shared_memory_object;
+            m_shared_memory_object = nullptr;
+
+            if (!boost::interprocess::shared_memory_object::remove(SHARED_CONTROLLER_STATE_NAME))
+            {
+                SERVER_LOG_ERROR("SharedControllerState::dispose") << "Failed to free shared memory: " << SHARED_CONTROLLER_STATE_NAME;
+            }
+        }
+    }
+
+    bool writeControllerState(const CompactControllerDataFrame &data_frame)
+    {
+        bool bSuccess = false;
+
+        if (data_frame.controller_id >= 0 && data_frame.controller_id < SHARED_CONTROLLER_STATE_SLOT_COUNT)
+        {
+            getHeader()->getSlotMutable(data_frame.controller_id)->write(data_frame);
+            bSuccess = true;
+        }
+
+        return bSuccess;
+    }
+
+protected:
+    SharedControllerStateHeader *getHeader()
+    {
+        return reinterpret_cast<SharedControllerStateHeader *>(m_region->get_address());
+    }
+
+private:
+    boost::interprocess::shared_memory_object *m_shared_memory_object;
+    boost::interprocess::mapped_region *m_region;
+};
+
 class IServerNetworkEventListener
 {
 public:
 	virtual void handle_client_connection_stopped(int connection_id) = 0;
 };
 
+// -DeviceStateLockedHandler-
+/**
+ * Wraps a socket callback so that it runs under the device state lock.
+ * The callbacks reach into the device state through the request handler,
+ * and the device threads (when running) publish through the network manager.
+ * The main loop already holds the lock when it polls the io_service, but not while it waits on it.
+ */
+template <typename t_handler>
+class DeviceStateLockedHandler
+{
+public:
+    DeviceStateLockedHandler(std::recursive_mutex &device_state_mutex, const t_handler &handler)
+        : m_device_state_mutex(&device_state_mutex)
+        , m_handler(handler)
+    {
+    }
+
+    template <typename... t_args>
+    void operator()(const t_args&... args)
+    {
+        std::lock_guard<std::recursive_mutex> lock(*m_device_state_mutex);
+        m_handler(args...);
+    }
+
+private:
+    std::recursive_mutex *m_device_state_mutex;
+    t_handler m_handler;
+};
+
+template <typename t_handler>
+static DeviceStateLockedHandler<t_handler> lock_device_state(std::recursive_mutex &device_state_mutex, const t_handler &handler)
+{
+    return DeviceStateLockedHandler<t_handler>(device_state_mutex, handler);
+}
+
 // -ClientConnection-
 /**
  * Maintains TCP and UDP connection state to a single client.
@@ -60,14 +237,16 @@ public:
         IServerNetworkEventListener* network_event_listener,
         asio::io_service& io_service_ref,
         udp::socket& udp_socket_ref, 
-        ServerRequestHandler &request_handler_ref)
+        ServerRequestHandler &request_handler_ref,
+        std::recursive_mutex &device_state_mutex_ref)
     {
         return ClientConnectionPtr(
             new ClientConnection(
                 network_event_listener, 
                 io_service_ref, 
                 udp_socket_ref, 
-                request_handler_ref));
+                request_handler_ref,
+                device_state_mutex_ref));
     }
 
     int get_connection_id() const
@@ -122,6 +301,11 @@ public:
             m_has_pending_tcp_write= false;
             m_has_pending_udp_write= false;
 
+            SERVER_LOG_INFO("ClientConnection::stop") << "Connection id " << m_connection_id
+                << " sent " << m_sent_dataframe_count << " data frames, "
+                << m_coalesced_dataframe_count << " replaced by a newer one before they went out, "
+                << m_dropped_dataframe_count << " too big to send";
+
             // Notify the parent network manager that this connection is going away
             m_network_event_listener->handle_client_connection_stopped(m_connection_id);
         }
@@ -159,7 +343,7 @@ public:
 
     bool has_queued_controller_data_frames() const
     {
-        return m_connection_started && m_pending_dataframes.size() > 0;
+        return m_connection_started && m_ready_dataframe_slots.size() > 0;
     }
 
     void add_tcp_response_to_write_queue(ResponsePtr response)
@@ -196,7 +380,9 @@ public:
                     boost::asio::async_write(
                         m_tcp_socket, 
                         boost::asio::buffer(m_response_write_buffer),
-                        boost::bind(&ClientConnection::handle_write_response_complete, this, _1));
+                        lock_device_state(
+                            m_device_state_mutex_ref,
+                            boost::bind(&ClientConnection::handle_write_response_complete, this, _1)));
                 }
             }
             else
@@ -208,9 +394,37 @@ public:
         return write_in_progress;
     }
     
-    void add_device_data_frame_to_write_queue(DeviceOutputDataFramePtr data_frame)
+    /// Each device has one slot holding the newest data frame for it that hasn't gone out yet.
+    /// A newer data frame replaces the waiting one rather than queuing up behind it,
+    /// so a client that can't keep up gets the latest state instead of a growing backlog.
+    void add_device_data_frame_to_write_queue(
+        DeviceOutputDataFramePtr data_frame,
+        PackedDeviceDataFramePtr packed_data_frame,
+        SharedLatencyTracesPtr latency_traces)
     {
-        m_pending_dataframes.push_back(data_frame);
+        if (data_frame->device_category() == PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER_BUNDLE)
+        {
+            add_controller_bundle_to_write_queue(data_frame, latency_traces);
+        }
+        else
+        {
+            const t_data_frame_slot_key slot_key= get_data_frame_slot_key(*data_frame);
+            PendingDeviceDataFrame &slot= m_dataframe_slots[slot_key];
+
+            if (slot.data_frame)
+            {
+                // Still waiting to go out, keep its place in line
+                ++m_coalesced_dataframe_count;
+            }
+            else
+            {
+                m_ready_dataframe_slots.push_back(slot_key);
+            }
+
+            slot.data_frame= data_frame;
+            slot.packed_data_frame= packed_data_frame;
+            slot.latency_traces= latency_traces;
+        }
     }
 
     bool start_udp_write_queued_device_data_frame()
@@ -221,19 +435,63 @@ public:
         {
             if (!m_has_pending_udp_write)
             {
-                if (m_pending_dataframes.size() > 0)
+                while (!write_in_progress && m_ready_dataframe_slots.size() > 0)
                 {
-                    DeviceOutputDataFramePtr dataframe= m_pending_dataframes.front();
+                    // Empty the slot now, anything published while this is being sent goes out after it
+                    const t_data_frame_slot_key slot_key= m_ready_dataframe_slots.front();
+                    PendingDeviceDataFrame pending;
+                    m_ready_dataframe_slots.pop_front();
+
+                    if (slot_key.first == PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER_BUNDLE)
+                    {
+                        pending= take_controller_bundle();
+                    }
+                    else
+                    {
+                        std::swap(pending, m_dataframe_slots[slot_key]);
+                    }
 
-                    m_packed_output_dataframe.set_msg(dataframe);
-                    if (m_packed_output_dataframe.pack(m_output_dataframe_buffer, sizeof(m_output_dataframe_buffer)))
+                    asio::const_buffer send_buffer;
+                    bool bSuccess= false;
+
+                    if (pending.packed_data_frame)
+                    {
+                        // Already packed once for every connection that wants this data frame
+                        const data_buffer &packed_data_frame= *pending.packed_data_frame;
+
+                        SERVER_LOG_DEBUG("ClientConnection::start_udp_write_queued_device_data_frame") << "Sending shared UDP DataFrame";
+                        SERVER_LOG_DEBUG("   ") << packed_data_frame.size() << " bytes";
+
+                        // Hold on to it until it's sent, the other connections may be done with it first
+                        m_sending_packed_dataframe= pending.packed_data_frame;
+                        send_buffer= asio::buffer(packed_data_frame);
+                        bSuccess= true;
+                    }
+                    else
                     {
-                        int msg_size= m_packed_output_dataframe.get_msg()->ByteSize();
+                        m_packed_output_dataframe.set_msg(pending.data_frame);
 
-                        SERVER_LOG_DEBUG("ClientConnection::start_udp_write_queued_device_data_frame") << "Sending UDP DataFrame";
-                        SERVER_LOG_DEBUG("   ") << show_hex(m_output_dataframe_buffer, HEADER_SIZE+msg_size);
-                        SERVER_LOG_DEBUG("   ") << msg_size << " bytes";
+                        if (m_packed_output_dataframe.pack(m_output_dataframe_buffer, sizeof(m_output_dataframe_buffer)))
+                        {
+                            for (const DeviceLatencyTrace &latency_trace : *pending.latency_traces)
+                            {
+                                latency_trace.record(LatencyStage_Serialization);
+                            }
 
+                            int msg_size= m_packed_output_dataframe.get_msg()->ByteSize();
+
+                            SERVER_LOG_DEBUG("ClientConnection::start_udp_write_queued_device_data_frame") << "Sending UDP DataFrame";
+                            SERVER_LOG_DEBUG("   ") << show_hex(m_output_dataframe_buffer, HEADER_SIZE+msg_size);
+                            SERVER_LOG_DEBUG("   ") << msg_size << " bytes";
+
+                            // Only send as much of the buffer as the data frame takes up
+                            send_buffer= asio::buffer(m_output_dataframe_buffer, HEADER_SIZE+msg_size);
+                            bSuccess= true;
+                        }
+                    }
+
+                    if (bSuccess)
+                    {
                         // The queue should prevent us from writing more than one data frame at once
                         assert(!m_has_pending_udp_write);
                         m_has_pending_udp_write= true;
@@ -242,14 +500,28 @@ public:
                         // Start an asynchronous operation to send the data frame
                         // NOTE: Even if the write completes immediate, the callback will only be called from io_service::poll()
                         m_udp_socket_ref.async_send_to(
-                            boost::asio::buffer(m_output_dataframe_buffer, sizeof(m_output_dataframe_buffer)),
+                            asio::buffer(send_buffer),
                             m_udp_remote_endpoint,
-                            boost::bind(&ClientConnection::handle_udp_write_device_data_frame_complete, this, _1));
+                            lock_device_state(
+                                m_device_state_mutex_ref,
+                                boost::bind(&ClientConnection::handle_udp_write_device_data_frame_complete, this, _1)));
+
+                        for (const DeviceLatencyTrace &latency_trace : *pending.latency_traces)
+                        {
+                            latency_trace.record(LatencyStage_Send);
+                        }
+                        pending.latency_traces->clear();
                     }
                     else
                     {
                         SERVER_LOG_ERROR("ClientConnection::start_udp_write_queued_device_data_frame") 
                             << "DataFrame too big to fit in packet!";
+
+                        // Count every controller a bundle carried, same as the coalesced ones
+                        m_dropped_dataframe_count+=
+                            (slot_key.first == PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER_BUNDLE)
+                            ? pending.data_frame->controller_data_packet_bundle_size()
+                            : 1;
                     }
                 }
             }
@@ -263,6 +535,101 @@ public:
     }
 
 private:
+    /// Bundled controllers each get their own slot, so a bundle only replaces
+    /// the waiting state of the controllers it actually carries.
+    /// They all share one place in line and get bundled back up when it's their turn.
+    void add_controller_bundle_to_write_queue(
+        DeviceOutputDataFramePtr bundle,
+        SharedLatencyTracesPtr latency_traces)
+    {
+        const int packet_count= bundle->controller_data_packet_bundle_size();
+        const int trace_count= static_cast<int>(latency_traces->size());
+
+        for (int packet_index= 0; packet_index < packet_count; ++packet_index)
+        {
+            const int controller_id= bundle->controller_data_packet_bundle(packet_index).controller_id();
+            PendingBundledControllerPacket &slot= m_bundled_controller_slots[controller_id];
+
+            if (slot.bundle)
+            {
+                // Still waiting to go out
+                ++m_coalesced_dataframe_count;
+            }
+
+            slot.bundle= bundle;
+            slot.packet_index= packet_index;
+            slot.latency_trace= (packet_index < trace_count) ? latency_traces->at(packet_index) : DeviceLatencyTrace();
+        }
+
+        if (!m_controller_bundle_queued && packet_count > 0)
+        {
+            m_ready_dataframe_slots.push_back(get_data_frame_slot_key(*bundle));
+            m_controller_bundle_queued= true;
+        }
+    }
+
+    /// Bundle up as many of the waiting controllers as fit in one datagram.
+    /// The rest go back in line to go out in the next one.
+    PendingDeviceDataFrame take_controller_bundle()
+    {
+        PendingDeviceDataFrame pending;
+        pending.data_frame= DeviceOutputDataFramePtr(new PSMoveProtocol::DeviceOutputDataFrame);
+        pending.data_frame->set_device_category(PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER_BUNDLE);
+        pending.latency_traces= std::make_shared<std::vector<DeviceLatencyTrace>>();
+
+        t_bundled_controller_slot_map::iterator iter= m_bundled_controller_slots.begin();
+        bool bIsFull= false;
+
+        while (!bIsFull && iter != m_bundled_controller_slots.end())
+        {
+            PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket *packet=
+                pending.data_frame->add_controller_data_packet_bundle();
+            packet->CopyFrom(iter->second.bundle->controller_data_packet_bundle(iter->second.packet_index));
+
+            if (pending.data_frame->controller_data_packet_bundle_size() > 1 &&
+                pending.data_frame->ByteSize() > MAX_OUTPUT_DATA_FRAME_MESSAGE_SIZE)
+            {
+                pending.data_frame->mutable_controller_data_packet_bundle()->RemoveLast();
+                bIsFull= true;
+            }
+            else
+            {
+                pending.latency_traces->push_back(iter->second.latency_trace);
+                iter= m_bundled_controller_slots.erase(iter);
+            }
+        }
+
+        m_controller_bundle_queued= !m_bundled_controller_slots.empty();
+        if (m_controller_bundle_queued)
+        {
+            m_ready_dataframe_slots.push_back(get_data_frame_slot_key(*pending.data_frame));
+        }
+
+        return pending;
+    }
+
+    static t_data_frame_slot_key get_data_frame_slot_key(const PSMoveProtocol::DeviceOutputDataFrame &data_frame)
+    {
+        int device_id= 0;
+
+        switch (data_frame.device_category())
+        {
+        case PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER:
+            device_id= data_frame.controller_data_packet().controller_id();
+            break;
+        case PSMoveProtocol::DeviceOutputDataFrame::TRACKER:
+            device_id= data_frame.tracker_data_packet().tracker_id();
+            break;
+        case PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER_BUNDLE:
+            // Bundled controllers have their own slots and all share this place in line
+            break;
+        default:
+            break;
+        }
+
+        return t_data_frame_slot_key(static_cast<int>(data_frame.device_category()), device_id);
+    }
+
     static int next_connection_id;
 
     IServerNetworkEventListener* m_network_event_listener;
@@ -270,6 +637,7 @@ private:
     int m_connection_id;
 
     ServerRequestHandler &m_request_handler_ref;
+    std::recursive_mutex &m_device_state_mutex_ref;
     tcp::socket m_tcp_socket;
     udp::socket &m_udp_socket_ref;
     udp::endpoint m_udp_remote_endpoint;
@@ -283,9 +651,16 @@ private:
 
     uint8_t m_output_dataframe_buffer[HEADER_SIZE+MAX_OUTPUT_DATA_FRAME_MESSAGE_SIZE];
     PackedMessage<PSMoveProtocol::DeviceOutputDataFrame> m_packed_output_dataframe;
+    PackedDeviceDataFramePtr m_sending_packed_dataframe; // shared data frame in the middle of being sent
 
     deque<ResponsePtr> m_pending_responses;
-    deque<DeviceOutputDataFramePtr> m_pending_dataframes;
+    t_data_frame_slot_map m_dataframe_slots;
+    deque<t_data_frame_slot_key> m_ready_dataframe_slots; // slots with a data frame waiting, oldest first
+    t_bundled_controller_slot_map m_bundled_controller_slots;
+    bool m_controller_bundle_queued; // the bundled controllers have a place in m_ready_dataframe_slots
+    unsigned int m_sent_dataframe_count;
+    unsigned int m_coalesced_dataframe_count;
+    unsigned int m_dropped_dataframe_count;
     
     bool m_connection_started;
     bool m_connection_stopped;
@@ -296,10 +671,12 @@ private:
         IServerNetworkEventListener *network_event_listener,
         asio::io_service& io_service_ref,
         udp::socket& udp_socket_ref , 
-        ServerRequestHandler &request_handler_ref)
+        ServerRequestHandler &request_handler_ref,
+        std::recursive_mutex &device_state_mutex_ref)
         : m_network_event_listener(network_event_listener)
         , m_connection_id(next_connection_id)
         , m_request_handler_ref(request_handler_ref)
+        , m_device_state_mutex_ref(device_state_mutex_ref)
         , m_tcp_socket(io_service_ref)
         , m_udp_socket_ref(udp_socket_ref)
         , m_udp_remote_endpoint()
@@ -309,8 +686,15 @@ private:
         , m_response_write_buffer()
         , m_packed_response()
         , m_packed_output_dataframe()
+        , m_sending_packed_dataframe()
         , m_pending_responses()
-        , m_pending_dataframes()
+        , m_dataframe_slots()
+        , m_ready_dataframe_slots()
+        , m_bundled_controller_slots()
+        , m_controller_bundle_queued(false)
+        , m_sent_dataframe_count(0)
+        , m_coalesced_dataframe_count(0)
+        , m_dropped_dataframe_count(0)
         , m_connection_started(false)
         , m_connection_stopped(false)
         , m_has_pending_tcp_write(false)
@@ -345,10 +729,12 @@ private:
         asio::async_read(
             m_tcp_socket, 
             asio::buffer(m_request_read_buffer),
-            boost::bind(
-                &ClientConnection::handle_tcp_read_request_header, 
-                shared_from_this(),
-                asio::placeholders::error));
+            lock_device_state(
+                m_device_state_mutex_ref,
+                boost::bind(
+                    &ClientConnection::handle_tcp_read_request_header, 
+                    shared_from_this(),
+                    asio::placeholders::error)));
     }
 
     void handle_tcp_read_request_header(const boost::system::error_code& error)
@@ -394,10 +780,12 @@ private:
         asio::mutable_buffers_1 buf = asio::buffer(&m_request_read_buffer[HEADER_SIZE], msg_len);
         asio::async_read(
             m_tcp_socket, buf,
-            boost::bind(
-                &ClientConnection::handle_tcp_read_request_body, 
-                shared_from_this(),
-                asio::placeholders::error));
+            lock_device_state(
+                m_device_state_mutex_ref,
+                boost::bind(
+                    &ClientConnection::handle_tcp_read_request_body, 
+                    shared_from_this(),
+                    asio::placeholders::error)));
     }
 
     void handle_tcp_read_request_body(const boost::system::error_code& error)
@@ -488,9 +876,8 @@ private:
 
             // no longer is there a pending write
             m_has_pending_udp_write= false;
-
-            // Remove the dataframe from the pending send queue now that it's sent
-            m_pending_dataframes.pop_front();
+            m_sending_packed_dataframe.reset();
+            ++m_sent_dataframe_count;
         }
         else
         {
@@ -508,16 +895,22 @@ int ClientConnection::next_connection_id = 0;
 class ServerNetworkManagerImpl : public IServerNetworkEventListener
 {
 public:
-    ServerNetworkManagerImpl(asio::io_service &io_service, unsigned int port, ServerRequestHandler &requestHandler)
+    ServerNetworkManagerImpl(
+        asio::io_service &io_service, unsigned int port,
+        ServerRequestHandler &requestHandler, std::recursive_mutex &device_state_mutex)
         : m_request_handler_ref(requestHandler)
+        , m_device_state_mutex_ref(device_state_mutex)
         , m_io_service(io_service)
+        , m_wait_timer(io_service)
         , m_tcp_acceptor(m_io_service, tcp::endpoint(tcp::v4(), port))
         , m_udp_socket(m_io_service, udp::endpoint(udp::v4(), port))
         , m_udp_connecting_remote_endpoint()
         , m_packed_input_dataframe(std::shared_ptr<PSMoveProtocol::DeviceInputDataFrame>(new PSMoveProtocol::DeviceInputDataFrame()))
+        , m_packed_output_dataframe()
         , m_udp_connection_result_write_buffer(false)
         , m_has_pending_udp_read(false)
         , m_connections()
+        , m_shared_controller_state_accessor(nullptr)
     {
         memset(m_input_dataframe_buffer, 0, sizeof(m_input_dataframe_buffer));
     }
@@ -529,6 +922,8 @@ public:
         {
             SERVER_LOG_ERROR("~ServerNetworkManagerImpl") << "Network manager deleted while there were unclosed connections!";
         }
+
+        close_shared_controller_state();
     }
 
     //-- ServerNetworkManagerImpl ----
@@ -545,7 +940,8 @@ public:
                 this, 
                 m_tcp_acceptor.get_io_service(), 
                 m_udp_socket, 
-                m_request_handler_ref);
+                m_request_handler_ref,
+                m_device_state_mutex_ref);
 
         // Add the connection to the list
         t_id_client_connection_pair map_entry(new_connection->get_connection_id(), new_connection);
@@ -554,7 +950,9 @@ public:
         // Asynchronously wait to accept a new tcp client
         m_tcp_acceptor.async_accept(
             new_connection->get_tcp_socket(),
-            boost::bind(&ServerNetworkManagerImpl::handle_tcp_accept, this, new_connection, asio::placeholders::error));
+            lock_device_state(
+                m_device_state_mutex_ref,
+                boost::bind(&ServerNetworkManagerImpl::handle_tcp_accept, this, new_connection, asio::placeholders::error)));
 
         
         // Asynchronously wait to accept a new udp clients
@@ -562,6 +960,36 @@ public:
         start_udp_read_input_data_frame();
     }
 
+    /// Called during PSMoveService::startup()
+    /// Same-host clients can still get all of their data frames over the network if this fails.
+    bool open_shared_controller_state()
+    {
+        assert(m_shared_controller_state_accessor == nullptr);
+        m_shared_controller_state_accessor = new SharedControllerStateReadWriteAccessor();
+
+        if (!m_shared_controller_state_accessor->initialize())
+        {
+            delete m_shared_controller_state_accessor;
+            m_shared_controller_state_accessor = nullptr;
+        }
+
+        return m_shared_controller_state_accessor != nullptr;
+    }
+
+    void close_shared_controller_state()
+    {
+        if (m_shared_controller_state_accessor != nullptr)
+        {
+            delete m_shared_controller_state_accessor;
+            m_shared_controller_state_accessor = nullptr;
+        }
+    }
+
+    bool has_shared_controller_state() const
+    {
+        return m_shared_controller_state_accessor != nullptr;
+    }
+
     void poll()
     {
         bool keep_polling= true;
@@ -588,6 +1016,23 @@ public:
         }
     }
 
+    void wait_for_activity(int timeout_ms)
+    {
+        // Whichever comes first, a socket callback or the timer
+        m_wait_timer.expires_from_now(boost::posix_time::milliseconds(timeout_ms));
+        m_wait_timer.async_wait(boost::bind(&ServerNetworkManagerImpl::handle_wait_timeout, this, asio::placeholders::error));
+
+        m_io_service.run_one();
+
+        // If it was a socket callback, the cancelled timer's callback runs on the next poll()
+        m_wait_timer.cancel();
+    }
+
+    void handle_wait_timeout(const boost::system::error_code&)
+    {
+        // Only there to wake up wait_for_activity()
+    }
+
     void close_all_connections()
     {
         SERVER_LOG_DEBUG("ServerNetworkManager::close_all_connections") << "Stopping all client connections";
@@ -670,7 +1115,10 @@ public:
         }
     }
 
-    void send_device_data_frame(int connection_id, DeviceOutputDataFramePtr data_frame)
+    void send_device_data_frame(
+        int connection_id,
+        DeviceOutputDataFramePtr data_frame,
+        const std::vector<DeviceLatencyTrace> &latency_traces)
     {
         t_client_connection_map_iter entry = m_connections.find(connection_id);
 
@@ -681,7 +1129,8 @@ public:
             SERVER_LOG_TRACE("ServerNetworkManager::send_device_data_frame") 
                 << "Sending data_frame to connection " << connection_id;
 
-            connection->add_device_data_frame_to_write_queue(data_frame);
+            connection->add_device_data_frame_to_write_queue(
+                data_frame, PackedDeviceDataFramePtr(), std::make_shared<std::vector<DeviceLatencyTrace>>(latency_traces));
 
             start_udp_queued_data_frame_write();
         }
@@ -692,6 +1141,86 @@ public:
         }
     }
 
+    void send_device_data_frame_to_connections(
+        const std::vector<int> &connection_ids,
+        DeviceOutputDataFramePtr data_frame,
+        const std::vector<DeviceLatencyTrace> &latency_traces)
+    {
+        if (connection_ids.size() == 1)
+        {
+            // Nothing to share, let the connection pack it when it's ready to send it
+            send_device_data_frame(connection_ids[0], data_frame, latency_traces);
+        }
+        else if (connection_ids.size() > 1)
+        {
+            // Pack the data frame once and hand the same bytes to every connection
+            std::shared_ptr<data_buffer> packed_data_frame(new data_buffer);
+
+            m_packed_output_dataframe.set_msg(data_frame);
+
+            if (!m_packed_output_dataframe.pack(*packed_data_frame) ||
+                packed_data_frame->size() > HEADER_SIZE+MAX_OUTPUT_DATA_FRAME_MESSAGE_SIZE)
+            {
+                SERVER_LOG_ERROR("ServerNetworkManager::send_device_data_frame_to_connections") 
+                    << "DataFrame too big to fit in packet!";
+                return;
+            }
+
+            add_packed_data_frame_to_connections(connection_ids, data_frame, packed_data_frame, latency_traces);
+        }
+    }
+
+    void send_compact_controller_data_frame_to_connections(
+        const std::vector<int> &connection_ids,
+        DeviceOutputDataFramePtr data_frame,
+        const DeviceLatencyStats::timestamp &sample_time,
+        const std::vector<DeviceLatencyTrace> &latency_traces)
+    {
+        if (connection_ids.size() > 0)
+        {
+            // Fixed layout, so it always fits and there's nothing to size up first
+            CompactControllerDataFrame compact_data_frame;
+            build_compact_controller_data_frame(*data_frame, sample_time, compact_data_frame);
+
+            std::shared_ptr<data_buffer> packed_data_frame(new data_buffer(sizeof(CompactControllerDataFrame)));
+            compact_data_frame.pack(packed_data_frame->data());
+
+            // The protobuf data frame still goes along to pick out the connections' data frame slots
+            add_packed_data_frame_to_connections(connection_ids, data_frame, packed_data_frame, latency_traces);
+        }
+    }
+
+    void write_controller_data_frame_to_shared_memory(
+        DeviceOutputDataFramePtr data_frame,
+        const DeviceLatencyStats::timestamp &sample_time,
+        const std::vector<DeviceLatencyTrace> &latency_traces)
+    {
+        if (m_shared_controller_state_accessor != nullptr)
+        {
+            CompactControllerDataFrame compact_data_frame;
+            build_compact_controller_data_frame(*data_frame, sample_time, compact_data_frame);
+
+            for (const DeviceLatencyTrace &latency_trace : latency_traces)
+            {
+                latency_trace.record(LatencyStage_Serialization);
+            }
+
+            if (m_shared_controller_state_accessor->writeControllerState(compact_data_frame))
+            {
+                // As far as the clients are concerned, that was the send
+                for (const DeviceLatencyTrace &latency_trace : latency_traces)
+                {
+                    latency_trace.record(LatencyStage_Send);
+                }
+            }
+            else
+            {
+                SERVER_LOG_ERROR("ServerNetworkManager::write_controller_data_frame_to_shared_memory") 
+                    << "No shared memory slot for controller " << compact_data_frame.controller_id;
+            }
+        }
+    }
+
     // -- IServerNetworkEventListener ----
 	virtual void handle_client_connection_stopped(int connection_id) override
     {
@@ -709,9 +1238,15 @@ public:
 private:
     // Process and responds to incoming PSMoveService request
     ServerRequestHandler &m_request_handler_ref;
+
+    // Held while the socket callbacks run, see DeviceStateLockedHandler
+    std::recursive_mutex &m_device_state_mutex_ref;
     
     // Core i/o functionality for TCP/UDP sockets
     asio::io_service &m_io_service;
+
+    // Bounds how long wait_for_activity() blocks on the io_service
+    asio::deadline_timer m_wait_timer;
     
     // Handles waiting for and accepting new TCP connections
     tcp::acceptor m_tcp_acceptor;
@@ -726,6 +1261,9 @@ private:
     uint8_t m_input_dataframe_buffer[HEADER_SIZE + MAX_INPUT_DATA_FRAME_MESSAGE_SIZE];
     PackedMessage<PSMoveProtocol::DeviceInputDataFrame> m_packed_input_dataframe;
 
+    // Packs the data frames shared by several connections
+    PackedMessage<PSMoveProtocol::DeviceOutputDataFrame> m_packed_output_dataframe;
+
     // A pending udp result sent to the client
     bool m_udp_connection_result_write_buffer;
 
@@ -735,6 +1273,133 @@ private:
     // A mapping from connection_id -> ClientConnectionPtr
     t_client_connection_map m_connections;
 
+    // Where the controller streams of same-host clients get written (null if it couldn't be allocated)
+    SharedControllerStateReadWriteAccessor *m_shared_controller_state_accessor;
+
+    void add_packed_data_frame_to_connections(
+        const std::vector<int> &connection_ids,
+        DeviceOutputDataFramePtr data_frame,
+        PackedDeviceDataFramePtr packed_data_frame,
+        const std::vector<DeviceLatencyTrace> &latency_traces)
+    {
+        for (const DeviceLatencyTrace &latency_trace : latency_traces)
+        {
+            latency_trace.record(LatencyStage_Serialization);
+        }
+
+        SharedLatencyTracesPtr shared_latency_traces= std::make_shared<std::vector<DeviceLatencyTrace>>(latency_traces);
+
+        for (int connection_id : connection_ids)
+        {
+            t_client_connection_map_iter entry = m_connections.find(connection_id);
+
+            if (entry != m_connections.end())
+            {
+                SERVER_LOG_TRACE("ServerNetworkManager::add_packed_data_frame_to_connections") 
+                    << "Sending shared data_frame to connection " << connection_id;
+
+                entry->second->add_device_data_frame_to_write_queue(data_frame, packed_data_frame, shared_latency_traces);
+            }
+            else
+            {
+                SERVER_LOG_ERROR("ServerNetworkManager::add_packed_data_frame_to_connections") 
+                    << "Can't send data_frame to unknown connection " << connection_id;
+            }
+        }
+
+        start_udp_queued_data_frame_write();
+    }
+
+    static void build_compact_controller_data_frame(
+        const PSMoveProtocol::DeviceOutputDataFrame &data_frame,
+        const DeviceLatencyStats::timestamp &sample_time,
+        CompactControllerDataFrame &out_compact_data_frame)
+    {
+        const PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket &controller_packet= data_frame.controller_data_packet();
+
+        out_compact_data_frame.Clear();
+        out_compact_data_frame.sample_time_us=
+            std::chrono::duration_cast<std::chrono::microseconds>(sample_time.time_since_epoch()).count();
+        out_compact_data_frame.controller_id= controller_packet.controller_id();
+        out_compact_data_frame.controller_type= controller_packet.controller_type();
+        out_compact_data_frame.sequence_num= controller_packet.sequence_num();
+        out_compact_data_frame.button_down_bitmask= controller_packet.button_down_bitmask();
+        out_compact_data_frame.setFlag(CompactControllerDataFrame::IsConnected, controller_packet.isconnected());
+
+        switch (controller_packet.controller_type())
+        {
+        case PSMoveProtocol::PSMOVE:
+            {
+                const auto &psmove_state= controller_packet.psmove_state();
+
+                build_compact_tracked_controller_state(psmove_state, out_compact_data_frame);
+                out_compact_data_frame.trigger_value= psmove_state.trigger_value();
+            } break;
+        case PSMoveProtocol::PSNAVI:
+            {
+                const auto &psnavi_state= controller_packet.psnavi_state();
+
+                out_compact_data_frame.trigger_value= psnavi_state.trigger_value();
+                out_compact_data_frame.stick_xaxis= psnavi_state.stick_xaxis();
+                out_compact_data_frame.stick_yaxis= psnavi_state.stick_yaxis();
+            } break;
+        case PSMoveProtocol::PSDUALSHOCK4:
+            {
+                const auto &ds4_state= controller_packet.psdualshock4_state();
+
+                build_compact_tracked_controller_state(ds4_state, out_compact_data_frame);
+                out_compact_data_frame.left_thumbstick_x= ds4_state.left_thumbstick_x();
+                out_compact_data_frame.left_thumbstick_y= ds4_state.left_thumbstick_y();
+                out_compact_data_frame.right_thumbstick_x= ds4_state.right_thumbstick_x();
+                out_compact_data_frame.right_thumbstick_y= ds4_state.right_thumbstick_y();
+                out_compact_data_frame.left_trigger_value= ds4_state.left_trigger_value();
+                out_compact_data_frame.right_trigger_value= ds4_state.right_trigger_value();
+            } break;
+        default:
+            break;
+        }
+    }
+
+    // The PSMove and DualShock4 states name their tracking fields the same
+    template <typename t_tracked_controller_state>
+    static void build_compact_tracked_controller_state(
+        const t_tracked_controller_state &controller_state,
+        CompactControllerDataFrame &out_compact_data_frame)
+    {
+        out_compact_data_frame.setFlag(CompactControllerDataFrame::ValidHardwareCalibration, controller_state.validhardwarecalibration());
+        out_compact_data_frame.setFlag(CompactControllerDataFrame::IsTrackingEnabled, controller_state.istrackingenabled());
+        out_compact_data_frame.setFlag(CompactControllerDataFrame::IsCurrentlyTracking, controller_state.iscurrentlytracking());
+        out_compact_data_frame.setFlag(CompactControllerDataFrame::IsOrientationValid, controller_state.isorientationvalid());
+        out_compact_data_frame.setFlag(CompactControllerDataFrame::IsPositionValid, controller_state.ispositionvalid());
+
+        out_compact_data_frame.position[0]= controller_state.position().x();
+        out_compact_data_frame.position[1]= controller_state.position().y();
+        out_compact_data_frame.position[2]= controller_state.position().z();
+
+        out_compact_data_frame.orientation[0]= controller_state.orientation().w();
+        out_compact_data_frame.orientation[1]= controller_state.orientation().x();
+        out_compact_data_frame.orientation[2]= controller_state.orientation().y();
+        out_compact_data_frame.orientation[3]= controller_state.orientation().z();
+
+        if (controller_state.has_physics_data())
+        {
+            const auto &physics_data= controller_state.physics_data();
+
+            out_compact_data_frame.setFlag(CompactControllerDataFrame::HasPhysicsData, true);
+            copy_float_vector(physics_data.velocity(), out_compact_data_frame.velocity);
+            copy_float_vector(physics_data.acceleration(), out_compact_data_frame.acceleration);
+            copy_float_vector(physics_data.angular_velocity(), out_compact_data_frame.angular_velocity);
+            copy_float_vector(physics_data.angular_acceleration(), out_compact_data_frame.angular_acceleration);
+        }
+    }
+
+    static inline void copy_float_vector(const PSMoveProtocol::FloatVector &vector, float out_vector[3])
+    {
+        out_vector[0]= vector.i();
+        out_vector[1]= vector.j();
+        out_vector[2]= vector.k();
+    }
+
 protected:
     void handle_tcp_accept(ClientConnectionPtr connection, const boost::system::error_code& error)
     {        
@@ -770,10 +1435,12 @@ protected:
             m_udp_socket.async_receive_from(
                 asio::buffer(m_input_dataframe_buffer, sizeof(m_input_dataframe_buffer)),
                 m_udp_connecting_remote_endpoint,
-                boost::bind(
-                    &ServerNetworkManagerImpl::handle_udp_read_data_frame,
-                    this,
-                    asio::placeholders::error));
+                lock_device_state(
+                    m_device_state_mutex_ref,
+                    boost::bind(
+                        &ServerNetworkManagerImpl::handle_udp_read_data_frame,
+                        this,
+                        asio::placeholders::error)));
         }
     }
 
@@ -863,7 +1530,9 @@ protected:
         m_udp_socket.async_send_to(
             boost::asio::buffer(&m_udp_connection_result_write_buffer, sizeof(m_udp_connection_result_write_buffer)), 
             m_udp_connecting_remote_endpoint,
-            boost::bind(&ServerNetworkManagerImpl::handle_udp_write_connection_result, this, boost::asio::placeholders::error));
+            lock_device_state(
+                m_device_state_mutex_ref,
+                boost::bind(&ServerNetworkManagerImpl::handle_udp_write_connection_result, this, boost::asio::placeholders::error)));
     }
 
     void handle_udp_write_connection_result(const boost::system::error_code& error)
@@ -928,8 +1597,9 @@ ServerNetworkManager *ServerNetworkManager::m_instance = NULL;
 ServerNetworkManager::ServerNetworkManager(
     boost::asio::io_service *io_service,
     unsigned port,
-    ServerRequestHandler *requestHandler)
-    : implementation_ptr(new ServerNetworkManagerImpl(*io_service, port, *requestHandler))
+    ServerRequestHandler *requestHandler,
+    std::recursive_mutex *device_state_mutex)
+    : implementation_ptr(new ServerNetworkManagerImpl(*io_service, port, *requestHandler, *device_state_mutex))
 {
 }
 
@@ -954,6 +1624,11 @@ bool ServerNetworkManager::startup()
     
     implementation_ptr->start_connection_accept();
 
+    if (!implementation_ptr->open_shared_controller_state())
+    {
+        SERVER_LOG_WARNING("ServerNetworkManager::startup") << "Controller streams will only go out over the network";
+    }
+
     return true;
 }
 
@@ -962,10 +1637,16 @@ void ServerNetworkManager::update()
     implementation_ptr->poll();
 }
 
+void ServerNetworkManager::wait_for_activity(int timeout_ms)
+{
+    implementation_ptr->wait_for_activity(timeout_ms);
+}
+
 void ServerNetworkManager::shutdown()
 {
     
     implementation_ptr->close_all_connections();
+    implementation_ptr->close_shared_controller_state();
     
     m_instance= NULL;
 }
@@ -980,7 +1661,66 @@ void ServerNetworkManager::send_notification_to_all_clients(ResponsePtr response
     implementation_ptr->send_notification_to_all_clients(response);
 }
 
-void ServerNetworkManager::send_device_data_frame(int connection_id, DeviceOutputDataFramePtr data_frame)
+void ServerNetworkManager::send_device_data_frame(
+    int connection_id, DeviceOutputDataFramePtr data_frame, const DeviceLatencyTrace &latency_trace)
+{
+    std::vector<DeviceLatencyTrace> latency_traces;
+
+    if (latency_trace.stats)
+    {
+        latency_traces.push_back(latency_trace);
+    }
+
+    implementation_ptr->send_device_data_frame(connection_id, data_frame, latency_traces);
+}
+
+void ServerNetworkManager::send_device_data_frame(
+    int connection_id, DeviceOutputDataFramePtr data_frame, const std::vector<DeviceLatencyTrace> &latency_traces)
+{
+    implementation_ptr->send_device_data_frame(connection_id, data_frame, latency_traces);
+}
+
+void ServerNetworkManager::send_device_data_frame_to_connections(
+    const std::vector<int> &connection_ids, DeviceOutputDataFramePtr data_frame, const DeviceLatencyTrace &latency_trace)
 {
-    implementation_ptr->send_device_data_frame(connection_id, data_frame);
+    std::vector<DeviceLatencyTrace> latency_traces;
+
+    if (latency_trace.stats)
+    {
+        latency_traces.push_back(latency_trace);
+    }
+
+    implementation_ptr->send_device_data_frame_to_connections(connection_ids, data_frame, latency_traces);
+}
+
+void ServerNetworkManager::send_compact_controller_data_frame_to_connections(
+    const std::vector<int> &connection_ids, DeviceOutputDataFramePtr data_frame, const DeviceLatencyTrace &latency_trace)
+{
+    std::vector<DeviceLatencyTrace> latency_traces;
+
+    if (latency_trace.stats)
+    {
+        latency_traces.push_back(latency_trace);
+    }
+
+    implementation_ptr->send_compact_controller_data_frame_to_connections(
+        connection_ids, data_frame, latency_trace.origin_time, latency_traces);
+}
+
+bool ServerNetworkManager::has_shared_controller_state() const
+{
+    return implementation_ptr->has_shared_controller_state();
+}
+
+void ServerNetworkManager::write_controller_data_frame_to_shared_memory(
+    DeviceOutputDataFramePtr data_frame, const DeviceLatencyTrace &latency_trace)
+{
+    std::vector<DeviceLatencyTrace> latency_traces;
+
+    if (latency_trace.stats)
+    {
+        latency_traces.push_back(latency_trace);
+    }
+
+    implementation_ptr->write_controller_data_frame_to_shared_memory(data_frame, latency_trace.origin_time, latency_traces);
 }
@@ -3,6 +3,10 @@
 
 //-- includes -----
 #include "PSMoveProtocolInterface.h"
+#include "ServerLatencyStats.h"
+
+#include <mutex>
+#include <vector>
 
 //-- pre-declarations -----
 class ServerRequestHandler;
@@ -25,8 +29,11 @@ public:
      \param io_service Uses default initializer of boost::asio::io_service
      \param port Default is PSMOVE_SERVER_PORT = 9512
      \param request_handler Default ServerRequestHandler(ControllerManager)
+     \param device_state_mutex DeviceManager::getDeviceStateMutex(), held while the socket callbacks run
      */
-    ServerNetworkManager(boost::asio::io_service *io_service, unsigned port, ServerRequestHandler *request_handler);
+    ServerNetworkManager(
+        boost::asio::io_service *io_service, unsigned port,
+        ServerRequestHandler *request_handler, std::recursive_mutex *device_state_mutex);
     virtual ~ServerNetworkManager();
 
     static ServerNetworkManager *get_instance() { return m_instance; }
@@ -42,6 +49,12 @@ public:
      Calls ServerNetworkManagerImpl::poll()
      */
     void update();
+
+    /// Called by the PSMoveService main loop in between updates while the device threads are running
+    /**
+     Blocks until a socket callback has run or timeout_ms is up
+     */
+    void wait_for_activity(int timeout_ms);
     
     /// Called last by PSMoveService::shutdown()
     /**
@@ -53,7 +66,31 @@ public:
     
     void send_notification_to_all_clients(ResponsePtr response);
     
-    void send_device_data_frame(int connection_id, DeviceOutputDataFramePtr data_frame);
+    /// latency_trace says where to record when the data frame got serialized and sent (if anywhere)
+    void send_device_data_frame(
+        int connection_id, DeviceOutputDataFramePtr data_frame,
+        const DeviceLatencyTrace &latency_trace = DeviceLatencyTrace());
+    /// For data frames that carry the state of several devices
+    void send_device_data_frame(
+        int connection_id, DeviceOutputDataFramePtr data_frame,
+        const std::vector<DeviceLatencyTrace> &latency_traces);
+    /// Packs the data frame once and sends the same bytes to every one of the given connections
+    void send_device_data_frame_to_connections(
+        const std::vector<int> &connection_ids, DeviceOutputDataFramePtr data_frame,
+        const DeviceLatencyTrace &latency_trace = DeviceLatencyTrace());
+    /// Same as send_device_data_frame_to_connections, but sent as a CompactControllerDataFrame.
+    /// The latency trace's origin time is the sample time it carries.
+    void send_compact_controller_data_frame_to_connections(
+        const std::vector<int> &connection_ids, DeviceOutputDataFramePtr data_frame,
+        const DeviceLatencyTrace &latency_trace);
+
+    /// Whether the shared controller state memory (see SharedControllerState.h) got allocated at startup
+    bool has_shared_controller_state() const;
+    /// Writes the controller data frame into the controller's shared controller state slot
+    /// for same-host clients to read, as a CompactControllerDataFrame.
+    /// Does nothing without the shared controller state.
+    void write_controller_data_frame_to_shared_memory(
+        DeviceOutputDataFramePtr data_frame, const DeviceLatencyTrace &latency_trace);
 
 private:
     /// Must use the overloaded constructor
@@ -12,19 +12,25 @@
 #include "PSDualShock4Controller.h"
 #include "PSMoveController.h"
 #include "PSMoveProtocol.pb.h"
+#include "SharedControllerState.h"
 #include "ServerControllerView.h"
 #include "ServerDeviceView.h"
 #include "ServerNetworkManager.h"
 #include "ServerTrackerView.h"
 #include "ServerLog.h"
+#include "ServerTrace.h"
 #include "ServerUtility.h"
 #include "TrackerManager.h"
 
 #include <cassert>
 #include <bitset>
 #include <map>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 
+static_assert(SHARED_CONTROLLER_STATE_SLOT_COUNT == ControllerManager::k_max_devices,
+    "Every controller needs a shared controller state slot");
+
 //-- pre-declarations -----
 class ServerRequestHandlerImpl;
 typedef boost::shared_ptr<ServerRequestHandlerImpl> ServerRequestHandlerImplPtr;
@@ -38,12 +44,16 @@ struct RequestConnectionState
     AsyncBluetoothRequest *pending_bluetooth_request;
     ControllerStreamInfo active_controller_stream_info[ControllerManager::k_max_devices];
     TrackerStreamInfo active_tracker_stream_info[TrackerManager::k_max_devices];
+    DeviceOutputDataFramePtr pending_controller_bundle; // null until a bundled stream publishes
+    std::vector<DeviceLatencyTrace> pending_controller_bundle_traces; // one per packet in the bundle, in the same order
 
     RequestConnectionState()
         : connection_id(-1)
         , active_controller_streams()
         , active_tracker_streams()
         , pending_bluetooth_request(nullptr)
+        , pending_controller_bundle()
+        , pending_controller_bundle_traces()
     {
         for (int index = 0; index < ControllerManager::k_max_devices; ++index)
         {
@@ -68,6 +78,15 @@ struct RequestContext
     RequestPtr request;
 };
 
+// One controller data frame and the (unbundled) connections it goes out to
+struct ControllerDataFrameFanOut
+{
+    unsigned int signature;
+    bool compact_data_frame;
+    DeviceOutputDataFramePtr data_frame;
+    std::vector<int> connection_ids;
+};
+
 //-- private implementation -----
 class ServerRequestHandlerImpl
 {
@@ -270,6 +289,16 @@ public:
                 handle_request__set_hmd_tracking_space_origin(context, response);
                 break;
 
+            // Diagnostic Requests
+            case PSMoveProtocol::Request_RequestType_GET_LATENCY_STATS:
+                response = new PSMoveProtocol::Response;
+                handle_request__get_latency_stats(context, response);
+                break;
+            case PSMoveProtocol::Request_RequestType_DUMP_TRACE:
+                response = new PSMoveProtocol::Response;
+                handle_request__dump_trace(context, response);
+                break;
+
             default:
                 assert(0 && "Whoops, bad request!");
         }
@@ -357,8 +386,26 @@ public:
          ServerControllerView *controller_view, 
          ServerRequestHandler::t_generate_controller_data_frame_for_stream callback)
     {
+        SERVER_TRACE_SCOPE("ServerRequestHandler::publish_controller_data_frame");
+
         int controller_id= controller_view->getDeviceID();
 
+        // Time the data frames' way out from when the controller state they carry was read
+        const DeviceLatencyTrace latency_trace(
+            controller_view->getLatencyStats(), controller_view->getLastNewDataTimestamp());
+
+        // Every stream that asks for the same data gets the same data frame,
+        // so only fill out and pack one per stream signature
+        std::vector<ControllerDataFrameFanOut> fan_outs;
+
+        // Every same-host stream of the controller reads the one shared memory data frame,
+        // so it carries everything any of them asked for
+        ControllerStreamInfo shared_memory_stream_info;
+        bool bHasSharedMemoryStream= false;
+        shared_memory_stream_info.Clear();
+        shared_memory_stream_info.compact_data_frame= true;
+        shared_memory_stream_info.shared_memory_data_frame= true;
+
         // Notify any connections that care about the controller update
         for (t_connection_state_iter iter= m_connection_state_map.begin(); iter != m_connection_state_map.end(); ++iter)
         {
@@ -369,14 +416,81 @@ public:
             {
                 const ControllerStreamInfo &streamInfo=
                     connection_state->active_controller_stream_info[controller_id];
+                const unsigned int signature= streamInfo.getDataFrameSignature();
 
-                // Fill out a data frame specific to this stream using the given callback
-                DeviceOutputDataFramePtr data_frame(new PSMoveProtocol::DeviceOutputDataFrame);
-                callback(controller_view, &streamInfo, data_frame);
+                if (streamInfo.shared_memory_data_frame)
+                {
+                    // Written to the shared memory once after the loop
+                    shared_memory_stream_info.include_position_data|= streamInfo.include_position_data;
+                    shared_memory_stream_info.include_physics_data|= streamInfo.include_physics_data;
+                    bHasSharedMemoryStream= true;
+                }
+                else
+                {
+                    ControllerDataFrameFanOut *fan_out= nullptr;
+                    for (ControllerDataFrameFanOut &existing_fan_out : fan_outs)
+                    {
+                        if (existing_fan_out.signature == signature)
+                        {
+                            fan_out= &existing_fan_out;
+                            break;
+                        }
+                    }
 
-                // Send the controller data frame over the network
-                ServerNetworkManager::get_instance()->send_device_data_frame(connection_id, data_frame);
+                    if (fan_out == nullptr)
+                    {
+                        // Fill out a data frame specific to this stream using the given callback
+                        fan_outs.push_back(ControllerDataFrameFanOut());
+                        fan_out= &fan_outs.back();
+                        fan_out->signature= signature;
+                        fan_out->compact_data_frame= streamInfo.compact_data_frame;
+                        fan_out->data_frame= DeviceOutputDataFramePtr(new PSMoveProtocol::DeviceOutputDataFrame);
+                        callback(controller_view, &streamInfo, fan_out->data_frame);
+                    }
+
+                    if (streamInfo.bundle_controller_data && !streamInfo.compact_data_frame)
+                    {
+                        // Goes out with the connection's other bundled controllers in flush_controller_data_bundles()
+                        add_to_controller_data_bundle(connection_state, fan_out->data_frame, latency_trace);
+                    }
+                    else
+                    {
+                        fan_out->connection_ids.push_back(connection_id);
+                    }
+                }
+            }
+        }
+
+        // Same-host clients read it straight out of the shared memory, nothing gets sent to them
+        if (bHasSharedMemoryStream)
+        {
+            DeviceOutputDataFramePtr data_frame(new PSMoveProtocol::DeviceOutputDataFrame);
+            callback(controller_view, &shared_memory_stream_info, data_frame);
+
+            ServerNetworkManager::get_instance()->write_controller_data_frame_to_shared_memory(data_frame, latency_trace);
+        }
+
+        // Send each controller data frame over the network to every connection that wants it
+        for (const ControllerDataFrameFanOut &fan_out : fan_outs)
+        {
+            if (fan_out.compact_data_frame)
+            {
+                ServerNetworkManager::get_instance()->send_compact_controller_data_frame_to_connections(
+                    fan_out.connection_ids, fan_out.data_frame, latency_trace);
             }
+            else
+            {
+                ServerNetworkManager::get_instance()->send_device_data_frame_to_connections(
+                    fan_out.connection_ids, fan_out.data_frame, latency_trace);
+            }
+        }
+    }
+
+    void flush_controller_data_bundles()
+    {
+        for (t_connection_state_iter iter= m_connection_state_map.begin(); iter != m_connection_state_map.end(); ++iter)
+        {
+            send_controller_data_bundle(iter->second);
         }
     }
 
@@ -408,6 +522,55 @@ public:
     }
 
 protected:
+    void add_to_controller_data_bundle(
+        RequestConnectionStatePtr connection_state,
+        DeviceOutputDataFramePtr data_frame,
+        const DeviceLatencyTrace &latency_trace)
+    {
+        if (!connection_state->pending_controller_bundle)
+        {
+            connection_state->pending_controller_bundle = DeviceOutputDataFramePtr(new PSMoveProtocol::DeviceOutputDataFrame);
+            connection_state->pending_controller_bundle->set_device_category(PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER_BUNDLE);
+        }
+
+        DeviceOutputDataFramePtr bundle = connection_state->pending_controller_bundle;
+        PSMoveProtocol::DeviceOutputDataFrame_ControllerDataPacket *packet = bundle->add_controller_data_packet_bundle();
+
+        // Copied, since other connections may be sent the same data frame
+        packet->CopyFrom(data_frame->controller_data_packet());
+
+        // If this packet doesn't fit in the datagram anymore,
+        // send the ones before it and start the next bundle with it
+        if (bundle->controller_data_packet_bundle_size() > 1 &&
+            bundle->ByteSize() > MAX_OUTPUT_DATA_FRAME_MESSAGE_SIZE)
+        {
+            packet = bundle->mutable_controller_data_packet_bundle()->ReleaseLast();
+
+            send_controller_data_bundle(connection_state);
+
+            connection_state->pending_controller_bundle = DeviceOutputDataFramePtr(new PSMoveProtocol::DeviceOutputDataFrame);
+            connection_state->pending_controller_bundle->set_device_category(PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER_BUNDLE);
+            connection_state->pending_controller_bundle->mutable_controller_data_packet_bundle()->AddAllocated(packet);
+        }
+
+        // Even untraced, so the network manager can match each packet up with its trace
+        connection_state->pending_controller_bundle_traces.push_back(latency_trace);
+    }
+
+    void send_controller_data_bundle(RequestConnectionStatePtr connection_state)
+    {
+        if (connection_state->pending_controller_bundle)
+        {
+            ServerNetworkManager::get_instance()->send_device_data_frame(
+                connection_state->connection_id,
+                connection_state->pending_controller_bundle,
+                connection_state->pending_controller_bundle_traces);
+
+            connection_state->pending_controller_bundle.reset();
+            connection_state->pending_controller_bundle_traces.clear();
+        }
+    }
+
     RequestConnectionStatePtr FindOrCreateConnectionState(int connection_id)
     {
         t_connection_state_iter iter= m_connection_state_map.find(connection_id);
@@ -529,6 +692,23 @@ protected:
                 streamInfo.include_raw_sensor_data = request.include_raw_sensor_data();
                 streamInfo.include_calibrated_sensor_data = request.include_calibrated_sensor_data();
                 streamInfo.include_raw_tracker_data = request.include_raw_tracker_data();
+                streamInfo.bundle_controller_data = request.bundle_controller_data();
+
+                // Compact data frames have no room for the raw sensor or tracker data
+                streamInfo.compact_data_frame =
+                    request.compact_data_frame() &&
+                    !streamInfo.include_raw_sensor_data &&
+                    !streamInfo.include_calibrated_sensor_data &&
+                    !streamInfo.include_raw_tracker_data;
+
+                // Same goes for the shared memory, which holds compact data frames.
+                // Without it the stream just falls back to data frames sent over the network.
+                streamInfo.shared_memory_data_frame =
+                    request.shared_memory_data_frame() &&
+                    !streamInfo.include_raw_sensor_data &&
+                    !streamInfo.include_calibrated_sensor_data &&
+                    !streamInfo.include_raw_tracker_data &&
+                    ServerNetworkManager::get_instance()->has_shared_controller_state();
 
                 if (streamInfo.include_position_data)
                 {
@@ -951,6 +1131,8 @@ protected:
                 switch (tracker_view->getTrackerDeviceType())
                 {
                 case CommonControllerState::PS3EYE:
+                // Recorded trackers replay PS3EYE footage, so clients treat them as one
+                case CommonControllerState::ReplayTracker:
                     tracker_info->set_tracker_type(PSMoveProtocol::PS3EYE);
                     break;
                 default:
@@ -970,6 +1152,8 @@ protected:
                     break;
                     // PSMoveProtocol::ISIGHT?
                 case ITrackerInterface::Generic_Webcam:
+                // No protocol driver type for recordings yet
+                case ITrackerInterface::Replay:
                     tracker_info->set_tracker_driver(PSMoveProtocol::GENERIC_WEBCAM);
                     break;
                 default:
@@ -1461,6 +1645,8 @@ protected:
         const RequestContext &context,
         PSMoveProtocol::Response *response)
     {
+        SERVER_TRACE_SCOPE("ServerRequestHandler::search_for_new_trackers");
+
         // The video polling threads tend to stall out when we are polling for new devices via libusb.
         // Until we have a better solution, best to just shut down all of the trackers
         // and then wait for them to restart next tracker device refresh.
@@ -1497,6 +1683,98 @@ protected:
         response->set_result_code(PSMoveProtocol::Response_ResultCode_RESULT_OK);
     }
 
+    // -- Diagnostic Requests -----
+    void handle_request__get_latency_stats(
+        const RequestContext &context,
+        PSMoveProtocol::Response *response)
+    {
+        const bool bResetStats = context.request->request_get_latency_stats().reset_stats();
+
+        response->set_type(PSMoveProtocol::Response_ResponseType_LATENCY_STATS);
+
+        PSMoveProtocol::Response_ResultLatencyStats* result = response->mutable_result_latency_stats();
+
+        for (int controller_id = 0; controller_id < m_device_manager.getControllerViewMaxCount(); ++controller_id)
+        {
+            ServerControllerViewPtr controller_view = m_device_manager.getControllerViewPtr(controller_id);
+
+            append_device_latency_stats(
+                PSMoveProtocol::DeviceOutputDataFrame_DeviceCategory_CONTROLLER,
+                controller_id,
+                *controller_view->getLatencyStats(),
+                result);
+
+            if (bResetStats)
+            {
+                controller_view->getLatencyStats()->reset();
+            }
+        }
+
+        for (int tracker_id = 0; tracker_id < m_device_manager.getTrackerViewMaxCount(); ++tracker_id)
+        {
+            ServerTrackerViewPtr tracker_view = m_device_manager.getTrackerViewPtr(tracker_id);
+
+            append_device_latency_stats(
+                PSMoveProtocol::DeviceOutputDataFrame_DeviceCategory_TRACKER,
+                tracker_id,
+                *tracker_view->getLatencyStats(),
+                result);
+
+            if (bResetStats)
+            {
+                tracker_view->getLatencyStats()->reset();
+            }
+        }
+
+        response->set_result_code(PSMoveProtocol::Response_ResultCode_RESULT_OK);
+    }
+
+    void handle_request__dump_trace(
+        const RequestContext &context,
+        PSMoveProtocol::Response *response)
+    {
+        if (m_device_manager.dumpTrace())
+        {
+            response->set_result_code(PSMoveProtocol::Response_ResultCode_RESULT_OK);
+        }
+        else
+        {
+            response->set_result_code(PSMoveProtocol::Response_ResultCode_RESULT_ERROR);
+        }
+    }
+
+    static void append_device_latency_stats(
+        const PSMoveProtocol::DeviceOutputDataFrame_DeviceCategory device_category,
+        const int device_id,
+        const DeviceLatencyStats &latency_stats,
+        PSMoveProtocol::Response_ResultLatencyStats *result)
+    {
+        if (latency_stats.getHasSamples())
+        {
+            PSMoveProtocol::Response_ResultLatencyStats_DeviceLatency *device_latency = result->add_devices();
+
+            device_latency->set_device_category(device_category);
+            device_latency->set_device_id(device_id);
+
+            for (int stage_index = 0; stage_index < MAX_LATENCY_STAGES; ++stage_index)
+            {
+                const LatencyHistogram &histogram = latency_stats.getHistogram(static_cast<eLatencyStage>(stage_index));
+
+                if (histogram.getSampleCount() > 0)
+                {
+                    PSMoveProtocol::Response_ResultLatencyStats_StageLatency *stage_latency = device_latency->add_stages();
+
+                    // eLatencyStage and the protocol stage enum are in the same order
+                    stage_latency->set_stage(static_cast<PSMoveProtocol::Response_ResultLatencyStats_Stage>(stage_index));
+                    stage_latency->set_sample_count(static_cast<int>(histogram.getSampleCount()));
+                    stage_latency->set_p50_us(static_cast<int>(histogram.getPercentile(0.5f)));
+                    stage_latency->set_p99_us(static_cast<int>(histogram.getPercentile(0.99f)));
+                    stage_latency->set_max_us(static_cast<int>(histogram.getMax()));
+                }
+            }
+        }
+    }
+
     // -- Data Frame Updates -----
     void handle_data_frame__controller_packet(
         RequestConnectionStatePtr connection_state,
@@ -1672,6 +1950,11 @@ void ServerRequestHandler::publish_controller_data_frame(
     return m_implementation_ptr->publish_controller_data_frame(controller_view, callback);
 }
 
+void ServerRequestHandler::flush_controller_data_bundles()
+{
+    m_implementation_ptr->flush_controller_data_bundles();
+}
+
 void ServerRequestHandler::publish_tracker_data_frame(
     class ServerTrackerView *tracker_view,
     t_generate_tracker_data_frame_for_stream callback)
@@ -19,6 +19,9 @@ struct ControllerStreamInfo
     bool include_raw_sensor_data;
     bool include_calibrated_sensor_data;
     bool include_raw_tracker_data;
+    bool bundle_controller_data;
+    bool compact_data_frame;
+    bool shared_memory_data_frame;
     bool led_override_active;
     int last_data_input_sequence_number;
 
@@ -29,9 +32,24 @@ struct ControllerStreamInfo
         include_raw_sensor_data = false;
         include_calibrated_sensor_data= false;
         include_raw_tracker_data = false;
+        bundle_controller_data = false;
+        compact_data_frame = false;
+        shared_memory_data_frame = false;
         led_override_active = false;
         last_data_input_sequence_number = -1;
     }
+
+    /// Streams with the same signature get identical controller data frames
+    inline unsigned int getDataFrameSignature() const
+    {
+        return
+            (include_position_data ? 0x01 : 0) |
+            (include_physics_data ? 0x02 : 0) |
+            (include_raw_sensor_data ? 0x04 : 0) |
+            (include_calibrated_sensor_data ? 0x08 : 0) |
+            (include_raw_tracker_data ? 0x10 : 0) |
+            (compact_data_frame ? 0x20 : 0);
+    }
 };
 
 struct TrackerStreamInfo
@@ -74,6 +92,10 @@ public:
     void publish_controller_data_frame(
         class ServerControllerView *controller_view, t_generate_controller_data_frame_for_stream callback);
 
+    /// Streams started with bundle_controller_data don't get their controller data frames sent right away.
+    /// They get collected into one data frame per connection, sent out when the publish pass is done.
+    void flush_controller_data_bundles();
+
     /// When publishing tracker data to all listening connections
     /// we need to provide a callback that will fill out a data frame given:
     /// * A \ref ServerTrackerView we want to publish to all listening connections
@@ -0,0 +1,292 @@
+//-- includes -----
+#include "ServerTrace.h"
+#include "ServerLog.h"
+
+#ifdef PSMOVESERVICE_TRACING
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+#endif // PSMOVESERVICE_TRACING
+
+#ifdef PSMOVESERVICE_TRACING
+//-- constants -----
+static const int k_trace_events_per_thread = 1 << 16; // must be a power of two
+
+//-- private definitions -----
+// The fields are relaxed atomics only so the dump can read them while the owning thread overwrites them.
+// Torn events get thrown out by checking the write index again after they're copied.
+struct TraceEvent
+{
+    std::atomic<const char *> name;
+    std::atomic<long long> begin_ns; // since the trace epoch
+    std::atomic<long long> duration_ns;
+};
+
+struct TraceEventCopy
+{
+    const char *name;
+    long long begin_ns;
+    long long duration_ns;
+};
+
+// Written by exactly one thread at a time, read by the dump
+struct ThreadTraceBuffer
+{
+    ThreadTraceBuffer(int in_thread_id)
+        : thread_id(in_thread_id)
+        , thread_name(nullptr)
+        , write_index(0)
+        , events(new TraceEvent[k_trace_events_per_thread])
+        , in_use(true)
+    {}
+
+    const int thread_id;
+    std::atomic<const char *> thread_name;
+    std::atomic<unsigned long long> write_index; // count of events ever recorded
+    TraceEvent *events;
+    bool in_use; // guarded by the registry mutex
+};
+
+// Every ring buffer ever handed out. They outlive their threads so the last events of
+// a stalled-then-exited thread still show up in the dump, and get reused by later threads.
+struct TraceBufferRegistry
+{
+    std::mutex mutex;
+    std::vector<ThreadTraceBuffer *> buffers;
+    ServerTrace::timestamp epoch;
+
+    TraceBufferRegistry()
+        : epoch(std::chrono::high_resolution_clock::now())
+    {}
+};
+
+// Gives the thread's buffer back to the registry when the thread exits
+struct ThreadTraceBufferLease
+{
+    ThreadTraceBuffer *buffer;
+
+    ThreadTraceBufferLease()
+        : buffer(nullptr)
+    {}
+
+    ~ThreadTraceBufferLease();
+};
+
+//-- globals -----
+static thread_local ThreadTraceBufferLease g_thread_buffer_lease;
+
+//-- private methods -----
+static TraceBufferRegistry &get_registry()
+{
+    static TraceBufferRegistry registry;
+
+    return registry;
+}
+
+static ThreadTraceBuffer *acquire_thread_buffer()
+{
+    TraceBufferRegistry &registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    for (ThreadTraceBuffer *buffer : registry.buffers)
+    {
+        if (!buffer->in_use)
+        {
+            buffer->in_use = true;
+            buffer->thread_name.store(nullptr, std::memory_order_relaxed);
+
+            return buffer;
+        }
+    }
+
+    ThreadTraceBuffer *buffer = new ThreadTraceBuffer(static_cast<int>(registry.buffers.size()) + 1);
+    registry.buffers.push_back(buffer);
+
+    return buffer;
+}
+
+static inline ThreadTraceBuffer *get_thread_buffer()
+{
+    if (g_thread_buffer_lease.buffer == nullptr)
+    {
+        g_thread_buffer_lease.buffer = acquire_thread_buffer();
+    }
+
+    return g_thread_buffer_lease.buffer;
+}
+
+ThreadTraceBufferLease::~ThreadTraceBufferLease()
+{
+    if (buffer != nullptr)
+    {
+        TraceBufferRegistry &registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        buffer->in_use = false;
+    }
+}
+
+static long long get_nanoseconds_since_epoch(const ServerTrace::timestamp &time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - get_registry().epoch).count();
+}
+
+static void copy_thread_events(ThreadTraceBuffer *buffer, std::vector<TraceEventCopy> &out_events)
+{
+    const unsigned long long k_capacity = k_trace_events_per_thread;
+    const unsigned long long end_index = buffer->write_index.load(std::memory_order_acquire);
+    const unsigned long long begin_index = (end_index > k_capacity) ? end_index - k_capacity : 0;
+
+    out_events.clear();
+
+    for (unsigned long long event_index = begin_index; event_index < end_index; ++event_index)
+    {
+        const TraceEvent &event = buffer->events[event_index & (k_capacity - 1)];
+        TraceEventCopy copy;
+
+        copy.name = event.name.load(std::memory_order_relaxed);
+        copy.begin_ns = event.begin_ns.load(std::memory_order_relaxed);
+        copy.duration_ns = event.duration_ns.load(std::memory_order_relaxed);
+        out_events.push_back(copy);
+    }
+
+    // Drop the oldest events if the thread lapped us while we were copying
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const unsigned long long final_index = buffer->write_index.load(std::memory_order_relaxed);
+    const unsigned long long first_valid_index = (final_index >= k_capacity) ? final_index - k_capacity + 1 : 0;
+
+    if (first_valid_index > begin_index)
+    {
+        const size_t torn_count =
+            static_cast<size_t>(std::min(first_valid_index - begin_index, end_index - begin_index));
+
+        out_events.erase(out_events.begin(), out_events.begin() + torn_count);
+    }
+}
+
+static void write_json_string(std::ostream &out, const char *str)
+{
+    out << '"';
+
+    for (const char *c = str; *c != '\0'; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            out << '\\';
+        }
+
+        out << *c;
+    }
+
+    out << '"';
+}
+#endif // PSMOVESERVICE_TRACING
+
+//-- public methods -----
+#ifdef PSMOVESERVICE_TRACING
+bool ServerTrace::getIsEnabled()
+{
+    return true;
+}
+
+void ServerTrace::recordScope(const char *name, const timestamp &begin_time, const timestamp &end_time)
+{
+    ThreadTraceBuffer *buffer = get_thread_buffer();
+    const unsigned long long write_index = buffer->write_index.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer->events[write_index & (k_trace_events_per_thread - 1)];
+
+    event.name.store(name, std::memory_order_relaxed);
+    event.begin_ns.store(get_nanoseconds_since_epoch(begin_time), std::memory_order_relaxed);
+    event.duration_ns.store(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count(),
+        std::memory_order_relaxed);
+
+    buffer->write_index.store(write_index + 1, std::memory_order_release);
+}
+
+void ServerTrace::setThreadName(const char *name)
+{
+    get_thread_buffer()->thread_name.store(name, std::memory_order_relaxed);
+}
+
+bool ServerTrace::dumpToFile(const std::string &path)
+{
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::trunc);
+
+    if (!out.is_open())
+    {
+        SERVER_LOG_ERROR("ServerTrace::dumpToFile") << "Failed to open trace file: " << path;
+        return false;
+    }
+
+    TraceBufferRegistry &registry = get_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    std::vector<TraceEventCopy> events;
+    size_t total_event_count = 0;
+    bool bFirstEvent = true;
+
+    events.reserve(k_trace_events_per_thread);
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    out << std::fixed << std::setprecision(3);
+
+    for (ThreadTraceBuffer *buffer : registry.buffers)
+    {
+        const char *thread_name = buffer->thread_name.load(std::memory_order_relaxed);
+
+        if (thread_name != nullptr)
+        {
+            out << (bFirstEvent ? "\n" : ",\n");
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id << ",\"args\":{\"name\":";
+            write_json_string(out, thread_name);
+            out << "}}";
+            bFirstEvent = false;
+        }
+
+        copy_thread_events(buffer, events);
+
+        for (const TraceEventCopy &event : events)
+        {
+            out << (bFirstEvent ? "\n" : ",\n");
+            out << "{\"name\":";
+            write_json_string(out, event.name);
+            out << ",\"cat\":\"psmoveservice\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+                << ",\"ts\":" << static_cast<double>(event.begin_ns) / 1000.0
+                << ",\"dur\":" << static_cast<double>(event.duration_ns) / 1000.0 << "}";
+            bFirstEvent = false;
+        }
+
+        total_event_count += events.size();
+    }
+
+    out << "\n]}\n";
+    out.close();
+
+    SERVER_LOG_INFO("ServerTrace::dumpToFile") <<
+        "Wrote " << total_event_count << " trace events from " << registry.buffers.size() << " threads to " << path;
+
+    return !out.fail();
+}
+#else
+bool ServerTrace::getIsEnabled()
+{
+    return false;
+}
+
+void ServerTrace::recordScope(const char *, const timestamp &, const timestamp &)
+{
+}
+
+void ServerTrace::setThreadName(const char *)
+{
+}
+
+bool ServerTrace::dumpToFile(const std::string &)
+{
+    SERVER_LOG_WARNING("ServerTrace::dumpToFile") << "Service wasn't built with PSMOVESERVICE_TRACING, no trace to dump";
+    return false;
+}
+#endif // PSMOVESERVICE_TRACING
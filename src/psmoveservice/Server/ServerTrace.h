@@ -0,0 +1,69 @@
+#ifndef SERVER_TRACE_H
+#define SERVER_TRACE_H
+
+//-- includes -----
+#include <chrono>
+#include <string>
+
+//-- macros -----
+/// Scoped trace markers for the service hot paths.
+/**
+Only built when the service is configured with PSMOVESERVICE_TRACING, otherwise the markers compile to nothing.
+Each thread records the scopes it leaves into its own ring buffer (no locks, no allocations),
+which keeps the most recent ~64k scopes per thread. Dump them with ServerTrace::dumpToFile()
+and load the file in chrome://tracing or https://ui.perfetto.dev.
+
+SERVER_TRACE_SCOPE("name") - times from here to the end of the enclosing scope. The name must be a string literal.
+SERVER_TRACE_THREAD_NAME("name") - labels the calling thread in the trace
+*/
+#ifdef PSMOVESERVICE_TRACING
+#define SERVER_TRACE_CONCAT_INNER(a, b) a##b
+#define SERVER_TRACE_CONCAT(a, b) SERVER_TRACE_CONCAT_INNER(a, b)
+#define SERVER_TRACE_SCOPE(name) ServerTraceScope SERVER_TRACE_CONCAT(server_trace_scope_, __LINE__)(name)
+#define SERVER_TRACE_THREAD_NAME(name) ServerTrace::setThreadName(name)
+#else
+#define SERVER_TRACE_SCOPE(name) ((void)0)
+#define SERVER_TRACE_THREAD_NAME(name) ((void)0)
+#endif // PSMOVESERVICE_TRACING
+
+//-- definitions -----
+class ServerTrace
+{
+public:
+    typedef std::chrono::time_point<std::chrono::high_resolution_clock> timestamp;
+
+    /// Whether the service was built with the trace markers
+    static bool getIsEnabled();
+
+    /// Records a finished scope on the calling thread's ring buffer
+    static void recordScope(const char *name, const timestamp &begin_time, const timestamp &end_time);
+
+    /// Labels the calling thread in the dumped trace
+    static void setThreadName(const char *name);
+
+    /// Write what's in every thread's ring buffer out as Chrome trace event JSON.
+    /// Safe to call from any thread while the others keep recording.
+    static bool dumpToFile(const std::string &path);
+};
+
+#ifdef PSMOVESERVICE_TRACING
+class ServerTraceScope
+{
+public:
+    inline ServerTraceScope(const char *name)
+        : m_name(name)
+        , m_begin_time(std::chrono::high_resolution_clock::now())
+    {}
+
+    inline ~ServerTraceScope()
+    {
+        ServerTrace::recordScope(m_name, m_begin_time, std::chrono::high_resolution_clock::now());
+    }
+
+private:
+    const char *m_name;
+    ServerTrace::timestamp m_begin_time;
+};
+#endif // PSMOVESERVICE_TRACING
+
+#endif // SERVER_TRACE_H
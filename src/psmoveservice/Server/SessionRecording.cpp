@@ -0,0 +1,960 @@
+//-- includes -----
+#include "SessionRecording.h"
+#include "ServerLog.h"
+
+#include <boost/bind.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+//-- constants -----
+// Chunks start on 8 byte boundaries so the headers can be read straight out of a mapping
+static const size_t k_chunk_alignment = 8;
+
+// How many video frames can be waiting on the writer thread before new ones get dropped
+static const int k_max_pending_video_frames = 32;
+
+// Same for hid reports (about a second's worth from every controller)
+static const int k_max_pending_hid_reports = 4096;
+
+// Zero-run encoding:
+// a control byte 0x00-0x7f is followed by (control + 1) literal bytes,
+// a control byte 0x80-0xff and the byte after it give a run of (((control & 0x7f) << 8 | next) + 1) zeros.
+static const size_t k_max_literal_run = 0x80;
+static const size_t k_max_zero_run = 0x8000;
+
+//-- private methods -----
+static size_t get_padded_size(size_t size)
+{
+    return (size + k_chunk_alignment - 1) & ~(k_chunk_alignment - 1);
+}
+
+// Returns false (leaving out_encoded in an unspecified state) if the encoding wouldn't be any smaller than the source
+static bool zero_run_encode(
+    const unsigned char *src, size_t src_size, std::vector<unsigned char> &out_encoded)
+{
+    // Room for the largest encoding we'd accept plus one more control sequence
+    out_encoded.resize(src_size + k_max_literal_run + 2);
+
+    unsigned char *dst = out_encoded.data();
+    size_t dst_size = 0;
+    size_t src_index = 0;
+
+    while (src_index < src_size)
+    {
+        if (dst_size >= src_size)
+        {
+            return false;
+        }
+
+        size_t run = 1;
+
+        if (src[src_index] == 0)
+        {
+            while (src_index + run < src_size && run < k_max_zero_run && src[src_index + run] == 0)
+            {
+                ++run;
+            }
+
+            const size_t code = run - 1;
+            dst[dst_size++] = static_cast<unsigned char>(0x80 | (code >> 8));
+            dst[dst_size++] = static_cast<unsigned char>(code & 0xff);
+        }
+        else
+        {
+            // A lone zero is cheaper to leave in the literal run than to start a zero run for
+            while (src_index + run < src_size && run < k_max_literal_run &&
+                   (src[src_index + run] != 0 || (src_index + run + 1 < src_size && src[src_index + run + 1] != 0)))
+            {
+                ++run;
+            }
+
+            dst[dst_size++] = static_cast<unsigned char>(run - 1);
+            std::memcpy(dst + dst_size, src + src_index, run);
+            dst_size += run;
+        }
+
+        src_index += run;
+    }
+
+    if (dst_size >= src_size)
+    {
+        return false;
+    }
+
+    out_encoded.resize(dst_size);
+    return true;
+}
+
+// When bDelta is set the decoded bytes are added on to what's already in dst
+static bool zero_run_decode(
+    const unsigned char *src, size_t src_size, bool bDelta, unsigned char *dst, size_t dst_size)
+{
+    size_t src_index = 0;
+    size_t dst_index = 0;
+
+    while (src_index < src_size)
+    {
+        const unsigned char control = src[src_index++];
+
+        if ((control & 0x80) != 0)
+        {
+            if (src_index >= src_size)
+            {
+                return false;
+            }
+
+            const size_t run = ((static_cast<size_t>(control & 0x7f) << 8) | src[src_index++]) + 1;
+
+            if (dst_index + run > dst_size)
+            {
+                return false;
+            }
+
+            if (!bDelta)
+            {
+                std::memset(dst + dst_index, 0, run);
+            }
+            dst_index += run;
+        }
+        else
+        {
+            const size_t run = static_cast<size_t>(control) + 1;
+
+            if (src_index + run > src_size || dst_index + run > dst_size)
+            {
+                return false;
+            }
+
+            if (bDelta)
+            {
+                for (size_t i = 0; i < run; ++i)
+                {
+                    dst[dst_index + i] += src[src_index + i];
+                }
+            }
+            else
+            {
+                std::memcpy(dst + dst_index, src + src_index, run);
+            }
+            src_index += run;
+            dst_index += run;
+        }
+    }
+
+    return dst_index == dst_size;
+}
+
+static size_t get_video_frame_size(const SessionStreamInfo *stream_info)
+{
+    const size_t bytes_per_pixel = (stream_info->pixel_format == SessionPixelFormat_BayerGB) ? 1 : 3;
+
+    return stream_info->width * stream_info->height * bytes_per_pixel;
+}
+
+//-- public implementation -----
+// -- ServerSessionRecorder
+ServerSessionRecorder::ServerSessionRecorder()
+    : m_file(nullptr)
+    , m_keyframe_interval(1)
+    , m_pending_video_frame_count(0)
+    , m_dropped_video_frame_count(0)
+    , m_pending_hid_report_count(0)
+    , m_dropped_hid_report_count(0)
+    , m_write_failed(false)
+    , m_exit_requested(false)
+    , m_writer_thread(nullptr)
+    , m_write_offset(0)
+{
+}
+
+ServerSessionRecorder::~ServerSessionRecorder()
+{
+    shutdown();
+
+    for (auto it = m_free_chunks.begin(); it != m_free_chunks.end(); ++it)
+    {
+        delete *it;
+    }
+    m_free_chunks.clear();
+}
+
+bool ServerSessionRecorder::startup(const std::string &path, int keyframe_interval)
+{
+    assert(m_file == nullptr);
+
+    m_file = fopen(path.c_str(), "wb");
+
+    if (m_file == nullptr)
+    {
+        SERVER_LOG_ERROR("ServerSessionRecorder::startup") << "Failed to open " << path << " for recording";
+        return false;
+    }
+
+    // Big writes, fewer syscalls
+    setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+
+    // The index location gets filled in when the recording is finished
+    SessionFileHeader file_header;
+    std::memset(&file_header, 0, sizeof(file_header));
+    std::memcpy(file_header.magic, SESSION_RECORDING_MAGIC, sizeof(file_header.magic));
+    file_header.version = SESSION_RECORDING_VERSION;
+
+    if (fwrite(&file_header, sizeof(file_header), 1, m_file) != 1)
+    {
+        SERVER_LOG_ERROR("ServerSessionRecorder::startup") << "Failed to write to " << path;
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+
+    m_write_offset = sizeof(file_header);
+    m_keyframe_interval = std::max(keyframe_interval, 1);
+    m_start_time = std::chrono::high_resolution_clock::now();
+    m_pending_video_frame_count = 0;
+    m_dropped_video_frame_count = 0;
+    m_pending_hid_report_count = 0;
+    m_dropped_hid_report_count = 0;
+    m_write_failed = false;
+    m_exit_requested = false;
+    m_stream_ids.clear();
+    m_video_stream_states.clear();
+    m_index.clear();
+
+    m_writer_thread = new boost::thread(boost::bind(&ServerSessionRecorder::writerThreadFunc, this));
+
+    SERVER_LOG_INFO("ServerSessionRecorder::startup") << "Recording session to " << path;
+
+    return true;
+}
+
+void ServerSessionRecorder::shutdown()
+{
+    if (m_file == nullptr)
+    {
+        return;
+    }
+
+    // Let the writer thread finish off everything that's queued
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        m_exit_requested = true;
+    }
+    m_queue_condition.notify_all();
+
+    m_writer_thread->join();
+    delete m_writer_thread;
+    m_writer_thread = nullptr;
+
+    // Append the index and point the file header at it
+    // (a recording without an index still plays back, the reader rebuilds it)
+    bool bSuccess = !m_write_failed;
+    const unsigned long long index_offset = m_write_offset;
+
+    if (bSuccess)
+    {
+        SessionChunkHeader index_header;
+        std::memset(&index_header, 0, sizeof(index_header));
+        index_header.chunk_type = SessionChunk_Index;
+        index_header.timestamp_usec = getTimestamp(std::chrono::high_resolution_clock::now());
+        index_header.payload_size = static_cast<unsigned int>(m_index.size() * sizeof(SessionIndexEntry));
+
+        bSuccess = writeChunk(index_header, reinterpret_cast<const unsigned char *>(m_index.data()));
+    }
+
+    if (bSuccess)
+    {
+        SessionFileHeader file_header;
+        std::memset(&file_header, 0, sizeof(file_header));
+        std::memcpy(file_header.magic, SESSION_RECORDING_MAGIC, sizeof(file_header.magic));
+        file_header.version = SESSION_RECORDING_VERSION;
+        file_header.index_offset = index_offset;
+        file_header.index_entry_count = m_index.size();
+
+        bSuccess =
+            fseek(m_file, 0, SEEK_SET) == 0 &&
+            fwrite(&file_header, sizeof(file_header), 1, m_file) == 1;
+    }
+
+    bSuccess &= fclose(m_file) == 0;
+    m_file = nullptr;
+
+    if (m_dropped_video_frame_count > 0)
+    {
+        SERVER_LOG_WARNING("ServerSessionRecorder::shutdown") <<
+            "Dropped " << m_dropped_video_frame_count << " video frames the disk couldn't keep up with";
+    }
+
+    if (m_dropped_hid_report_count > 0)
+    {
+        SERVER_LOG_WARNING("ServerSessionRecorder::shutdown") <<
+            "Dropped " << m_dropped_hid_report_count << " hid reports the disk couldn't keep up with";
+    }
+
+    if (bSuccess)
+    {
+        SERVER_LOG_INFO("ServerSessionRecorder::shutdown") << "Finished recording (" << m_write_offset << " bytes)";
+    }
+    else
+    {
+        SERVER_LOG_ERROR("ServerSessionRecorder::shutdown") << "Recording is incomplete (" << m_write_offset << " bytes written)";
+    }
+}
+
+void ServerSessionRecorder::recordVideoFrame(
+    const std::string &stream_name,
+    int device_type,
+    int width,
+    int height,
+    eSessionPixelFormat pixel_format,
+    const unsigned char *pixels,
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &capture_time)
+{
+    if (m_file == nullptr)
+    {
+        return;
+    }
+
+    const size_t frame_size = width * height * ((pixel_format == SessionPixelFormat_BayerGB) ? 1 : 3);
+    const unsigned long long timestamp_usec = getTimestamp(capture_time);
+    PendingChunk *chunk = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+
+        if (m_write_failed)
+        {
+            return;
+        }
+
+        if (m_pending_video_frame_count >= k_max_pending_video_frames)
+        {
+            ++m_dropped_video_frame_count;
+            return;
+        }
+
+        SessionStreamInfo stream_info;
+        stream_info.stream_type = SessionStream_Video;
+        stream_info.device_type = device_type;
+        stream_info.width = width;
+        stream_info.height = height;
+        stream_info.pixel_format = pixel_format;
+        stream_info.name_length = static_cast<unsigned int>(stream_name.size());
+
+        chunk = allocatePendingChunk();
+        chunk->header.chunk_type = SessionChunk_VideoFrame;
+        chunk->header.stream_id = getOrAddStream(stream_name, stream_info, timestamp_usec);
+        chunk->header.timestamp_usec = timestamp_usec;
+        chunk->header.flags = 0;
+        ++m_pending_video_frame_count;
+    }
+
+    // Copy the frame outside of the lock, the writer thread does the encoding
+    chunk->payload.assign(pixels, pixels + frame_size);
+
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+        m_pending_chunks.push_back(chunk);
+    }
+    m_queue_condition.notify_one();
+}
+
+void ServerSessionRecorder::recordHIDReport(
+    const std::string &stream_name,
+    int device_type,
+    const unsigned char *report,
+    size_t report_size)
+{
+    if (m_file == nullptr)
+    {
+        return;
+    }
+
+    const unsigned long long timestamp_usec = getTimestamp(std::chrono::high_resolution_clock::now());
+
+    {
+        std::lock_guard<std::mutex> lock(m_queue_mutex);
+
+        if (m_write_failed)
+        {
+            return;
+        }
+
+        if (m_pending_hid_report_count >= k_max_pending_hid_reports)
+        {
+            ++m_dropped_hid_report_count;
+            return;
+        }
+
+        SessionStreamInfo stream_info;
+        std::memset(&stream_info, 0, sizeof(stream_info));
+        stream_info.stream_type = SessionStream_HIDReports;
+        stream_info.device_type = device_type;
+        stream_info.name_length = static_cast<unsigned int>(stream_name.size());
+
+        PendingChunk *chunk = allocatePendingChunk();
+        chunk->header.chunk_type = SessionChunk_HIDReport;
+        chunk->header.stream_id = getOrAddStream(stream_name, stream_info, timestamp_usec);
+        chunk->header.timestamp_usec = timestamp_usec;
+        chunk->header.flags = 0;
+        chunk->payload.assign(report, report + report_size);
+        ++m_pending_hid_report_count;
+
+        m_pending_chunks.push_back(chunk);
+    }
+    m_queue_condition.notify_one();
+}
+
+//-- private implementation -----
+unsigned long long ServerSessionRecorder::getTimestamp(
+    const std::chrono::time_point<std::chrono::high_resolution_clock> &time) const
+{
+    const std::chrono::microseconds time_since_start =
+        std::chrono::duration_cast<std::chrono::microseconds>(time - m_start_time);
+
+    return (time_since_start.count() > 0) ? static_cast<unsigned long long>(time_since_start.count()) : 0;
+}
+
+// Call with m_queue_mutex held
+int ServerSessionRecorder::getOrAddStream(
+    const std::string &stream_name,
+    const SessionStreamInfo &stream_info,
+    unsigned long long timestamp_usec)
+{
+    auto it = m_stream_ids.find(stream_name);
+
+    if (it != m_stream_ids.end())
+    {
+        return it->second;
+    }
+
+    const int stream_id = static_cast<int>(m_stream_ids.size());
+    m_stream_ids.insert(std::make_pair(stream_name, stream_id));
+
+    // Describe the stream ahead of its first chunk
+    PendingChunk *chunk = allocatePendingChunk();
+    chunk->header.chunk_type = SessionChunk_StreamInfo;
+    chunk->header.stream_id = stream_id;
+    chunk->header.timestamp_usec = timestamp_usec;
+    chunk->header.flags = 0;
+    chunk->payload.resize(sizeof(SessionStreamInfo) + stream_name.size());
+    std::memcpy(chunk->payload.data(), &stream_info, sizeof(SessionStreamInfo));
+    std::memcpy(chunk->payload.data() + sizeof(SessionStreamInfo), stream_name.data(), stream_name.size());
+
+    m_pending_chunks.push_back(chunk);
+
+    return stream_id;
+}
+
+// Call with m_queue_mutex held
+ServerSessionRecorder::PendingChunk *ServerSessionRecorder::allocatePendingChunk()
+{
+    PendingChunk *chunk = nullptr;
+
+    if (m_free_chunks.empty())
+    {
+        chunk = new PendingChunk;
+    }
+    else
+    {
+        chunk = m_free_chunks.back();
+        m_free_chunks.pop_back();
+    }
+
+    std::memset(&chunk->header, 0, sizeof(chunk->header));
+
+    return chunk;
+}
+
+void ServerSessionRecorder::writerThreadFunc()
+{
+    bool bWriteFailed = false;
+
+    for (;;)
+    {
+        PendingChunk *chunk = nullptr;
+
+        {
+            std::unique_lock<std::mutex> lock(m_queue_mutex);
+            m_queue_condition.wait(lock, [this] { return m_exit_requested || !m_pending_chunks.empty(); });
+
+            if (m_pending_chunks.empty())
+            {
+                // Only get here once everything queued has been written
+                break;
+            }
+
+            chunk = m_pending_chunks.front();
+            m_pending_chunks.pop_front();
+        }
+
+        // Once a write has failed, the rest of the queue only gets recycled
+        if (!bWriteFailed)
+        {
+            switch (chunk->header.chunk_type)
+            {
+            case SessionChunk_StreamInfo:
+                {
+                    SessionIndexEntry entry;
+                    entry.timestamp_usec = chunk->header.timestamp_usec;
+                    entry.chunk_offset = m_write_offset;
+                    entry.stream_id = chunk->header.stream_id;
+                    entry.chunk_type = SessionChunk_StreamInfo;
+                    m_index.push_back(entry);
+
+                    if (m_video_stream_states.size() <= chunk->header.stream_id)
+                    {
+                        m_video_stream_states.resize(chunk->header.stream_id + 1);
+                    }
+                    m_video_stream_states[chunk->header.stream_id].frames_since_keyframe = 0;
+
+                    chunk->header.payload_size = static_cast<unsigned int>(chunk->payload.size());
+                    bWriteFailed = !writeChunk(chunk->header, chunk->payload.data());
+                } break;
+            case SessionChunk_VideoFrame:
+                {
+                    bWriteFailed = !encodeVideoFrame(chunk);
+                } break;
+            default:
+                {
+                    chunk->header.payload_size = static_cast<unsigned int>(chunk->payload.size());
+                    bWriteFailed = !writeChunk(chunk->header, chunk->payload.data());
+                } break;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+
+            if (bWriteFailed && !m_write_failed)
+            {
+                SERVER_LOG_ERROR("ServerSessionRecorder::writerThreadFunc") <<
+                    "Failed to write to the session recording, no longer recording";
+                m_write_failed = true;
+            }
+
+            if (chunk->header.chunk_type == SessionChunk_VideoFrame)
+            {
+                --m_pending_video_frame_count;
+            }
+            else if (chunk->header.chunk_type == SessionChunk_HIDReport)
+            {
+                --m_pending_hid_report_count;
+            }
+
+            m_free_chunks.push_back(chunk);
+        }
+    }
+
+    if (!bWriteFailed && fflush(m_file) != 0)
+    {
+        SERVER_LOG_ERROR("ServerSessionRecorder::writerThreadFunc") << "Failed to flush the session recording";
+
+        // Only read back by shutdown() once this thread has been joined
+        m_write_failed = true;
+    }
+}
+
+bool ServerSessionRecorder::encodeVideoFrame(PendingChunk *chunk)
+{
+    VideoStreamState &state = m_video_stream_states[chunk->header.stream_id];
+    const std::vector<unsigned char> &frame = chunk->payload;
+    const size_t frame_size = frame.size();
+
+    bool bKeyframe =
+        state.previous_frame.size() != frame_size ||
+        state.frames_since_keyframe + 1 >= m_keyframe_interval;
+    bool bEncoded = false;
+    eSessionFrameEncoding encoding = SessionFrameEncoding_Raw;
+
+    if (bKeyframe)
+    {
+        // Tracking runs at low exposure, so most of a frame is black
+        bEncoded = zero_run_encode(frame.data(), frame_size, m_encode_buffer);
+        encoding = SessionFrameEncoding_ZeroRun;
+    }
+    else
+    {
+        // The cameras don't move, so most of a frame is unchanged from the last one
+        m_delta_buffer.resize(frame_size);
+        for (size_t i = 0; i < frame_size; ++i)
+        {
+            m_delta_buffer[i] = static_cast<unsigned char>(frame[i] - state.previous_frame[i]);
+        }
+
+        bEncoded = zero_run_encode(m_delta_buffer.data(), frame_size, m_encode_buffer);
+        encoding = SessionFrameEncoding_DeltaZeroRun;
+    }
+
+    if (!bEncoded)
+    {
+        // A raw frame doesn't depend on the previous frame either
+        encoding = SessionFrameEncoding_Raw;
+        bKeyframe = true;
+    }
+
+    if (bKeyframe)
+    {
+        SessionIndexEntry entry;
+        entry.timestamp_usec = chunk->header.timestamp_usec;
+        entry.chunk_offset = m_write_offset;
+        entry.stream_id = chunk->header.stream_id;
+        entry.chunk_type = SessionChunk_VideoFrame;
+        m_index.push_back(entry);
+
+        state.frames_since_keyframe = 0;
+    }
+    else
+    {
+        ++state.frames_since_keyframe;
+    }
+
+    chunk->header.flags = encoding | (bKeyframe ? SESSION_CHUNK_FLAG_KEYFRAME : 0);
+
+    bool bSuccess = false;
+    if (bEncoded)
+    {
+        chunk->header.payload_size = static_cast<unsigned int>(m_encode_buffer.size());
+        bSuccess = writeChunk(chunk->header, m_encode_buffer.data());
+    }
+    else
+    {
+        chunk->header.payload_size = static_cast<unsigned int>(frame_size);
+        bSuccess = writeChunk(chunk->header, frame.data());
+    }
+
+    // Hang on to the frame for the next delta (the old one gets recycled with the chunk)
+    state.previous_frame.swap(chunk->payload);
+
+    return bSuccess;
+}
+
+bool ServerSessionRecorder::writeChunk(const SessionChunkHeader &header, const unsigned char *payload)
+{
+    static const unsigned char k_padding[k_chunk_alignment] = { 0 };
+    const size_t padded_size = get_padded_size(header.payload_size);
+
+    bool bSuccess = fwrite(&header, sizeof(header), 1, m_file) == 1;
+    if (bSuccess && header.payload_size > 0)
+    {
+        bSuccess = fwrite(payload, 1, header.payload_size, m_file) == header.payload_size;
+    }
+    if (bSuccess && padded_size > header.payload_size)
+    {
+        bSuccess = fwrite(k_padding, 1, padded_size - header.payload_size, m_file) == padded_size - header.payload_size;
+    }
+
+    if (bSuccess)
+    {
+        m_write_offset += sizeof(header) + padded_size;
+    }
+
+    return bSuccess;
+}
+
+// -- SessionRecordingReader
+SessionRecordingReader::SessionRecordingReader()
+    : m_file_mapping(nullptr)
+    , m_region(nullptr)
+    , m_data(nullptr)
+    , m_data_size(0)
+    , m_header(nullptr)
+    , m_end_offset(0)
+    , m_read_offset(0)
+{
+}
+
+SessionRecordingReader::~SessionRecordingReader()
+{
+    close();
+}
+
+bool SessionRecordingReader::open(const std::string &path)
+{
+    close();
+
+    try
+    {
+        m_file_mapping = new boost::interprocess::file_mapping(path.c_str(), boost::interprocess::read_only);
+        m_region = new boost::interprocess::mapped_region(*m_file_mapping, boost::interprocess::read_only);
+    }
+    catch (boost::interprocess::interprocess_exception &e)
+    {
+        SERVER_LOG_ERROR("SessionRecordingReader::open") << "Failed to map recording " << path << ": " << e.what();
+        close();
+        return false;
+    }
+
+    m_data = reinterpret_cast<const unsigned char *>(m_region->get_address());
+    m_data_size = m_region->get_size();
+
+    const SessionFileHeader *header = reinterpret_cast<const SessionFileHeader *>(m_data);
+
+    if (m_data_size < sizeof(SessionFileHeader) ||
+        std::memcmp(header->magic, SESSION_RECORDING_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SESSION_RECORDING_VERSION)
+    {
+        SERVER_LOG_ERROR("SessionRecordingReader::open") << "Recording " << path << " isn't a version " << SESSION_RECORDING_VERSION << " session recording";
+        close();
+        return false;
+    }
+
+    m_header = header;
+
+    const SessionChunkHeader *index_chunk =
+        (m_header->index_offset != 0 && validateChunk(m_header->index_offset))
+        ? reinterpret_cast<const SessionChunkHeader *>(m_data + m_header->index_offset)
+        : nullptr;
+
+    if (index_chunk != nullptr &&
+        index_chunk->chunk_type == SessionChunk_Index &&
+        index_chunk->payload_size == m_header->index_entry_count * sizeof(SessionIndexEntry))
+    {
+        const SessionIndexEntry *entries = reinterpret_cast<const SessionIndexEntry *>(getChunkPayload(index_chunk));
+
+        m_index.assign(entries, entries + m_header->index_entry_count);
+        m_end_offset = m_header->index_offset;
+    }
+    else
+    {
+        // The recording never got finished (the service crashed or was killed),
+        // so work out the index from what made it to disk
+        SERVER_LOG_WARNING("SessionRecordingReader::open") << "Recording " << path << " has no index, rebuilding it";
+        buildIndex();
+    }
+
+    for (auto it = m_index.begin(); it != m_index.end(); ++it)
+    {
+        if (it->chunk_type == SessionChunk_StreamInfo)
+        {
+            if (m_stream_infos.size() <= it->stream_id)
+            {
+                m_stream_infos.resize(it->stream_id + 1, nullptr);
+            }
+
+            m_stream_infos[it->stream_id] = reinterpret_cast<const SessionChunkHeader *>(m_data + it->chunk_offset);
+        }
+    }
+
+    rewind();
+
+    return true;
+}
+
+void SessionRecordingReader::close()
+{
+    if (m_region != nullptr)
+    {
+        delete m_region;
+        m_region = nullptr;
+    }
+
+    if (m_file_mapping != nullptr)
+    {
+        delete m_file_mapping;
+        m_file_mapping = nullptr;
+    }
+
+    m_data = nullptr;
+    m_data_size = 0;
+    m_header = nullptr;
+    m_end_offset = 0;
+    m_read_offset = 0;
+    m_index.clear();
+    m_stream_infos.clear();
+}
+
+int SessionRecordingReader::getStreamCount() const
+{
+    return static_cast<int>(m_stream_infos.size());
+}
+
+const SessionStreamInfo *SessionRecordingReader::getStreamInfo(int stream_id) const
+{
+    const SessionStreamInfo *result = nullptr;
+
+    if (stream_id >= 0 && stream_id < getStreamCount() && m_stream_infos[stream_id] != nullptr)
+    {
+        result = reinterpret_cast<const SessionStreamInfo *>(getChunkPayload(m_stream_infos[stream_id]));
+    }
+
+    return result;
+}
+
+std::string SessionRecordingReader::getStreamName(int stream_id) const
+{
+    std::string result;
+    const SessionStreamInfo *stream_info = getStreamInfo(stream_id);
+
+    if (stream_info != nullptr &&
+        sizeof(SessionStreamInfo) + stream_info->name_length <= m_stream_infos[stream_id]->payload_size)
+    {
+        result.assign(reinterpret_cast<const char *>(stream_info + 1), stream_info->name_length);
+    }
+
+    return result;
+}
+
+int SessionRecordingReader::findVideoStream(int video_stream_index) const
+{
+    for (int stream_id = 0; stream_id < getStreamCount(); ++stream_id)
+    {
+        const SessionStreamInfo *stream_info = getStreamInfo(stream_id);
+
+        if (stream_info != nullptr && stream_info->stream_type == SessionStream_Video)
+        {
+            if (video_stream_index == 0)
+            {
+                return stream_id;
+            }
+
+            --video_stream_index;
+        }
+    }
+
+    return -1;
+}
+
+void SessionRecordingReader::rewind()
+{
+    m_read_offset = sizeof(SessionFileHeader);
+}
+
+void SessionRecordingReader::seekToKeyframe(int stream_id, unsigned long long timestamp_usec)
+{
+    const SessionIndexEntry *seek_entry = nullptr;
+
+    for (auto it = m_index.begin(); it != m_index.end(); ++it)
+    {
+        if (it->chunk_type == SessionChunk_VideoFrame && it->stream_id == static_cast<unsigned int>(stream_id))
+        {
+            // Fall back to the first keyframe if the time is before any of them
+            if (seek_entry == nullptr || it->timestamp_usec <= timestamp_usec)
+            {
+                seek_entry = &(*it);
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    if (seek_entry != nullptr)
+    {
+        m_read_offset = seek_entry->chunk_offset;
+    }
+    else
+    {
+        rewind();
+    }
+}
+
+const SessionChunkHeader *SessionRecordingReader::readNextChunk()
+{
+    const SessionChunkHeader *chunk = peekNextChunk();
+
+    if (chunk != nullptr)
+    {
+        m_read_offset += sizeof(SessionChunkHeader) + get_padded_size(chunk->payload_size);
+    }
+
+    return chunk;
+}
+
+const SessionChunkHeader *SessionRecordingReader::peekNextChunk() const
+{
+    const SessionChunkHeader *chunk = nullptr;
+
+    if (m_header != nullptr && m_read_offset < m_end_offset && validateChunk(m_read_offset))
+    {
+        chunk = reinterpret_cast<const SessionChunkHeader *>(m_data + m_read_offset);
+    }
+
+    return chunk;
+}
+
+bool SessionRecordingReader::decodeVideoFrame(
+    const SessionChunkHeader *chunk,
+    bool bHasPreviousFrame,
+    unsigned char *in_out_frame) const
+{
+    const SessionStreamInfo *stream_info = getStreamInfo(chunk->stream_id);
+
+    if (chunk->chunk_type != SessionChunk_VideoFrame || stream_info == nullptr)
+    {
+        return false;
+    }
+
+    const size_t frame_size = get_video_frame_size(stream_info);
+    const unsigned char *payload = getChunkPayload(chunk);
+    bool bSuccess = false;
+
+    switch (chunk->flags & SESSION_CHUNK_ENCODING_MASK)
+    {
+    case SessionFrameEncoding_Raw:
+        if (chunk->payload_size == frame_size)
+        {
+            std::memcpy(in_out_frame, payload, frame_size);
+            bSuccess = true;
+        }
+        break;
+    case SessionFrameEncoding_ZeroRun:
+        bSuccess = zero_run_decode(payload, chunk->payload_size, false, in_out_frame, frame_size);
+        break;
+    case SessionFrameEncoding_DeltaZeroRun:
+        bSuccess = bHasPreviousFrame && zero_run_decode(payload, chunk->payload_size, true, in_out_frame, frame_size);
+        break;
+    }
+
+    return bSuccess;
+}
+
+//-- private implementation -----
+bool SessionRecordingReader::validateChunk(unsigned long long offset) const
+{
+    if (offset + sizeof(SessionChunkHeader) > m_data_size)
+    {
+        return false;
+    }
+
+    const SessionChunkHeader *chunk = reinterpret_cast<const SessionChunkHeader *>(m_data + offset);
+
+    return offset + sizeof(SessionChunkHeader) + chunk->payload_size <= m_data_size;
+}
+
+void SessionRecordingReader::buildIndex()
+{
+    unsigned long long offset = sizeof(SessionFileHeader);
+
+    m_index.clear();
+
+    while (validateChunk(offset))
+    {
+        const SessionChunkHeader *chunk = reinterpret_cast<const SessionChunkHeader *>(m_data + offset);
+
+        if (chunk->chunk_type == SessionChunk_Index)
+        {
+            break;
+        }
+
+        if (chunk->chunk_type == SessionChunk_StreamInfo ||
+            (chunk->chunk_type == SessionChunk_VideoFrame && (chunk->flags & SESSION_CHUNK_FLAG_KEYFRAME) != 0))
+        {
+            SessionIndexEntry entry;
+            entry.timestamp_usec = chunk->timestamp_usec;
+            entry.chunk_offset = offset;
+            entry.stream_id = chunk->stream_id;
+            entry.chunk_type = chunk->chunk_type;
+            m_index.push_back(entry);
+        }
+
+        offset += sizeof(SessionChunkHeader) + get_padded_size(chunk->payload_size);
+    }
+
+    // Anything past here is a partly written chunk
+    m_end_offset = offset;
+}
@@ -0,0 +1,239 @@
+#ifndef SESSION_RECORDING_H
+#define SESSION_RECORDING_H
+
+//-- includes -----
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//-- pre-declarations -----
+namespace boost
+{
+    class thread;
+
+    namespace interprocess
+    {
+        class file_mapping;
+        class mapped_region;
+    };
+};
+
+//-- constants -----
+#define SESSION_RECORDING_MAGIC "PSMVSESS"
+#define SESSION_RECORDING_VERSION 1
+
+enum eSessionChunkType
+{
+    SessionChunk_StreamInfo,    // payload: SessionStreamInfo followed by the stream name
+    SessionChunk_VideoFrame,    // payload: an encoded video frame (see eSessionFrameEncoding)
+    SessionChunk_HIDReport,     // payload: a raw hid input report
+    SessionChunk_Index,         // payload: an array of SessionIndexEntry
+};
+
+enum eSessionStreamType
+{
+    SessionStream_Video,
+    SessionStream_HIDReports,
+};
+
+enum eSessionPixelFormat
+{
+    SessionPixelFormat_BayerGB, // raw PS3EYE sensor image, 1 byte per pixel
+    SessionPixelFormat_BGR,     // demosaiced (unflipped) camera image, 3 bytes per pixel
+};
+
+enum eSessionFrameEncoding
+{
+    SessionFrameEncoding_Raw,           // the frame's bytes as is
+    SessionFrameEncoding_ZeroRun,       // the frame's bytes, zero-run encoded
+    SessionFrameEncoding_DeltaZeroRun,  // the byte-wise difference from the stream's previous frame, zero-run encoded
+};
+
+// Low byte of the chunk flags holds the eSessionFrameEncoding of a video frame
+#define SESSION_CHUNK_ENCODING_MASK 0xff
+// Set on video frames that can be decoded without the previous frame
+#define SESSION_CHUNK_FLAG_KEYFRAME 0x100
+
+//-- definitions -----
+/// Layout of a recorded session:
+/// a SessionFileHeader followed by a sequence of chunks, each a SessionChunkHeader
+/// followed by payload_size bytes of payload (padded out to 8 bytes).
+/// The Index chunk comes last and lists every stream info chunk and video keyframe,
+/// so that a reader can jump straight to a point in the recording.
+struct SessionFileHeader
+{
+    char magic[8]; // SESSION_RECORDING_MAGIC (not null terminated)
+    unsigned int version;
+    unsigned int reserved;
+    unsigned long long index_offset; // 0 if the recording was never finished
+    unsigned long long index_entry_count;
+};
+
+struct SessionChunkHeader
+{
+    unsigned int chunk_type; // eSessionChunkType
+    unsigned int stream_id;
+    unsigned long long timestamp_usec; // relative to the start of the recording
+    unsigned int payload_size;
+    unsigned int flags;
+};
+
+struct SessionStreamInfo
+{
+    unsigned int stream_type; // eSessionStreamType
+    unsigned int device_type; // CommonDeviceState::eDeviceType of the recorded device
+    unsigned int width; // video streams only
+    unsigned int height; // video streams only
+    unsigned int pixel_format; // eSessionPixelFormat, video streams only
+    unsigned int name_length;
+};
+
+struct SessionIndexEntry
+{
+    unsigned long long timestamp_usec;
+    unsigned long long chunk_offset;
+    unsigned int stream_id;
+    unsigned int chunk_type;
+};
+
+/// Records camera frames and controller hid reports to a session file.
+/**
+Devices hand their data over from their poll() and the recorder copies it into a queue.
+A writer thread does the frame encoding and the disk writes so polling never waits on the disk.
+If the writer falls too far behind, new video frames and hid reports get dropped rather than queued.
+If a disk write fails, the recording stops taking new data and the file is left without an index.
+*/
+class ServerSessionRecorder
+{
+public:
+    ServerSessionRecorder();
+    ~ServerSessionRecorder();
+
+    /// Start a new recording. A keyframe gets written at least every keyframe_interval frames per video stream.
+    bool startup(const std::string &path, int keyframe_interval);
+    void shutdown();
+
+    inline bool getIsRecording() const
+    { return m_file != nullptr; }
+
+    void recordVideoFrame(
+        const std::string &stream_name,
+        int device_type,
+        int width,
+        int height,
+        eSessionPixelFormat pixel_format,
+        const unsigned char *pixels,
+        const std::chrono::time_point<std::chrono::high_resolution_clock> &capture_time);
+    void recordHIDReport(
+        const std::string &stream_name,
+        int device_type,
+        const unsigned char *report,
+        size_t report_size);
+
+private:
+    struct PendingChunk
+    {
+        SessionChunkHeader header;
+        std::vector<unsigned char> payload;
+    };
+
+    struct VideoStreamState
+    {
+        std::vector<unsigned char> previous_frame;
+        int frames_since_keyframe;
+    };
+
+    unsigned long long getTimestamp(const std::chrono::time_point<std::chrono::high_resolution_clock> &time) const;
+    int getOrAddStream(const std::string &stream_name, const SessionStreamInfo &stream_info, unsigned long long timestamp_usec);
+    PendingChunk *allocatePendingChunk();
+    void writerThreadFunc();
+    bool encodeVideoFrame(PendingChunk *chunk);
+    bool writeChunk(const SessionChunkHeader &header, const unsigned char *payload);
+
+    FILE *m_file;
+    std::chrono::time_point<std::chrono::high_resolution_clock> m_start_time;
+    int m_keyframe_interval;
+
+    // Shared with the writer thread
+    std::mutex m_queue_mutex;
+    std::condition_variable m_queue_condition;
+    std::deque<PendingChunk *> m_pending_chunks;
+    std::vector<PendingChunk *> m_free_chunks;
+    int m_pending_video_frame_count;
+    unsigned long long m_dropped_video_frame_count;
+    int m_pending_hid_report_count;
+    unsigned long long m_dropped_hid_report_count;
+    bool m_write_failed;
+    bool m_exit_requested;
+    std::map<std::string, int> m_stream_ids;
+    boost::thread *m_writer_thread;
+
+    // Writer thread only
+    std::vector<VideoStreamState> m_video_stream_states; // indexed by stream id
+    std::vector<SessionIndexEntry> m_index;
+    std::vector<unsigned char> m_encode_buffer;
+    std::vector<unsigned char> m_delta_buffer;
+    unsigned long long m_write_offset;
+};
+
+/// Reads back a recorded session straight out of a memory mapping of the file.
+class SessionRecordingReader
+{
+public:
+    SessionRecordingReader();
+    ~SessionRecordingReader();
+
+    bool open(const std::string &path);
+    void close();
+
+    inline bool getIsOpen() const
+    { return m_header != nullptr; }
+
+    int getStreamCount() const;
+    const SessionStreamInfo *getStreamInfo(int stream_id) const;
+    std::string getStreamName(int stream_id) const;
+
+    /// Returns the stream id of the nth video stream in the recording, or -1 if there aren't that many
+    int findVideoStream(int video_stream_index) const;
+
+    /// Go back to the first chunk in the recording
+    void rewind();
+
+    /// Jump to the last keyframe of the given stream at or before the given time
+    void seekToKeyframe(int stream_id, unsigned long long timestamp_usec);
+
+    /// Returns the chunk at the read position and steps past it, or nullptr at the end of the recording
+    const SessionChunkHeader *readNextChunk();
+
+    /// Returns the chunk at the read position without stepping past it
+    const SessionChunkHeader *peekNextChunk() const;
+
+    inline const unsigned char *getChunkPayload(const SessionChunkHeader *chunk) const
+    { return reinterpret_cast<const unsigned char *>(chunk + 1); }
+
+    /// Decode a video frame chunk on top of the stream's previously decoded frame.
+    /// Fails if the chunk is a delta frame and there is no previous frame to apply it to.
+    bool decodeVideoFrame(const SessionChunkHeader *chunk, bool bHasPreviousFrame, unsigned char *in_out_frame) const;
+
+private:
+    bool validateChunk(unsigned long long offset) const;
+    void buildIndex();
+
+    boost::interprocess::file_mapping *m_file_mapping;
+    boost::interprocess::mapped_region *m_region;
+    const unsigned char *m_data;
+    unsigned long long m_data_size;
+    const SessionFileHeader *m_header;
+    unsigned long long m_end_offset; // end of the chunks that hold recorded data
+    unsigned long long m_read_offset;
+
+    std::vector<SessionIndexEntry> m_index;
+    std::vector<const SessionChunkHeader *> m_stream_infos; // indexed by stream id
+};
+
+#endif // SESSION_RECORDING_H
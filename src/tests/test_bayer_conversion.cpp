@@ -0,0 +1,136 @@
+#include "PSEyeBayerConversion.h"
+#include "opencv2/opencv.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Benchmarks the fused bayer->mirrored HSV kernel against the OpenCV conversion chain
+// the tracker used to run (demosaic, flip, BGR->HSV) and checks that the results agree.
+
+static const int k_frame_width = 640;
+static const int k_frame_height = 480;
+static const int k_default_iterations = 500;
+
+// Hue is circular, so 179 and 0 are 1 apart
+static int compute_max_channel_difference(const cv::Mat &a, const cv::Mat &b, bool bIsHSV)
+{
+    int max_difference = 0;
+
+    // Skip the 1 pixel frame border, OpenCV extrapolates the edges of the demosaic differently
+    for (int y = 1; y < a.rows - 1; ++y)
+    {
+        for (int x = 1; x < a.cols - 1; ++x)
+        {
+            const cv::Vec3b &pa = a.at<cv::Vec3b>(y, x);
+            const cv::Vec3b &pb = b.at<cv::Vec3b>(y, x);
+
+            for (int channel = 0; channel < 3; ++channel)
+            {
+                int difference = std::abs(static_cast<int>(pa[channel]) - static_cast<int>(pb[channel]));
+
+                if (bIsHSV && channel == 0 && difference > 90)
+                {
+                    difference = 180 - difference;
+                }
+
+                max_difference = std::max(max_difference, difference);
+            }
+        }
+    }
+
+    return max_difference;
+}
+
+template <typename t_function>
+static double time_per_frame_ms(int iterations, t_function function)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        function();
+    }
+
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    return elapsed.count() / static_cast<double>(iterations);
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = (argc > 1) ? std::max(std::atoi(argv[1]), 1) : k_default_iterations;
+
+    // Smooth gradients with some noise look more like a real sensor image than pure noise
+    cv::Mat bayer(k_frame_height, k_frame_width, CV_8UC1);
+    std::srand(12345);
+    for (int y = 0; y < k_frame_height; ++y)
+    {
+        for (int x = 0; x < k_frame_width; ++x)
+        {
+            bayer.at<unsigned char>(y, x) = static_cast<unsigned char>(((x * 255) / k_frame_width + (y * 127) / k_frame_height + (std::rand() % 32)) & 0xFF);
+        }
+    }
+
+    // Reference: the OpenCV chain
+    cv::Mat demosaiced, opencv_bgr, opencv_hsv;
+    auto opencv_chain = [&]() {
+        cv::cvtColor(bayer, demosaiced, CV_BayerGB2BGR);
+        cv::flip(demosaiced, opencv_bgr, 1);
+        cv::cvtColor(opencv_bgr, opencv_hsv, cv::COLOR_BGR2HSV);
+    };
+
+    cv::Mat fused_bgr(k_frame_height, k_frame_width, CV_8UC3);
+    cv::Mat fused_hsv(k_frame_height, k_frame_width, CV_8UC3);
+    std::vector<unsigned char> scratch_buffer(pseye_bayer_get_scratch_buffer_size(k_frame_width));
+    auto fused_with_path = [&](ePSEyeBayerConversionPath path, bool bWithBGR) {
+        pseye_bayer_gb_to_mirrored_hsv_with_path(
+            path,
+            bayer.data, k_frame_width, k_frame_height,
+            0, 0, k_frame_width, k_frame_height,
+            fused_hsv.data, bWithBGR ? fused_bgr.data : nullptr,
+            scratch_buffer.data());
+    };
+
+    // Correctness
+    opencv_chain();
+
+    bool bSuccess = true;
+    const ePSEyeBayerConversionPath best_path = pseye_bayer_get_best_conversion_path();
+    for (int path_index = PSEyeBayerConversion_Scalar; path_index <= best_path; ++path_index)
+    {
+        const ePSEyeBayerConversionPath path = static_cast<ePSEyeBayerConversionPath>(path_index);
+
+        fused_with_path(path, true);
+
+        const int bgr_difference = compute_max_channel_difference(opencv_bgr, fused_bgr, false);
+        const int hsv_difference = compute_max_channel_difference(opencv_hsv, fused_hsv, true);
+
+        std::cout << pseye_bayer_get_conversion_path_name(path)
+            << ": max BGR difference " << bgr_difference
+            << ", max HSV difference " << hsv_difference << std::endl;
+
+        if (bgr_difference > 1 || hsv_difference > 1)
+        {
+            std::cout << "  FAILED: fused output doesn't match OpenCV" << std::endl;
+            bSuccess = false;
+        }
+    }
+
+    // Performance
+    std::cout << std::endl << "Timing " << k_frame_width << "x" << k_frame_height << " over " << iterations << " frames" << std::endl;
+    std::cout << "OpenCV demosaic + flip + HSV: " << time_per_frame_ms(iterations, opencv_chain) << " ms/frame" << std::endl;
+
+    for (int path_index = PSEyeBayerConversion_Scalar; path_index <= best_path; ++path_index)
+    {
+        const ePSEyeBayerConversionPath path = static_cast<ePSEyeBayerConversionPath>(path_index);
+        const char *path_name = pseye_bayer_get_conversion_path_name(path);
+
+        std::cout << "Fused " << path_name << " HSV: "
+            << time_per_frame_ms(iterations, [&]() { fused_with_path(path, false); }) << " ms/frame" << std::endl;
+        std::cout << "Fused " << path_name << " HSV + BGR: "
+            << time_per_frame_ms(iterations, [&]() { fused_with_path(path, true); }) << " ms/frame" << std::endl;
+    }
+
+    return bSuccess ? 0 : -1;
+}
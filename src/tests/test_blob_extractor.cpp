@@ -0,0 +1,92 @@
+#include "TrackerBlobExtractor.h"
+#include "opencv2/opencv.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Benchmarks the scanline blob extractor against the cv::findContours + cv::contourArea search
+// the tracker used to run and checks that both pick the same blob.
+
+static const int k_frame_width = 640;
+static const int k_frame_height = 480;
+static const int k_default_iterations = 500;
+
+template <typename t_function>
+static double time_per_frame_ms(int iterations, t_function function)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        function();
+    }
+
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    return elapsed.count() / static_cast<double>(iterations);
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = (argc > 1) ? std::max(std::atoi(argv[1]), 1) : k_default_iterations;
+
+    // A bulb, a smaller second light and some speckle noise
+    cv::Mat mask = cv::Mat::zeros(k_frame_height, k_frame_width, CV_8UC1);
+    cv::circle(mask, cv::Point(320, 240), 40, cv::Scalar(255), -1);
+    cv::circle(mask, cv::Point(500, 100), 15, cv::Scalar(255), -1);
+    std::srand(12345);
+    for (int speck = 0; speck < 500; ++speck)
+    {
+        mask.at<unsigned char>(std::rand() % k_frame_height, std::rand() % k_frame_width) = 255;
+    }
+
+    // Reference: largest contour by area
+    std::vector<cv::Point> opencv_contour;
+    auto opencv_search = [&]() {
+        cv::Mat scratch = mask.clone(); // findContours() scribbles on its input
+        std::vector<std::vector<cv::Point> > contours;
+        cv::findContours(scratch, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+
+        double biggest_area = 0;
+        for (auto it = contours.begin(); it != contours.end(); ++it)
+        {
+            const double area = cv::contourArea(*it);
+
+            if (area > biggest_area)
+            {
+                biggest_area = area;
+                opencv_contour = *it;
+            }
+        }
+    };
+
+    TrackerBlobExtractor extractor;
+    TrackerBlobExtractor::BlobStats stats;
+    std::vector<cv::Point> blob_outline;
+    auto scanline_search = [&]() {
+        extractor.findLargestBlob(mask.data, mask.step, cv::Rect(0, 0, k_frame_width, k_frame_height), 0xff, blob_outline, &stats);
+    };
+
+    // Correctness
+    opencv_search();
+    scanline_search();
+
+    const cv::Rect opencv_box = cv::boundingRect(opencv_contour);
+    bool bSuccess = (opencv_box == stats.bounding_box);
+
+    std::cout << "findContours bounding box " << opencv_box << std::endl;
+    std::cout << "Scanline bounding box " << stats.bounding_box << ", area " << stats.area << ", outline points " << blob_outline.size() << std::endl;
+
+    if (!bSuccess)
+    {
+        std::cout << "  FAILED: scanline search found a different blob" << std::endl;
+    }
+
+    // Performance
+    std::cout << std::endl << "Timing " << k_frame_width << "x" << k_frame_height << " over " << iterations << " frames" << std::endl;
+    std::cout << "findContours + contourArea: " << time_per_frame_ms(iterations, opencv_search) << " ms/frame" << std::endl;
+    std::cout << "Scanline blob extractor: " << time_per_frame_ms(iterations, scanline_search) << " ms/frame" << std::endl;
+
+    return bSuccess ? 0 : -1;
+}
@@ -0,0 +1,306 @@
+#include "CompactDataFrame.h"
+#include "PackedMessage.h"
+#include "PSMoveProtocolInterface.h"
+#include "PSMoveProtocol.pb.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Encodes the same stream of PSMove states as packed protobuf DeviceOutputDataFrames and as CompactControllerDataFrames,
+// checks that both decode back to the same state and times both ways.
+// Encoding fills the data frame in from the controller state and packs it, the way the service does.
+// Decoding unpacks it and reads the state back out, the way the client does.
+//
+// test_compact_data_frame [<iterations>]
+
+static const int k_default_iterations = 1000000;
+static const int k_state_count = 256;
+
+struct ControllerState
+{
+    int sequence_num;
+    unsigned int button_bitmask;
+    int trigger_value;
+    float position[3];
+    float orientation[4];
+    float velocity[3];
+    float acceleration[3];
+    float angular_velocity[3];
+    float angular_acceleration[3];
+};
+
+static void encode_protobuf(const ControllerState &state, PSMoveProtocol::DeviceOutputDataFrame &data_frame)
+{
+    data_frame.Clear();
+    data_frame.set_device_category(PSMoveProtocol::DeviceOutputDataFrame::CONTROLLER);
+
+    auto *controller_packet = data_frame.mutable_controller_data_packet();
+    controller_packet->set_controller_id(0);
+    controller_packet->set_controller_type(PSMoveProtocol::PSMOVE);
+    controller_packet->set_sequence_num(state.sequence_num);
+    controller_packet->set_isconnected(true);
+    controller_packet->set_button_down_bitmask(state.button_bitmask);
+
+    auto *psmove_state = controller_packet->mutable_psmove_state();
+    psmove_state->set_validhardwarecalibration(true);
+    psmove_state->set_istrackingenabled(true);
+    psmove_state->set_iscurrentlytracking(true);
+    psmove_state->set_isorientationvalid(true);
+    psmove_state->set_ispositionvalid(true);
+    psmove_state->set_trigger_value(state.trigger_value);
+
+    psmove_state->mutable_position()->set_x(state.position[0]);
+    psmove_state->mutable_position()->set_y(state.position[1]);
+    psmove_state->mutable_position()->set_z(state.position[2]);
+
+    psmove_state->mutable_orientation()->set_w(state.orientation[0]);
+    psmove_state->mutable_orientation()->set_x(state.orientation[1]);
+    psmove_state->mutable_orientation()->set_y(state.orientation[2]);
+    psmove_state->mutable_orientation()->set_z(state.orientation[3]);
+
+    auto *physics_data = psmove_state->mutable_physics_data();
+    physics_data->mutable_velocity()->set_i(state.velocity[0]);
+    physics_data->mutable_velocity()->set_j(state.velocity[1]);
+    physics_data->mutable_velocity()->set_k(state.velocity[2]);
+    physics_data->mutable_acceleration()->set_i(state.acceleration[0]);
+    physics_data->mutable_acceleration()->set_j(state.acceleration[1]);
+    physics_data->mutable_acceleration()->set_k(state.acceleration[2]);
+    physics_data->mutable_angular_velocity()->set_i(state.angular_velocity[0]);
+    physics_data->mutable_angular_velocity()->set_j(state.angular_velocity[1]);
+    physics_data->mutable_angular_velocity()->set_k(state.angular_velocity[2]);
+    physics_data->mutable_angular_acceleration()->set_i(state.angular_acceleration[0]);
+    physics_data->mutable_angular_acceleration()->set_j(state.angular_acceleration[1]);
+    physics_data->mutable_angular_acceleration()->set_k(state.angular_acceleration[2]);
+}
+
+static void decode_protobuf(const PSMoveProtocol::DeviceOutputDataFrame &data_frame, ControllerState &out_state)
+{
+    const auto &controller_packet = data_frame.controller_data_packet();
+    const auto &psmove_state = controller_packet.psmove_state();
+    const auto &physics_data = psmove_state.physics_data();
+
+    out_state.sequence_num = controller_packet.sequence_num();
+    out_state.button_bitmask = controller_packet.button_down_bitmask();
+    out_state.trigger_value = psmove_state.trigger_value();
+
+    out_state.position[0] = psmove_state.position().x();
+    out_state.position[1] = psmove_state.position().y();
+    out_state.position[2] = psmove_state.position().z();
+
+    out_state.orientation[0] = psmove_state.orientation().w();
+    out_state.orientation[1] = psmove_state.orientation().x();
+    out_state.orientation[2] = psmove_state.orientation().y();
+    out_state.orientation[3] = psmove_state.orientation().z();
+
+    out_state.velocity[0] = physics_data.velocity().i();
+    out_state.velocity[1] = physics_data.velocity().j();
+    out_state.velocity[2] = physics_data.velocity().k();
+    out_state.acceleration[0] = physics_data.acceleration().i();
+    out_state.acceleration[1] = physics_data.acceleration().j();
+    out_state.acceleration[2] = physics_data.acceleration().k();
+    out_state.angular_velocity[0] = physics_data.angular_velocity().i();
+    out_state.angular_velocity[1] = physics_data.angular_velocity().j();
+    out_state.angular_velocity[2] = physics_data.angular_velocity().k();
+    out_state.angular_acceleration[0] = physics_data.angular_acceleration().i();
+    out_state.angular_acceleration[1] = physics_data.angular_acceleration().j();
+    out_state.angular_acceleration[2] = physics_data.angular_acceleration().k();
+}
+
+static void encode_compact(const ControllerState &state, CompactControllerDataFrame &data_frame)
+{
+    data_frame.Clear();
+    data_frame.controller_id = 0;
+    data_frame.controller_type = PSMoveProtocol::PSMOVE;
+    data_frame.sequence_num = state.sequence_num;
+    data_frame.button_down_bitmask = state.button_bitmask;
+    data_frame.trigger_value = state.trigger_value;
+    data_frame.flags =
+        CompactControllerDataFrame::IsConnected |
+        CompactControllerDataFrame::ValidHardwareCalibration |
+        CompactControllerDataFrame::IsTrackingEnabled |
+        CompactControllerDataFrame::IsCurrentlyTracking |
+        CompactControllerDataFrame::IsOrientationValid |
+        CompactControllerDataFrame::IsPositionValid |
+        CompactControllerDataFrame::HasPhysicsData;
+
+    memcpy(data_frame.position, state.position, sizeof(data_frame.position));
+    memcpy(data_frame.orientation, state.orientation, sizeof(data_frame.orientation));
+    memcpy(data_frame.velocity, state.velocity, sizeof(data_frame.velocity));
+    memcpy(data_frame.acceleration, state.acceleration, sizeof(data_frame.acceleration));
+    memcpy(data_frame.angular_velocity, state.angular_velocity, sizeof(data_frame.angular_velocity));
+    memcpy(data_frame.angular_acceleration, state.angular_acceleration, sizeof(data_frame.angular_acceleration));
+}
+
+static void decode_compact(const CompactControllerDataFrame &data_frame, ControllerState &out_state)
+{
+    out_state.sequence_num = data_frame.sequence_num;
+    out_state.button_bitmask = data_frame.button_down_bitmask;
+    out_state.trigger_value = data_frame.trigger_value;
+
+    memcpy(out_state.position, data_frame.position, sizeof(out_state.position));
+    memcpy(out_state.orientation, data_frame.orientation, sizeof(out_state.orientation));
+    memcpy(out_state.velocity, data_frame.velocity, sizeof(out_state.velocity));
+    memcpy(out_state.acceleration, data_frame.acceleration, sizeof(out_state.acceleration));
+    memcpy(out_state.angular_velocity, data_frame.angular_velocity, sizeof(out_state.angular_velocity));
+    memcpy(out_state.angular_acceleration, data_frame.angular_acceleration, sizeof(out_state.angular_acceleration));
+}
+
+static bool states_match(const ControllerState &a, const ControllerState &b)
+{
+    return
+        a.sequence_num == b.sequence_num &&
+        a.button_bitmask == b.button_bitmask &&
+        a.trigger_value == b.trigger_value &&
+        memcmp(a.position, b.position, sizeof(a.position)) == 0 &&
+        memcmp(a.orientation, b.orientation, sizeof(a.orientation)) == 0 &&
+        memcmp(a.velocity, b.velocity, sizeof(a.velocity)) == 0 &&
+        memcmp(a.acceleration, b.acceleration, sizeof(a.acceleration)) == 0 &&
+        memcmp(a.angular_velocity, b.angular_velocity, sizeof(a.angular_velocity)) == 0 &&
+        memcmp(a.angular_acceleration, b.angular_acceleration, sizeof(a.angular_acceleration)) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    const int iterations = (argc > 1) ? std::atoi(argv[1]) : k_default_iterations;
+
+    if (iterations < 1)
+    {
+        std::cout << "usage: test_compact_data_frame [<iterations>]" << std::endl;
+        return -1;
+    }
+
+    // A controller being waved around with the odd button press
+    std::mt19937 generator(0);
+    std::normal_distribution<float> noise(0.f, 1.f);
+    std::vector<ControllerState> states(k_state_count);
+
+    for (int state_index = 0; state_index < k_state_count; ++state_index)
+    {
+        ControllerState &state = states[state_index];
+        const float w = 1.f + 0.1f*noise(generator), x = 0.1f*noise(generator), y = 0.1f*noise(generator), z = 0.1f*noise(generator);
+        const float length = std::sqrt(w*w + x*x + y*y + z*z);
+
+        state.sequence_num = state_index;
+        state.button_bitmask = (state_index % 16 < 4) ? (1 << (state_index % 9)) : 0;
+        state.trigger_value = (state_index * 7) % 256;
+        state.orientation[0] = w / length;
+        state.orientation[1] = x / length;
+        state.orientation[2] = y / length;
+        state.orientation[3] = z / length;
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            state.position[axis] = 50.f*noise(generator);
+            state.velocity[axis] = 10.f*noise(generator);
+            state.acceleration[axis] = 100.f*noise(generator);
+            state.angular_velocity[axis] = noise(generator);
+            state.angular_acceleration[axis] = 10.f*noise(generator);
+        }
+    }
+
+    DeviceOutputDataFramePtr protobuf_data_frame(new PSMoveProtocol::DeviceOutputDataFrame);
+    PackedMessage<PSMoveProtocol::DeviceOutputDataFrame> packed_protobuf_data_frame(protobuf_data_frame);
+    CompactControllerDataFrame compact_data_frame;
+    std::vector<boost::uint8_t> protobuf_buffers(k_state_count * (HEADER_SIZE + MAX_OUTPUT_DATA_FRAME_MESSAGE_SIZE));
+    std::vector<boost::uint8_t> compact_buffers(k_state_count * sizeof(CompactControllerDataFrame));
+    std::vector<unsigned int> protobuf_sizes(k_state_count);
+
+    auto protobuf_buffer = [&](const int state_index) {
+        return &protobuf_buffers[state_index * (HEADER_SIZE + MAX_OUTPUT_DATA_FRAME_MESSAGE_SIZE)];
+    };
+    auto compact_buffer = [&](const int state_index) {
+        return &compact_buffers[state_index * sizeof(CompactControllerDataFrame)];
+    };
+
+    auto protobuf_encode = [&](const int state_index) {
+        encode_protobuf(states[state_index], *protobuf_data_frame);
+        packed_protobuf_data_frame.pack(protobuf_buffer(state_index), HEADER_SIZE + MAX_OUTPUT_DATA_FRAME_MESSAGE_SIZE);
+        protobuf_sizes[state_index] = HEADER_SIZE + protobuf_data_frame->ByteSize();
+    };
+    auto protobuf_decode = [&](const int state_index, ControllerState &out_state) {
+        bool bSuccess = packed_protobuf_data_frame.unpack(protobuf_buffer(state_index), protobuf_sizes[state_index]);
+        decode_protobuf(*protobuf_data_frame, out_state);
+        return bSuccess;
+    };
+    auto compact_encode = [&](const int state_index) {
+        encode_compact(states[state_index], compact_data_frame);
+        compact_data_frame.pack(compact_buffer(state_index));
+    };
+    auto compact_decode = [&](const int state_index, ControllerState &out_state) {
+        bool bSuccess = compact_data_frame.unpack(compact_buffer(state_index), sizeof(CompactControllerDataFrame));
+        decode_compact(compact_data_frame, out_state);
+        return bSuccess;
+    };
+
+    // Correctness
+    int mismatch_count = 0;
+    unsigned int protobuf_total_size = 0;
+
+    for (int state_index = 0; state_index < k_state_count; ++state_index)
+    {
+        ControllerState protobuf_state, compact_state;
+
+        protobuf_encode(state_index);
+        compact_encode(state_index);
+        protobuf_total_size += protobuf_sizes[state_index];
+
+        if (!protobuf_decode(state_index, protobuf_state) || !states_match(protobuf_state, states[state_index]) ||
+            !compact_decode(state_index, compact_state) || !states_match(compact_state, states[state_index]))
+        {
+            ++mismatch_count;
+        }
+    }
+
+    const bool bSuccess = mismatch_count == 0;
+
+    std::cout << "Protobuf data frame: " << protobuf_total_size / k_state_count << " bytes on average" << std::endl;
+    std::cout << "Compact data frame: " << sizeof(CompactControllerDataFrame) << " bytes" << std::endl;
+
+    if (!bSuccess)
+    {
+        std::cout << "  FAILED: " << mismatch_count << " of " << k_state_count << " states didn't make the round trip" << std::endl;
+    }
+
+    // Performance
+    ControllerState decoded_state;
+    int checksum = 0;
+
+    auto time_ns_per_packet = [&](const std::function<void(int)> &operation) {
+        const std::chrono::time_point<std::chrono::high_resolution_clock> timer_start = std::chrono::high_resolution_clock::now();
+        for (int iteration = 0; iteration < iterations; ++iteration)
+        {
+            operation(iteration % k_state_count);
+        }
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::high_resolution_clock::now() - timer_start;
+
+        return elapsed.count() / static_cast<double>(iterations);
+    };
+
+    const double protobuf_encode_ns = time_ns_per_packet([&](int state_index) { protobuf_encode(state_index); });
+    const double compact_encode_ns = time_ns_per_packet([&](int state_index) { compact_encode(state_index); });
+    const double protobuf_decode_ns = time_ns_per_packet([&](int state_index) {
+        protobuf_decode(state_index, decoded_state);
+        checksum += decoded_state.trigger_value;
+    });
+    const double compact_decode_ns = time_ns_per_packet([&](int state_index) {
+        compact_decode(state_index, decoded_state);
+        checksum += decoded_state.trigger_value;
+    });
+
+    std::cout << std::endl << "Timing " << iterations << " packets (checksum " << checksum << ")" << std::endl;
+    std::cout << "Protobuf encode: " << protobuf_encode_ns << " ns/packet" << std::endl;
+    std::cout << "Compact encode: " << compact_encode_ns << " ns/packet" << std::endl;
+    std::cout << "Protobuf decode: " << protobuf_decode_ns << " ns/packet" << std::endl;
+    std::cout << "Compact decode: " << compact_decode_ns << " ns/packet" << std::endl;
+
+    google::protobuf::ShutdownProtobufLibrary();
+
+    return bSuccess ? 0 : -1;
+}
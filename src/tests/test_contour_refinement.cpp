@@ -0,0 +1,298 @@
+#include "TrackerBlobExtractor.h"
+#include "TrackerContourRefiner.h"
+#include "ReplayTracker.h"
+#include "MathAlignment.h"
+#include "opencv2/opencv.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Measures how much the sub-pixel hull refinement steadies the sphere fit.
+//
+// With no arguments a bulb is rendered drifting a fraction of a pixel per frame at a fixed
+// distance, so the fit can be compared against the truth.
+// Given a raw replay recording (as read by the replay tracker) the fit is run on every
+// frame of it and the jitter is measured as the frame-to-frame change in velocity.
+//
+// test_contour_refinement [<recording.frames> [<value threshold>]]
+
+static const int k_frame_width = 640;
+static const int k_frame_height = 480;
+static const int k_synthetic_frame_count = 300;
+static const float k_focal_length_px = 554.2563f; // PS3EYE at 640x480
+static const float k_bulb_radius_cm = 2.25f;
+static const float k_synthetic_bulb_distance_cm = 100.f;
+static const int k_default_value_threshold = 128;
+
+struct BulbFit
+{
+    bool bValid;
+    Eigen::Vector3f position;
+};
+
+class BulbFitter
+{
+public:
+    BulbFitter(int value_threshold)
+        : m_value_threshold(value_threshold)
+        , m_refine_time_ms(0.0)
+        , m_refine_count(0)
+    {}
+
+    BulbFit fit(const cv::Mat &bgr, bool bRefine)
+    {
+        BulbFit result;
+        result.bValid = false;
+
+        cv::cvtColor(bgr, m_hsv, cv::COLOR_BGR2HSV);
+        cv::inRange(m_hsv, cv::Scalar(0, 0, m_value_threshold), cv::Scalar(180, 255, 255), m_mask);
+
+        const cv::Rect frame_rect(0, 0, bgr.cols, bgr.rows);
+        if (!m_extractor.findLargestBlob(m_mask.data, m_mask.step, frame_rect, 0xff, m_outline) || m_outline.size() <= 5)
+        {
+            return result;
+        }
+
+        cv::convexHull(m_outline, m_hull);
+
+        if (bRefine)
+        {
+            const auto start = std::chrono::high_resolution_clock::now();
+            m_refiner.refineHullEdges(m_hsv.data, m_hsv.step, 3, 2, frame_rect, m_hull, m_refined_hull);
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            m_refine_time_ms += elapsed.count();
+            ++m_refine_count;
+        }
+        else
+        {
+            m_refined_hull.assign(m_hull.begin(), m_hull.end());
+        }
+
+        // Same screen space the tracker fits in
+        std::vector<Eigen::Vector2f> points;
+        for (auto it = m_refined_hull.begin(); it != m_refined_hull.end(); ++it)
+        {
+            points.push_back(Eigen::Vector2f(it->x - bgr.cols / 2.f, bgr.rows / 2.f - it->y));
+        }
+
+        eigen_alignment_fit_focal_cone_to_sphere(
+            points.data(), static_cast<int>(points.size()),
+            k_bulb_radius_cm, k_focal_length_px,
+            &result.position);
+        result.bValid = true;
+
+        return result;
+    }
+
+    double getAverageRefineTimeMs() const
+    {
+        return (m_refine_count > 0) ? m_refine_time_ms / m_refine_count : 0.0;
+    }
+
+private:
+    int m_value_threshold;
+    cv::Mat m_hsv;
+    cv::Mat m_mask;
+    TrackerBlobExtractor m_extractor;
+    TrackerContourRefiner m_refiner;
+    std::vector<cv::Point> m_outline;
+    std::vector<cv::Point> m_hull;
+    std::vector<cv::Point2f> m_refined_hull;
+    double m_refine_time_ms;
+    int m_refine_count;
+};
+
+// A magenta bulb with a soft edge a couple of pixels wide, plus a little sensor noise
+static void render_bulb(float center_x, float center_y, float radius, cv::Mat &out_bgr)
+{
+    out_bgr.create(k_frame_height, k_frame_width, CV_8UC3);
+
+    for (int y = 0; y < k_frame_height; ++y)
+    {
+        unsigned char *row = out_bgr.ptr<unsigned char>(y);
+
+        for (int x = 0; x < k_frame_width; ++x)
+        {
+            const float dx = x - center_x;
+            const float dy = y - center_y;
+            const float coverage = std::min(std::max(0.5f - (std::sqrt(dx*dx + dy*dy) - radius) / 2.f, 0.f), 1.f);
+            const float noise = static_cast<float>(std::rand() % 7 - 3);
+            const unsigned char bright = cv::saturate_cast<unsigned char>(20.f + 220.f*coverage + noise);
+            const unsigned char dark = cv::saturate_cast<unsigned char>(20.f + noise);
+
+            row[3*x + 0] = bright;
+            row[3*x + 1] = dark;
+            row[3*x + 2] = bright;
+        }
+    }
+}
+
+static void run_synthetic_benchmark()
+{
+    const float radius_px = k_focal_length_px * k_bulb_radius_cm / k_synthetic_bulb_distance_cm;
+
+    std::cout << "Synthetic footage: " << k_synthetic_frame_count << " frames, bulb radius "
+        << radius_px << "px at " << k_synthetic_bulb_distance_cm << "cm" << std::endl;
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const bool bRefine = (pass == 1);
+        BulbFitter fitter(k_default_value_threshold);
+        double depth_error_sq_sum = 0.0;
+        double lateral_error_sq_sum = 0.0;
+        int fit_count = 0;
+        cv::Mat frame;
+
+        std::srand(12345);
+        for (int frame_index = 0; frame_index < k_synthetic_frame_count; ++frame_index)
+        {
+            // Drift a fraction of a pixel per frame so the segmentation keeps crossing pixel boundaries
+            const float center_x = 300.f + 0.13f*frame_index;
+            const float center_y = 220.f + 10.f*std::sin(0.02f*frame_index);
+
+            render_bulb(center_x, center_y, radius_px, frame);
+
+            const BulbFit bulb = fitter.fit(frame, bRefine);
+            if (bulb.bValid)
+            {
+                const float true_x = (center_x - k_frame_width / 2.f) * k_synthetic_bulb_distance_cm / k_focal_length_px;
+                const float true_y = (k_frame_height / 2.f - center_y) * k_synthetic_bulb_distance_cm / k_focal_length_px;
+                const float depth_error = std::fabs(bulb.position.z()) - k_synthetic_bulb_distance_cm;
+                const float lateral_error_x = bulb.position.x() - true_x;
+                const float lateral_error_y = bulb.position.y() - true_y;
+
+                depth_error_sq_sum += depth_error*depth_error;
+                lateral_error_sq_sum += lateral_error_x*lateral_error_x + lateral_error_y*lateral_error_y;
+                ++fit_count;
+            }
+        }
+
+        std::cout << (bRefine ? "  Refined hull:" : "  Pixel hull:  ")
+            << " fits " << fit_count
+            << ", RMS depth error " << std::sqrt(depth_error_sq_sum / std::max(fit_count, 1)) << "cm"
+            << ", RMS lateral error " << std::sqrt(lateral_error_sq_sum / std::max(fit_count, 1)) << "cm";
+        if (bRefine)
+        {
+            std::cout << ", refinement " << fitter.getAverageRefineTimeMs() << " ms/frame";
+        }
+        std::cout << std::endl;
+    }
+}
+
+static bool read_recording(const char *path, std::vector<cv::Mat> &out_frames)
+{
+    FILE *file = std::fopen(path, "rb");
+    if (file == nullptr)
+    {
+        std::cout << "Couldn't open " << path << std::endl;
+        return false;
+    }
+
+    ReplayFrameFileHeader header;
+    bool bSuccess =
+        std::fread(&header, sizeof(header), 1, file) == 1 &&
+        std::memcmp(header.magic, REPLAY_FRAME_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == REPLAY_FRAME_FILE_VERSION;
+
+    if (!bSuccess)
+    {
+        std::cout << path << " isn't a raw replay recording" << std::endl;
+    }
+
+    for (unsigned int frame_index = 0; bSuccess && frame_index < header.frame_count; ++frame_index)
+    {
+        const bool bIsBayer = (header.pixel_format == ReplayFramePixelFormat_BayerGB);
+        cv::Mat pixels(header.height, header.width, bIsBayer ? CV_8UC1 : CV_8UC3);
+        ReplayFrameHeader frame_header;
+
+        bSuccess =
+            std::fread(&frame_header, sizeof(frame_header), 1, file) == 1 &&
+            std::fread(pixels.data, pixels.total() * pixels.elemSize(), 1, file) == 1;
+
+        if (bSuccess)
+        {
+            if (bIsBayer)
+            {
+                cv::Mat bgr;
+                cv::cvtColor(pixels, bgr, cv::COLOR_BayerGB2BGR);
+                out_frames.push_back(bgr);
+            }
+            else
+            {
+                out_frames.push_back(pixels);
+            }
+        }
+    }
+
+    std::fclose(file);
+
+    return !out_frames.empty();
+}
+
+static void run_recording_benchmark(const std::vector<cv::Mat> &frames, int value_threshold)
+{
+    std::cout << "Recorded footage: " << frames.size() << " frames" << std::endl;
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const bool bRefine = (pass == 1);
+        BulbFitter fitter(value_threshold);
+        std::vector<BulbFit> fits;
+
+        for (auto it = frames.begin(); it != frames.end(); ++it)
+        {
+            fits.push_back(fitter.fit(*it, bRefine));
+        }
+
+        // The bulb moves smoothly between frames, so the change in velocity is mostly fit noise
+        double jitter_sq_sum = 0.0;
+        int jitter_count = 0;
+        for (size_t fit_index = 2; fit_index < fits.size(); ++fit_index)
+        {
+            if (fits[fit_index].bValid && fits[fit_index - 1].bValid && fits[fit_index - 2].bValid)
+            {
+                const Eigen::Vector3f second_difference =
+                    fits[fit_index].position - 2.f*fits[fit_index - 1].position + fits[fit_index - 2].position;
+
+                jitter_sq_sum += second_difference.squaredNorm();
+                ++jitter_count;
+            }
+        }
+
+        std::cout << (bRefine ? "  Refined hull:" : "  Pixel hull:  ")
+            << " fit triples " << jitter_count
+            << ", RMS jitter " << std::sqrt(jitter_sq_sum / std::max(jitter_count, 1)) << "cm";
+        if (bRefine)
+        {
+            std::cout << ", refinement " << fitter.getAverageRefineTimeMs() << " ms/frame";
+        }
+        std::cout << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        const int value_threshold = (argc > 2) ? std::atoi(argv[2]) : k_default_value_threshold;
+        std::vector<cv::Mat> frames;
+
+        if (!read_recording(argv[1], frames))
+        {
+            return -1;
+        }
+
+        run_recording_benchmark(frames, value_threshold);
+    }
+    else
+    {
+        run_synthetic_benchmark();
+    }
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include "OrientationFilter.h"
+#include "OrientationFilterBatch.h"
+#include "MathEigen.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Runs the same sensor stream through one set of orientation filters updated one at a time
+// and another set updated together through an OrientationFilterBatch,
+// checks that they agree and times both.
+//
+// test_orientation_filter_batch [<controller count> [<iterations>]]
+
+static const int k_default_controller_count = 5;
+static const int k_default_iterations = 100000;
+static const int k_sensor_packet_count = 256;
+static const float k_delta_time = 1.f / 180.f;
+static const float k_max_orientation_error = 1e-4f;
+
+static const OrientationFilter::FusionType k_fusion_types[] = {
+    OrientationFilter::FusionTypeMadgwickARG,
+    OrientationFilter::FusionTypeMadgwickMARG,
+    OrientationFilter::FusionTypeComplementaryOpticalARG
+};
+static const int k_fusion_type_count = sizeof(k_fusion_types) / sizeof(k_fusion_types[0]);
+
+static void init_filter(OrientationFilter &filter, const OrientationFilter::FusionType fusion_type)
+{
+    OrientationFilterSpace filterSpace(
+        Eigen::Vector3f(0.f, 1.f, 0.f),
+        Eigen::Vector3f(0.3f, -0.5f, 0.8f).normalized(),
+        *k_eigen_identity_pose_laying_flat,
+        *k_eigen_sensor_transform_opengl);
+
+    filter.setFilterSpace(filterSpace);
+    filter.setFusionType(fusion_type);
+    filter.setGyroscopeError(0.05f);
+    filter.setGyroscopeDrift(0.02f);
+}
+
+int main(int argc, char** argv)
+{
+    const int controller_count = (argc > 1) ? std::atoi(argv[1]) : k_default_controller_count;
+    const int iterations = (argc > 2) ? std::atoi(argv[2]) : k_default_iterations;
+
+    if (controller_count < 1 || controller_count > OrientationFilterBatch::k_max_lanes || iterations < 1)
+    {
+        std::cout << "usage: test_orientation_filter_batch [<controller count 1-" << OrientationFilterBatch::k_max_lanes << "> [<iterations>]]" << std::endl;
+        return -1;
+    }
+
+    // Noisy sensor readings with the occasional missing accelerometer reading and optical orientation
+    std::mt19937 generator(0);
+    std::normal_distribution<float> noise(0.f, 1.f);
+    std::vector<OrientationSensorPacket> packets(k_sensor_packet_count);
+
+    for (int packet_index = 0; packet_index < k_sensor_packet_count; ++packet_index)
+    {
+        OrientationSensorPacket &packet = packets[packet_index];
+        const bool bHasOpticalOrientation = (packet_index / 8) % 2 == 1;
+
+        packet.accelerometer = (packet_index % 50 == 0)
+            ? Eigen::Vector3f::Zero()
+            : Eigen::Vector3f(0.1f*noise(generator), 0.1f*noise(generator), 1.f + 0.1f*noise(generator));
+        packet.magnetometer = Eigen::Vector3f(0.3f + 0.1f*noise(generator), -0.5f, 0.8f);
+        packet.gyroscope = 0.5f*Eigen::Vector3f(noise(generator), noise(generator), noise(generator));
+        packet.orientation = bHasOpticalOrientation
+            ? Eigen::Quaternionf(1.f, 0.1f*noise(generator), 0.1f*noise(generator), 0.1f*noise(generator)).normalized()
+            : Eigen::Quaternionf::Identity();
+        packet.orientation_source = bHasOpticalOrientation ? OrientationSource_Optical : OrientationSource_PreviousFrame;
+        packet.orientation_quality = bHasOpticalOrientation ? 0.5f : -1.f;
+    }
+
+    std::vector<OrientationFilter> serial_filters(controller_count);
+    std::vector<OrientationFilter> batched_filters(controller_count);
+
+    for (int controller_index = 0; controller_index < controller_count; ++controller_index)
+    {
+        const OrientationFilter::FusionType fusion_type = k_fusion_types[controller_index % k_fusion_type_count];
+
+        init_filter(serial_filters[controller_index], fusion_type);
+        init_filter(batched_filters[controller_index], fusion_type);
+    }
+
+    OrientationFilterBatch batch;
+    std::vector<int> lanes(controller_count);
+    const std::chrono::time_point<std::chrono::high_resolution_clock> sample_time = std::chrono::high_resolution_clock::now();
+
+    auto serial_update = [&](const int iteration) {
+        for (int controller_index = 0; controller_index < controller_count; ++controller_index)
+        {
+            const OrientationSensorPacket &packet = packets[(iteration + controller_index) % k_sensor_packet_count];
+
+            serial_filters[controller_index].update(sample_time, k_delta_time, packet);
+        }
+    };
+
+    auto batched_update = [&](const int iteration) {
+        batch.clear();
+
+        for (int controller_index = 0; controller_index < controller_count; ++controller_index)
+        {
+            const OrientationSensorPacket &packet = packets[(iteration + controller_index) % k_sensor_packet_count];
+
+            batched_filters[controller_index].stageBatchedUpdate(sample_time, k_delta_time, packet, batch, lanes[controller_index]);
+        }
+
+        batch.update();
+
+        for (int controller_index = 0; controller_index < controller_count; ++controller_index)
+        {
+            batched_filters[controller_index].finishBatchedUpdate(batch, lanes[controller_index]);
+        }
+    };
+
+    // Correctness
+    float max_orientation_error = 0.f;
+
+    for (int iteration = 0; iteration < k_sensor_packet_count * 8; ++iteration)
+    {
+        serial_update(iteration);
+        batched_update(iteration);
+
+        for (int controller_index = 0; controller_index < controller_count; ++controller_index)
+        {
+            const float orientation_error =
+                (serial_filters[controller_index].getOrientation().coeffs() -
+                 batched_filters[controller_index].getOrientation().coeffs()).norm();
+
+            max_orientation_error = std::max(max_orientation_error, orientation_error);
+        }
+    }
+
+    const bool bSuccess = max_orientation_error <= k_max_orientation_error;
+
+    std::cout << "Max orientation difference between serial and batched updates: " << max_orientation_error << std::endl;
+
+    if (!bSuccess)
+    {
+        std::cout << "  FAILED: the batched update doesn't match the serial one" << std::endl;
+    }
+
+    // Performance
+    std::chrono::time_point<std::chrono::high_resolution_clock> timer_start = std::chrono::high_resolution_clock::now();
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        serial_update(iteration);
+    }
+    const std::chrono::duration<double, std::nano> serial_elapsed = std::chrono::high_resolution_clock::now() - timer_start;
+
+    timer_start = std::chrono::high_resolution_clock::now();
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        batched_update(iteration);
+    }
+    const std::chrono::duration<double, std::nano> batched_elapsed = std::chrono::high_resolution_clock::now() - timer_start;
+
+    const double update_count = static_cast<double>(iterations) * static_cast<double>(controller_count);
+
+    std::cout << std::endl << "Timing " << controller_count << " controllers over " << iterations << " updates" << std::endl;
+    std::cout << "Serial: " << serial_elapsed.count() / update_count << " ns/controller update" << std::endl;
+    std::cout << "Batched: " << batched_elapsed.count() / update_count << " ns/controller update" << std::endl;
+
+    return bSuccess ? 0 : -1;
+}
@@ -0,0 +1,177 @@
+#include "SharedControllerState.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <vector>
+
+// Hammers one shared controller state slot from a writer thread while reader threads copy it out,
+// the way the service and its same-host clients do (minus the shared memory object itself).
+// Every data frame the writer writes has all of its fields derived from one counter,
+// so a reader that ever keeps a torn copy will see fields that disagree.
+//
+// A write interval of zero has the writer write back to back, which is the worst case for torn reads.
+// The service writes a controller's state about once a millisecond.
+//
+// test_shared_controller_state [<duration_ms>] [<reader_count>] [<write_interval_us>]
+
+static const int k_default_duration_ms = 2000;
+static const int k_default_reader_count = 2;
+static const int k_default_write_interval_us = 0;
+
+static void fill_data_frame(boost::int32_t counter, CompactControllerDataFrame &data_frame)
+{
+    data_frame.Clear();
+    data_frame.controller_id = 0;
+    data_frame.sequence_num = counter;
+    data_frame.button_down_bitmask = static_cast<boost::uint32_t>(counter);
+    data_frame.trigger_value = counter;
+    data_frame.sample_time_us = counter;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        data_frame.position[axis] = static_cast<float>(counter & 0xffff);
+        data_frame.velocity[axis] = static_cast<float>(counter & 0xffff);
+        data_frame.angular_acceleration[axis] = static_cast<float>(counter & 0xffff);
+    }
+}
+
+static bool is_data_frame_consistent(const CompactControllerDataFrame &data_frame)
+{
+    const boost::int32_t counter = data_frame.sequence_num;
+    bool bConsistent =
+        data_frame.button_down_bitmask == static_cast<boost::uint32_t>(counter) &&
+        data_frame.trigger_value == counter &&
+        data_frame.sample_time_us == counter;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        bConsistent &=
+            data_frame.position[axis] == static_cast<float>(counter & 0xffff) &&
+            data_frame.velocity[axis] == static_cast<float>(counter & 0xffff) &&
+            data_frame.angular_acceleration[axis] == static_cast<float>(counter & 0xffff);
+    }
+
+    return bConsistent;
+}
+
+int main(int argc, char** argv)
+{
+    const int duration_ms = (argc > 1) ? std::atoi(argv[1]) : k_default_duration_ms;
+    const int reader_count = (argc > 2) ? std::atoi(argv[2]) : k_default_reader_count;
+    const int write_interval_us = (argc > 3) ? std::atoi(argv[3]) : k_default_write_interval_us;
+
+    if (duration_ms < 1 || reader_count < 1 || write_interval_us < 0)
+    {
+        std::cout << "usage: test_shared_controller_state [<duration_ms>] [<reader_count>] [<write_interval_us>]" << std::endl;
+        return -1;
+    }
+
+    // Stands in for the mapped region, laid out the same way
+    std::vector<SharedControllerStateSlot> region_storage(1 + SHARED_CONTROLLER_STATE_SLOT_COUNT);
+    SharedControllerStateHeader *header = new (region_storage.data()) SharedControllerStateHeader();
+    for (int controller_id = 0; controller_id < SHARED_CONTROLLER_STATE_SLOT_COUNT; ++controller_id)
+    {
+        new (header->getSlotMutable(controller_id)) SharedControllerStateSlot();
+    }
+
+    static_assert(sizeof(SharedControllerStateHeader) <= sizeof(SharedControllerStateSlot), "Header doesn't fit in the first slot");
+
+    if (!header->isCompatible(SharedControllerStateHeader::computeTotalSize()))
+    {
+        std::cout << "FAILED: header doesn't recognize its own layout" << std::endl;
+        return -1;
+    }
+
+    std::atomic<bool> bStop(false);
+    std::atomic<long long> write_count(0);
+    std::atomic<long long> read_count(0);
+    std::atomic<long long> missed_read_count(0);
+    std::atomic<long long> torn_read_count(0);
+    std::atomic<long long> out_of_order_count(0);
+    std::atomic<long long> read_ns(0);
+
+    std::thread writer([&]() {
+        CompactControllerDataFrame data_frame;
+        boost::int32_t counter = 0;
+
+        while (!bStop.load(std::memory_order_relaxed))
+        {
+            fill_data_frame(++counter, data_frame);
+            header->getSlotMutable(0)->write(data_frame);
+
+            if (write_interval_us > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(write_interval_us));
+            }
+        }
+
+        write_count = counter;
+    });
+
+    std::vector<std::thread> readers;
+    for (int reader_index = 0; reader_index < reader_count; ++reader_index)
+    {
+        readers.push_back(std::thread([&]() {
+            const SharedControllerStateSlot *slot = header->getSlot(0);
+            CompactControllerDataFrame data_frame;
+            boost::uint32_t last_sequence = 0;
+            boost::int32_t last_counter = 0;
+            long long local_read_count = 0, local_missed_count = 0, local_torn_count = 0, local_out_of_order_count = 0;
+            const std::chrono::time_point<std::chrono::high_resolution_clock> timer_start = std::chrono::high_resolution_clock::now();
+
+            while (!bStop.load(std::memory_order_relaxed))
+            {
+                if (slot->read(last_sequence, data_frame, last_sequence))
+                {
+                    ++local_read_count;
+                    local_torn_count += is_data_frame_consistent(data_frame) ? 0 : 1;
+                    local_out_of_order_count += (data_frame.sequence_num > last_counter) ? 0 : 1;
+                    last_counter = data_frame.sequence_num;
+                }
+                else
+                {
+                    ++local_missed_count;
+                }
+            }
+
+            const std::chrono::duration<double, std::nano> elapsed = std::chrono::high_resolution_clock::now() - timer_start;
+
+            read_count += local_read_count;
+            missed_read_count += local_missed_count;
+            torn_read_count += local_torn_count;
+            out_of_order_count += local_out_of_order_count;
+            read_ns += static_cast<long long>(elapsed.count());
+        }));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms));
+    bStop = true;
+
+    writer.join();
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+
+    const long long total_read_attempts = read_count + missed_read_count;
+    const bool bSuccess = torn_read_count == 0 && out_of_order_count == 0 && read_count > 0;
+
+    std::cout << "Writes: " << write_count << std::endl;
+    std::cout << "Reads: " << read_count << " new states, " << missed_read_count << " with nothing new or mid-write" << std::endl;
+    std::cout << "Read attempt: " << static_cast<double>(read_ns) / static_cast<double>(total_read_attempts > 0 ? total_read_attempts : 1) << " ns" << std::endl;
+
+    if (torn_read_count > 0)
+    {
+        std::cout << "  FAILED: " << torn_read_count << " torn reads" << std::endl;
+    }
+
+    if (out_of_order_count > 0)
+    {
+        std::cout << "  FAILED: " << out_of_order_count << " reads went back in time" << std::endl;
+    }
+
+    return bSuccess ? 0 : -1;
+}